@@ -0,0 +1,133 @@
+/*
+ * Microbenchmark of the client preview's MJPEG decode path.
+ *
+ * Encodes a synthetic frame (gradients plus noise, like a camera image) with
+ * libjpeg, then decodes it in a loop two ways:
+ *   per-frame  - the original path: a frame buffer and a decoder (SDL_image's
+ *                surface) allocated for every frame, the surface copied to the
+ *                frame buffer, then the frame buffer copied to the texture
+ *   persistent - one mjpeg_decoder reused for every frame, decoding straight
+ *                into the texture memory
+ * Both must produce the same pixels. Reports decoded frames/s.
+ *
+ * Usage: ./bench_decode [width] [height] [quality]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <jpeglib.h>
+
+#include "../mjpeg_decode.h"
+
+#define MIN_BENCH_SEC 1.0
+
+static double now_sec(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// Function to encode a synthetic camera-like frame: returns the JPEG size
+static size_t make_frame(int width, int height, int quality, uint8_t** jpeg){
+    uint8_t* rgb = malloc((size_t)width * height * 3);
+    uint32_t rnd = 12345;
+    for(int y = 0; y < height; y++){
+        for(int x = 0; x < width; x++){
+            rnd = rnd * 1103515245 + 12345;
+            int noise = (rnd >> 16) % 24;
+            uint8_t* p = rgb + ((size_t)y * width + x) * 3;
+            p[0] = (x * 255 / width + noise) & 0xFF;
+            p[1] = (y * 255 / height + noise) & 0xFF;
+            p[2] = ((x ^ y) & 0x40 ? 200 : 40) + noise;
+        }
+    }
+
+    struct jpeg_compress_struct cinfo;
+    struct jpeg_error_mgr err;
+    unsigned long len = 0;
+    cinfo.err = jpeg_std_error(&err);
+    jpeg_create_compress(&cinfo);
+    *jpeg = NULL;
+    jpeg_mem_dest(&cinfo, jpeg, &len);
+    cinfo.image_width = width;
+    cinfo.image_height = height;
+    cinfo.input_components = 3;
+    cinfo.in_color_space = JCS_RGB;
+    jpeg_set_defaults(&cinfo);
+    jpeg_set_quality(&cinfo, quality, TRUE);
+    jpeg_start_compress(&cinfo, TRUE);
+    while(cinfo.next_scanline < cinfo.image_height){
+        JSAMPROW row = rgb + (size_t)cinfo.next_scanline * width * 3;
+        jpeg_write_scanlines(&cinfo, &row, 1);
+    }
+    jpeg_finish_compress(&cinfo);
+    jpeg_destroy_compress(&cinfo);
+    free(rgb);
+    return len;
+}
+
+// Original path: fresh decoder and buffers for every frame, two full-frame copies
+static int decode_per_frame(const uint8_t* jpeg, size_t len, uint8_t* texture, int width, int height){
+    size_t frame_size = (size_t)width * height * 3;
+    uint8_t* buf0 = malloc(frame_size);                 // render_frame()
+    uint8_t* surface = malloc(frame_size);              // IMG_LoadJPG_RW()
+    struct mjpeg_decoder* d = mjpeg_decoder_open();
+    int ret = mjpeg_decode(d, jpeg, len, surface, width * 3, width, height);
+    mjpeg_decoder_close(d);
+    memcpy(buf0, surface, frame_size);                  // decode_sdl2_mjpeg_frame()
+    free(surface);
+    memcpy(texture, buf0, frame_size);                  // SDL_UpdateTexture()
+    free(buf0);
+    return ret;
+}
+
+int main(int argc, char** argv){
+    int width = argc > 1 ? atoi(argv[1]) : 640;
+    int height = argc > 2 ? atoi(argv[2]) : 480;
+    int quality = argc > 3 ? atoi(argv[3]) : 85;
+    if(!mjpeg_decoder_available()){
+        fprintf(stderr, "Built without libjpeg\n");
+        return 1;
+    }
+
+    uint8_t* jpeg;
+    size_t len = make_frame(width, height, quality, &jpeg);
+    size_t frame_size = (size_t)width * height * 3;
+    uint8_t* tex_old = malloc(frame_size);
+    uint8_t* tex_new = malloc(frame_size);
+    printf("Frame: %dx%d, quality %d, %zu bytes\n", width, height, quality, len);
+
+    struct mjpeg_decoder* d = mjpeg_decoder_open();
+    if(decode_per_frame(jpeg, len, tex_old, width, height) || mjpeg_decode(d, jpeg, len, tex_new, width * 3, width, height)){
+        fprintf(stderr, "Decode failed\n");
+        return 1;
+    }
+    if(memcmp(tex_old, tex_new, frame_size)){
+        fprintf(stderr, "MISMATCH between the decode paths\n");
+        return 1;
+    }
+
+    double fps[2];
+    for(int mode = 0; mode < 2; mode++){
+        long frames = 0;
+        double t0 = now_sec(), t;
+        do{
+            for(int i = 0; i < 16; i++){
+                if(mode == 0) decode_per_frame(jpeg, len, tex_old, width, height);
+                else mjpeg_decode(d, jpeg, len, tex_new, width * 3, width, height);
+            }
+            frames += 16;
+        }while((t = now_sec() - t0) < MIN_BENCH_SEC);
+        fps[mode] = frames / t;
+        printf("%-10s %8.0f frames/s  %6.3f ms/frame\n", mode ? "persistent" : "per-frame", fps[mode], 1e3 / fps[mode]);
+    }
+    printf("Speedup: %.2fx\n", fps[1] / fps[0]);
+
+    mjpeg_decoder_close(d);
+    free(tex_old);
+    free(tex_new);
+    free(jpeg);
+    return 0;
+}
@@ -0,0 +1,98 @@
+#!/bin/sh
+# End-to-end loopback benchmark: Cserver plus N Cclient instances streaming
+# generated test-pattern frames (no camera needed).
+#
+# Sweeps frame size, fps, client count, cameras per client and server receive
+# buffer size. For each
+# combination it starts a fresh Cserver with -m (per-stream metrics), runs the
+# clients and reports frames/s, MB/s, capture-to-ingest latency percentiles,
+# server CPU time per GB ingested, and missing/corrupt frames.
+# Results are appended to $OUT (CSV) and written to ${OUT%.csv}.json.
+#
+# Usage: bench/bench_e2e.sh
+# Sweep, from the environment (space-separated lists):
+#   SIZES="16384 262144"  FPS="30 0"  CLIENTS="1 8"  BUFFERS="65536"
+#   CAMERAS="1"       cameras (-s pattern repeated) driven by each client process;
+#                     CLIENTS=1 CAMERAS="1 2 4 8" against CLIENTS="1 2 4 8" compares
+#                     one multi-camera client with one process per camera
+# Other settings:
+#   DURATION=5        seconds per paced run (frames = fps * DURATION)
+#   BYTES=268435456   bytes sent per unpaced (fps 0) run, split across cameras
+#   SERVER_FLAGS=     extra Cserver flags, e.g. -s for splice ingest
+#   PORT=9500  OUT=bench_e2e.csv
+set -e
+
+SIZES=${SIZES:-16384 262144}
+FPS=${FPS:-30 0}
+CLIENTS=${CLIENTS:-1 8}
+BUFFERS=${BUFFERS:-65536}
+CAMERAS=${CAMERAS:-1}
+DURATION=${DURATION:-5}
+BYTES=${BYTES:-268435456}
+SERVER_FLAGS=${SERVER_FLAGS:-}
+PORT=${PORT:-9500}
+OUT=${OUT:-bench_e2e.csv}
+JSON=${OUT%.csv}.json
+ROOT=$(cd "$(dirname "$0")/.." && pwd)
+HZ=$(getconf CLK_TCK)
+VERSION=$(git -C "$ROOT" describe --always --dirty 2>/dev/null || echo unknown)
+
+cpu_ticks() { awk '{print $14 + $15}' /proc/$1/stat; }
+
+[ -s "$OUT" ] || echo "version,server_flags,frame_bytes,fps,clients,buf_bytes,frames,seconds,frames_per_s,MB_per_s,lat_p50_us,lat_p99_us,lat_p999_us,lat_max_us,server_cpu_s_per_GB,missing,corrupt,cameras" > "$OUT"
+START_LINE=$(($(wc -l < "$OUT") + 1))
+
+for SIZE in $SIZES; do
+for RATE in $FPS; do
+for N in $CLIENTS; do
+for CAMS in $CAMERAS; do
+for BUF in $BUFFERS; do
+    DIR=$(mktemp -d)
+    (cd "$DIR" && exec "$ROOT/Cserver" "$PORT" -b "$BUF" -m metrics.csv $SERVER_FLAGS > server.log 2>&1) &
+    PID=$!
+    sleep 0.3
+    T0=$(cpu_ticks $PID)
+
+    STREAMS=$((N * CAMS))
+    if [ "$RATE" = 0 ]; then FRAMES=$((BYTES / SIZE / STREAMS)); else FRAMES=$((RATE * DURATION)); fi
+    [ "$FRAMES" -ge 10 ] || FRAMES=10
+    SOURCES=
+    i=0
+    while [ $i -lt "$CAMS" ]; do SOURCES="$SOURCES -s pattern"; i=$((i + 1)); done
+    i=0
+    CPIDS=
+    while [ $i -lt "$N" ]; do
+        "$ROOT/Cclient" "$PORT" "$FRAMES" $SOURCES -f "$RATE" -S "$SIZE" > "$DIR/client$i.log" 2>&1 &
+        CPIDS="$CPIDS $!"
+        i=$((i + 1))
+    done
+    # Wait for the clients, then for the server to close every stream (10 s at most)
+    for CPID in $CPIDS; do wait "$CPID" || echo "client failed, see $DIR/client*.log" >&2; done
+    i=0
+    while [ "$(grep -c '^stream,' "$DIR/metrics.csv" 2>/dev/null)" != "$STREAMS" ] && [ $i -lt 100 ]; do sleep 0.1; i=$((i + 1)); done
+    T1=$(cpu_ticks $PID)
+    kill $PID; wait $PID 2>/dev/null || true
+
+    # The last "server" row holds the totals of the run
+    grep '^server,' "$DIR/metrics.csv" | tail -1 | awk -F, -v OFS=, -v ver="$VERSION" -v flags="$SERVER_FLAGS" \
+        -v size=$SIZE -v rate=$RATE -v n=$N -v cams=$CAMS -v buf=$BUF -v t=$((T1 - T0)) -v hz=$HZ '{
+        frames = $4; bytes = $5; secs = $8
+        print ver, flags, size, rate, n, buf, frames, secs, sprintf("%.1f", frames / secs), sprintf("%.1f", bytes / secs / 1e6),
+              $9, $10, $11, $12, sprintf("%.3f", (t / hz) / (bytes / 1e9)), $6, $7, cams
+    }' | tee -a "$OUT"
+    rm -rf "$DIR"
+done
+done
+done
+done
+done
+
+# JSON copy of this sweep's rows
+tail -n +$START_LINE "$OUT" | awk -F, -v hdr="$(head -1 "$OUT")" 'BEGIN { n = split(hdr, k, ","); print "[" }
+{
+    printf "%s  {", (NR > 1 ? ",\n" : "")
+    for (i = 1; i <= n; i++) printf "%s\"%s\": %s", (i > 1 ? ", " : ""), k[i], (i <= 2 ? "\"" $i "\"" : $i)
+    printf "}"
+}
+END { print "\n]" }' > "$JSON"
+echo "Results: $OUT, $JSON" >&2
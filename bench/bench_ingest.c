@@ -0,0 +1,145 @@
+/*
+ * Ingest load generator: opens N framed streams to a running Cserver and sends
+ * synthetic MJPEG frames as fast as possible for a fixed time.
+ *
+ * Usage: ./bench_ingest <port> [streams] [frame_bytes] [seconds]
+ * Prints one line: streams, frame size, MB/s and frames/s achieved.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <linux/videodev2.h>
+
+#include "../cam_proto.h"
+
+struct stream{
+    pthread_t thread;
+    int id;
+    uint64_t bytes;
+    uint64_t frames;
+};
+
+static int port;
+static size_t frame_bytes;
+static double seconds;
+static uint8_t* frame;
+
+static double now_sec(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// Function to write a whole iovec array, resuming after short writes
+static int writev_all(int fd, struct iovec* iov, int cnt){
+    while(cnt > 0){
+        ssize_t n = writev(fd, iov, cnt);
+        if(n == -1){
+            if(errno == EINTR) continue;
+            return -1;
+        }
+        while(cnt > 0 && (size_t)n >= iov->iov_len){
+            n -= iov->iov_len;
+            iov++;
+            cnt--;
+        }
+        if(cnt > 0){
+            iov->iov_base = (uint8_t*)iov->iov_base + n;
+            iov->iov_len -= n;
+        }
+    }
+    return 0;
+}
+
+static void* run_stream(void* arg){
+    struct stream* st = arg;
+    struct sockaddr_in sin;
+    memset(&sin, 0, sizeof(sin));
+    sin.sin_family = AF_INET;
+    sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    sin.sin_port = htons(port);
+
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if(fd == -1 || connect(fd, (struct sockaddr*)&sin, sizeof(sin)) == -1){
+        perror("connect");
+        exit(EXIT_FAILURE);
+    }
+
+    struct cam_session session;
+    memset(&session, 0, sizeof(session));
+    session.width = 640;
+    session.height = 480;
+    session.pixelformat = V4L2_PIX_FMT_MJPEG;
+    session.fps_num = 30;
+    session.fps_den = 1;
+    snprintf(session.filename, sizeof(session.filename), "ingest_%d.mjpeg", st->id);
+    uint8_t session_hdr[CAM_SESSION_HDR_LEN];
+    cam_pack_session(session_hdr, &session);
+    struct iovec iov0 = {session_hdr, sizeof(session_hdr)};
+    if(writev_all(fd, &iov0, 1) == -1) return NULL;
+
+    double end = now_sec() + seconds;
+    struct cam_frame f;
+    memset(&f, 0, sizeof(f));
+    f.length = frame_bytes;
+    while(now_sec() < end){
+        uint8_t hdr[CAM_FRAME_HDR_LEN];
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        f.sequence = st->frames;
+        f.timestamp_us = (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+        cam_pack_frame(hdr, &f);
+        struct iovec iov[2] = {{hdr, sizeof(hdr)}, {frame, frame_bytes}};
+        if(writev_all(fd, iov, 2) == -1) break;
+        st->frames++;
+        st->bytes += sizeof(hdr) + frame_bytes;
+    }
+    close(fd);
+    return NULL;
+}
+
+int main(int argc, char** argv){
+    if(argc < 2){
+        printf("Usage: ./bench_ingest <port> [streams] [frame_bytes] [seconds]\n");
+        return EXIT_FAILURE;
+    }
+    port = atoi(argv[1]);
+    int n_streams = argc > 2 ? atoi(argv[2]) : 8;
+    frame_bytes = argc > 3 ? strtoul(argv[3], NULL, 0) : 64 << 10;
+    seconds = argc > 4 ? atof(argv[4]) : 5;
+    if(frame_bytes < 4) frame_bytes = 4;
+
+    // A frame that looks like a JPEG: SOI, filler, EOI
+    frame = malloc(frame_bytes);
+    for(size_t i = 0; i < frame_bytes; i++) frame[i] = (uint8_t)(i * 131);
+    frame[0] = 0xFF; frame[1] = 0xD8;
+    frame[frame_bytes-2] = 0xFF; frame[frame_bytes-1] = 0xD9;
+
+    struct stream* st = calloc(n_streams, sizeof(*st));
+    double t0 = now_sec();
+    for(int i = 0; i < n_streams; i++){
+        st[i].id = i;
+        pthread_create(&st[i].thread, NULL, run_stream, &st[i]);
+    }
+    uint64_t bytes = 0, frames = 0;
+    for(int i = 0; i < n_streams; i++){
+        pthread_join(st[i].thread, NULL);
+        bytes += st[i].bytes;
+        frames += st[i].frames;
+    }
+    double t = now_sec() - t0;
+    printf("streams=%d frame_bytes=%zu MB/s=%.1f frames/s=%.0f\n", n_streams, frame_bytes, bytes / t / 1e6, frames / t);
+
+    free(st);
+    free(frame);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,41 @@
+#!/bin/sh
+# Compare server ingest paths over loopback: the copy path with the original
+# 1 KiB buffer, the copy path with the default buffer, splice, and the copy path
+# with io_uring storage (through the page cache, and with O_DIRECT).
+# For each mode, starts Cserver in a scratch directory, drives it with
+# bench_ingest and reports client-side throughput and server CPU time per GB.
+#
+# Usage: bench/bench_ingest.sh [streams] [frame_bytes] [seconds] [port]
+set -e
+
+STREAMS=${1:-8}
+FRAME=${2:-65536}
+SECONDS_RUN=${3:-5}
+PORT=${4:-9400}
+ROOT=$(cd "$(dirname "$0")/.." && pwd)
+HZ=$(getconf CLK_TCK)
+
+cpu_ticks() { awk '{print $14 + $15}' /proc/$1/stat; }
+
+for MODE in copy-1k copy splice uring uring-direct; do
+    DIR=$(mktemp -d)
+    case $MODE in
+        copy-1k) FLAG="-b 1024" ;;
+        copy) FLAG="" ;;
+        splice) FLAG="-s" ;;
+        uring) FLAG="-u 16" ;;
+        uring-direct) FLAG="-u 16 -D" ;;
+    esac
+    (cd "$DIR" && exec "$ROOT/Cserver" "$PORT" $FLAG > server.log 2>&1) &
+    PID=$!
+    sleep 0.3
+    T0=$(cpu_ticks $PID)
+    RESULT=$("$ROOT/bench_ingest" "$PORT" "$STREAMS" "$FRAME" "$SECONDS_RUN")
+    sleep 0.3
+    T1=$(cpu_ticks $PID)
+    BYTES=$(cat "$DIR"/*.mjpeg | wc -c)
+    kill $PID; wait $PID 2>/dev/null || true
+    echo "$MODE $RESULT" | awk -v t=$((T1 - T0)) -v hz=$HZ -v b=$BYTES \
+        '{ printf "%-12s %s %s %s server_cpu_s/GB=%.3f\n", $1, $2, $4, $5, (t / hz) / (b / 1e9) }'
+    rm -rf "$DIR"
+done
@@ -0,0 +1,159 @@
+/*
+ * Microbenchmark of the MJPEG marker scanner against the original count_frame loop.
+ *
+ * Builds a synthetic MJPEG stream (headers, byte-stuffed entropy data, restart
+ * markers) in memory, checks that every kernel finds the same markers, then
+ * reports single-core throughput in GB/s.
+ *
+ * Usage: ./bench_scan [stream_MiB] [frame_KiB] [chunk_bytes]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#include "../mjpeg_scan.h"
+
+#define MIN_BENCH_SEC 1.0
+
+// Original server loop: state is reset on every call
+static void count_frame(int* frame_count, const char* buffer,int rec_bytes){
+    char prev_byte=0;
+    for (int i = 0; i < rec_bytes; i++) {
+        if (prev_byte == (char)0xFF && buffer[i] == (char)0xD8) {
+            (*frame_count)++;
+        }
+        prev_byte = buffer[i];
+    }
+}
+
+static double now_sec(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// Function to build a synthetic MJPEG stream: returns the number of frames
+static size_t make_stream(uint8_t* buf, size_t len, size_t frame_len){
+    static const uint8_t header[] = {
+        0xFF, 0xD8,                                     // SOI
+        0xFF, 0xE0, 0x00, 0x10, 'J', 'F', 'I', 'F', 0, 1, 1, 0, 0, 1, 0, 1, 0, 0,
+        0xFF, 0xDB, 0x00, 0x04, 0x00, 0x10,             // DQT (truncated, layout only)
+        0xFF, 0xC0, 0x00, 0x08, 0x08, 0x01, 0xE0, 0x02, 0x80, 0x03,
+        0xFF, 0xDA, 0x00, 0x04, 0x01, 0x00,             // SOS
+    };
+    size_t pos = 0, frames = 0;
+    uint32_t rnd = 12345;
+
+    while(pos + frame_len <= len){
+        size_t end = pos + frame_len - 2;
+        memcpy(buf + pos, header, sizeof(header));
+        pos += sizeof(header);
+        int rst = 0;
+        while(pos < end - 2){
+            rnd = rnd * 1103515245 + 12345;
+            uint8_t b = rnd >> 16;
+            buf[pos++] = b;
+            // Byte stuffing after 0xFF, and a restart marker every ~4 KiB
+            if(b == 0xFF) buf[pos++] = 0x00;
+            else if(!(rnd >> 20 & 0xFFF)){
+                buf[pos++] = 0xFF;
+                buf[pos++] = 0xD0 + (rst++ & 7);
+            }
+        }
+        while(pos < end) buf[pos++] = 0x00;
+        buf[pos++] = 0xFF;
+        buf[pos++] = 0xD9;                              // EOI
+        frames++;
+    }
+    memset(buf + pos, 0, len - pos);
+    return frames;
+}
+
+int main(int argc, char** argv){
+    size_t stream_mib = argc > 1 ? atoi(argv[1]) : 128;
+    size_t frame_kib = argc > 2 ? atoi(argv[2]) : 48;
+    size_t chunk = argc > 3 ? atoi(argv[3]) : 1023;
+    size_t len = stream_mib << 20;
+
+    uint8_t* buf = malloc(len);
+    if(!buf){
+        perror("malloc");
+        return EXIT_FAILURE;
+    }
+    size_t frames = make_stream(buf, len, frame_kib << 10);
+    size_t max_marks = 2 * frames + 16;
+    struct mjpeg_mark* ref = malloc(max_marks * sizeof(*ref));
+    struct mjpeg_mark* marks = malloc(max_marks * sizeof(*marks));
+
+    printf("stream: %zu MiB, %zu frames of %zu KiB, chunk %zu bytes\n", stream_mib, frames, frame_kib, chunk);
+    printf("%-28s %10s %10s\n", "kernel", "GB/s", "frames");
+
+    // Baseline: the original loop, called per recv-sized chunk
+    double t0 = now_sec(), t;
+    int iters = 0, count = 0;
+    do{
+        count = 0;
+        for(size_t off = 0; off < len; off += chunk)
+            count_frame(&count, (const char*)buf + off, (int)(len - off < chunk ? len - off : chunk));
+        iters++;
+    }while((t = now_sec() - t0) < MIN_BENCH_SEC);
+    printf("%-28s %10.2f %10d\n", "count_frame (original)", (double)len * iters / t / 1e9, count);
+
+    // Reference marks, scalar kernel over the whole stream
+    struct mjpeg_scanner s;
+    size_t consumed, n_ref;
+    mjpeg_scan_set_impl(MJPEG_SCAN_SCALAR);
+    mjpeg_scan_init(&s);
+    n_ref = mjpeg_scan(&s, buf, len, ref, max_marks, &consumed);
+
+    const enum mjpeg_scan_impl impls[] = {MJPEG_SCAN_SCALAR, MJPEG_SCAN_SSE2, MJPEG_SCAN_AVX2};
+    int failed = 0;
+    for(size_t k = 0; k < sizeof(impls)/sizeof(impls[0]); k++){
+        if(mjpeg_scan_set_impl(impls[k]) != impls[k]) continue;
+        char name[64];
+
+        // Check: chunked scan must find exactly the reference marks
+        size_t n = 0;
+        mjpeg_scan_init(&s);
+        for(size_t off = 0; off < len; off += chunk)
+            n += mjpeg_scan(&s, buf + off, len - off < chunk ? len - off : chunk, marks + n, max_marks - n, &consumed);
+        if(n != n_ref || memcmp(marks, ref, n * sizeof(*marks))){
+            fprintf(stderr, "%s: marks differ from the scalar reference\n", mjpeg_scan_impl_name());
+            failed = 1;
+        }
+
+        snprintf(name, sizeof(name), "count_soi/%s", mjpeg_scan_impl_name());
+        t0 = now_sec();
+        iters = 0;
+        size_t soi;
+        do{
+            mjpeg_scan_init(&s);
+            soi = 0;
+            for(size_t off = 0; off < len; off += chunk)
+                soi += mjpeg_count_soi(&s, buf + off, len - off < chunk ? len - off : chunk);
+            iters++;
+        }while((t = now_sec() - t0) < MIN_BENCH_SEC);
+        printf("%-28s %10.2f %10zu\n", name, (double)len * iters / t / 1e9, soi);
+        if(soi != frames) failed = 1;
+
+        snprintf(name, sizeof(name), "scan offsets/%s", mjpeg_scan_impl_name());
+        t0 = now_sec();
+        iters = 0;
+        do{
+            mjpeg_scan_init(&s);
+            n = 0;
+            for(size_t off = 0; off < len; off += chunk)
+                n += mjpeg_scan(&s, buf + off, len - off < chunk ? len - off : chunk, marks + n, max_marks - n, &consumed);
+            iters++;
+        }while((t = now_sec() - t0) < MIN_BENCH_SEC);
+        printf("%-28s %10.2f %10zu\n", name, (double)len * iters / t / 1e9, n / 2);
+    }
+
+    free(marks);
+    free(ref);
+    free(buf);
+    if(failed) fprintf(stderr, "FAILED: kernels disagree\n");
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
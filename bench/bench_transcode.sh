@@ -0,0 +1,33 @@
+#!/bin/sh
+# Wall-clock speedup of the segmented H.264 transcode (Cindex mp4, as Cserver -x)
+# from 1 to N cores, against one multi-threaded ffmpeg over the whole recording
+# (the unsegmented transcode). Needs ffmpeg with libx264 and an indexed recording.
+#
+# Usage: bench/bench_transcode.sh <recording.mjpeg> [max_cores]
+set -e
+
+REC=$1
+[ -f "$REC" ] || { echo "Usage: $0 <recording.mjpeg> [max_cores]" >&2; exit 1; }
+MAX=${2:-$(nproc)}
+ROOT=$(cd "$(dirname "$0")/.." && pwd)
+OUT=$(mktemp -d)
+trap 'rm -rf "$OUT"' EXIT
+
+now_ms() { echo $(($(date +%s%N) / 1000000)); }
+
+T0=$(now_ms)
+ffmpeg -y -loglevel error -i "$REC" -c:v libx264 -preset fast -crf 23 -threads "$MAX" "$OUT/whole.mp4"
+WHOLE=$(($(now_ms) - T0))
+echo "whole recording, ffmpeg -threads $MAX: $WHOLE ms"
+
+printf "%-6s %10s %9s %12s\n" cores wall_ms speedup vs_whole
+BASE=
+CORES=1
+while [ "$CORES" -le "$MAX" ]; do
+    T0=$(now_ms)
+    "$ROOT/Cindex" mp4 "$REC" "$OUT/seg.mp4" "$CORES" > /dev/null
+    WALL=$(($(now_ms) - T0))
+    BASE=${BASE:-$WALL}
+    awk -v c=$CORES -v w=$WALL -v b=$BASE -v h=$WHOLE 'BEGIN { printf "%-6d %10d %8.2fx %11.2fx\n", c, w, b / w, h / w }'
+    CORES=$((CORES + 1))
+done
@@ -0,0 +1,17 @@
+#!/bin/sh
+# Merge Chrome trace files written by Cclient -t and Cserver -t into one, to
+# follow frames from capture to disk on a single timeline (chrome://tracing or
+# https://ui.perfetto.dev). Both ends must run on the same host: timestamps are
+# CLOCK_MONOTONIC. Flow arrows join each frame's send to its reception.
+#
+# Usage: bench/trace_merge.sh server.json client.json... > merged.json
+set -e
+
+[ $# -ge 1 ] || { echo "Usage: $0 trace.json... > merged.json" >&2; exit 1; }
+
+# Each file: a header line, one event per line (the last without a comma), a footer line
+echo '{"traceEvents":['
+for TRACE in "$@"; do
+    sed '1d;$d' "$TRACE" | sed '$s/$/,/'
+done | sed '$s/,$//'
+echo '],"displayTimeUnit":"ms"}'
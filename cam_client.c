@@ -1,40 +1,136 @@
 #include <stdio.h>
-#include <fcntl.h>
-#include <sys/ioctl.h>
 #include <unistd.h>
 #include <stdint.h>
 #include <errno.h>
 #include <string.h>
 #include <stdlib.h>
-#include <linux/videodev2.h>
-#include <sys/mman.h>
+#include <sys/eventfd.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/timerfd.h>
+#include <signal.h>
+#include <time.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdatomic.h>
 
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <netdb.h>
 #include <arpa/inet.h>
 
-#include "ext_lib/render_sdl2.h"
+#include "cam_proto.h"
+#include "cam_net.h"
+#include "spsc_ring.h"
+#include "frame_source.h"
+#include "motion.h"
+#include "cam_udp.h"
+#include "cam_hist.h"
+#include "cam_trace.h"
+#include "cam_preview.h"
 
 #pragma region DEF_CONST
 
-#define SDL_RENDER 0//[DEBUG PURPOSE] Enable rendering if set to 1
-
 #define TRUE 1
-#define MIN_BUFF 2  // Minimum number of buffers required
 #define REQ_BUFF 4  // Requested number of buffers
 #define FRAME_WIDTH 640
 #define FRAME_HEIGHT 480
-#define FILENAME_MAX_LEN 256
+
+#define RING_DEPTH (REQ_BUFF - 2) // Default frames queued for the sender
+
+#define MAX_CAMERAS 16         // Sources one client can drive (-s repeated)
+#define CAPTURE_EVENTS 32       // Max epoll events handled per capture wake-up
+
+#define MOTION_AREA 0.5         // Default % of the blocks that must change
+#define MOTION_KEEPALIVE 10     // Default seconds between keep-alive frames
+
+// Stages timed for every frame, in us (lock-free histograms, see cam_hist.h)
+enum stage{
+    STAGE_DQBUF,    // Driver capture timestamp -> dequeued by the capture thread
+    STAGE_SEND,     // Dequeued -> send complete (handed to the kernel)
+    STAGE_TOTAL,    // Driver capture timestamp -> send complete
+    N_STAGES,
+};
+
+static const char* stage_name[N_STAGES] = { "capture>dqbuf", "dqbuf>sent", "capture>sent" };
+
+// What the capture thread does with a new frame when the send ring is full
+enum drop_policy{
+    DROP_BLOCK,     // Wait for the sender (the driver drops frames meanwhile)
+    DROP_OLDEST,    // Recycle the oldest queued frame
+    DROP_NEWEST,    // Recycle the new frame
+};
 
 struct buffer{
-    void *start;
-    size_t length;
+    void *start;            // Frame data (may change between frames for file replay)
+    uint32_t bytesused;     // Frame metadata, set by the capture thread before publishing
+    uint32_t sequence;
+    uint64_t timestamp_us;
+    uint64_t dq_us;         // Dequeued from the source
+    uint32_t flags;         // Frame header flags
+    int pending;            // Zero-copy send in flight: not yet back to the driver
+    uint32_t zc_id;         // Id of the last zero-copy send() of this buffer
+};
+
+// Per-camera state shared by the capture thread and the camera's sender thread
+struct client{
+    struct frame_source* src;
+    char tag[80];               // Log prefix naming the camera ("" with a single camera)
+    struct preview* preview;    // Window showing this camera's frames (-p, NULL: none)
+    int socket_ds;
+    struct buffer* buffers;
+    unsigned int n_buffers;
+
+    // Capture -> sender: dequeued frames; sender -> capture: buffers to re-queue
+    struct spsc_ring tx_ring;
+    struct spsc_ring ret_ring;
+    int tx_event;               // eventfd: frames pushed to tx_ring
+    int ret_event;              // eventfd: buffers pushed to ret_ring
+    enum drop_policy policy;
+    int held;                   // DROP_BLOCK: a frame waits for room in tx_ring, the source is paused
+    uint32_t held_index;
+    atomic_int stop;            // No more frames: the sender exits once tx_ring is empty
+
+    int zerocopy;               // Send payload with MSG_ZEROCOPY
+    struct zc_sender zc;        // Owned by the sender thread
+
+    struct motion_gate* motion; // Send only frames with motion (NULL: every frame)
+    int gated;                  // Frames were suppressed since the last frame queued
+
+    struct udp_sender* udp;     // UDP transport (NULL: TCP); sender-owned
+    uint32_t trace_stream;      // Stream key in the trace (-t)
+    int verbose;                // Print a line per frame sent (-v)
+
+    struct latency_bound* lb;   // Drop frames that would arrive too late (NULL: send all); sender-owned
+    atomic_uint fps_milli;      // Sender -> capture: frame rate the source should run at (x1000, 0: as is)
+    uint32_t fps_applied;       // Capture: last frame rate asked of the source
+    int fps_fixed;              // Capture: the source cannot change its frame rate
+
+    // Statistics
+    atomic_ullong sent;
+    atomic_ullong dropped_oldest;
+    atomic_ullong dropped_newest;
+    atomic_ullong blocked;      // Times the capture thread waited for the sender
+    unsigned long long driver_gaps; // Frames the source dropped (sequence gaps)
+    unsigned long long gap_events;  // Gaps in the sequence
+    uint32_t last_gap_seq;      // Sequence number after the last gap
+    uint32_t next_seq;          // Expected sequence number of the next frame
+
+    // Stage latencies: STAGE_DQBUF added by the capture thread, the others by the sender
+    struct cam_hist stages[N_STAGES];
+    struct cam_hist last[N_STAGES];     // Capture thread: snapshot at the previous summary
+    unsigned long long last_sent, last_gaps, last_gap_events;
 };
 
 // Macro to clear struct memory
 #define CLEAR(x) memset(&(x), 0, sizeof(x))
 
+static uint64_t now_us(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
 // Function to handle errors and exit
 static void errno_exit(const char* s){
     fprintf(stderr, "%s error %d, %s\n", s, errno, strerror(errno));
@@ -45,199 +141,724 @@ static void errno_exit(const char* s){
 
 #pragma region FRAME_PROC_FUN
 
-// Function to render a frame using SDL2 [DEBUG PURPOSE]
-static void render_frame(const void* p, int size_bytes, const struct v4l2_format* v4l_sd2l){
-    uint8_t *buf0 = malloc(sizeof(char) * (v4l_sd2l->fmt.pix.sizeimage) * 3);
-    decode_sdl2_mjpeg_frame((uint8_t *)p, buf0, size_bytes);
-    render_sdl2_frame(buf0, (v4l_sd2l->fmt.pix.width) * sizeof(char) * 3);
-    free(buf0);
-}
-
-// Function to process a single video frame: dequeues, sends, optionally renders, then re-queues
-static int process_frame(int webcam_ds, int socket_ds, struct buffer* buffers,const struct v4l2_format* v4l_sd2l){
-    struct v4l2_buffer buf;
-    CLEAR(buf);
-    buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-    buf.memory = V4L2_MEMORY_MMAP;
-
-    // Dequeue a frame from the buffer
-    if (ioctl(webcam_ds, VIDIOC_DQBUF, &buf) == -1) errno_exit("VIDIOC_DQBUF");
-
-    // Send the frame data to the server
-    if(send(socket_ds, buffers[buf.index].start, buf.bytesused, 0) == -1) errno_exit("Frame_send");
-    
-    #if SDL_RENDER
-        render_frame(buffers[buf.index].start, buf.bytesused,v4l_sd2l);
-    #endif
-
-    // Re-queue the buffer for further capturing
-    if (ioctl(webcam_ds, VIDIOC_QBUF, &buf) == -1) errno_exit("VIDIOC_QBUF");
+// Function to send a whole buffer, resuming after short writes
+static void send_all(int socket_ds, const void* data, size_t len, int flags){
+    const uint8_t* p = data;
+    while(len > 0){
+        ssize_t sent = send(socket_ds, p, len, flags);
+        if(sent == -1){
+            if(errno == EINTR) continue;
+            errno_exit("Frame_send");
+        }
+        p += sent;
+        len -= sent;
+    }
+}
+
+// Function to wake up the thread waiting on an eventfd
+static void notify(int event_ds){
+    uint64_t one = 1;
+    if(write(event_ds, &one, sizeof(one)) == -1 && errno != EAGAIN) errno_exit("Eventfd_write");
+}
+
+// Function to consume the pending wake-ups of an eventfd
+static void clear_event(int event_ds){
+    uint64_t n;
+    if(read(event_ds, &n, sizeof(n)) == -1 && errno != EAGAIN) errno_exit("Eventfd_read");
+}
+
+// Function to give a buffer back to the frame source
+static void requeue_buffer(struct client* cl, uint32_t index){
+    uint64_t t0 = cam_trace_begin();
+    if (source_requeue(cl->src, index) == -1) errno_exit(cl->src->error);
+    cam_trace_span("QBUF", t0, cl->trace_stream, cl->buffers[index].sequence);
+}
+
+// Function to re-queue every buffer the sender has finished with
+static void requeue_returned(struct client* cl){
+    uint32_t index;
+    clear_event(cl->ret_event);
+    while(spsc_pop(&cl->ret_ring, &index)) requeue_buffer(cl, index);
+}
+
+// Function to capture a single video frame: dequeues, optionally previews, then hands it
+// to the sender according to the drop policy. Returns -1 at the end of the source.
+static int process_frame(struct client* cl){
+    struct frame_desc frame;
+
+    // Dequeue a frame from the source
+    uint64_t t0 = cam_trace_begin();
+    int ret = source_dequeue(cl->src, &frame);
+    if(ret == -1){
+        if(errno == ENODATA) return -1;
+        errno_exit(cl->src->error);
+    }
+    if(!ret) return 0;
+    cam_trace_span("DQBUF", t0, cl->trace_stream, frame.sequence);
+    uint64_t now = now_us();
+    cam_hist_add_atomic(&cl->stages[STAGE_DQBUF], now > frame.timestamp_us ? now - frame.timestamp_us : 0);
+
+    // Frames the source had to drop show up as gaps in the sequence
+    if(cl->next_seq && frame.sequence > cl->next_seq){
+        cl->driver_gaps += frame.sequence - cl->next_seq;
+        cl->gap_events++;
+        cl->last_gap_seq = frame.sequence;
+    }
+    cl->next_seq = frame.sequence + 1;
+
+    struct buffer* b = &cl->buffers[frame.index];
+    b->start = frame.data;
+    b->bytesused = frame.bytesused;
+    b->sequence = frame.sequence;
+    b->timestamp_us = frame.timestamp_us;
+    b->dq_us = now;
+
+    // Frames without motion go straight back to the source
+    if(cl->motion){
+        t0 = cam_trace_begin();
+        int skip = motion_check(cl->motion, frame.data, frame.bytesused, frame.timestamp_us) == MOTION_SKIP;
+        cam_trace_span("motion", t0, cl->trace_stream, frame.sequence);
+        if(skip){
+            requeue_buffer(cl, frame.index);
+            cl->gated = 1;
+            return 1;
+        }
+    }
+    b->flags = cl->gated ? CAM_FRAME_GATED : 0;
+
+    // A copy for the preview thread: the buffer never waits for decode or vsync
+#ifdef HAVE_SDL
+    if(cl->preview){
+        t0 = cam_trace_begin();
+        preview_publish(cl->preview, b->start, frame.bytesused, cl->trace_stream, frame.sequence);
+        cam_trace_span("preview", t0, cl->trace_stream, frame.sequence);
+    }
+#endif
+
+    // Hand the frame to the sender thread
+    while(!spsc_push(&cl->tx_ring, frame.index)){
+        uint32_t oldest;
+        switch(cl->policy){
+        case DROP_NEWEST:
+            requeue_buffer(cl, frame.index);
+            atomic_fetch_add(&cl->dropped_newest, 1);
+            return 1;
+        case DROP_OLDEST:
+            // The sender may have taken it meanwhile: then just retry the push
+            if(spsc_pop(&cl->tx_ring, &oldest)){
+                requeue_buffer(cl, oldest);
+                atomic_fetch_add(&cl->dropped_oldest, 1);
+            }
+            break;
+        case DROP_BLOCK:
+            // Hold the frame until the sender returns a buffer (see push_held()):
+            // the other cameras keep capturing meanwhile
+            atomic_fetch_add(&cl->blocked, 1);
+            cl->held = 1;
+            cl->held_index = frame.index;
+            return 1;
+        }
+    }
+    cl->gated = 0;
+    notify(cl->tx_event);
     return 1;
 }
 
-#pragma endregion
+// Function to retry handing the held frame to the sender: returns 1 once it is queued
+static int push_held(struct client* cl){
+    if(!spsc_push(&cl->tx_ring, cl->held_index)) return 0;
+    cl->held = 0;
+    cl->gated = 0;
+    notify(cl->tx_event);
+    return 1;
+}
 
-int main(int argc, char** argv){
-    int port,num_frame;
+// Function to send one frame to the server. Returns 1 if the buffer can go back to the driver.
+static int send_frame(struct client* cl, uint32_t index){
+    struct buffer* b = &cl->buffers[index];
+
+    // Send the frame header, then the frame data to the server
+    struct cam_frame frame;
+    CLEAR(frame);
+    frame.sequence = b->sequence;
+    frame.timestamp_us = b->timestamp_us;
+    frame.length = b->bytesused;
+    frame.flags = b->flags;
+
+    uint8_t hdr[CAM_FRAME_HDR_LEN];
+    cam_pack_frame(hdr, &frame);
+    if(cl->udp){
+        // Fragments are copied into the socket buffer: the buffer is free once sent
+        if(udp_send_frame(cl->udp, hdr, b->start, b->bytesused) == -1) errno_exit("Frame_send");
+        return 1;
+    }
+    if(cl->zerocopy){
+        if(zc_send(&cl->zc, hdr, sizeof(hdr), b->start, b->bytesused, &b->zc_id) == -1) errno_exit("Frame_send");
+        b->pending = 1;
+        return 0;
+    }
+
+    struct iovec iov[2] = {{hdr, sizeof(hdr)}, {b->start, b->bytesused}};
+    if(net_writev_all(cl->socket_ds, iov, 2) == -1) errno_exit("Frame_send");
+    return 1;
+}
+
+// Function to return the buffers whose zero-copy sends have completed: returns how many are still in flight
+static int return_completed(struct client* cl){
+    int returned = 0, in_flight = 0;
+    if(zc_reap(&cl->zc, 0) == -1) errno_exit("Zerocopy_completion");
+
+    for(unsigned int i = 0; i < cl->n_buffers; i++){
+        if(!cl->buffers[i].pending) continue;
+        if(!zc_done(&cl->zc, cl->buffers[i].zc_id)){
+            in_flight++;
+            continue;
+        }
+        cl->buffers[i].pending = 0;
+        spsc_push(&cl->ret_ring, i);
+        returned = 1;
+    }
+    if(returned) notify(cl->ret_event);
+    return in_flight;
+}
+
+// Function to hand the latency bound's frame rate to the capture thread, and report the link once per window
+static void latency_tick(struct client* cl){
+    struct latency_bound* lb = cl->lb;
+    double fps = lb->fps;
+    if(!lb_tick(lb)) return;
+    if(lb->fps != fps) atomic_store(&cl->fps_milli, (unsigned int)(lb->fps * 1000 + 0.5));
+    printf("%sLatency: link %.2f MB/s, unsent %u KB, sent %.1f fps, source %.1f fps, stale drops %llu\n",
+        cl->tag, lb->rate / 1e6, lb->queued >> 10, lb->sent_fps, lb->fps, lb->stale);
+}
+
+// Function to run the source at the frame rate the latency bound asks for (capture thread)
+static void apply_fps(struct client* cl){
+    uint32_t milli = atomic_load(&cl->fps_milli);
+    if(!milli || milli == cl->fps_applied || cl->fps_fixed) return;
+    cl->fps_applied = milli;
+    if(source_set_fps(cl->src, milli, 1000) == -1){
+        fprintf(stderr, "%s%s: %s, dropping stale frames only\n", cl->tag, cl->src->error, strerror(errno));
+        cl->fps_fixed = 1;
+    }
+}
 
-    if(argc < 3){
-        printf("Usage: ./CClient <port> <num_frame>\n");
-        exit(EXIT_FAILURE);
+// Function to print the stage latencies and source drops of a camera, since the previous
+// summary (<interval> s, periodic) or since the start (capture thread)
+static void print_stages(struct client* cl, double interval){
+    struct cam_hist cur, since;
+    char lat[N_STAGES][64], gap[48] = "";
+    unsigned long long sent = atomic_load(&cl->sent), gaps = cl->driver_gaps, gap_events = cl->gap_events;
+    for(int i = 0; i < N_STAGES; i++){
+        cam_hist_snapshot(&cur, &cl->stages[i]);
+        if(interval > 0){
+            cam_hist_since(&since, &cur, &cl->last[i]);
+            cl->last[i] = cur;
+        }
+        cam_hist_format(lat[i], sizeof(lat[i]), interval > 0 ? &since : &cur);
+    }
+    if(interval > 0){
+        sent -= cl->last_sent;
+        gaps -= cl->last_gaps;
+        gap_events -= cl->last_gap_events;
+        cl->last_sent = atomic_load(&cl->sent);
+        cl->last_gaps = cl->driver_gaps;
+        cl->last_gap_events = cl->gap_events;
+        printf("%sLast %.1f s: %llu frames sent (%.1f fps)", cl->tag, interval, sent, sent / interval);
+    }
+    else printf("%sSince start: %llu frames sent", cl->tag, sent);
+    if(gap_events) snprintf(gap, sizeof(gap), " (last before sequence %u)", cl->last_gap_seq);
+    printf(", source drops %llu in %llu gaps%s; p50/p99/max us: %s %s, %s %s, %s %s\n", gaps, gap_events, gap,
+        stage_name[STAGE_DQBUF], lat[STAGE_DQBUF], stage_name[STAGE_SEND], lat[STAGE_SEND], stage_name[STAGE_TOTAL], lat[STAGE_TOTAL]);
+}
+
+// Sender thread: sends the frames queued by the capture thread and returns their buffers
+static void* sender_thread(void* arg){
+    struct client* cl = arg;
+    char name[96];
+    snprintf(name, sizeof(name), "%ssender", cl->tag);
+    cam_trace_thread(name);
+
+    while(TRUE){
+        int in_flight = cl->zerocopy ? return_completed(cl) : 0;
+
+        uint32_t index;
+        if(spsc_pop(&cl->tx_ring, &index)){
+            size_t len = CAM_FRAME_HDR_LEN + cl->buffers[index].bytesused;
+            if(cl->lb && !lb_admit(cl->lb, cl->buffers[index].timestamp_us, len, spsc_count(&cl->tx_ring) > 0)){
+                // Too late to be worth sending: straight back to the source
+                spsc_push(&cl->ret_ring, index);
+                notify(cl->ret_event);
+                latency_tick(cl);
+                continue;
+            }
+            uint64_t t0 = cam_trace_begin();
+            int done = send_frame(cl, index);
+            // Time the send before the buffer may go back to the source
+            uint64_t now = now_us();
+            struct buffer* b = &cl->buffers[index];
+            cam_trace_send("send", t0, cl->trace_stream, b->sequence);
+            cam_hist_add_atomic(&cl->stages[STAGE_SEND], now - b->dq_us);
+            cam_hist_add_atomic(&cl->stages[STAGE_TOTAL], now > b->timestamp_us ? now - b->timestamp_us : 0);
+            if(done){
+                spsc_push(&cl->ret_ring, index);
+                notify(cl->ret_event);
+            }
+            unsigned long long sent = atomic_fetch_add(&cl->sent, 1) + 1;
+            if(cl->verbose) printf("%sFrame: %llu CATCHED \t SENT to Cserver\n", cl->tag, sent);
+            if(cl->lb){
+                lb_sent(cl->lb, len);
+                latency_tick(cl);
+            }
+            continue;
+        }
+        if(atomic_load(&cl->stop) && !spsc_count(&cl->tx_ring) && !in_flight) break;
+
+        // Sleep until a new frame, or a zero-copy completion (shows up as POLLERR)
+        struct pollfd pfd[2] = {{.fd = cl->tx_event, .events = POLLIN}, {.fd = cl->socket_ds, .events = 0}};
+        if(poll(pfd, in_flight ? 2 : 1, -1) == -1 && errno != EINTR) errno_exit("Poll");
+        if(pfd[0].revents & POLLIN) clear_event(cl->tx_event);
     }
-    sscanf(argv[1], "%d", &port);
-    sscanf(argv[2], "%d", &num_frame);
+    return NULL;
+}
+
+#pragma endregion
+
+static void usage(void){
+    printf("Usage: ./CClient <port> <num_frame> [-s source]... [-r WxH] [-f fps] [-S bytes] [-l] [-z] [-P block|oldest|newest] [-q depth]\n"
+           "                 [-m threshold [-A area] [-K sec] [-M x,y,w,h]...] [-L ms] [-U [-R mbit] [-T mtu]] [-i sec] [-t trace.json] [-p] [-v]\n"
+           "  -s  frame source: v4l2[:device] (default v4l2:/dev/video0), file:<recording.mjpeg> or pattern;\n"
+           "      repeat to drive up to %d cameras, each on its own connection (settings apply to all)\n"
+           "  -r  resolution (default %dx%d; file replay uses the recording's)\n"
+           "  -f  file/pattern frame rate, 0 for as fast as possible (default 30)\n"
+           "  -S  pad the pattern frames to this size in bytes\n"
+           "  -l  loop the file replay instead of stopping at its end\n"
+           "  -z  zero-copy send (MSG_ZEROCOPY) straight from the capture buffers\n"
+           "  -P  when the sender falls behind: wait for it (default), drop the oldest or the newest frame\n"
+           "  -q  frames queued between capture and send (default %d, max %d)\n"
+           "  -m  motion gating: send only frames where 8x8 blocks changed luma by more than threshold (0-255)\n"
+           "  -A  %% of the blocks that must change for motion (default %g)\n"
+           "  -K  send a keep-alive frame after this many seconds without motion, 0 for never (default %d)\n"
+           "  -M  only look for motion in this region, in %% of the frame (repeatable, up to %d)\n"
+           "  -L  latency bound: drop frames that would reach the server later than this after capture,\n"
+           "      and lower the source frame rate to what the link carries\n"
+           "  -U  send over UDP (server started with -U): a lost datagram costs its frame instead of delaying the next ones\n"
+           "  -R  UDP pacing: spread the datagrams at this many Mbit/s (default: as fast as the socket takes them)\n"
+           "  -T  UDP path MTU, datagrams are sized to fit it (default %d)\n"
+           "  -i  print the frames sent, source drops and stage latencies (capture > dequeue > sent) every <sec> seconds\n"
+           "      (since the start: kill -USR1 <pid>)\n"
+           "  -t  trace every frame (dequeue, send, re-queue...) to a Chrome trace JSON file, written at exit;\n"
+           "      Ctrl-C then stops the capture cleanly\n"
+           "  -p  preview the first camera in a window (SDL2), decoded and shown on its own thread:\n"
+           "      the newest frame is shown, capture and send never wait for the display (build with SDL=1)\n"
+           "  -v  print a line for every frame sent (off: -i prints the frames sent periodically)\n",
+           MAX_CAMERAS, FRAME_WIDTH, FRAME_HEIGHT, RING_DEPTH, REQ_BUFF - 1, MOTION_AREA, MOTION_KEEPALIVE, MOTION_MAX_REGIONS, UDP_MTU);
+    exit(EXIT_FAILURE);
+}
 
-    // Open the webcam device
+// Settings shared by every camera of the client
+struct client_opts{
+    int port;
+    int num_frame;
+    uint32_t width, height;
+    double fps;
+    size_t frame_size;
+    int loop;
+    unsigned int ring_depth;
+    enum drop_policy policy;
+    int zerocopy;
+    struct motion_gate motion;  // Gate settings (threshold < 0: off)
+    double latency_ms;
+    int udp, mtu;
+    double pacing_mbit;
+    double stats_interval;      // Seconds between stage summaries, 0 for none
+    const char* trace;          // Chrome trace file (-t), NULL for none
+    int preview;                // Show the first camera in a window (-p)
+    int verbose;                // A line per frame sent (-v)
+    unsigned int n_cams;
+};
+
+// One camera: its source, its connection and its sender thread
+struct camera{
+    struct client cl;
+    struct frame_source src;
+    struct motion_gate motion;
+    struct latency_bound lb;
+    struct udp_sender us;
+    const char* spec;           // Source as given with -s
+    pthread_t sender;
+    unsigned int captured;      // Frames taken from the source
+    int done;                   // Source ended or <num_frame> reached
+    int paused;                 // Source fd out of the epoll set (DROP_BLOCK)
+};
+
+// Function to open a camera's source, connect it to the server and start its sender thread
+static void start_camera(struct camera* cam, unsigned int id, const struct client_opts* o){
+    struct client* cl = &cam->cl;
+    struct frame_source* src = &cam->src;
+    const char* source = cam->spec;
+
+    // Open the frame source
     // REMINDER: Active webcam device on VirtualBox
-    const char* dev_name = "/dev/video0";
-    int webcam_ds = -1;
-    if((webcam_ds = open(dev_name,O_RDWR | O_NONBLOCK, 0)) == -1) errno_exit(dev_name);
+    int ret = -1;
+    if(!strcmp(source, "v4l2")) ret = source_open_v4l2(src, "/dev/video0", o->width, o->height, REQ_BUFF);
+    else if(!strncmp(source, "v4l2:", 5)) ret = source_open_v4l2(src, source + 5, o->width, o->height, REQ_BUFF);
+    else if(!strncmp(source, "file:", 5)) ret = source_open_file(src, source + 5, o->fps, o->loop, REQ_BUFF);
+    else if(!strcmp(source, "pattern")) ret = source_open_pattern(src, o->width, o->height, o->fps, o->frame_size, REQ_BUFF);
+    else usage();
+    if(ret == -1) errno_exit(src->error);
+    if(o->n_cams > 1) snprintf(cl->tag, sizeof(cl->tag), "[cam %u %s] ", id, source);
+    cl->policy = o->policy;
+    cl->zerocopy = o->zerocopy;
+    if(o->motion.threshold >= 0){
+        cam->motion = o->motion;
+        if(motion_init(&cam->motion, src->width, src->height) == -1) errno_exit("Motion_gate");
+        cl->motion = &cam->motion;
+    }
 
     // Create socket
     struct sockaddr_in sin;
     CLEAR(sin);
     sin.sin_family = AF_INET;
     sin.sin_addr.s_addr = htonl(INADDR_ANY);
-    sin.sin_port = htons(port);
+    sin.sin_port = htons(o->port);
 
     int socket_ds = -1;
-    if ((socket_ds = socket(AF_INET, SOCK_STREAM, 0)) == -1) errno_exit("Socket");
+    if ((socket_ds = socket(AF_INET, o->udp ? SOCK_DGRAM : SOCK_STREAM, 0)) == -1) errno_exit("Socket");
 
-    // Connect to server localhost:<port>
+    // Connect to server localhost:<port> (UDP: only sets the destination)
     if (connect(socket_ds,(struct sockaddr *)&sin, sizeof(sin)) == -1) errno_exit("Connect");
-    printf("Connected to %s:%d\n", inet_ntoa(sin.sin_addr),port);
-
-    // Send filename to server
-    char filename[FILENAME_MAX_LEN];
-    CLEAR(filename);
-    sprintf(filename,"Webcam_%d_%d_%d.mjpeg",FRAME_WIDTH,FRAME_HEIGHT,num_frame);
-    if (send(socket_ds, filename, strlen(filename), 0) == -1) errno_exit("Send_filename");
-    printf("Filename %s sent to %s:%d\n",filename,inet_ntoa(sin.sin_addr),port);
-
-    // Initialize the webcam device
-    // 1. Query webcam device capabilities
-    // NOTE: V4L2_CAP_READWRITE not work
-    struct v4l2_capability cap;
-    CLEAR(cap);
-
-    if(ioctl(webcam_ds,VIDIOC_QUERYCAP,&cap)==-1) errno_exit("VIDIOC_QUERYCAP");
-
-    if (!(cap.capabilities & V4L2_CAP_VIDEO_CAPTURE)) errno_exit("Not a video capture device");
-    if (!(cap.capabilities & V4L2_CAP_STREAMING)) errno_exit("Streaming I/O not supported");
-
-    
-    //2. Set video format (MJPEG for VirtualBox compatibility)
-    struct v4l2_format my_fmt;
-    CLEAR(my_fmt);
-
-    my_fmt.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-    my_fmt.fmt.pix.width = FRAME_WIDTH;
-    my_fmt.fmt.pix.height = FRAME_HEIGHT;
-    my_fmt.fmt.pix.pixelformat = V4L2_PIX_FMT_MJPEG;
-
-    if (ioctl(webcam_ds, VIDIOC_S_FMT, &my_fmt) == -1) errno_exit("VIDIOC_S_FMT");
-    
-    // Initialize SDL2 [DEBUG PURPOSE]
-    struct v4l2_format v4l_sd2l; 
-    #if SDL_RENDER
-        init_render_sdl2(FRAME_WIDTH, FRAME_HEIGHT, 0);
-        v4l_sd2l = my_fmt;
-    #endif
-
-    // Initilzie mmap
-    struct v4l2_requestbuffers req;
-    CLEAR(req);
-
-    req.count = REQ_BUFF; 
-    req.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-    req.memory = V4L2_MEMORY_MMAP;
-
-    if (ioctl(webcam_ds, VIDIOC_REQBUFS, &req) == -1) errno_exit("VIDIOC_REQBUFS");
-    if (req.count < MIN_BUFF) errno_exit("Insufficient buffer memory");
-
-    struct buffer* buffers = calloc(req.count, sizeof(*buffers));
-    if (!buffers) errno_exit("Out of memory");
-
-    // Map the webcam device registers to main memory addresses
-    unsigned int num_buffer;
-    for (num_buffer = 0; num_buffer < req.count; ++num_buffer){
-        struct v4l2_buffer buf;
-        CLEAR(buf);
-
-        buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-        buf.memory = V4L2_MEMORY_MMAP;
-        buf.index = num_buffer;
-
-        if (ioctl(webcam_ds, VIDIOC_QUERYBUF, &buf)== -1) errno_exit("VIDIOC_QUERYBUF");
-
-        buffers[num_buffer].length = buf.length;
-        buffers[num_buffer].start =
-            mmap(NULL /* start anywhere */,
-                 buf.length,
-                 PROT_READ | PROT_WRITE /* required */,
-                 MAP_SHARED /* recommended */,
-                 webcam_ds, buf.m.offset);
-
-        if (MAP_FAILED == buffers[num_buffer].start) errno_exit("mmap");
-    }
-
-
-    // Start capturing the frames
-    enum v4l2_buf_type type;
-    for (size_t i = 0; i < num_buffer; ++i){
-        
-        struct v4l2_buffer buf;
-        CLEAR(buf);
-
-        buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-        buf.memory = V4L2_MEMORY_MMAP;
-        buf.index = i;
-
-        if (ioctl(webcam_ds, VIDIOC_QBUF, &buf) == -1) errno_exit("VIDIOC_QBUF");
-    }
-    type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-    if (ioctl(webcam_ds, VIDIOC_STREAMON, &type) == -1) errno_exit("VIDIOC_STREAMON");
-
-    
-    // Catch the <num_frame> frames required and sending them to the server
-    // if <num_frame>=-1 --> acquire frames until the client is stopped
-    unsigned int count = num_frame; // = UINT_MAX = 4294967295
-    for(int i = 0; i<count; i++){
-        while(TRUE){
-            fd_set fds;
-            FD_ZERO(&fds);
-            FD_SET(webcam_ds, &fds);
-
-            // Time interval for selection
-            struct timeval tv = {.tv_sec=5,.tv_usec=0};
-
-            if(select(webcam_ds + 1, &fds, NULL, NULL, &tv)==-1) errno_exit("Select");
-            #if SDL_RENDER
-                render_sdl2_dispatch_events();
-            #endif
-
-            //Taking the frame and sending to the server/render by SD2L
-            if (process_frame(webcam_ds,socket_ds,buffers,&v4l_sd2l)) break;
+    printf("%sConnected to %s:%d%s\n", cl->tag, inet_ntoa(sin.sin_addr), o->port, o->udp ? " (UDP)" : "");
+    if(o->udp){
+        if(udp_sender_init(&cam->us, socket_ds, o->mtu, o->pacing_mbit * 1e6 / 8) == -1){
+            fprintf(stderr, "Invalid MTU %d\n", o->mtu);
+            exit(EXIT_FAILURE);
+        }
+        cl->udp = &cam->us;
+        if(cl->zerocopy){
+            if(!id) fprintf(stderr, "Zero-copy send is TCP only, ignoring -z\n");
+            cl->zerocopy = 0;
         }
-        printf("Frame: %d CATCHED \t SENT to Cserver\n",i+1);
-    }
-
-    // Stop capturing the frames
-    type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-    if (-1 == ioctl(webcam_ds, VIDIOC_STREAMOFF, &type)) errno_exit("VIDIOC_STREAMOFF");
-      
-    // Clean-up the webcam device
-    for (size_t i = 0; i < num_buffer; ++i)
-        if (-1 == munmap(buffers[i].start, buffers[i].length)) errno_exit("munmap");
-    free(buffers);
-    #if SDL_RENDER
-        render_sdl2_clean();
-    #endif
-
-    // Close the webcam device
-    if(close(webcam_ds)==-1)  errno_exit(dev_name);
+    }
+    if(cl->zerocopy && zc_init(&cl->zc, socket_ds) == -1){
+        fprintf(stderr, "SO_ZEROCOPY not supported, using copy send\n");
+        cl->zerocopy = 0;
+    }
+    if(o->latency_ms > 0){
+        lb_init(&cam->lb, socket_ds, o->latency_ms * 1000, src->fps_num ? (double)src->fps_num / src->fps_den : 0);
+        cl->lb = &cam->lb;
+    }
+
+    // Send the session header (format and filename) to server
+    struct cam_session session;
+    CLEAR(session);
+    session.width = src->width;
+    session.height = src->height;
+    session.pixelformat = src->pixelformat;
+    session.fps_num = src->fps_num;
+    session.fps_den = src->fps_den;
+    // Until stopped: the server may keep it in a bounded ring (Cserver -r)
+    if(o->num_frame < 0) session.flags = CAM_SESSION_CONTINUOUS;
+    // Cameras of one client get a recording each
+    char cam_suffix[16] = "";
+    if(o->n_cams > 1) snprintf(cam_suffix, sizeof(cam_suffix), "_cam%u", id);
+    if(!strcmp(src->name, "v4l2"))
+        snprintf(session.filename, sizeof(session.filename), "Webcam_%u_%u_%d%s.mjpeg", session.width, session.height, o->num_frame, cam_suffix);
+    else // Synthetic clients often run side by side: keep their recordings apart
+        snprintf(session.filename, sizeof(session.filename), "%s_%u_%u_%d_%d%s.mjpeg", src->name, session.width, session.height,
+            o->num_frame, (int)getpid(), cam_suffix);
+    cl->trace_stream = cam_trace_stream(session.filename);
+    cl->verbose = o->verbose;
+
+    uint8_t session_hdr[CAM_SESSION_HDR_LEN];
+    cam_pack_session(session_hdr, &session);
+    if(cl->udp){
+        if(udp_send_session(&cam->us, session_hdr) == -1) errno_exit("Session_send");
+    }
+    else send_all(socket_ds, session_hdr, sizeof(session_hdr), 0);
+    printf("%sFilename %s sent to %s:%d\n", cl->tag, session.filename, inet_ntoa(sin.sin_addr), o->port);
+
+    // Start the sender thread: keep at least one buffer with the source
+    unsigned int ring_depth = o->ring_depth;
+    cl->src = src;
+    cl->socket_ds = socket_ds;
+    if(!(cl->buffers = calloc(src->n_buffers, sizeof(*cl->buffers)))) errno_exit("Out of memory");
+    cl->n_buffers = src->n_buffers;
+    if(ring_depth < 1) ring_depth = 1;
+    if(ring_depth > src->n_buffers - 1) ring_depth = src->n_buffers - 1;
+    spsc_init(&cl->tx_ring, ring_depth);
+    spsc_init(&cl->ret_ring, src->n_buffers);
+    if((cl->tx_event = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) == -1) errno_exit("Eventfd");
+    if((cl->ret_event = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) == -1) errno_exit("Eventfd");
+    if((errno = pthread_create(&cam->sender, NULL, sender_thread, cl))) errno_exit("Pthread_create");
+}
+
+// Capture epoll events: camera index << 1, low bit set for its ret_event
+#define EV_SOURCE(c) ((uint64_t)(c) << 1)
+#define EV_RETURN(c) ((uint64_t)(c) << 1 | 1)
+#define EV_SIGNAL UINT64_MAX        // SIGUSR1: stage latencies since the start
+#define EV_STATS (UINT64_MAX - 1)   // Periodic stage summary (-i)
+
+// Function to add or remove a camera's source in the capture epoll set
+static void watch_source(int epoll_ds, struct camera* cam, unsigned int id, int on){
+    struct epoll_event ev;
+    CLEAR(ev);
+    ev.events = EPOLLIN;
+    ev.data.u64 = EV_SOURCE(id);
+    if(epoll_ctl(epoll_ds, on ? EPOLL_CTL_ADD : EPOLL_CTL_DEL, cam->src.fd, &ev) == -1) errno_exit("Epoll_ctl");
+    cam->paused = !on;
+}
+
+// Function to take a camera out of the capture loop: its sender drains the queue and exits
+static void finish_camera(int epoll_ds, struct camera* cam, unsigned int id){
+    if(!cam->paused) watch_source(epoll_ds, cam, id, 0);
+    atomic_store(&cam->cl.stop, 1);
+    notify(cam->cl.tx_event);
+}
+
+// Function to wait for a camera's sender, report its statistics and release it
+static void stop_camera(struct camera* cam, const struct client_opts* o){
+    struct client* cl = &cam->cl;
+    pthread_join(cam->sender, NULL);
+    if(cl->udp) udp_send_end(&cam->us);
+
+    printf("%sFrames sent: %llu, dropped (oldest): %llu, dropped (newest): %llu, capture waits: %llu, source drops: %llu\n",
+        cl->tag, (unsigned long long)cl->sent, (unsigned long long)cl->dropped_oldest, (unsigned long long)cl->dropped_newest,
+        (unsigned long long)cl->blocked, cl->driver_gaps);
+    if(cl->zerocopy)
+        printf("%sZero-copy sends: %llu, copied by the kernel: %llu\n", cl->tag, (unsigned long long)cl->zc.sends, (unsigned long long)cl->zc.copied);
+    if(cl->udp)
+        printf("%sUDP: datagrams sent: %llu, refused: %llu, frames too large: %llu\n", cl->tag, cam->us.datagrams, cam->us.errors, cam->us.too_big);
+    if(cl->lb)
+        printf("%sLatency bound %.0f ms: stale drops: %llu, frame rate changes: %llu, source fps: %.2f, link %.2f MB/s\n",
+            cl->tag, o->latency_ms, cam->lb.stale, cam->lb.fps_changes, cam->src.fps_num ? (double)cam->src.fps_num / cam->src.fps_den : 0,
+            cam->lb.rate / 1e6);
+    struct motion_gate* m = cl->motion;
+    if(m && m->frames){
+        printf("%sMotion gate: %llu of %llu frames suppressed (%.1f%%), keep-alives: %llu, undecodable: %llu, check time avg %.0f us, max %.0f us\n",
+            cl->tag, m->suppressed, m->frames, 100.0 * m->suppressed / m->frames, m->keepalives, m->errors,
+            m->time_ns / 1e3 / m->frames, m->max_time_ns / 1e3);
+    }
+
+    // Stop capturing the frames and release the source
+    source_close(&cam->src);
+    free(cl->buffers);
+    if(m) motion_close(m);
+    print_stages(cl, 0);
+
     // Close the socket
-    if(close(socket_ds)==-1)  errno_exit("Socket_close");
+    if(close(cl->socket_ds)==-1)  errno_exit("Socket_close");
+    close(cl->tx_event);
+    close(cl->ret_event);
+}
+
+int main(int argc, char** argv){
+    struct client_opts o;
+    CLEAR(o);
+    o.ring_depth = RING_DEPTH;
+    o.width = FRAME_WIDTH;
+    o.height = FRAME_HEIGHT;
+    o.fps = 30;
+    o.motion.threshold = -1;
+    o.motion.min_area = MOTION_AREA / 100;
+    o.motion.keepalive_us = MOTION_KEEPALIVE * 1000000ull;
+    o.mtu = UDP_MTU;
+    const char* sources[MAX_CAMERAS];
+
+    if(argc < 3) usage();
+    sscanf(argv[1], "%d", &o.port);
+    sscanf(argv[2], "%d", &o.num_frame);
+
+    int opt;
+    optind = 3;
+    while((opt = getopt(argc, argv, "s:r:f:S:lzP:q:m:A:K:M:L:UR:T:i:t:pv")) != -1){
+        switch(opt){
+        case 's':
+            if(o.n_cams == MAX_CAMERAS) usage();
+            sources[o.n_cams++] = optarg;
+            break;
+        case 'r': if(sscanf(optarg, "%ux%u", &o.width, &o.height) != 2 || !o.width || !o.height) usage(); break;
+        case 'f': o.fps = atof(optarg); break;
+        case 'S': o.frame_size = strtoull(optarg, NULL, 10); break;
+        case 'l': o.loop = 1; break;
+        case 'z': o.zerocopy = 1; break;
+        case 'P':
+            if(!strcmp(optarg, "block")) o.policy = DROP_BLOCK;
+            else if(!strcmp(optarg, "oldest")) o.policy = DROP_OLDEST;
+            else if(!strcmp(optarg, "newest")) o.policy = DROP_NEWEST;
+            else usage();
+            break;
+        case 'q': o.ring_depth = atoi(optarg); break;
+        case 'm': o.motion.threshold = atoi(optarg); break;
+        case 'A': o.motion.min_area = atof(optarg) / 100; break;
+        case 'K': o.motion.keepalive_us = atof(optarg) * 1e6; break;
+        case 'M': if(motion_add_region(&o.motion, optarg) == -1) usage(); break;
+        case 'L': o.latency_ms = atof(optarg); break;
+        case 'U': o.udp = 1; break;
+        case 'R': o.pacing_mbit = atof(optarg); break;
+        case 'T': o.mtu = atoi(optarg); break;
+        case 'i': o.stats_interval = atof(optarg); break;
+        case 't': o.trace = optarg; break;
+        case 'v': o.verbose = 1; break;
+#ifdef HAVE_SDL
+        case 'p': o.preview = 1; break;
+#else
+        case 'p': fprintf(stderr, "-p: built without SDL2 (make SDL=1)\n"); exit(EXIT_FAILURE);
+#endif
+        default: usage();
+        }
+    }
+    if(!o.n_cams) sources[o.n_cams++] = "v4l2";
+
+    // SIGUSR1 dumps the stage latencies: blocked before the sender threads start, read from a signalfd.
+    // When tracing, SIGINT/SIGTERM stop the capture instead of killing the client, so the trace gets written.
+    sigset_t sigs;
+    sigemptyset(&sigs);
+    sigaddset(&sigs, SIGUSR1);
+    if(o.trace){
+        if(cam_trace_open(o.trace, "Cclient") == -1) errno_exit(o.trace);
+        cam_trace_thread("capture");
+        sigaddset(&sigs, SIGINT);
+        sigaddset(&sigs, SIGTERM);
+    }
+    if(sigprocmask(SIG_BLOCK, &sigs, NULL) == -1) errno_exit("Sigprocmask");
+    int signal_ds = signalfd(-1, &sigs, SFD_NONBLOCK | SFD_CLOEXEC);
+    if(signal_ds == -1) errno_exit("Signalfd");
+
+    struct camera* cams = calloc(o.n_cams, sizeof(*cams));
+    if(!cams) errno_exit("Out of memory");
+    for(unsigned int c = 0; c < o.n_cams; c++){
+        cams[c].spec = sources[c];
+        start_camera(&cams[c], c, &o);
+    }
+
+    // Preview of the first camera, on its own thread
+#ifdef HAVE_SDL
+    struct preview preview;
+    if(o.preview){
+        if(preview_start(&preview, cams[0].src.width, cams[0].src.height) == -1) errno_exit("Preview");
+        cams[0].cl.preview = &preview;
+    }
+#endif
+
+    // One event loop captures from every camera: a source fd is readable when a frame
+    // may be ready, a ret_event when its sender has buffers to give back
+    int epoll_ds = epoll_create1(EPOLL_CLOEXEC);
+    if(epoll_ds == -1) errno_exit("Epoll_create");
+    for(unsigned int c = 0; c < o.n_cams; c++){
+        struct epoll_event ev;
+        CLEAR(ev);
+        ev.events = EPOLLIN;
+        ev.data.u64 = EV_RETURN(c);
+        if(epoll_ctl(epoll_ds, EPOLL_CTL_ADD, cams[c].cl.ret_event, &ev) == -1) errno_exit("Epoll_ctl");
+        watch_source(epoll_ds, &cams[c], c, 1);
+    }
+    struct epoll_event ev;
+    CLEAR(ev);
+    ev.events = EPOLLIN;
+    ev.data.u64 = EV_SIGNAL;
+    if(epoll_ctl(epoll_ds, EPOLL_CTL_ADD, signal_ds, &ev) == -1) errno_exit("Epoll_ctl");
+    int stats_ds = -1;
+    uint64_t stats_us = now_us();
+    if(o.stats_interval > 0){
+        uint64_t ns = o.stats_interval * 1e9;
+        struct itimerspec its = {.it_interval = {ns / 1000000000, ns % 1000000000}, .it_value = {ns / 1000000000, ns % 1000000000}};
+        if((stats_ds = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC)) == -1) errno_exit("Timerfd_create");
+        if(timerfd_settime(stats_ds, 0, &its, NULL) == -1) errno_exit("Timerfd_settime");
+        ev.data.u64 = EV_STATS;
+        if(epoll_ctl(epoll_ds, EPOLL_CTL_ADD, stats_ds, &ev) == -1) errno_exit("Epoll_ctl");
+    }
+
+    // Catch the <num_frame> frames required from each camera and hand them to its sender thread
+    // if <num_frame>=-1 --> acquire frames until the client is stopped (or the recording ends)
+    unsigned int count = o.num_frame; // = UINT_MAX = 4294967295
+    unsigned int running = o.n_cams;
+    struct epoll_event events[CAPTURE_EVENTS];
+    while(running){
+        int n_events = epoll_wait(epoll_ds, events, CAPTURE_EVENTS, 5000);
+        if(n_events == -1){
+            if(errno == EINTR) continue;
+            errno_exit("Epoll_wait");
+        }
+        uint64_t wake = cam_trace_begin();
+
+        for(int e = 0; e < n_events; e++){
+            if(events[e].data.u64 == EV_SIGNAL){
+                struct signalfd_siginfo si;
+                CLEAR(si);
+                if(read(signal_ds, &si, sizeof(si)) == -1 && errno != EAGAIN) errno_exit("Signalfd_read");
+                if(si.ssi_signo == SIGUSR1){
+                    for(unsigned int c = 0; c < o.n_cams; c++) print_stages(&cams[c].cl, 0);
+                    continue;
+                }
+                // Stop every camera as if its last frame was reached
+                printf("Stopping the capture\n");
+                for(unsigned int c = 0; c < o.n_cams; c++){
+                    if(cams[c].done) continue;
+                    cams[c].done = 1;
+                    if(cams[c].cl.held) continue;   // Finished once its held frame reaches the sender
+                    finish_camera(epoll_ds, &cams[c], c);
+                    running--;
+                }
+                continue;
+            }
+            if(events[e].data.u64 == EV_STATS){
+                uint64_t expirations, now = now_us();
+                if(read(stats_ds, &expirations, sizeof(expirations)) == -1 && errno != EAGAIN) errno_exit("Timerfd_read");
+                for(unsigned int c = 0; c < o.n_cams; c++) if(!cams[c].done) print_stages(&cams[c].cl, (now - stats_us) / 1e6);
+                stats_us = now;
+                continue;
+            }
+            unsigned int id = events[e].data.u64 >> 1;
+            struct camera* cam = &cams[id];
+            struct client* cl = &cam->cl;
+
+            if(events[e].data.u64 & 1){
+                // Give the sent buffers back to the source, then retry the held frame
+                requeue_returned(cl);
+                if(cl->held && push_held(cl)){
+                    if(!cam->done) watch_source(epoll_ds, cam, id, 1);
+                    else{
+                        finish_camera(epoll_ds, cam, id);
+                        running--;
+                    }
+                }
+                continue;
+            }
+            if(cam->done || cam->paused) continue;
+
+            // Taking the frame and passing it to the sender (and the preview)
+            int got = process_frame(cl);
+            if(got == -1 || (cam->captured += got) >= count){
+                // A held frame still has to reach the sender before it may stop
+                cam->done = 1;
+                if(cl->held) watch_source(epoll_ds, cam, id, 0);
+                else{
+                    finish_camera(epoll_ds, cam, id);
+                    running--;
+                }
+                continue;
+            }
+            // DROP_BLOCK: leave the source to the driver until the sender catches up
+            if(cl->held) watch_source(epoll_ds, cam, id, 0);
+            if(cl->lb) apply_fps(cl);
+        }
+        cam_trace_span("wake", wake, 0, -1);
+    }
+
+    // Let the senders drain their queues (and zero-copy completions)
+    for(unsigned int c = 0; c < o.n_cams; c++) stop_camera(&cams[c], &o);
+#ifdef HAVE_SDL
+    if(o.preview){
+        preview_stop(&preview);
+        printf("Preview: %llu of %llu frames shown, %llu replaced by a newer frame, undecodable: %llu, decode+present avg %.0f us\n",
+            preview.shown, preview.published, preview.skipped, preview.errors, preview.shown ? preview.present_ns / 1e3 / preview.shown : 0);
+    }
+#endif
+    close(epoll_ds);
+    close(signal_ds);
+    if(stats_ds != -1) close(stats_ds);
+    free(cams);
 
     return EXIT_SUCCESS;
 }
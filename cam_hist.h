@@ -0,0 +1,105 @@
+#ifndef CAM_HIST_H
+#define CAM_HIST_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+/*
+ * Log-linear histogram of 64-bit values (e.g. latencies in microseconds).
+ *
+ * Values below CAM_HIST_SUB are counted exactly; above, every power of two is
+ * split into CAM_HIST_SUB buckets, so a percentile is off by at most 1/32 (~3%)
+ * whatever the magnitude. Adding a value is a few instructions, with no allocation.
+ *
+ * Across threads, one writer uses cam_hist_add_atomic() while any thread takes
+ * consistent-enough copies with cam_hist_snapshot(): no lock, relaxed atomics only.
+ */
+
+#define CAM_HIST_SUB_BITS 5
+#define CAM_HIST_SUB (1 << CAM_HIST_SUB_BITS)
+#define CAM_HIST_BUCKETS ((64 - CAM_HIST_SUB_BITS + 1) * CAM_HIST_SUB)
+
+struct cam_hist{
+    uint64_t count;
+    uint64_t max;
+    uint64_t buckets[CAM_HIST_BUCKETS];
+};
+
+static inline void cam_hist_init(struct cam_hist* h){
+    memset(h, 0, sizeof(*h));
+}
+
+static inline unsigned int cam_hist_index(uint64_t v){
+    if(v < CAM_HIST_SUB) return v;
+    unsigned int e = 63 - __builtin_clzll(v);
+    return (e - CAM_HIST_SUB_BITS + 1) * CAM_HIST_SUB + ((v >> (e - CAM_HIST_SUB_BITS)) & (CAM_HIST_SUB - 1));
+}
+
+// Function to get the largest value counted in bucket <i>
+static inline uint64_t cam_hist_bucket_max(unsigned int i){
+    if(i < CAM_HIST_SUB) return i;
+    unsigned int shift = i / CAM_HIST_SUB - 1;
+    return ((uint64_t)(CAM_HIST_SUB + i % CAM_HIST_SUB) << shift) + ((1ull << shift) - 1);
+}
+
+static inline void cam_hist_add(struct cam_hist* h, uint64_t v){
+    h->buckets[cam_hist_index(v)]++;
+    h->count++;
+    if(v > h->max) h->max = v;
+}
+
+// Function to add a value while other threads may take snapshots (single writer)
+static inline void cam_hist_add_atomic(struct cam_hist* h, uint64_t v){
+    __atomic_fetch_add(&h->buckets[cam_hist_index(v)], 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&h->count, 1, __ATOMIC_RELAXED);
+    if(v > __atomic_load_n(&h->max, __ATOMIC_RELAXED)) __atomic_store_n(&h->max, v, __ATOMIC_RELAXED);
+}
+
+// Function to copy a histogram that another thread is adding to
+static inline void cam_hist_snapshot(struct cam_hist* dst, const struct cam_hist* src){
+    uint64_t count = 0;
+    for(unsigned int i = 0; i < CAM_HIST_BUCKETS; i++) count += dst->buckets[i] = __atomic_load_n(&src->buckets[i], __ATOMIC_RELAXED);
+    dst->count = count;     // Sum of the buckets read, so that percentiles stay consistent
+    dst->max = __atomic_load_n(&src->max, __ATOMIC_RELAXED);
+}
+
+// Function to get the samples of <cur> added since the snapshot <prev> (max: upper bound of the top bucket)
+static inline void cam_hist_since(struct cam_hist* dst, const struct cam_hist* cur, const struct cam_hist* prev){
+    dst->count = dst->max = 0;
+    for(unsigned int i = 0; i < CAM_HIST_BUCKETS; i++){
+        dst->buckets[i] = cur->buckets[i] - prev->buckets[i];
+        dst->count += dst->buckets[i];
+        if(dst->buckets[i]) dst->max = cam_hist_bucket_max(i);
+    }
+    if(dst->max > cur->max) dst->max = cur->max;
+}
+
+static inline void cam_hist_merge(struct cam_hist* dst, const struct cam_hist* src){
+    for(unsigned int i = 0; i < CAM_HIST_BUCKETS; i++) dst->buckets[i] += src->buckets[i];
+    dst->count += src->count;
+    if(src->max > dst->max) dst->max = src->max;
+}
+
+// Function to get the value below which a fraction <q> (0..1) of the samples fall: 0 if empty
+static inline uint64_t cam_hist_percentile(const struct cam_hist* h, double q){
+    if(!h->count) return 0;
+    uint64_t rank = (uint64_t)(q * h->count + 0.5), seen = 0;
+    if(rank < 1) rank = 1;
+    for(unsigned int i = 0; i < CAM_HIST_BUCKETS; i++){
+        seen += h->buckets[i];
+        if(seen >= rank){
+            uint64_t v = cam_hist_bucket_max(i);
+            return v < h->max ? v : h->max;
+        }
+    }
+    return h->max;
+}
+
+// Function to format "p50/p99/max" into <out>
+static inline void cam_hist_format(char* out, size_t size, const struct cam_hist* h){
+    snprintf(out, size, "%llu/%llu/%llu", (unsigned long long)cam_hist_percentile(h, 0.5),
+        (unsigned long long)cam_hist_percentile(h, 0.99), (unsigned long long)h->max);
+}
+
+#endif
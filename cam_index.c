@@ -0,0 +1,526 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/sendfile.h>
+
+#include "cam_index.h"
+#include "cam_mkv.h"
+#include "cam_ring.h"
+#include "conv_split.h"
+#include "mjpeg_scan.h"
+
+#pragma region DEF_CONST
+
+#define MAX_FILE_LEN 512    // Maximum length for filename
+#define MAX_THREADS 64      // Max scanning threads for "build"
+#define MIN_CHUNK (4 << 20) // Smallest share of the recording worth a thread
+#define MARK_BATCH 4096     // Markers returned by one mjpeg_scan() call
+
+// Macro to clear struct memory
+#define CLEAR(x) memset(&(x), 0, sizeof(x))
+
+// Function to handle errors and exit
+static void errno_exit(const char* s){
+    fprintf(stderr, "%s error %d, %s\n", s, errno, strerror(errno));
+    exit(EXIT_FAILURE);
+}
+
+static double now_sec(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+#pragma endregion
+
+#pragma region INDEX
+
+// Opened index of a recording
+struct index{
+    int fd;
+    struct cam_index_info info;
+    uint64_t frames;
+};
+
+// Function to open the index of a recording
+static void open_index(const char* recording, struct index* idx){
+    char path[MAX_FILE_LEN + 8];
+    uint8_t hdr[CAM_INDEX_HDR_LEN];
+    struct stat st;
+    if(cam_index_path(recording, path, sizeof(path)) == -1){
+        fprintf(stderr, "Filename too long: %s\n", recording);
+        exit(EXIT_FAILURE);
+    }
+    if((idx->fd = open(path, O_RDONLY)) == -1){
+        fprintf(stderr, "No index for %s (%s): rebuild it with ./Cindex build %s\n", recording, strerror(errno), recording);
+        exit(EXIT_FAILURE);
+    }
+    if(pread(idx->fd, hdr, sizeof(hdr), 0) != sizeof(hdr) || cam_unpack_index_header(hdr, &idx->info) == -1){
+        fprintf(stderr, "Invalid index %s\n", path);
+        exit(EXIT_FAILURE);
+    }
+    if(fstat(idx->fd, &st) == -1) errno_exit("Fstat");
+    idx->frames = (st.st_size - CAM_INDEX_HDR_LEN) / idx->info.entry_len;
+}
+
+// Function to read the entry of frame <k>: a single read, wherever the frame is
+static void read_entry(const struct index* idx, uint64_t k, struct cam_index_entry* e){
+    uint8_t buf[CAM_INDEX_ENTRY_LEN];
+    if(pread(idx->fd, buf, sizeof(buf), CAM_INDEX_HDR_LEN + k * idx->info.entry_len) != sizeof(buf)) errno_exit("Index_read");
+    cam_unpack_index_entry(buf, e);
+}
+
+// Function to resolve a frame argument: a frame number, or @<seconds> from the first frame
+static uint64_t parse_frame(const struct index* idx, const char* arg){
+    uint64_t k;
+    if(arg[0] == '@'){
+        if(idx->info.flags & CAM_INDEX_REBUILT){
+            fprintf(stderr, "Rebuilt index without timestamps: select frames by number\n");
+            exit(EXIT_FAILURE);
+        }
+        if(!idx->frames){
+            fprintf(stderr, "Empty index: no frame at %s\n", arg);
+            exit(EXIT_FAILURE);
+        }
+        struct cam_index_entry e;
+        read_entry(idx, 0, &e);
+        uint64_t target = e.timestamp_us + (uint64_t)(atof(arg + 1) * 1e6);
+        // First frame captured at or after the target: timestamps only grow
+        uint64_t lo = 0, hi = idx->frames;
+        while(lo < hi){
+            uint64_t mid = lo + (hi - lo) / 2;
+            read_entry(idx, mid, &e);
+            if(e.timestamp_us < target) lo = mid + 1;
+            else hi = mid;
+        }
+        k = lo;
+    }
+    else k = strtoull(arg, NULL, 0);
+
+    if(k >= idx->frames){
+        fprintf(stderr, "Frame %s out of range (%llu frames)\n", arg, (unsigned long long)idx->frames);
+        exit(EXIT_FAILURE);
+    }
+    return k;
+}
+
+// Function to copy <len> bytes of a recording from <off> to an output, in the kernel
+static void copy_range(int in_ds, uint64_t off, int out_ds, uint64_t len){
+    off_t pos = off;
+    while(len){
+        ssize_t n = sendfile(out_ds, in_ds, &pos, len);
+        if(n == -1){
+            if(errno == EINTR) continue;
+            errno_exit("Sendfile");
+        }
+        if(!n){
+            fprintf(stderr, "Recording shorter than its index\n");
+            exit(EXIT_FAILURE);
+        }
+        len -= n;
+    }
+}
+
+#pragma endregion
+
+#pragma region BUILD
+
+// Share of the recording scanned by one thread
+struct scan_job{
+    pthread_t tid;
+    const uint8_t* map;
+    uint64_t start, end;        // Chunk, plus the byte completing a marker at its end
+    struct mjpeg_mark* marks;
+    size_t n_marks, cap;
+    int error;
+};
+
+// Thread: finds the markers of one chunk. Chunks overlap by one byte, so a marker split
+// across two chunks is reported once, by the chunk holding its 0xFF.
+static void* scan_chunk(void* arg){
+    struct scan_job* j = arg;
+    struct mjpeg_scanner scan;
+    mjpeg_scan_init(&scan);
+    scan.offset = j->start;
+
+    for(uint64_t pos = j->start; pos < j->end;){
+        if(j->cap - j->n_marks < MARK_BATCH){
+            size_t cap = 2 * j->cap + MARK_BATCH;
+            struct mjpeg_mark* marks = realloc(j->marks, cap * sizeof(*marks));
+            if(!marks){
+                j->error = ENOMEM;
+                return NULL;
+            }
+            j->marks = marks;
+            j->cap = cap;
+        }
+        size_t consumed;
+        j->n_marks += mjpeg_scan(&scan, j->map + pos, j->end - pos, j->marks + j->n_marks, MARK_BATCH, &consumed);
+        pos += consumed;
+    }
+    return NULL;
+}
+
+// Function to take the resolution from a frame's SOF header
+static void frame_size(const uint8_t* f, uint32_t len, struct cam_index_info* info){
+    for(uint32_t i = 2; i + 9 < len && f[i] == 0xFF; i += 2 + (f[i+2] << 8 | f[i+3])){
+        if(f[i+1] >= 0xC0 && f[i+1] <= 0xC2){
+            info->height = f[i+5] << 8 | f[i+6];
+            info->width = f[i+7] << 8 | f[i+8];
+            return;
+        }
+    }
+}
+
+// Function to rebuild the index of a recording: the scan is split between threads,
+// then the markers are paired in order, each frame running from an SOI to the next EOI
+static void build(const char* recording, int threads){
+    char path[MAX_FILE_LEN + 8], tmp[MAX_FILE_LEN + 16];
+    if(cam_index_path(recording, path, sizeof(path)) == -1){
+        fprintf(stderr, "Filename too long: %s\n", recording);
+        exit(EXIT_FAILURE);
+    }
+    snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+
+    int fd = open(recording, O_RDONLY);
+    if(fd == -1) errno_exit(recording);
+    struct stat st;
+    if(fstat(fd, &st) == -1) errno_exit("Fstat");
+    uint64_t len = st.st_size;
+    const uint8_t* map = len ? mmap(NULL, len, PROT_READ, MAP_SHARED, fd, 0) : NULL;
+    if(map == MAP_FAILED) errno_exit("mmap");
+    close(fd);
+
+    double t0 = now_sec();
+    if(threads < 1) threads = 1;
+    if(threads > MAX_THREADS) threads = MAX_THREADS;
+    if((uint64_t)threads > len / MIN_CHUNK) threads = len / MIN_CHUNK ? len / MIN_CHUNK : 1;
+    struct scan_job jobs[MAX_THREADS];
+    // Pick the scan kernel here: left to the first scan, the threads would race to set it
+    mjpeg_scan_set_impl(MJPEG_SCAN_AUTO);
+    for(int i = 0; i < threads; i++){
+        CLEAR(jobs[i]);
+        jobs[i].map = map;
+        jobs[i].start = len * i / threads;
+        jobs[i].end = len * (i + 1) / threads + 1;
+        if(jobs[i].end > len) jobs[i].end = len;
+        if((errno = pthread_create(&jobs[i].tid, NULL, scan_chunk, &jobs[i]))) errno_exit("Pthread_create");
+    }
+    for(int i = 0; i < threads; i++){
+        pthread_join(jobs[i].tid, NULL);
+        if((errno = jobs[i].error)) errno_exit("Scan");
+    }
+    double t1 = now_sec();
+
+    // Written aside and renamed, so that readers never see a partial index
+    FILE* out = fopen(tmp, "w");
+    if(!out) errno_exit(tmp);
+    setvbuf(out, NULL, _IOFBF, 1 << 20);
+    struct cam_index_info info = {.flags = CAM_INDEX_REBUILT};
+    uint8_t hdr[CAM_INDEX_HDR_LEN], entry[CAM_INDEX_ENTRY_LEN];
+    if(fwrite(hdr, sizeof(hdr), 1, out) != 1) errno_exit("Index_write");
+
+    uint64_t frames = 0;
+    int64_t start = -1;
+    for(int i = 0; i < threads; i++){
+        for(size_t m = 0; m < jobs[i].n_marks; m++){
+            const struct mjpeg_mark* mark = &jobs[i].marks[m];
+            if(mark->type == MJPEG_SOI){
+                start = mark->offset;
+                continue;
+            }
+            if(start < 0) continue;
+            struct cam_index_entry e = {.offset = start, .length = mark->offset + 2 - start};
+            if(!frames++) frame_size(map + e.offset, e.length, &info);
+            cam_pack_index_entry(entry, &e);
+            if(fwrite(entry, sizeof(entry), 1, out) != 1) errno_exit("Index_write");
+            start = -1;
+        }
+        free(jobs[i].marks);
+    }
+    cam_pack_index_header(hdr, &info);
+    if(fseek(out, 0, SEEK_SET) == -1 || fwrite(hdr, sizeof(hdr), 1, out) != 1) errno_exit("Index_write");
+    if(fclose(out) == EOF) errno_exit("Index_close");
+    if(rename(tmp, path) == -1) errno_exit("Rename");
+    if(map) munmap((void*)map, len);
+
+    double t2 = now_sec();
+    printf("%s: %llu frames, %ux%u, %.1f MB scanned in %.1f ms (%d thread(s), %s, %.2f GB/s), index %s written in %.1f ms\n",
+        recording, (unsigned long long)frames, info.width, info.height, len / 1e6, (t1 - t0) * 1e3, threads,
+        mjpeg_scan_impl_name(), (t1 > t0 ? len / (t1 - t0) : 0) / 1e9, path, (t2 - t1) * 1e3);
+}
+
+#pragma endregion
+
+#pragma region COMMANDS
+
+// Function to print the index summary of a recording
+static void info(const char* recording){
+    struct index idx;
+    open_index(recording, &idx);
+    printf("%s: %llu frames, %ux%u", recording, (unsigned long long)idx.frames, idx.info.width, idx.info.height);
+    if(idx.info.fps_den) printf(" @ %u/%u fps", idx.info.fps_num, idx.info.fps_den);
+    if(idx.frames){
+        struct cam_index_entry first, last;
+        read_entry(&idx, 0, &first);
+        read_entry(&idx, idx.frames - 1, &last);
+        uint64_t bytes = last.offset + last.length - first.offset;
+        printf(", %.1f MB, %.1f KB/frame", bytes / 1e6, bytes / 1e3 / idx.frames);
+        if(!(idx.info.flags & CAM_INDEX_REBUILT) && last.timestamp_us > first.timestamp_us){
+            double seconds = (last.timestamp_us - first.timestamp_us) / 1e6;
+            printf(", %.1f s captured (%.2f fps)", seconds, (idx.frames - 1) / seconds);
+        }
+    }
+    printf("%s\n", idx.info.flags & CAM_INDEX_REBUILT ? " (rebuilt, no timestamps)" : "");
+    close(idx.fd);
+}
+
+// Function to extract one frame as a JPEG file (or to stdout)
+static void get(const char* recording, const char* frame, const char* output){
+    struct index idx;
+    struct cam_index_entry e;
+    open_index(recording, &idx);
+    uint64_t k = parse_frame(&idx, frame);
+    read_entry(&idx, k, &e);
+
+    int in_ds = open(recording, O_RDONLY);
+    if(in_ds == -1) errno_exit(recording);
+    int out_ds = output ? open(output, O_WRONLY | O_CREAT | O_TRUNC, 0644) : STDOUT_FILENO;
+    if(out_ds == -1) errno_exit(output);
+    copy_range(in_ds, e.offset, out_ds, e.length);
+    fprintf(stderr, "Frame %llu: offset %llu, %u bytes, captured at %llu us\n", (unsigned long long)k,
+        (unsigned long long)e.offset, e.length, (unsigned long long)e.timestamp_us);
+    close(in_ds);
+    if(output) close(out_ds);
+    close(idx.fd);
+}
+
+// Function to copy frames <first> to <last> (included) to a new recording, with its index
+static void clip(const char* recording, const char* first_arg, const char* last_arg, const char* output){
+    struct index idx;
+    struct cam_index_entry first, last, e;
+    open_index(recording, &idx);
+    uint64_t k0 = parse_frame(&idx, first_arg), k1 = parse_frame(&idx, last_arg);
+    if(k1 < k0){
+        fprintf(stderr, "Clip ends before it starts\n");
+        exit(EXIT_FAILURE);
+    }
+    read_entry(&idx, k0, &first);
+    read_entry(&idx, k1, &last);
+
+    // The frames are contiguous in the recording: one copy
+    int in_ds = open(recording, O_RDONLY);
+    if(in_ds == -1) errno_exit(recording);
+    int out_ds = open(output, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if(out_ds == -1) errno_exit(output);
+    uint64_t bytes = last.offset + last.length - first.offset;
+    copy_range(in_ds, first.offset, out_ds, bytes);
+    close(out_ds);
+    close(in_ds);
+
+    // Same entries, offsets relative to the clip
+    char path[MAX_FILE_LEN + 8];
+    uint8_t hdr[CAM_INDEX_HDR_LEN], entry[CAM_INDEX_ENTRY_LEN];
+    if(cam_index_path(output, path, sizeof(path)) == -1) errno_exit("Clip_index");
+    FILE* out = fopen(path, "w");
+    if(!out) errno_exit(path);
+    cam_pack_index_header(hdr, &idx.info);
+    if(fwrite(hdr, sizeof(hdr), 1, out) != 1) errno_exit("Index_write");
+    for(uint64_t k = k0; k <= k1; k++){
+        read_entry(&idx, k, &e);
+        e.offset -= first.offset;
+        cam_pack_index_entry(entry, &e);
+        if(fwrite(entry, sizeof(entry), 1, out) != 1) errno_exit("Index_write");
+    }
+    if(fclose(out) == EOF) errno_exit("Index_close");
+    close(idx.fd);
+    printf("%s: frames %llu-%llu (%llu frames, %.1f MB)\n", output, (unsigned long long)k0, (unsigned long long)k1,
+        (unsigned long long)(k1 - k0 + 1), bytes / 1e6);
+}
+
+// Function to remux a recording to Matroska, timed by its index
+static void mkv(const char* recording, const char* output){
+    struct mkv_stats st;
+    const char* step;
+    struct timespec t0, t1;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    if(mkv_remux(recording, output, &st, &step) == -1){
+        if(!strcmp(step, "Index")) fprintf(stderr, "No valid index for %s: rebuild it with ./Cindex build\n", recording);
+        errno_exit(step);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    double s = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+    printf("%s: %llu frames, %.1f s%s, %.1f MB in %.3f s (%.0f MB/s)\n", output, (unsigned long long)st.frames,
+        st.seconds, st.timed ? "" : " (nominal frame rate: no timestamps in the index)", st.bytes / 1e6, s, st.bytes / 1e6 / s);
+}
+
+// Function to transcode a recording to H.264 MP4 in segments, <cores> encoders at a time
+static void mp4(const char* recording, const char* output, int cores){
+    struct split_stats st;
+    const char* step;
+    struct timespec t0, t1;
+    sem_t sem;
+    if(sem_init(&sem, 0, cores) == -1) errno_exit("Semaphore");
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    int status = split_transcode(recording, output, cores, &sem, 0, &st, &step);
+    if(status > 0){
+        fprintf(stderr, "%s: ffmpeg exit status %d\n", step, status);
+        exit(EXIT_FAILURE);
+    }
+    if(status == -1){
+        if(!strcmp(step, "Index")) fprintf(stderr, "No valid index for %s: rebuild it with ./Cindex build\n", recording);
+        errno_exit(step);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    double s = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+    printf("%s: %llu frames, %u segment(s) on %d core(s) in %.2f s (%.0f fps; segments encoded in %.2f s in total, joined in %.2f s)\n",
+        output, (unsigned long long)st.frames, st.segments, cores, s, st.frames / s, st.encode_ms / 1e3, st.concat_ms / 1e3);
+    sem_destroy(&sem);
+}
+
+// Function to format a wall clock time (us since the epoch)
+static const char* wall_time(uint64_t us, char* out, size_t len){
+    time_t t = us / 1000000;
+    struct tm tm;
+    strftime(out, len, "%Y-%m-%d %H:%M:%S", localtime_r(&t, &tm));
+    return out;
+}
+
+// Function to list the segments of a ring, <path> then its segments oldest first (with <minutes> and
+// <output>: copy the frames of the last <minutes> to a new recording, with its index)
+static void ring(const char* path, const char* minutes, const char* output){
+    static struct cam_ring_seg seg[CAM_RING_MAX_SEGMENTS];
+    uint32_t order[CAM_RING_MAX_SEGMENTS], used = 0, segments;
+    uint64_t seg_size;
+    char t0[32], t1[32], t2[32];
+    int fd = open(path, O_RDONLY);
+    if(fd == -1) errno_exit(path);
+    if(cam_ring_read(fd, &segments, &seg_size, seg) == -1) errno_exit("Ring");
+
+    // Segments in use, by sequence
+    for(uint32_t k = 0; k < segments; k++){
+        if(!seg[k].seq || !seg[k].frames) continue;
+        uint32_t i = used++;
+        for(; i && seg[order[i-1]].seq > seg[k].seq; i--) order[i] = order[i-1];
+        order[i] = k;
+    }
+    if(!output){
+        printf("%s: %u segments of %.1f MB, %u used\n", path, segments, seg_size / 1e6, used);
+        for(uint32_t i = 0; i < used; i++){
+            const struct cam_ring_seg* s = &seg[order[i]];
+            printf("  segment %3u: session %s, %s - %s, %u frames, %.1f MB, %ux%u\n", order[i],
+                wall_time(s->session, t0, sizeof(t0)), wall_time(s->first_us, t1, sizeof(t1)),
+                wall_time(s->last_us, t2, sizeof(t2)), s->frames, s->bytes / 1e6, s->width, s->height);
+        }
+        close(fd);
+        return;
+    }
+    if(!used){
+        fprintf(stderr, "%s: empty ring\n", path);
+        exit(EXIT_FAILURE);
+    }
+
+    struct stat st;
+    if(fstat(fd, &st) == -1) errno_exit("Fstat");
+    const uint8_t* map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    if(map == MAP_FAILED) errno_exit("mmap");
+    const struct cam_ring_seg* newest = &seg[order[used-1]];
+    uint64_t span_us = atof(minutes) * 60e6, cutoff = newest->last_us > span_us ? newest->last_us - span_us : 0;
+
+    // Same index as a recording of the server, timestamps on the server's wall clock
+    char idx_path[MAX_FILE_LEN + 8];
+    uint8_t hdr[CAM_INDEX_HDR_LEN], entry[CAM_INDEX_ENTRY_LEN];
+    struct cam_index_info info = {.width = newest->width, .height = newest->height, .fps_num = newest->fps_num, .fps_den = newest->fps_den};
+    FILE* out = fopen(output, "w");
+    if(!out) errno_exit(output);
+    if(cam_index_path(output, idx_path, sizeof(idx_path)) == -1) errno_exit("Clip_index");
+    FILE* idx = fopen(idx_path, "w");
+    if(!idx) errno_exit(idx_path);
+    cam_pack_index_header(hdr, &info);
+    if(fwrite(hdr, sizeof(hdr), 1, idx) != 1) errno_exit("Index_write");
+
+    uint64_t frames = 0, bytes = 0, first_us = 0, last_us = 0;
+    for(uint32_t i = 0; i < used; i++){
+        const struct cam_ring_seg* s = &seg[order[i]];
+        if(s->last_us < cutoff) continue;
+        uint64_t off = cam_ring_seg_offset(seg_size, order[i]), end = off + (s->bytes < seg_size ? s->bytes : seg_size);
+        if(end > (uint64_t)st.st_size) end = st.st_size;
+        // Frames are placed on the wall clock by their capture time, from the segment's first frame
+        uint64_t capture0 = 0;
+        struct cam_frame f;
+        for(int first = 1; off + CAM_FRAME_HDR_LEN <= end; off += CAM_FRAME_HDR_LEN + f.length, first = 0){
+            if(cam_unpack_frame(map + off, &f) == -1 || off + CAM_FRAME_HDR_LEN + f.length > end){
+                fprintf(stderr, "Segment %u: frame cut short at +%llu\n", order[i],
+                    (unsigned long long)(off - cam_ring_seg_offset(seg_size, order[i])));
+                break;
+            }
+            if(first) capture0 = f.timestamp_us;
+            uint64_t wall = s->first_us + (f.timestamp_us > capture0 ? f.timestamp_us - capture0 : 0);
+            if(wall < cutoff) continue;
+            struct cam_index_entry e = {.offset = bytes, .timestamp_us = wall, .length = f.length, .flags = f.flags};
+            cam_pack_index_entry(entry, &e);
+            if(fwrite(map + off + CAM_FRAME_HDR_LEN, 1, f.length, out) != f.length || fwrite(entry, sizeof(entry), 1, idx) != 1)
+                errno_exit("Write");
+            if(!frames++) first_us = wall;
+            last_us = wall;
+            bytes += f.length;
+        }
+    }
+    if(fclose(out) == EOF || fclose(idx) == EOF) errno_exit("Close");
+    munmap((void*)map, st.st_size);
+    close(fd);
+    printf("%s: %llu frames, %.1f MB, %s - %s\n", output, (unsigned long long)frames, bytes / 1e6,
+        wall_time(first_us, t0, sizeof(t0)), wall_time(last_us, t1, sizeof(t1)));
+}
+
+static void usage(void){
+    printf("Usage: ./Cindex build <recording.mjpeg> [threads]\n"
+           "       ./Cindex info <recording.mjpeg>\n"
+           "       ./Cindex get <recording.mjpeg> <frame> [output.jpg]\n"
+           "       ./Cindex clip <recording.mjpeg> <first> <last> <output.mjpeg>\n"
+           "       ./Cindex mkv <recording.mjpeg> <output.mkv>\n"
+           "       ./Cindex mp4 <recording.mjpeg> <output.mp4> [cores]\n"
+           "       ./Cindex ring <camera.ring> [<minutes> <output.mjpeg>]\n"
+           "  build  rebuild <recording>.idx with a parallel marker scan (default: one thread per core)\n"
+           "  info   frame count, size and duration of a recording\n"
+           "  get    extract one frame (to stdout without output file)\n"
+           "  clip   copy frames <first> to <last> (included) to a new recording, with its index\n"
+           "  mkv    remux a recording to Matroska without re-encoding, timed by its capture timestamps\n"
+           "  mp4    transcode a recording to H.264 with ffmpeg, one segment per core (default: all), joined losslessly\n"
+           "  ring   list the segments of a ring recording (Cserver -r), or copy its last <minutes> to a recording\n"
+           "  Frames are numbered from 0, or given as @<seconds> from the first frame.\n");
+    exit(0);
+}
+
+#pragma endregion
+
+int main(int argc, char** argv){
+    if(argc < 3) usage();
+    const char* cmd = argv[1];
+
+    if(!strcmp(cmd, "build")){
+        long cores = sysconf(_SC_NPROCESSORS_ONLN);
+        build(argv[2], argc > 3 ? atoi(argv[3]) : (cores > 0 ? cores : 1));
+    }
+    else if(!strcmp(cmd, "info")) info(argv[2]);
+    else if(!strcmp(cmd, "get") && argc > 3) get(argv[2], argv[3], argc > 4 ? argv[4] : NULL);
+    else if(!strcmp(cmd, "clip") && argc > 5) clip(argv[2], argv[3], argv[4], argv[5]);
+    else if(!strcmp(cmd, "mkv") && argc > 3) mkv(argv[2], argv[3]);
+    else if(!strcmp(cmd, "ring")) ring(argv[2], argc > 4 ? argv[3] : NULL, argc > 4 ? argv[4] : NULL);
+    else if(!strcmp(cmd, "mp4") && argc > 3){
+        long cores = sysconf(_SC_NPROCESSORS_ONLN);
+        int n = argc > 4 ? atoi(argv[4]) : (cores > 0 ? cores : 1);
+        mp4(argv[2], argv[3], n > 0 ? n : 1);
+    }
+    else usage();
+    return 0;
+}
@@ -0,0 +1,142 @@
+#ifndef CAM_INDEX_H
+#define CAM_INDEX_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <sys/stat.h>
+
+#include "cam_proto.h"
+
+/*
+ * Frame index of a recording, stored next to it as <recording>.idx.
+ * Every field is big-endian, as in the wire protocol.
+ *
+ * A fixed header:
+ *   magic "CIDX" | version | entry length | width | height | fps numerator |
+ *   fps denominator | flags | reserved
+ *
+ * Then one fixed-size entry per frame, in recording order:
+ *   byte offset in the recording | capture timestamp (us) | length | frame flags
+ *
+ * The frame count follows from the file size, so the index is append-only and
+ * frame k is found with a single read at CAM_INDEX_HDR_LEN + k * CAM_INDEX_ENTRY_LEN.
+ * A partially written last entry (e.g. after a crash) is ignored.
+ */
+
+#pragma region DEF_CONST
+
+#define CAM_INDEX_MAGIC     0x43494458U // "CIDX"
+#define CAM_INDEX_VERSION   1
+#define CAM_INDEX_HDR_LEN   32
+#define CAM_INDEX_ENTRY_LEN 24
+
+// Header flags
+#define CAM_INDEX_REBUILT   0x1         // Rebuilt from the recording: no timestamps
+
+// Index header, host byte order
+struct cam_index_info{
+    uint16_t version;
+    uint16_t entry_len;
+    uint32_t width;
+    uint32_t height;
+    uint32_t fps_num;
+    uint32_t fps_den;
+    uint32_t flags;
+};
+
+// Index entry, host byte order
+struct cam_index_entry{
+    uint64_t offset;        // Offset of the frame's first byte in the recording
+    uint64_t timestamp_us;  // Capture timestamp, 0 if unknown
+    uint32_t length;
+    uint32_t flags;         // Flags of the frame header
+};
+
+#pragma endregion
+
+#pragma region PACKING
+
+// Function to build the sidecar path of a recording: returns -1 if it does not fit
+static inline int cam_index_path(const char* recording, char* out, size_t len){
+    int n = snprintf(out, len, "%s.idx", recording);
+    return n < 0 || (size_t)n >= len ? -1 : 0;
+}
+
+// Function to serialize an index header into CAM_INDEX_HDR_LEN bytes
+static inline void cam_pack_index_header(uint8_t* out, const struct cam_index_info* h){
+    cam_put32(out, CAM_INDEX_MAGIC);
+    cam_put16(out + 4, CAM_INDEX_VERSION);
+    cam_put16(out + 6, CAM_INDEX_ENTRY_LEN);
+    cam_put32(out + 8, h->width);
+    cam_put32(out + 12, h->height);
+    cam_put32(out + 16, h->fps_num);
+    cam_put32(out + 20, h->fps_den);
+    cam_put32(out + 24, h->flags);
+    cam_put32(out + 28, 0);
+}
+
+// Function to deserialize an index header: returns -1 if invalid
+static inline int cam_unpack_index_header(const uint8_t* in, struct cam_index_info* h){
+    if(cam_get32(in) != CAM_INDEX_MAGIC || cam_get16(in + 4) != CAM_INDEX_VERSION) return -1;
+    h->version = cam_get16(in + 4);
+    h->entry_len = cam_get16(in + 6);
+    if(h->entry_len < CAM_INDEX_ENTRY_LEN) return -1;
+    h->width = cam_get32(in + 8);
+    h->height = cam_get32(in + 12);
+    h->fps_num = cam_get32(in + 16);
+    h->fps_den = cam_get32(in + 20);
+    h->flags = cam_get32(in + 24);
+    return 0;
+}
+
+// Function to serialize an index entry into CAM_INDEX_ENTRY_LEN bytes
+static inline void cam_pack_index_entry(uint8_t* out, const struct cam_index_entry* e){
+    cam_put64(out, e->offset);
+    cam_put64(out + 8, e->timestamp_us);
+    cam_put32(out + 16, e->length);
+    cam_put32(out + 20, e->flags);
+}
+
+// Function to deserialize an index entry
+static inline void cam_unpack_index_entry(const uint8_t* in, struct cam_index_entry* e){
+    e->offset = cam_get64(in);
+    e->timestamp_us = cam_get64(in + 8);
+    e->length = cam_get32(in + 16);
+    e->flags = cam_get32(in + 20);
+}
+
+// Function to read a whole index: returns its <n> entries (caller frees), NULL on error
+// (errno: ENOENT no index, EINVAL invalid, ENOMEM)
+static inline struct cam_index_entry* cam_index_load(const char* recording, struct cam_index_info* info, uint64_t* n){
+    char path[1024];
+    uint8_t hdr[CAM_INDEX_HDR_LEN], entry[256];
+    struct stat st;
+    if(cam_index_path(recording, path, sizeof(path)) == -1){
+        errno = ENAMETOOLONG;
+        return NULL;
+    }
+    FILE* f = fopen(path, "r");
+    if(!f) return NULL;
+    if(fstat(fileno(f), &st) == -1 || fread(hdr, sizeof(hdr), 1, f) != 1 || cam_unpack_index_header(hdr, info) == -1
+       || info->entry_len > sizeof(entry)){
+        fclose(f);
+        errno = EINVAL;
+        return NULL;
+    }
+    uint64_t count = (st.st_size - CAM_INDEX_HDR_LEN) / info->entry_len;
+    struct cam_index_entry* entries = malloc((count ? count : 1) * sizeof(*entries));
+    if(!entries){
+        fclose(f);
+        errno = ENOMEM;
+        return NULL;
+    }
+    for(*n = 0; *n < count && fread(entry, info->entry_len, 1, f) == 1; (*n)++) cam_unpack_index_entry(entry, &entries[*n]);
+    fclose(f);
+    return entries;
+}
+
+#pragma endregion
+
+#endif
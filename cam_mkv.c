@@ -0,0 +1,428 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+
+#include "cam_mkv.h"
+#include "cam_index.h"
+
+#pragma region DEF_CONST
+
+#define MKV_IOV 1024                // Spans per writev()
+#define MKV_SLOT 32                 // Bytes for a cluster or block header
+#define MKV_FALLBACK_FPS 30         // Frame rate when neither timestamps nor a nominal rate are known
+
+// Matroska element ids (leading length bits included)
+#define ID_EBML             0x1A45DFA3
+#define ID_EBML_VERSION     0x4286
+#define ID_EBML_READ_VER    0x42F7
+#define ID_EBML_MAX_ID      0x42F2
+#define ID_EBML_MAX_SIZE    0x42F3
+#define ID_DOCTYPE          0x4282
+#define ID_DOCTYPE_VER      0x4287
+#define ID_DOCTYPE_READ_VER 0x4285
+#define ID_SEGMENT          0x18538067
+#define ID_SEEKHEAD         0x114D9B74
+#define ID_SEEK             0x4DBB
+#define ID_SEEK_ID          0x53AB
+#define ID_SEEK_POS         0x53AC
+#define ID_INFO             0x1549A966
+#define ID_TIMESCALE        0x2AD7B1
+#define ID_MUXING_APP       0x4D80
+#define ID_WRITING_APP      0x5741
+#define ID_DURATION         0x4489
+#define ID_TRACKS           0x1654AE6B
+#define ID_TRACK_ENTRY      0xAE
+#define ID_TRACK_NUMBER     0xD7
+#define ID_TRACK_UID        0x73C5
+#define ID_TRACK_TYPE       0x83
+#define ID_FLAG_LACING      0x9C
+#define ID_DEFAULT_DURATION 0x23E383
+#define ID_CODEC_ID         0x86
+#define ID_VIDEO            0xE0
+#define ID_PIXEL_WIDTH      0xB0
+#define ID_PIXEL_HEIGHT     0xBA
+#define ID_CLUSTER          0x1F43B675
+#define ID_TIMESTAMP        0xE7
+#define ID_SIMPLE_BLOCK     0xA3
+#define ID_CUES             0x1C53BB6B
+#define ID_CUE_POINT        0xBB
+#define ID_CUE_TIME         0xB3
+#define ID_CUE_TRACK_POS    0xB7
+#define ID_CUE_TRACK        0xF7
+#define ID_CUE_CLUSTER_POS  0xF1
+
+#define SIZE_LEN 8                  // Element sizes are written on 8 bytes: lengths known or not, one layout
+#define BLOCK_HDR_LEN (1 + SIZE_LEN + 4)    // SimpleBlock id, size, track, relative timestamp, flags
+
+#pragma endregion
+
+#pragma region EBML
+
+// Growable byte buffer for the header elements
+struct ebml{
+    uint8_t* p;
+    size_t len, cap;
+    int failed;                     // Out of memory
+};
+
+static void put_bytes(struct ebml* b, const void* data, size_t len){
+    if(b->failed) return;
+    if(b->len + len > b->cap){
+        size_t cap = b->cap ? b->cap * 2 : 256;
+        while(cap < b->len + len) cap *= 2;
+        uint8_t* p = realloc(b->p, cap);
+        if(!p){
+            b->failed = 1;
+            return;
+        }
+        b->p = p;
+        b->cap = cap;
+    }
+    memcpy(b->p + b->len, data, len);
+    b->len += len;
+}
+
+// Function to serialize an element id: its length is in its leading bits
+static size_t pack_id(uint8_t* out, uint32_t id){
+    size_t n = id > 0xFFFFFF ? 4 : id > 0xFFFF ? 3 : id > 0xFF ? 2 : 1;
+    for(size_t i = 0; i < n; i++) out[i] = id >> (8 * (n - 1 - i));
+    return n;
+}
+
+// Function to serialize an element size on SIZE_LEN bytes
+static size_t pack_size(uint8_t* out, uint64_t size){
+    out[0] = 0x01;
+    for(int i = 1; i < SIZE_LEN; i++) out[i] = size >> (8 * (SIZE_LEN - 1 - i));
+    return SIZE_LEN;
+}
+
+static void put_head(struct ebml* b, uint32_t id, uint64_t size){
+    uint8_t hdr[4 + SIZE_LEN];
+    size_t n = pack_id(hdr, id);
+    n += pack_size(hdr + n, size);
+    put_bytes(b, hdr, n);
+}
+
+// Function to add an unsigned integer element, on <width> bytes (0: as few as needed)
+static void put_uint(struct ebml* b, uint32_t id, uint64_t v, int width){
+    uint8_t data[8];
+    int n = width;
+    if(!n) for(n = 1; n < 8 && v >> (8 * n); n++);
+    for(int i = 0; i < n; i++) data[i] = v >> (8 * (n - 1 - i));
+    put_head(b, id, n);
+    put_bytes(b, data, n);
+}
+
+static void put_float(struct ebml* b, uint32_t id, double v){
+    uint64_t bits;
+    memcpy(&bits, &v, sizeof(bits));
+    put_uint(b, id, bits, 8);
+}
+
+static void put_string(struct ebml* b, uint32_t id, const char* s){
+    put_head(b, id, strlen(s));
+    put_bytes(b, s, strlen(s));
+}
+
+// Function to add a master element around the elements of <child>
+static void put_master(struct ebml* b, uint32_t id, const struct ebml* child){
+    if(child->failed) b->failed = 1;
+    put_head(b, id, child->len);
+    put_bytes(b, child->p, child->len);
+}
+
+static void put_seek(struct ebml* b, uint32_t id, uint64_t pos){
+    struct ebml seek = {0};
+    uint8_t raw[4];
+    size_t n = pack_id(raw, id);
+    put_head(&seek, ID_SEEK_ID, n);
+    put_bytes(&seek, raw, n);
+    put_uint(&seek, ID_SEEK_POS, pos, 8);    // Fixed width: the SeekHead size does not depend on it
+    put_master(b, ID_SEEK, &seek);
+    free(seek.p);
+}
+
+#pragma endregion
+
+#pragma region REMUX
+
+// A frame to copy
+struct mkv_frame{
+    uint64_t offset;
+    uint32_t length;
+    uint64_t ts;                    // In timestamp units, from the first frame
+};
+
+// Function to time index entries from the first one, in units of <scale_ns>: capture timestamps (us),
+// or <fps> if not <timed>. Returns the frames (caller frees), NULL if out of memory.
+static struct mkv_frame* time_frames(const struct cam_index_entry* e, uint64_t n, int timed, double fps, uint64_t scale_ns){
+    struct mkv_frame* frames = malloc((n ? n : 1) * sizeof(*frames));
+    if(!frames){
+        errno = ENOMEM;
+        return NULL;
+    }
+    uint64_t unit_us = scale_ns / 1000;
+    for(uint64_t k = 0; k < n; k++){
+        frames[k].offset = e[k].offset;
+        frames[k].length = e[k].length;
+        if(!timed) frames[k].ts = k * (1e9 / scale_ns) / fps + 0.5;
+        else frames[k].ts = e[k].timestamp_us > e[0].timestamp_us ? (e[k].timestamp_us - e[0].timestamp_us + unit_us / 2) / unit_us : 0;
+    }
+    // A clock step back must not reorder the blocks
+    for(uint64_t k = 1; k < n; k++) if(frames[k].ts < frames[k-1].ts) frames[k].ts = frames[k-1].ts;
+    return frames;
+}
+
+// Function to write every span, resuming after short writes: returns -1 on error
+static int write_iov(int fd, struct iovec* iov, int cnt){
+    while(cnt){
+        ssize_t n = writev(fd, iov, cnt);
+        if(n == -1){
+            if(errno == EINTR) continue;
+            return -1;
+        }
+        while(cnt && (size_t)n >= iov->iov_len){
+            n -= iov->iov_len;
+            iov++;
+            cnt--;
+        }
+        if(cnt){
+            iov->iov_base = (uint8_t*)iov->iov_base + n;
+            iov->iov_len -= n;
+        }
+    }
+    return 0;
+}
+
+// Function to find where the cluster starting at frame <k> ends: after MKV_CLUSTER_MS, or before
+// the 16-bit block timestamps relative to the cluster overflow
+static uint64_t cluster_end(const struct mkv_frame* frames, uint64_t n, uint64_t k, uint64_t scale_ns){
+    double span = MKV_CLUSTER_MS * (1000000.0 / scale_ns) < INT16_MAX ? MKV_CLUSTER_MS * (1000000.0 / scale_ns) : INT16_MAX;
+    uint64_t j = k + 1;
+    while(j < n && frames[j].ts - frames[k].ts < span) j++;
+    return j;
+}
+
+// Function to get the size of a cluster's content: its timestamp, then one SimpleBlock per frame
+static uint64_t cluster_size(const struct mkv_frame* frames, uint64_t k, uint64_t end){
+    struct ebml ts = {0};
+    put_uint(&ts, ID_TIMESTAMP, frames[k].ts, 0);
+    uint64_t size = ts.len;
+    free(ts.p);
+    for(uint64_t i = k; i < end; i++) size += BLOCK_HDR_LEN + frames[i].length;
+    return size;
+}
+
+// Function to write <frames> of the mapped recording to <out_ds> as a Matroska file, in one
+// sequential pass: every size is known up front. Timestamps are in units of <scale_ns>, <fps> is
+// announced as the default frame duration (0: none). Returns the duration in seconds, -1 on error.
+static double write_mkv(int out_ds, const uint8_t* map, const struct mkv_frame* frames, uint64_t n,
+                        uint32_t width, uint32_t height, double fps, uint64_t scale_ns){
+    struct ebml head = {0}, seekhead = {0}, segment_info = {0}, tracks = {0}, cues = {0}, tail = {0};
+    double ret = -1;
+
+    // Info: duration up to the end of the last frame
+    double frame_ts = n > 1 ? (double)(frames[n-1].ts - frames[0].ts) / (n - 1) : 1e9 / scale_ns / MKV_FALLBACK_FPS;
+    double duration = n ? frames[n-1].ts + frame_ts : 0;
+    put_uint(&segment_info, ID_TIMESCALE, scale_ns, 0);
+    put_string(&segment_info, ID_MUXING_APP, "CamProject_CRTP");
+    put_string(&segment_info, ID_WRITING_APP, "CamProject_CRTP");
+    put_float(&segment_info, ID_DURATION, duration);
+
+    // One MJPEG video track, every frame a keyframe
+    struct ebml entry = {0}, video = {0};
+    put_uint(&entry, ID_TRACK_NUMBER, 1, 0);
+    put_uint(&entry, ID_TRACK_UID, 1, 0);
+    put_uint(&entry, ID_TRACK_TYPE, 1, 0);
+    put_uint(&entry, ID_FLAG_LACING, 0, 0);
+    if(fps > 0) put_uint(&entry, ID_DEFAULT_DURATION, (uint64_t)(1e9 / fps), 0);
+    put_string(&entry, ID_CODEC_ID, "V_MJPEG");
+    put_uint(&video, ID_PIXEL_WIDTH, width, 0);
+    put_uint(&video, ID_PIXEL_HEIGHT, height, 0);
+    put_master(&entry, ID_VIDEO, &video);
+    put_master(&tracks, ID_TRACK_ENTRY, &entry);
+    free(entry.p);
+    free(video.p);
+
+    // Positions are relative to the segment's content: the SeekHead comes first, its size does not depend on them
+    put_seek(&seekhead, ID_INFO, 0);
+    put_seek(&seekhead, ID_TRACKS, 0);
+    put_seek(&seekhead, ID_CUES, 0);
+    uint64_t seek_len = 4 + SIZE_LEN + seekhead.len;
+    uint64_t info_pos = seek_len, tracks_pos = info_pos + 4 + SIZE_LEN + segment_info.len;
+    uint64_t pos = tracks_pos + 4 + SIZE_LEN + tracks.len;
+
+    // Clusters of about MKV_CLUSTER_MS, with a cue each
+    for(uint64_t k = 0; k < n;){
+        uint64_t end = cluster_end(frames, n, k, scale_ns);
+        struct ebml point = {0}, track_pos = {0};
+        put_uint(&point, ID_CUE_TIME, frames[k].ts, 0);
+        put_uint(&track_pos, ID_CUE_TRACK, 1, 0);
+        put_uint(&track_pos, ID_CUE_CLUSTER_POS, pos, 0);
+        put_master(&point, ID_CUE_TRACK_POS, &track_pos);
+        put_master(&cues, ID_CUE_POINT, &point);
+        free(point.p);
+        free(track_pos.p);
+        pos += 4 + SIZE_LEN + cluster_size(frames, k, end);
+        k = end;
+    }
+    uint64_t cues_pos = pos;
+    uint64_t segment_len = cues_pos + 4 + SIZE_LEN + cues.len;
+    seekhead.len = 0;
+    put_seek(&seekhead, ID_INFO, info_pos);
+    put_seek(&seekhead, ID_TRACKS, tracks_pos);
+    put_seek(&seekhead, ID_CUES, cues_pos);
+
+    // EBML header, then the segment up to its first cluster
+    struct ebml ebml = {0};
+    put_uint(&ebml, ID_EBML_VERSION, 1, 0);
+    put_uint(&ebml, ID_EBML_READ_VER, 1, 0);
+    put_uint(&ebml, ID_EBML_MAX_ID, 4, 0);
+    put_uint(&ebml, ID_EBML_MAX_SIZE, 8, 0);
+    put_string(&ebml, ID_DOCTYPE, "matroska");
+    put_uint(&ebml, ID_DOCTYPE_VER, 4, 0);
+    put_uint(&ebml, ID_DOCTYPE_READ_VER, 2, 0);
+    put_master(&head, ID_EBML, &ebml);
+    free(ebml.p);
+    put_head(&head, ID_SEGMENT, segment_len);
+    put_master(&head, ID_SEEKHEAD, &seekhead);
+    put_master(&head, ID_INFO, &segment_info);
+    put_master(&head, ID_TRACKS, &tracks);
+    errno = ENOMEM;
+    if(head.failed || cues.failed) goto out;
+
+    struct iovec iov[MKV_IOV];
+    uint8_t slots[MKV_IOV][MKV_SLOT];
+    int cnt = 0;
+    iov[cnt++] = (struct iovec){head.p, head.len};
+
+    // Clusters: headers from the slots, frames straight from the mapped recording
+    for(uint64_t k = 0; k < n;){
+        uint64_t end = cluster_end(frames, n, k, scale_ns);
+        if(cnt + 1 > MKV_IOV){
+            if(write_iov(out_ds, iov, cnt) == -1) goto out;
+            cnt = 0;
+        }
+        struct ebml ts = {0};
+        put_uint(&ts, ID_TIMESTAMP, frames[k].ts, 0);
+        size_t len = pack_id(slots[cnt], ID_CLUSTER);
+        len += pack_size(slots[cnt] + len, cluster_size(frames, k, end));
+        memcpy(slots[cnt] + len, ts.p, ts.len);
+        iov[cnt] = (struct iovec){slots[cnt], len + ts.len};
+        cnt++;
+        free(ts.p);
+
+        for(uint64_t i = k; i < end; i++){
+            if(cnt + 2 > MKV_IOV){
+                if(write_iov(out_ds, iov, cnt) == -1) goto out;
+                cnt = 0;
+            }
+            uint8_t* b = slots[cnt];
+            len = pack_id(b, ID_SIMPLE_BLOCK);
+            len += pack_size(b + len, 4 + frames[i].length);
+            b[len++] = 0x81;                            // Track 1
+            cam_put16(b + len, frames[i].ts - frames[k].ts);
+            len += 2;
+            b[len++] = 0x80;                            // Keyframe
+            iov[cnt++] = (struct iovec){b, len};
+            iov[cnt++] = (struct iovec){(void*)(map + frames[i].offset), frames[i].length};
+        }
+        k = end;
+    }
+    put_master(&tail, ID_CUES, &cues);
+    errno = ENOMEM;
+    if(tail.failed) goto out;
+    if(cnt + 1 > MKV_IOV){
+        if(write_iov(out_ds, iov, cnt) == -1) goto out;
+        cnt = 0;
+    }
+    iov[cnt++] = (struct iovec){tail.p, tail.len};
+    if(write_iov(out_ds, iov, cnt) == -1) goto out;
+    ret = duration * scale_ns / 1e9;
+
+out:
+    free(head.p);
+    free(seekhead.p);
+    free(segment_info.p);
+    free(tracks.p);
+    free(cues.p);
+    free(tail.p);
+    return ret;
+}
+
+int mkv_write_frames(int out_ds, const uint8_t* map, const struct cam_index_entry* e, uint64_t n,
+                     uint32_t width, uint32_t height, int timed, double fps){
+    struct mkv_frame* frames = time_frames(e, n, timed, fps, MKV_STREAM_TIMESCALE_NS);
+    if(!frames) return -1;
+    double duration = write_mkv(out_ds, map, frames, n, width, height, fps, MKV_STREAM_TIMESCALE_NS);
+    int saved = errno;
+    free(frames);
+    errno = saved;
+    return duration < 0 ? -1 : 0;
+}
+
+int mkv_remux(const char* recording, const char* output, struct mkv_stats* stats, const char** step){
+    struct cam_index_info info;
+    struct cam_index_entry* e = NULL;
+    uint64_t n = 0;
+    int in_ds = -1, out_ds = -1, ret = -1, saved;
+    uint8_t* map = MAP_FAILED;
+    struct stat st;
+    struct mkv_frame* frames = NULL;
+
+    *step = "Index";
+    if(!(e = cam_index_load(recording, &info, &n))) goto out;
+    // Capture timestamps, or the nominal frame rate for rebuilt indexes
+    int timed = !(info.flags & CAM_INDEX_REBUILT);
+    for(uint64_t k = 0; k < n && timed; k++) if(!e[k].timestamp_us) timed = 0;
+    double nominal = info.fps_num && info.fps_den ? (double)info.fps_num / info.fps_den : 0;
+    *step = "Out of memory";
+    if(!(frames = time_frames(e, n, timed, nominal ? nominal : MKV_FALLBACK_FPS, MKV_TIMESCALE_NS))) goto out;
+    *step = "Recording";
+    if((in_ds = open(recording, O_RDONLY | O_CLOEXEC)) == -1 || fstat(in_ds, &st) == -1) goto out;
+    // Frames past the end of the recording (e.g. cut short by a crash) are left out
+    while(n && frames[n-1].offset + frames[n-1].length > (uint64_t)st.st_size) n--;
+    if(st.st_size && (map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, in_ds, 0)) == MAP_FAILED) goto out;
+    if(map != MAP_FAILED) madvise(map, st.st_size, MADV_SEQUENTIAL);
+
+    *step = output;
+    if((out_ds = open(output, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644)) == -1) goto out;
+    double seconds = write_mkv(out_ds, map, frames, n, info.width, info.height, nominal, MKV_TIMESCALE_NS);
+    if(seconds < 0){
+        if(errno == ENOMEM) *step = "Out of memory";
+        goto out;
+    }
+
+    if(stats){
+        stats->frames = n;
+        stats->bytes = lseek(out_ds, 0, SEEK_CUR);
+        stats->seconds = seconds;
+        stats->timed = timed;
+    }
+    ret = 0;
+
+out:
+    saved = errno;
+    if(out_ds != -1 && close(out_ds) == -1 && !ret){
+        saved = errno;
+        *step = output;
+        ret = -1;
+    }
+    // No partial file left behind for a player to choke on
+    if(out_ds != -1 && ret) unlink(output);
+    if(map != MAP_FAILED) munmap(map, st.st_size);
+    if(in_ds != -1) close(in_ds);
+    free(frames);
+    free(e);
+    errno = saved;
+    return ret;
+}
+
+#pragma endregion
@@ -0,0 +1,60 @@
+#ifndef CAM_MKV_H
+#define CAM_MKV_H
+
+#include <stdint.h>
+
+#include "cam_index.h"
+
+/*
+ * MJPEG recording -> Matroska (.mkv) remux, without re-encoding.
+ *
+ * Every JPEG frame is copied unchanged into a V_MJPEG track (all keyframes),
+ * so the conversion costs about one read and one write of the recording
+ * instead of a decode and an H.264 encode, and the quality is the camera's.
+ * Frame boundaries and capture timestamps come from the frame index
+ * (<recording>.idx): the file keeps the real, variable frame rate instead of
+ * the 25 fps a raw MJPEG stream is assumed to have. Indexes rebuilt without
+ * timestamps fall back to the nominal frame rate.
+ *
+ * Clusters hold about MKV_CLUSTER_MS of frames, with a cue per cluster for
+ * seeking. To get an MP4, remux the result: ffmpeg -i in.mkv -c copy out.mp4.
+ */
+
+#define MKV_TIMESCALE_NS 1000000    // Timestamp unit: 1 ms (the Matroska default)
+#define MKV_STREAM_TIMESCALE_NS 10000   // Unit of mkv_write_frames(): 10 us, finer than a 90 kHz MP4
+#define MKV_CLUSTER_MS 1000         // Cluster length
+
+struct mkv_stats{
+    uint64_t frames;
+    uint64_t bytes;                 // Output file size
+    double seconds;                 // Duration
+    int timed;                      // Timestamps from the capture (0: nominal frame rate)
+};
+
+/*
+ * write <recording> as a Matroska file, using its index
+ * args:
+ *   output - Matroska file to create
+ *   stats - filled on success, may be NULL
+ *   step - on error, the step that failed
+ *
+ * returns: 0 ok, -1 on error (errno set; ENOENT/EINVAL for a missing or invalid index)
+ */
+int mkv_remux(const char* recording, const char* output, struct mkv_stats* stats, const char** step);
+
+/*
+ * write frames of a recording as a Matroska stream, timed from the first one.
+ * Written in one sequential pass: <out_ds> may be a pipe.
+ * args:
+ *   map - the recording, mapped
+ *   e, n - index entries of the frames
+ *   width, height - frame size
+ *   timed - time the frames by their capture timestamps, else at <fps>
+ *   fps - frame rate announced as the default frame duration (0: none, if timed)
+ *
+ * returns: 0 ok, -1 on error (errno set)
+ */
+int mkv_write_frames(int out_ds, const uint8_t* map, const struct cam_index_entry* e, uint64_t n,
+                     uint32_t width, uint32_t height, int timed, double fps);
+
+#endif
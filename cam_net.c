@@ -0,0 +1,201 @@
+#include <errno.h>
+#include <string.h>
+#include <poll.h>
+#include <time.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <linux/errqueue.h>
+#include <linux/sockios.h>
+
+#include "cam_net.h"
+
+#ifndef SO_ZEROCOPY
+#define SO_ZEROCOPY 60
+#endif
+#ifndef MSG_ZEROCOPY
+#define MSG_ZEROCOPY 0x4000000
+#endif
+
+int net_writev_all(int fd, struct iovec* iov, int iov_cnt){
+    while(iov_cnt > 0){
+        ssize_t n = writev(fd, iov, iov_cnt);
+        if(n == -1){
+            if(errno == EINTR) continue;
+            return -1;
+        }
+        // Skip the fully written entries, trim the partially written one
+        while(iov_cnt > 0 && (size_t)n >= iov->iov_len){
+            n -= iov->iov_len;
+            iov++;
+            iov_cnt--;
+        }
+        if(iov_cnt > 0){
+            iov->iov_base = (uint8_t*)iov->iov_base + n;
+            iov->iov_len -= n;
+        }
+    }
+    return 0;
+}
+
+int zc_init(struct zc_sender* zc, int socket_ds){
+    memset(zc, 0, sizeof(*zc));
+    zc->socket_ds = socket_ds;
+    int one = 1;
+    return setsockopt(socket_ds, SOL_SOCKET, SO_ZEROCOPY, &one, sizeof(one));
+}
+
+int zc_send(struct zc_sender* zc, const void* hdr, size_t hdr_len, const void* data, size_t len, uint32_t* last_id){
+    // The header is small: copying it is cheaper than pinning a page
+    struct iovec iov = {(void*)hdr, hdr_len};
+    while(iov.iov_len > 0){
+        ssize_t n = send(zc->socket_ds, iov.iov_base, iov.iov_len, MSG_MORE);
+        if(n == -1){
+            if(errno == EINTR) continue;
+            return -1;
+        }
+        iov.iov_base = (uint8_t*)iov.iov_base + n;
+        iov.iov_len -= n;
+    }
+
+    const uint8_t* p = data;
+    while(len > 0){
+        ssize_t n = send(zc->socket_ds, p, len, MSG_ZEROCOPY);
+        if(n == -1){
+            if(errno == EINTR) continue;
+            // Out of pinned-page budget (optmem): wait for the kernel to release some
+            if(errno == ENOBUFS){
+                if(zc_reap(zc, 1) == -1) return -1;
+                continue;
+            }
+            return -1;
+        }
+        // Every successful MSG_ZEROCOPY send() takes one id, even a short one
+        *last_id = zc->next_id++;
+        zc->sends++;
+        p += n;
+        len -= n;
+    }
+    return 0;
+}
+
+int zc_reap(struct zc_sender* zc, int wait){
+    int reaped = 0;
+    while(1){
+        char control[CMSG_SPACE(sizeof(struct sock_extended_err))];
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+
+        if(recvmsg(zc->socket_ds, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) == -1){
+            if(errno == EINTR) continue;
+            if(errno != EAGAIN && errno != EWOULDBLOCK) return -1;
+            if(reaped || !wait) return reaped;
+            // Nothing yet: the error queue shows up as POLLERR
+            struct pollfd pfd = {.fd = zc->socket_ds, .events = 0};
+            if(poll(&pfd, 1, -1) == -1 && errno != EINTR) return -1;
+            continue;
+        }
+
+        for(struct cmsghdr* cm = CMSG_FIRSTHDR(&msg); cm; cm = CMSG_NXTHDR(&msg, cm)){
+            struct sock_extended_err* err = (struct sock_extended_err*)CMSG_DATA(cm);
+            if(err->ee_errno != 0 || err->ee_origin != SO_EE_ORIGIN_ZEROCOPY) continue;
+            // Sends [ee_info, ee_data] completed; TCP reports them in order
+            if((int32_t)(err->ee_data + 1 - zc->done_id) > 0) zc->done_id = err->ee_data + 1;
+            if(err->ee_code & SO_EE_CODE_ZEROCOPY_COPIED) zc->copied += err->ee_data - err->ee_info + 1;
+            reaped++;
+        }
+    }
+}
+
+#pragma region LATENCY_BOUND
+
+static uint64_t now_us(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+// Function to read the unsent socket queue
+static uint32_t unsent_bytes(int socket_ds){
+    int outq = 0;
+    if(ioctl(socket_ds, SIOCOUTQ, &outq) == -1 || outq < 0) return 0;
+    return outq;
+}
+
+void lb_init(struct latency_bound* lb, int socket_ds, uint64_t target_us, double fps){
+    memset(lb, 0, sizeof(*lb));
+    lb->socket_ds = socket_ds;
+    lb->target_us = target_us;
+    lb->max_fps = lb->fps = fps;
+    lb->win_start_us = now_us();
+    lb->win_busy = 1;
+}
+
+// Function to close a window: updates the link rate and the frame rate
+static int lb_window(struct latency_bound* lb, uint64_t now){
+    double dt = (now - lb->win_start_us) / 1e6;
+    uint64_t delivered = lb->sent_bytes - lb->queued;
+    double sample = (delivered - lb->win_delivered) / dt;
+
+    // With an empty queue at times, the link carried all it got: the sample is only a lower bound
+    if(lb->win_busy) lb->rate = lb->rate ? (lb->rate + sample) / 2 : sample;
+    else if(sample > lb->rate) lb->rate = sample;
+    lb->sent_fps = lb->win_sent / dt;
+
+    // Drop to what the link carries while frames go stale; climb back once it keeps up
+    if(lb->max_fps){
+        if(lb->win_stale){
+            double fps = 0.9 * lb->rate / lb->frame_bytes;
+            if(fps < LB_MIN_FPS) fps = LB_MIN_FPS;
+            if(fps < lb->fps){
+                lb->fps = fps;
+                lb->fps_changes++;
+            }
+            lb->calm = 0;
+        }else if(lb->fps < lb->max_fps && ++lb->calm >= LB_CALM_WINDOWS){
+            lb->fps = lb->fps * 1.25 < lb->max_fps ? lb->fps * 1.25 : lb->max_fps;
+            lb->fps_changes++;
+            lb->calm = 0;
+        }
+    }
+
+    lb->win_start_us = now;
+    lb->win_delivered = delivered;
+    lb->win_busy = 1;
+    lb->win_sent = lb->win_stale = 0;
+    return 1;
+}
+
+int lb_admit(struct latency_bound* lb, uint64_t capture_us, size_t len, int newer){
+    uint64_t now = now_us();
+    lb->queued = unsent_bytes(lb->socket_ds);
+    if(!lb->queued) lb->win_busy = 0;
+    lb->frame_bytes = lb->frame_bytes ? 0.9 * lb->frame_bytes + 0.1 * len : len;
+    // First guess of the link rate, before a whole window has passed
+    if(!lb->rate && now - lb->win_start_us >= LB_WINDOW_US / 10)
+        lb->rate = (double)(lb->sent_bytes - lb->queued - lb->win_delivered) * 1e6 / (now - lb->win_start_us);
+
+    // Idle link and nothing fresher to send: this frame is the best there is
+    if(!lb->queued && !newer) return 1;
+    uint64_t age = now > capture_us ? now - capture_us : 0;
+    uint64_t drain = lb->rate > 0 ? (lb->queued + len) / lb->rate * 1e6 : 0;
+    if(age + drain <= lb->target_us) return 1;
+    lb->stale++;
+    lb->win_stale++;
+    return 0;
+}
+
+void lb_sent(struct latency_bound* lb, size_t len){
+    lb->sent_bytes += len;
+    lb->win_sent++;
+}
+
+int lb_tick(struct latency_bound* lb){
+    uint64_t now = now_us();
+    if(now - lb->win_start_us < LB_WINDOW_US) return 0;
+    lb->queued = unsent_bytes(lb->socket_ds);
+    return lb_window(lb, now);
+}
+
+#pragma endregion
@@ -0,0 +1,137 @@
+#ifndef CAM_NET_H
+#define CAM_NET_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/uio.h>
+
+/*
+ * Frame transmission helpers for the client.
+ *
+ * Two send paths:
+ *   - copy: writev() of header + payload, resumed after short writes.
+ *   - zero-copy: the payload is sent with MSG_ZEROCOPY straight from the V4L2
+ *     mmap buffer. The kernel reports on the socket error queue when it no longer
+ *     needs the pages; only then may the buffer go back to the driver.
+ *
+ * Latency bound: when the link is slower than the camera, frames queue up in
+ * the socket and every frame arrives later than the one before. The latency
+ * bound estimates when a frame would reach the server (its age plus the
+ * unsent socket queue, SIOCOUTQ, over the rate the link drains it) and drops
+ * the frames that would arrive later than the target. It also works out a
+ * frame rate the link can carry, for the capture side to ask of the source,
+ * and raises it again once the link keeps up.
+ */
+
+#define LB_WINDOW_US 1000000    // Rate and frame rate are re-evaluated this often
+#define LB_MIN_FPS 1.0          // Never ask the source for less
+#define LB_CALM_WINDOWS 2       // Windows without stale frames before the frame rate goes up
+
+// Zero-copy sender state for one socket
+struct zc_sender{
+    int socket_ds;
+    uint32_t next_id;   // Id the kernel gives the next MSG_ZEROCOPY send()
+    uint32_t done_id;   // Every send with id < done_id has completed
+    uint64_t sends;     // MSG_ZEROCOPY send() calls
+    uint64_t copied;    // Completions for which the kernel fell back to copying
+};
+
+// Latency bound state, owned by the sender thread
+struct latency_bound{
+    int socket_ds;
+    uint64_t target_us;         // Latest acceptable arrival, after capture
+    double max_fps;             // Source frame rate at the start (0: unpaced, not adjusted)
+    double fps;                 // Frame rate the source should run at
+
+    // Link estimate
+    uint64_t sent_bytes;        // Bytes handed to the socket
+    double rate;                // Bytes/s the link drains (0: unknown yet)
+    double frame_bytes;         // Average frame size (sent or not)
+    uint64_t win_start_us;
+    uint64_t win_delivered;     // Bytes out of the socket at the start of the window
+    int win_busy;               // The socket queue was never empty during the window
+    unsigned int win_sent;
+    unsigned int win_stale;
+    int calm;                   // Windows in a row without stale frames
+
+    // Statistics
+    unsigned long long stale;   // Frames dropped because they would arrive too late
+    unsigned long long fps_changes;
+    double sent_fps;            // Frames sent per second over the last window
+    uint32_t queued;            // Unsent socket bytes at the last check
+};
+
+/*
+ * set up the latency bound of a connected socket
+ * args:
+ *   target_us - latency target, from capture to arrival
+ *   fps - frame rate of the source, 0 if unpaced
+ */
+void lb_init(struct latency_bound* lb, int socket_ds, uint64_t target_us, double fps);
+
+/*
+ * decide whether a frame can still make it in time
+ * args:
+ *   capture_us - capture time of the frame (CLOCK_MONOTONIC)
+ *   len - bytes to send for it
+ *   newer - a newer frame is waiting behind this one
+ *
+ * returns: 1 send it, 0 drop it (counted as stale)
+ */
+int lb_admit(struct latency_bound* lb, uint64_t capture_us, size_t len, int newer);
+
+/*
+ * account a frame handed to the socket
+ */
+void lb_sent(struct latency_bound* lb, size_t len);
+
+/*
+ * re-evaluate the link rate and the frame rate once a window has passed
+ * (the source should then be adjusted if lb->fps changed)
+ *
+ * returns: 1 if a window closed, 0 otherwise
+ */
+int lb_tick(struct latency_bound* lb);
+
+/*
+ * write a whole iovec array, resuming after short writes (iov is modified)
+ *
+ * returns: 0 ok, -1 on error (errno set)
+ */
+int net_writev_all(int fd, struct iovec* iov, int iov_cnt);
+
+/*
+ * enable SO_ZEROCOPY on a connected socket
+ *
+ * returns: 0 ok, -1 if the kernel does not support it
+ */
+int zc_init(struct zc_sender* zc, int socket_ds);
+
+/*
+ * send a frame: the header is copied, the payload is sent zero-copy
+ * args:
+ *   hdr, hdr_len - frame header
+ *   data, len - payload, must stay untouched until zc_done(zc, *last_id)
+ *   last_id - id of the last send() covering the payload
+ *
+ * returns: 0 ok, -1 on error
+ */
+int zc_send(struct zc_sender* zc, const void* hdr, size_t hdr_len, const void* data, size_t len, uint32_t* last_id);
+
+/*
+ * read completion notifications from the socket error queue
+ * args:
+ *   wait - block until at least one notification arrives
+ *
+ * returns: number of notifications read, -1 on error
+ */
+int zc_reap(struct zc_sender* zc, int wait);
+
+/*
+ * returns: 1 if the send with the given id has completed
+ */
+static inline int zc_done(const struct zc_sender* zc, uint32_t id){
+    return (int32_t)(zc->done_id - id) > 0;
+}
+
+#endif
@@ -0,0 +1,99 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <time.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+
+#include "cam_preview.h"
+#include "cam_trace.h"
+#include "ext_lib/render_sdl2.h"
+
+static uint64_t now_ns(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+// Thread: owns the window, shows the newest frame published
+static void* preview_thread(void* arg){
+    struct preview* p = arg;
+    cam_trace_thread("preview");
+
+    // SDL2 is only used from this thread: window, renderer and events
+    if(init_render_sdl2(p->width, p->height, 0)){
+        fprintf(stderr, "Preview disabled\n");
+        atomic_store(&p->off, 1);
+        return NULL;
+    }
+
+    while(!atomic_load(&p->stop)){
+        struct pollfd pfd = {.fd = p->event_ds, .events = POLLIN};
+        if(poll(&pfd, 1, PREVIEW_EVENTS_MS) == -1 && errno != EINTR){
+            perror("Preview_poll");
+            break;
+        }
+        if(pfd.revents & POLLIN){
+            uint64_t n;
+            if(read(p->event_ds, &n, sizeof(n)) == -1 && errno != EAGAIN) perror("Preview_event");
+        }
+        render_sdl2_dispatch_events();
+        if(!tb_take(&p->tb)) continue;
+
+        // Decode into the texture and present: may wait for vsync, the capture thread does not
+        struct preview_slot* s = &p->slots[p->tb.front];
+        uint64_t t0 = cam_trace_begin(), start = now_ns();
+        if(render_sdl2_mjpeg_frame(s->data, s->len) == -1) p->errors++;
+        p->present_ns += now_ns() - start;
+        cam_trace_span("render", t0, s->stream, s->sequence);
+        p->shown++;
+    }
+
+    render_sdl2_clean();
+    return NULL;
+}
+
+int preview_start(struct preview* p, uint32_t width, uint32_t height){
+    memset(p, 0, sizeof(*p));
+    tb_init(&p->tb);
+    p->width = width;
+    p->height = height;
+    if((p->event_ds = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) == -1) return -1;
+    if((errno = pthread_create(&p->tid, NULL, preview_thread, p))){
+        close(p->event_ds);
+        return -1;
+    }
+    return 0;
+}
+
+void preview_publish(struct preview* p, const void* jpeg, size_t len, uint32_t stream, uint32_t sequence){
+    if(atomic_load_explicit(&p->off, memory_order_relaxed)) return;
+    struct preview_slot* s = &p->slots[p->tb.back];
+    if(len > s->cap){
+        // Slots grow to the largest frame seen, then stop allocating
+        uint8_t* data = realloc(s->data, len);
+        if(!data) return;
+        s->data = data;
+        s->cap = len;
+    }
+    memcpy(s->data, jpeg, len);
+    s->len = len;
+    s->stream = stream;
+    s->sequence = sequence;
+    p->published++;
+    if(tb_publish(&p->tb)) p->skipped++;
+
+    uint64_t one = 1;
+    if(write(p->event_ds, &one, sizeof(one)) == -1 && errno != EAGAIN) perror("Preview_event");
+}
+
+void preview_stop(struct preview* p){
+    uint64_t one = 1;
+    atomic_store(&p->stop, 1);
+    if(write(p->event_ds, &one, sizeof(one)) == -1 && errno != EAGAIN) perror("Preview_event");
+    pthread_join(p->tid, NULL);
+    close(p->event_ds);
+    for(int i = 0; i < 3; i++) free(p->slots[i].data);
+}
@@ -0,0 +1,73 @@
+#ifndef CAM_PREVIEW_H
+#define CAM_PREVIEW_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include "triple_buf.h"
+
+/*
+ * Client preview (-p) on its own thread.
+ *
+ * The capture thread copies each JPEG frame into a triple buffer and moves
+ * on: the V4L2 buffer goes to the sender (and back to the driver) without
+ * waiting for the preview. The preview thread owns the SDL2 window; it decodes
+ * and presents the newest frame, and dispatches the window events. Presenting
+ * waits for the display refresh (vsync), which only paces this thread: frames
+ * published meanwhile replace each other and only the latest one is shown.
+ */
+
+#define PREVIEW_EVENTS_MS 50    // Window events are dispatched at least this often
+
+// Frame copy, owned by whichever side holds its slot
+struct preview_slot{
+    uint8_t* data;
+    size_t len;
+    size_t cap;
+    uint32_t stream;            // Trace stream and frame sequence
+    uint32_t sequence;
+};
+
+struct preview{
+    struct triple_buf tb;
+    struct preview_slot slots[3];
+    uint32_t width, height;
+    int event_ds;               // eventfd: a frame was published
+    atomic_int stop;
+    atomic_int off;             // The window could not be opened: frames are not copied
+    pthread_t tid;
+
+    // Statistics
+    unsigned long long published;   // Capture thread
+    unsigned long long skipped;     // Replaced before the preview thread took them
+    unsigned long long shown;       // Preview thread
+    unsigned long long errors;      // Undecodable frames
+    uint64_t present_ns;            // Decode and present time (vsync wait included)
+};
+
+/*
+ * start the preview thread, which opens the window
+ * args:
+ *   width, height - frame size
+ *
+ * returns: 0 ok, -1 on error (errno set)
+ */
+int preview_start(struct preview* p, uint32_t width, uint32_t height);
+
+/*
+ * hand a frame to the preview (capture thread): it is copied, the caller keeps
+ * its buffer. Never blocks on the preview thread.
+ * args:
+ *   jpeg, len - frame data
+ *   stream, sequence - frame identity in the trace (-t)
+ */
+void preview_publish(struct preview* p, const void* jpeg, size_t len, uint32_t stream, uint32_t sequence);
+
+/*
+ * stop the preview thread, close the window and release the preview
+ */
+void preview_stop(struct preview* p);
+
+#endif
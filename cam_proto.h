@@ -0,0 +1,195 @@
+#ifndef CAM_PROTO_H
+#define CAM_PROTO_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+/*
+ * Wire protocol between Cclient and Cserver. Every field is big-endian.
+ *
+ * Once per connection, the client sends a session header:
+ *   magic "CCAM" | version | header length | width | height | pixel format (V4L2 fourcc) |
+ *   fps numerator | fps denominator | filename (NUL-padded) | session flags
+ *
+ * Then, for every frame, a fixed frame header followed by <length> payload bytes:
+ *   magic "CFRM" | flags | sequence number | capture timestamp (us) | length
+ *
+ * The header length field lets a newer client append session fields that an
+ * older server skips; a different version is rejected. Session flags were
+ * appended that way: headers of CAM_SESSION_MIN_LEN bytes, without them, are
+ * still accepted (no flags set).
+ *
+ * Over UDP (Cclient -U, Cserver -U) every datagram starts with:
+ *   magic "CUDP" | type | fragment index | fragment count | reserved | stream id |
+ *   frame number | offset | frame length
+ * A frame (frame header + payload, the same bytes as over TCP) is split into
+ * fragments that fit the MTU; offset and frame length place each fragment.
+ * The session header travels alone in a session datagram, repeated every
+ * second since any datagram may be lost, and an end datagram closes the stream.
+ */
+
+#pragma region DEF_CONST
+
+#define CAM_PROTO_MAGIC   0x4343414DU   // "CCAM"
+#define CAM_FRAME_MAGIC   0x4346524DU   // "CFRM"
+#define CAM_PROTO_VERSION 1
+
+#define CAM_FILENAME_LEN    256         // Filename field size, NUL included
+#define CAM_SESSION_HDR_LEN (32 + CAM_FILENAME_LEN)
+#define CAM_SESSION_MIN_LEN (28 + CAM_FILENAME_LEN)    // Before the session flags
+#define CAM_FRAME_HDR_LEN   28
+#define CAM_MAX_FRAME_LEN   (64u << 20) // Sanity limit on a single frame payload
+
+// Session flags
+#define CAM_SESSION_CONTINUOUS 0x1      // Runs until the client is stopped (num_frame -1)
+
+// Frame header flags
+#define CAM_FRAME_GATED     0x1         // The sequence gap before this frame is frames the client chose not to send
+
+// Session header, host byte order
+struct cam_session{
+    uint16_t version;
+    uint32_t width;
+    uint32_t height;
+    uint32_t pixelformat;
+    uint32_t fps_num;
+    uint32_t fps_den;
+    char filename[CAM_FILENAME_LEN];
+    uint32_t flags;
+};
+
+// Frame header, host byte order
+struct cam_frame{
+    uint32_t flags;
+    uint64_t sequence;      // V4L2 buffer sequence number
+    uint64_t timestamp_us;  // V4L2 capture timestamp (CLOCK_MONOTONIC)
+    uint32_t length;        // Payload bytes following the header
+};
+
+// UDP transport
+#define CAM_UDP_MAGIC     0x43554450U   // "CUDP"
+#define CAM_UDP_HDR_LEN   28
+#define CAM_UDP_MAX_DGRAM 9000          // Largest datagram accepted (jumbo frames)
+
+enum cam_udp_type{
+    CAM_UDP_SESSION = 1,    // Session header
+    CAM_UDP_FRAME,          // Fragment of a frame
+    CAM_UDP_END,            // End of the stream
+};
+
+// Datagram header, host byte order
+struct cam_udp_hdr{
+    uint16_t type;
+    uint16_t frag;          // Fragment index
+    uint16_t frags;         // Fragments in the frame
+    uint32_t stream;        // Random id of the client session
+    uint32_t frame;         // Frame number, counting from 0 (wraps)
+    uint32_t offset;        // Offset of the fragment in the frame
+    uint32_t total;         // Frame bytes (frame header + payload)
+};
+
+#pragma endregion
+
+#pragma region PACKING
+
+static inline void cam_put16(uint8_t* p, uint16_t v){ p[0] = v >> 8; p[1] = v; }
+static inline void cam_put32(uint8_t* p, uint32_t v){ cam_put16(p, v >> 16); cam_put16(p + 2, v); }
+static inline void cam_put64(uint8_t* p, uint64_t v){ cam_put32(p, v >> 32); cam_put32(p + 4, v); }
+static inline uint16_t cam_get16(const uint8_t* p){ return (uint16_t)(p[0] << 8 | p[1]); }
+static inline uint32_t cam_get32(const uint8_t* p){ return (uint32_t)cam_get16(p) << 16 | cam_get16(p + 2); }
+static inline uint64_t cam_get64(const uint8_t* p){ return (uint64_t)cam_get32(p) << 32 | cam_get32(p + 4); }
+
+// Function to serialize a session header into CAM_SESSION_HDR_LEN bytes
+static inline void cam_pack_session(uint8_t* out, const struct cam_session* s){
+    cam_put32(out, CAM_PROTO_MAGIC);
+    cam_put16(out + 4, CAM_PROTO_VERSION);
+    cam_put16(out + 6, CAM_SESSION_HDR_LEN);
+    cam_put32(out + 8, s->width);
+    cam_put32(out + 12, s->height);
+    cam_put32(out + 16, s->pixelformat);
+    cam_put32(out + 20, s->fps_num);
+    cam_put32(out + 24, s->fps_den);
+    memset(out + 28, 0, CAM_FILENAME_LEN);
+    memcpy(out + 28, s->filename, strnlen(s->filename, CAM_FILENAME_LEN - 1));   // Zeroed: stays terminated
+    cam_put32(out + 28 + CAM_FILENAME_LEN, s->flags);
+}
+
+// Function to parse the first 8 bytes of a session header: returns its total length, -1 if invalid
+static inline int cam_session_len(const uint8_t* in){
+    if(cam_get32(in) != CAM_PROTO_MAGIC || cam_get16(in + 4) != CAM_PROTO_VERSION) return -1;
+    if(cam_get16(in + 6) < CAM_SESSION_MIN_LEN) return -1;
+    return cam_get16(in + 6);
+}
+
+// Function to get how many bytes of a valid session header (first 8 bytes) are parsed: the rest is skipped
+static inline int cam_session_staged(const uint8_t* in){
+    return cam_session_len(in) < CAM_SESSION_HDR_LEN ? cam_session_len(in) : CAM_SESSION_HDR_LEN;
+}
+
+// Function to deserialize a session header (its cam_session_staged() bytes): returns -1 if invalid
+static inline int cam_unpack_session(const uint8_t* in, struct cam_session* s){
+    if(cam_session_len(in) == -1) return -1;
+    s->version = cam_get16(in + 4);
+    s->width = cam_get32(in + 8);
+    s->height = cam_get32(in + 12);
+    s->pixelformat = cam_get32(in + 16);
+    s->fps_num = cam_get32(in + 20);
+    s->fps_den = cam_get32(in + 24);
+    memcpy(s->filename, in + 28, CAM_FILENAME_LEN);
+    s->filename[CAM_FILENAME_LEN - 1] = '\0';
+    s->flags = cam_session_len(in) >= CAM_SESSION_HDR_LEN ? cam_get32(in + 28 + CAM_FILENAME_LEN) : 0;
+    return 0;
+}
+
+// Function to serialize a frame header into CAM_FRAME_HDR_LEN bytes
+static inline void cam_pack_frame(uint8_t* out, const struct cam_frame* f){
+    cam_put32(out, CAM_FRAME_MAGIC);
+    cam_put32(out + 4, f->flags);
+    cam_put64(out + 8, f->sequence);
+    cam_put64(out + 16, f->timestamp_us);
+    cam_put32(out + 24, f->length);
+}
+
+// Function to deserialize a frame header: returns -1 if invalid
+static inline int cam_unpack_frame(const uint8_t* in, struct cam_frame* f){
+    if(cam_get32(in) != CAM_FRAME_MAGIC) return -1;
+    f->flags = cam_get32(in + 4);
+    f->sequence = cam_get64(in + 8);
+    f->timestamp_us = cam_get64(in + 16);
+    f->length = cam_get32(in + 24);
+    if(f->length > CAM_MAX_FRAME_LEN) return -1;
+    return 0;
+}
+
+// Function to serialize a datagram header into CAM_UDP_HDR_LEN bytes
+static inline void cam_pack_udp(uint8_t* out, const struct cam_udp_hdr* h){
+    cam_put32(out, CAM_UDP_MAGIC);
+    cam_put16(out + 4, h->type);
+    cam_put16(out + 6, h->frag);
+    cam_put16(out + 8, h->frags);
+    cam_put16(out + 10, 0);
+    cam_put32(out + 12, h->stream);
+    cam_put32(out + 16, h->frame);
+    cam_put32(out + 20, h->offset);
+    cam_put32(out + 24, h->total);
+}
+
+// Function to deserialize the header of a len-byte datagram: returns -1 if invalid
+static inline int cam_unpack_udp(const uint8_t* in, size_t len, struct cam_udp_hdr* h){
+    if(len < CAM_UDP_HDR_LEN || cam_get32(in) != CAM_UDP_MAGIC) return -1;
+    h->type = cam_get16(in + 4);
+    h->frag = cam_get16(in + 6);
+    h->frags = cam_get16(in + 8);
+    h->stream = cam_get32(in + 12);
+    h->frame = cam_get32(in + 16);
+    h->offset = cam_get32(in + 20);
+    h->total = cam_get32(in + 24);
+    if(h->type == CAM_UDP_FRAME && (h->frag >= h->frags || h->total > CAM_FRAME_HDR_LEN + CAM_MAX_FRAME_LEN ||
+                                    h->offset + (len - CAM_UDP_HDR_LEN) > h->total)) return -1;
+    return 0;
+}
+
+#pragma endregion
+
+#endif
@@ -0,0 +1,150 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+
+#include "cam_ring.h"
+
+// Function to get the wall clock in us
+static uint64_t wall_us(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+// Function to write every byte at <off>: returns -1 on error
+static int pwrite_all(int fd, const uint8_t* data, size_t len, off_t off){
+    while(len){
+        ssize_t n = pwrite(fd, data, len, off);
+        if(n == -1 && errno == EINTR) continue;
+        if(n == -1) return -1;
+        data += n;
+        len -= n;
+        off += n;
+    }
+    return 0;
+}
+
+// Function to store the entry of segment <k>
+static int write_entry(struct cam_ring* r, uint32_t k){
+    uint8_t entry[CAM_RING_ENTRY_LEN];
+    cam_pack_ring_seg(entry, &r->seg[k]);
+    return pwrite_all(r->fd, entry, sizeof(entry), CAM_RING_TABLE_OFF + (off_t)k * CAM_RING_ENTRY_LEN);
+}
+
+// Function to start writing segment <k>: its old content is forgotten before it is overwritten
+static int start_segment(struct cam_ring* r, const struct cam_session* s, uint32_t k){
+    r->cur = k;
+    r->seg[k] = (struct cam_ring_seg){.seq = r->next_seq++, .session = r->session, .width = s->width, .height = s->height,
+                                      .fps_num = s->fps_num, .fps_den = s->fps_den};
+    if(write_entry(r, k) == -1) return -1;
+    r->synced_us = wall_us();
+    return lseek(r->fd, cam_ring_seg_offset(r->seg_size, k), SEEK_SET) == -1 ? -1 : 0;
+}
+
+int cam_ring_read(int fd, uint32_t* segments, uint64_t* seg_size, struct cam_ring_seg* seg){
+    uint8_t hdr[CAM_RING_HDR_LEN];
+    ssize_t n = pread(fd, hdr, sizeof(hdr), 0);
+    if(n == -1) return -1;
+    if(n != sizeof(hdr) || cam_get32(hdr) != CAM_RING_MAGIC || cam_get16(hdr + 4) != CAM_RING_VERSION ||
+       cam_get16(hdr + 6) != CAM_RING_ENTRY_LEN || !cam_get32(hdr + 8) || cam_get32(hdr + 8) > CAM_RING_MAX_SEGMENTS){
+        errno = EINVAL;
+        return -1;
+    }
+    *segments = cam_get32(hdr + 8);
+    *seg_size = cam_get64(hdr + 16);
+    for(uint32_t k = 0; k < *segments; k++) cam_unpack_ring_seg(hdr + CAM_RING_TABLE_OFF + k * CAM_RING_ENTRY_LEN, &seg[k]);
+    return 0;
+}
+
+int cam_ring_open(struct cam_ring* r, const char* path, const struct cam_session* session, uint32_t segments, uint64_t seg_size){
+    memset(r, 0, sizeof(*r));
+    if(!segments || segments > CAM_RING_MAX_SEGMENTS || seg_size < CAM_RING_MIN_SEGMENT){
+        errno = EINVAL;
+        return -1;
+    }
+    if((r->fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644)) == -1) return -1;
+    if(flock(r->fd, LOCK_EX | LOCK_NB) == -1){
+        if(errno == EWOULDBLOCK) errno = EBUSY;
+        goto fail;
+    }
+    r->segments = segments;
+    r->seg_size = seg_size;
+    r->session = wall_us();
+    r->next_seq = 1;
+
+    // Same geometry: continue the ring after its newest segment
+    uint32_t old_segments, newest = segments - 1;
+    uint64_t old_size;
+    if(cam_ring_read(r->fd, &old_segments, &old_size, r->seg) == 0 && old_segments == segments && old_size == seg_size){
+        for(uint32_t k = 0; k < segments; k++)
+            if(r->seg[k].seq >= r->next_seq){
+                r->next_seq = r->seg[k].seq + 1;
+                newest = k;
+            }
+    }
+    else{
+        uint8_t hdr[CAM_RING_HDR_LEN] = {0};
+        cam_put32(hdr, CAM_RING_MAGIC);
+        cam_put16(hdr + 4, CAM_RING_VERSION);
+        cam_put16(hdr + 6, CAM_RING_ENTRY_LEN);
+        cam_put32(hdr + 8, segments);
+        cam_put64(hdr + 16, seg_size);
+        memset(r->seg, 0, sizeof(r->seg));
+        if(pwrite_all(r->fd, hdr, sizeof(hdr), 0) == -1) goto fail;
+    }
+
+    // Allocate every block now: segment writes never extend the file or fragment it
+    off_t total = cam_ring_seg_offset(seg_size, segments);
+    struct stat st;
+    if(fstat(r->fd, &st) == -1) goto fail;
+    if(st.st_size > total && ftruncate(r->fd, total) == -1) goto fail;
+    if(fallocate(r->fd, 0, 0, total) == -1){
+        if(errno != EOPNOTSUPP) goto fail;
+        // Filesystem without fallocate(): sized, blocks allocated on first write
+        if(st.st_size < total && ftruncate(r->fd, total) == -1) goto fail;
+    }
+
+    if(start_segment(r, session, (newest + 1) % segments) == -1) goto fail;
+    return 0;
+
+fail:;
+    int saved = errno;
+    close(r->fd);
+    r->fd = -1;
+    errno = saved;
+    return -1;
+}
+
+int cam_ring_advance(struct cam_ring* r){
+    struct cam_ring_seg* s = &r->seg[r->cur];
+    struct cam_session fmt = {.width = s->width, .height = s->height, .fps_num = s->fps_num, .fps_den = s->fps_den};
+    if(write_entry(r, r->cur) == -1) return -1;
+    return start_segment(r, &fmt, (r->cur + 1) % r->segments);
+}
+
+void cam_ring_written(struct cam_ring* r, uint64_t len){
+    struct cam_ring_seg* s = &r->seg[r->cur];
+    uint64_t now_us = wall_us();
+    if(!s->frames) s->first_us = now_us;
+    s->last_us = now_us;
+    s->bytes += len;
+    s->frames++;
+    // Readers see the segment grow once per CAM_RING_SYNC_MS, without a table write per frame
+    if(now_us - r->synced_us >= CAM_RING_SYNC_MS * 1000ULL){
+        if(write_entry(r, r->cur) == -1) perror("Ring_table_write");
+        r->synced_us = now_us;
+    }
+}
+
+int cam_ring_close(struct cam_ring* r){
+    int ret = write_entry(r, r->cur);
+    if(close(r->fd) == -1) ret = -1;
+    r->fd = -1;
+    return ret;
+}
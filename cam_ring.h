@@ -0,0 +1,155 @@
+#ifndef CAM_RING_H
+#define CAM_RING_H
+
+#include <stdint.h>
+
+#include "cam_proto.h"
+
+/*
+ * Ring recording of continuous streams (Cserver -r): one file per camera,
+ * <recording>.ring, preallocated and split in fixed-size segments filled in
+ * turn. Once every segment is used, the oldest one is overwritten in place:
+ * disk usage is bounded, the file is never truncated, unlinked or recreated,
+ * and writes are sequential within a segment. Every field is big-endian.
+ *
+ * A header of CAM_RING_HDR_LEN bytes:
+ *   magic "CRNG" | version | entry length | segment count | reserved | segment size
+ * then, from CAM_RING_TABLE_OFF, one entry per segment:
+ *   sequence (0: empty) | session id | first and last frame (server wall clock, us) |
+ *   bytes | frames | width | height | fps numerator | fps denominator | reserved
+ * The segments follow the header. A segment holds its frames as they travel on
+ * the wire (frame header, then payload): it is read back without an index.
+ *
+ * A segment's entry is cleared before the segment is reused, then rewritten
+ * every CAM_RING_SYNC_MS and when the segment is full: a crash loses at most
+ * that much of the newest segment. A session id is the stream's start time
+ * (us since the epoch), unique per ring.
+ */
+
+#pragma region DEF_CONST
+
+#define CAM_RING_MAGIC      0x43524E47U // "CRNG"
+#define CAM_RING_VERSION    1
+#define CAM_RING_HDR_LEN    16384
+#define CAM_RING_TABLE_OFF  32
+#define CAM_RING_ENTRY_LEN  64
+#define CAM_RING_MAX_SEGMENTS ((CAM_RING_HDR_LEN - CAM_RING_TABLE_OFF) / CAM_RING_ENTRY_LEN)
+#define CAM_RING_MIN_SEGMENT (1u << 20)
+#define CAM_RING_SYNC_MS    1000
+
+// Segment entry, host byte order
+struct cam_ring_seg{
+    uint64_t seq;           // Order of use, 0 if empty
+    uint64_t session;
+    uint64_t first_us;      // Server wall clock when the first and last frame were stored
+    uint64_t last_us;
+    uint64_t bytes;         // Bytes of frames (headers included) from the segment start
+    uint32_t frames;
+    uint32_t width;
+    uint32_t height;
+    uint32_t fps_num;
+    uint32_t fps_den;
+};
+
+// Ring being written
+struct cam_ring{
+    int fd;                 // Locked while written: one stream per ring
+    uint32_t segments;
+    uint64_t seg_size;
+    uint64_t session;
+    uint32_t cur;           // Segment being written
+    uint64_t next_seq;
+    uint64_t synced_us;     // Last entry write
+    struct cam_ring_seg seg[CAM_RING_MAX_SEGMENTS];
+};
+
+#pragma endregion
+
+#pragma region PACKING
+
+// Function to get the file offset of segment <k>
+static inline uint64_t cam_ring_seg_offset(uint64_t seg_size, uint32_t k){
+    return CAM_RING_HDR_LEN + (uint64_t)k * seg_size;
+}
+
+// Function to serialize a segment entry into CAM_RING_ENTRY_LEN bytes
+static inline void cam_pack_ring_seg(uint8_t* out, const struct cam_ring_seg* s){
+    cam_put64(out, s->seq);
+    cam_put64(out + 8, s->session);
+    cam_put64(out + 16, s->first_us);
+    cam_put64(out + 24, s->last_us);
+    cam_put64(out + 32, s->bytes);
+    cam_put32(out + 40, s->frames);
+    cam_put32(out + 44, s->width);
+    cam_put32(out + 48, s->height);
+    cam_put32(out + 52, s->fps_num);
+    cam_put32(out + 56, s->fps_den);
+    cam_put32(out + 60, 0);
+}
+
+// Function to deserialize a segment entry
+static inline void cam_unpack_ring_seg(const uint8_t* in, struct cam_ring_seg* s){
+    s->seq = cam_get64(in);
+    s->session = cam_get64(in + 8);
+    s->first_us = cam_get64(in + 16);
+    s->last_us = cam_get64(in + 24);
+    s->bytes = cam_get64(in + 32);
+    s->frames = cam_get32(in + 40);
+    s->width = cam_get32(in + 44);
+    s->height = cam_get32(in + 48);
+    s->fps_num = cam_get32(in + 52);
+    s->fps_den = cam_get32(in + 56);
+}
+
+#pragma endregion
+
+/*
+ * open the ring at <path> for a new session, created and preallocated if needed.
+ * A ring with the same geometry continues after its newest segment; any other
+ * file at <path> is overwritten.
+ * args:
+ *   session - stream format, stored with each segment
+ *   segments - segment count (up to CAM_RING_MAX_SEGMENTS)
+ *   seg_size - bytes per segment (at least CAM_RING_MIN_SEGMENT)
+ *
+ * returns: 0 ok, -1 on error (errno set; EBUSY: ring written by another stream)
+ */
+int cam_ring_open(struct cam_ring* r, const char* path, const struct cam_session* session, uint32_t segments, uint64_t seg_size);
+
+/*
+ * returns: 1 if <len> more bytes fit in the current segment
+ */
+static inline int cam_ring_fits(const struct cam_ring* r, uint64_t len){
+    return r->seg[r->cur].bytes + len <= r->seg_size;
+}
+
+/*
+ * move to the next (oldest) segment: the file position is set to its start.
+ * Pending writes must be done first.
+ *
+ * returns: 0 ok, -1 on error (errno set)
+ */
+int cam_ring_advance(struct cam_ring* r);
+
+/*
+ * account a frame of <len> bytes (header included) written at the file position
+ */
+void cam_ring_written(struct cam_ring* r, uint64_t len);
+
+/*
+ * store the current segment's entry and close the ring
+ *
+ * returns: 0 ok, -1 on error (errno set)
+ */
+int cam_ring_close(struct cam_ring* r);
+
+/*
+ * read the header and segment table of the ring open as <fd>
+ * args:
+ *   seg - CAM_RING_MAX_SEGMENTS entries
+ *
+ * returns: 0 ok, -1 on error (errno set; EINVAL: not a ring)
+ */
+int cam_ring_read(int fd, uint32_t* segments, uint64_t* seg_size, struct cam_ring_seg* seg);
+
+#endif
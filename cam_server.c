@@ -1,3 +1,4 @@
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <sys/types.h>
 #include <sys/socket.h>
@@ -10,13 +11,54 @@
 #include <fcntl.h>
 #include <errno.h>
 #include <unistd.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/epoll.h>
+#include <sys/uio.h>
+#include <sys/mman.h>
+#include <sys/timerfd.h>
+#include <sys/signalfd.h>
+#include <linux/videodev2.h>
+
+#include "cam_proto.h"
+#include "mjpeg_scan.h"
+#include "cam_hist.h"
+#include "conv_queue.h"
+#include "uring_writer.h"
+#include "cam_index.h"
+#include "cam_ring.h"
+#include "cam_view.h"
+#include "cam_udp.h"
+#include "cam_trace.h"
 
 #pragma region DEF_CONST 
 
 #define TRUE 1
-#define BUFFER_SIZE 1024    // Buffer size for receiving data
+#define BUFFER_SIZE (64 << 10)  // Default buffer size for receiving data
+#define PIPE_SIZE (1 << 20)     // Pipe capacity requested for splice ingest
+#define SCAN_BATCH (1 << 20)    // Legacy splice streams: bytes to write before counting frames
 #define MAX_FILE_LEN 512    // Maximum length for filename
-#define QUEUE_LEN 2         // Max length of connection queue for listen()
+#define QUEUE_LEN 128       // Max length of connection queue for listen()
+#define MAX_EVENTS 64       // Max number of epoll events handled per wake-up
+#define READ_BUDGET 64      // Max recv() calls per stream before yielding to the others
+
+// Ceiling on concurrent streams handled by one event loop (i.e. one core).
+// A 640x480 MJPEG stream at 30 fps is ~1-4 MB/s, and the copy path costs two
+// syscalls per BUFFER_SIZE chunk, so 64 streams keep a core well below saturation.
+// Scale beyond that by starting one Cserver per core on the same port (SO_REUSEPORT).
+#define MAX_STREAMS 64
+#define MAX_IOV 64          // Max payload spans written by one writev()
+#define URING_BUF_SIZE (1 << 20)    // io_uring storage: size of each write
+#define CONV_NICE 10        // Default niceness of the MP4 conversions
+#define CONV_JOURNAL "conversions.journal"
+#define UDP_RCVBUF (8 << 20)    // UDP socket buffer: absorbs bursts of fragments between two wake-ups
+#define UDP_TICK_NS 10000000    // UDP: period of the reassembly deadline checks
+#define UDP_IDLE_US 5000000     // UDP: a stream silent this long is over (its end datagram was lost)
+#define STAMP_RING 256          // Frames received but not yet on disk, timed per stream
+#define WRITE_RING 64           // io_uring writes of a stream in flight, in file order
+#define RING_SEGMENTS 16        // Ring recording (-r): default segments per camera
+#define MAX_RENAMES 1000        // Numbered names tried for a recording whose name is taken
+
 // Macro to clear struct memory
 #define CLEAR(x) memset(&(x), 0, sizeof(x))
 
@@ -29,47 +71,1121 @@ static void errno_exit(const char* s){
 
 #pragma region UTILS
 
+static uint64_t now_us(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
 // Function to clean a string by removing non-printable characters
 void clean_string(char *str) {
     for (int i = 0; i < strlen(str); i++) if (!isprint(str[i])) str[i] = '\0';
 }
 
-// Function to change the file extension from .mjpeg to .mp4
-void change_extension(const char *input, char *output) {
+// Function to keep only the last path component of a client-supplied filename,
+// so that a client cannot write outside the working directory
+static int sanitize_filename(char *str) {
+    clean_string(str);
+    char* base = strrchr(str, '/');
+    if(base) memmove(str, base + 1, strlen(base + 1) + 1);
+    return (str[0] == '\0' || !strcmp(str, ".") || !strcmp(str, "..")) ? -1 : 0;
+}
+
+// Function to change the file extension from .mjpeg to <extension>
+void change_extension(const char *input, char *output, const char *extension) {
     sprintf(output,"%s", input);
-    strcpy(strrchr(output, '.'), ".mp4");
+    char* ext = strrchr(output, '.');
+    strcpy(ext ? ext : output + strlen(output), extension);
+}
+
+// Function to name the <n>th recording of <input>: <input> itself, then <input>_<n> (with <extension>)
+static void numbered_name(const char *input, int n, const char *extension, char *output) {
+    char stem[MAX_FILE_LEN];
+    change_extension(input, stem, "");
+    if(n) snprintf(output, MAX_FILE_LEN, "%.*s_%d%s", MAX_FILE_LEN - 32, stem, n, extension);
+    else snprintf(output, MAX_FILE_LEN, "%.*s%s", MAX_FILE_LEN - 32, stem, extension);
+}
+
+#pragma endregion
+
+#pragma region CONN
+
+enum conn_state{
+    CONN_SESSION,       // Waiting for the session header
+    CONN_FRAME_HDR,     // Waiting for a frame header
+    CONN_PAYLOAD,       // Receiving frame payload
+    CONN_LEGACY,        // Pre-protocol client: bare filename followed by raw MJPEG
+};
+
+// Per-client connection state
+struct conn{
+    int client_ds;                  // Client socket
+    int file_ds;                    // Recording file or ring
+    int recording;                  // Recording started
+    char filename[MAX_FILE_LEN];    // Recording filename (empty until received)
+    char addr[INET_ADDRSTRLEN];     // Client address
+    int frame_count;                // Frames received so far
+    int ready;                      // Still readable after using up its READ_BUDGET
+
+    enum conn_state state;
+    uint8_t hdr[CAM_SESSION_HDR_LEN];   // Partially received header
+    size_t hdr_len;                 // Bytes staged in hdr
+    size_t skip;                    // Unknown session header bytes still to discard
+    struct cam_session session;
+    struct cam_frame frame;         // Header of the frame being received
+    size_t payload_left;            // Payload bytes of the current frame still to receive
+    uint64_t next_seq;              // Expected sequence number of the next frame
+    int dropped;                    // Frames missing from the sequence
+    int gated;                      // Frames the client left out (motion gating)
+    struct mjpeg_scanner scan;      // Frame counter for legacy streams
+
+    int pipe_ds[2];                 // Splice ingest: socket -> pipe -> file
+    size_t pipe_size;               // Capacity of the pipe
+    off_t file_len;                 // Bytes written to the recording
+
+    // Ring recording of continuous streams (-r)
+    uint32_t ring_segments;         // 0 if off
+    uint64_t ring_seg_size;
+    struct cam_ring* ring;          // NULL: plain recording
+
+    // Frame index sidecar (<filename>.idx)
+    int indexed;                    // Write an index for this recording
+    FILE* index;
+    uint64_t frame_off;             // Recording offset of the current frame
+
+    // Live fan-out to HTTP viewers (-H)
+    struct view_server* view;       // NULL if off
+    struct view_stream* vstream;
+    struct view_frame* vframe;      // Current frame, assembled for the viewers
+
+    // io_uring storage (-u)
+    struct uring_writer* uw;        // NULL: synchronous write()
+    struct uw_buf* wb;              // Buffer being filled
+    unsigned int inflight;          // Writes not completed yet
+    struct{ uint64_t end; int done; } writes[WRITE_RING];  // Submitted writes, oldest first
+    unsigned int write_head, write_tail;
+    int closing;                    // Connection closed, waiting for its writes
+
+    // Metrics (-m)
+    int check;                      // Validate frames
+    uint8_t marks[4];               // First and last two bytes of the current frame
+    int corrupt;                    // Frames not starting with SOI or not ending with EOI
+    uint64_t start_us;              // Session start
+
+    // Stage latencies, in us (always on; reported with -i, SIGUSR1 and at the end of the stream)
+    struct cam_hist latency;        // Capture -> frame received (client clock: same host only)
+    struct cam_hist write_lat;      // Frame received -> on disk
+    struct cam_hist last[2];        // Both, at the previous periodic summary
+    int last_frames, last_dropped;
+    struct{ uint64_t end, recv_us; } stamps[STAMP_RING];   // Frames waiting for their write
+    unsigned int stamp_head, stamp_tail;
+    uint64_t disk_len;              // Recording bytes known to be written
+
+    // Tracing (-t)
+    uint32_t trace_stream;          // Stream key, from the session filename
+    uint64_t trace_frame;           // Header of the current frame received
+
+    // UDP transport (-U): client_ds is -1, frames come from the reassembly
+    struct udp_reasm* udp;          // NULL for TCP streams
+    uint32_t stream;                // Stream id of the datagrams
+    struct sockaddr_in peer;        // Client address and port
+    uint64_t last_rx_us;            // Last datagram received
+    int failed;                     // Protocol error: close at the next tick
+};
+
+struct server{
+    int socket_ds;                  // Listening socket
+    int epoll_ds;                   // Event loop
+    char convert;                   // Convert the recording when a stream ends
+    char transcode;                 // Convert by re-encoding to H.264 MP4, not remuxing to Matroska
+    struct conv_queue conv;         // Conversion jobs and workers
+    char splice;                    // Zero-copy ingest with splice()
+    char index;                     // Write frame index sidecars
+    uint32_t ring_segments;         // Ring recording of continuous streams: segments per camera, 0 if off
+    uint64_t ring_seg_size;
+    struct view_server* view;       // HTTP viewers, NULL if off
+    unsigned int uring_depth;       // io_uring storage: writes in flight, 0 for write()
+    struct uring_writer uw;
+    char *buffer;                   // Shared receive buffer
+    size_t buf_size;                // Size of the receive buffer
+    int num_conn;                   // Active streams
+    int accept_pending;             // Listening socket readable while at MAX_STREAMS
+    struct conn* conns[MAX_STREAMS];
+
+    // UDP transport (-U)
+    int udp_ds;                     // UDP socket on the same port, -1 if off
+    int tick_ds;                    // Timerfd for the reassembly deadlines
+    uint64_t udp_deadline_us;       // Time a frame may take to complete
+    uint8_t* udp_buf;               // recvmmsg() buffers, UDP_BATCH datagrams
+
+    // Metrics (-m): one CSV row per stream, then the running totals of the server
+    FILE* metrics;
+    uint64_t start_us;              // First session start
+    int streams;
+    unsigned long long frames, bytes, missing, corrupt;
+    struct cam_hist latency;
+
+    // Stage summaries: every <stats_interval> s (-i) and on SIGUSR1
+    int stats_ds;                   // Timerfd, -1 if no periodic summary
+    int signal_ds;                  // Signalfd for SIGUSR1
+    uint64_t stats_us;              // Last periodic summary
+};
+
+// Function to create the recording file, never over an earlier recording: a name already
+// taken gets a _<n> suffix. Returns -1 on error.
+static int open_unique(struct conn* c){
+    char name[MAX_FILE_LEN];
+    const char* ext = strrchr(c->filename, '.');
+    int flags = O_RDWR | O_CREAT | O_EXCL | (c->uw && c->uw->direct ? O_DIRECT : 0);
+    for(int n = 0; n < MAX_RENAMES && c->file_ds == -1; n++){
+        numbered_name(c->filename, n, ext ? ext : "", name);
+        // Read back by the splice path's frame checks
+        if((c->file_ds = open(name, flags, 0644)) == -1 && errno == EINVAL && (flags & O_DIRECT)){
+            // The filesystem does not support O_DIRECT: go through the page cache
+            fprintf(stderr, "[%s] O_DIRECT not supported for %s\n", c->addr, name);
+            flags &= ~O_DIRECT;
+            n--;
+        }
+        else if(c->file_ds == -1 && errno != EEXIST) break;
+    }
+    if(c->file_ds == -1){
+        fprintf(stderr, "[%s] Open %s error %d, %s\n", c->addr, name, errno, strerror(errno));
+        return -1;
+    }
+    if(strcmp(name, c->filename)) printf("[%s] %s exists, recording to %s\n", c->addr, c->filename, name);
+    strcpy(c->filename, name);
+    return 0;
+}
+
+// Function to open the ring of a continuous stream: <filename>.ring, or <filename>_<n>.ring
+// while another stream writes it. Returns -1 on error.
+static int open_ring(struct conn* c){
+    char name[MAX_FILE_LEN];
+    if(!(c->ring = malloc(sizeof(*c->ring)))) errno_exit("Out of memory");
+    for(int n = 0; n < MAX_RENAMES; n++){
+        numbered_name(c->filename, n, ".ring", name);
+        if(cam_ring_open(c->ring, name, &c->session, c->ring_segments, c->ring_seg_size) == 0) break;
+        if(errno != EBUSY){
+            fprintf(stderr, "[%s] Ring %s error %d, %s\n", c->addr, name, errno, strerror(errno));
+            free(c->ring);
+            c->ring = NULL;
+            return -1;
+        }
+    }
+    if(c->ring->fd == -1){
+        fprintf(stderr, "[%s] Every ring named after %s is busy\n", c->addr, c->filename);
+        free(c->ring);
+        c->ring = NULL;
+        return -1;
+    }
+    c->file_ds = c->ring->fd;
+    c->uw = NULL;   // Segment switches move the file position: plain write()
+    strcpy(c->filename, name);
+    printf("[%s] Recording to ring %s: %u segments of %.1f MB, from segment %u\n", c->addr, c->filename,
+        c->ring->segments, c->ring->seg_size / 1e6, c->ring->cur);
+    return 0;
+}
+
+// Function to create the recording file once the filename is known
+static int open_recording(struct conn* c){
+    if(sanitize_filename(c->filename) == -1){
+        fprintf(stderr, "[%s] Invalid filename\n", c->addr);
+        return -1;
+    }
+    printf("[%s] Filename: %s\n", c->addr, c->filename);
+
+    // Continuous streams go to their camera's ring (-r) instead of a file growing without limit
+    if(c->ring_segments && c->state != CONN_LEGACY && (c->session.flags & CAM_SESSION_CONTINUOUS)){
+        if(open_ring(c) == -1) return -1;
+    }
+    else if(open_unique(c) == -1) return -1;
+    c->recording = 1;
+
+    // Framed streams can be watched live
+    if(c->view && c->state != CONN_LEGACY && !(c->vstream = view_stream_open(c->view, c->filename, &c->session)))
+        fprintf(stderr, "[%s] Too many streams to serve viewers\n", c->addr);
+
+    // Index framed recordings as they are written (legacy streams: rebuild with Cindex)
+    if(c->indexed && c->state != CONN_LEGACY && !c->ring){
+        char index_filename[MAX_FILE_LEN + 8];
+        uint8_t hdr[CAM_INDEX_HDR_LEN];
+        struct cam_index_info info = {.width = c->session.width, .height = c->session.height,
+                                      .fps_num = c->session.fps_num, .fps_den = c->session.fps_den};
+        cam_index_path(c->filename, index_filename, sizeof(index_filename));
+        cam_pack_index_header(hdr, &info);
+        if(!(c->index = fopen(index_filename, "w")) || fwrite(hdr, sizeof(hdr), 1, c->index) != 1){
+            fprintf(stderr, "[%s] Index %s error %d, %s\n", c->addr, index_filename, errno, strerror(errno));
+            if(c->index) fclose(c->index);
+            c->index = NULL;
+        }
+    }
+    return 0;
+}
+
+// Function to time the frames whose last byte is now on disk
+static void frames_written(struct conn* c){
+    uint64_t now = now_us();
+    while(c->stamp_tail != c->stamp_head && c->stamps[c->stamp_tail % STAMP_RING].end <= c->disk_len){
+        cam_hist_add(&c->write_lat, now - c->stamps[c->stamp_tail % STAMP_RING].recv_us);
+        c->stamp_tail++;
+    }
+}
+
+// Function to hand the stream's write buffer to io_uring
+static void submit_buffer(struct conn* c){
+    struct uw_buf* b = c->wb;
+    c->wb = NULL;
+    // O_DIRECT writes whole blocks: the tail is padded, and the file truncated at the end
+    if(c->uw->direct){
+        size_t aligned = (b->len + UW_ALIGN - 1) & ~(size_t)(UW_ALIGN - 1);
+        memset(b->data + b->len, 0, aligned - b->len);
+        b->len = aligned;
+    }
+    // Writes may complete out of order: remember their order until the oldest is done
+    while(c->write_head - c->write_tail == WRITE_RING)
+        if(uw_reap(c->uw, 1) == -1) errno_exit("Io_uring_reap");
+    c->writes[c->write_head % WRITE_RING].end = b->off + b->len;
+    c->writes[c->write_head++ % WRITE_RING].done = 0;
+    c->inflight++;
+    uint64_t t0 = b->trace_ns = cam_trace_begin();
+    if(uw_submit(c->uw, b) == -1) errno_exit("Io_uring_submit");
+    cam_trace_span("submit", t0, c->trace_stream, c->frame.sequence);
+}
+
+// Function to copy payload into the stream's write buffer, submitting it once full
+static void stage_write(struct conn* c, const uint8_t* data, size_t len){
+    while(len){
+        if(!c->wb){
+            if(!(c->wb = uw_get(c->uw))) errno_exit("Write_buffer");
+            c->wb->fd = c->file_ds;
+            c->wb->owner = c;
+            c->wb->off = c->file_len;
+        }
+        size_t take = c->uw->buf_size - c->wb->len < len ? c->uw->buf_size - c->wb->len : len;
+        memcpy(c->wb->data + c->wb->len, data, take);
+        c->wb->len += take;
+        c->file_len += take;
+        data += take;
+        len -= take;
+        if(c->wb->len == c->uw->buf_size) submit_buffer(c);
+    }
+}
+
+// Function to write payload spans to the recording
+static void write_spans(struct conn* c, const struct iovec* iov, int iov_cnt){
+    if(c->uw){
+        for(int i = 0; i < iov_cnt; i++) stage_write(c, iov[i].iov_base, iov[i].iov_len);
+        return;
+    }
+    uint64_t t0 = cam_trace_begin();
+    ssize_t written = writev(c->file_ds, iov, iov_cnt);
+    if(written == -1) errno_exit("Write");
+    cam_trace_span("write", t0, c->trace_stream, c->frame.sequence);
+    c->file_len += written;
+    c->disk_len = c->file_len;
+    frames_written(c);
+}
+
+// Function to handle a client without session header: the first bytes are the filename,
+// up to the first non-printable byte (the JPEG start marker)
+static int start_legacy(struct conn* c, const uint8_t* data, size_t len, size_t* used){
+    size_t name_len = 0;
+    while(name_len < c->hdr_len && isprint(c->hdr[name_len])) name_len++;
+    if(name_len == c->hdr_len)
+        while(*used < len && name_len < MAX_FILE_LEN-1 && isprint(data[*used])) c->hdr[name_len++] = data[(*used)++];
+    memcpy(c->filename, c->hdr, name_len < MAX_FILE_LEN ? name_len : MAX_FILE_LEN-1);
+
+    c->state = CONN_LEGACY;
+    mjpeg_scan_init(&c->scan);
+    if(open_recording(c) == -1) return -1;
+
+    // Staged bytes after the filename already belong to the MJPEG stream
+    if(name_len < c->hdr_len){
+        struct iovec iov = {.iov_base = c->hdr + name_len, .iov_len = c->hdr_len - name_len};
+        write_spans(c, &iov, 1);
+        c->frame_count += mjpeg_count_soi(&c->scan, c->hdr + name_len, c->hdr_len - name_len);
+    }
+    return 0;
+}
+
+// Function to keep the first and last two bytes of the frame payload, to validate its markers
+static void track_marks(struct conn* c, const uint8_t* data, size_t take){
+    size_t off = c->frame.length - c->payload_left;
+    for(size_t i = 0; off + i < 2 && i < take; i++) c->marks[off + i] = data[i];
+    if(take >= 2) memcpy(c->marks + 2, data + take - 2, 2);
+    else if(take){
+        c->marks[2] = c->marks[3];
+        c->marks[3] = data[0];
+    }
+}
+
+// Function to finish the current frame. Latency assumes the client clock is ours (loopback).
+static void end_frame(struct conn* c){
+    c->frame_count++;
+    c->state = CONN_FRAME_HDR;
+    if(c->index){
+        uint8_t entry[CAM_INDEX_ENTRY_LEN];
+        struct cam_index_entry e = {.offset = c->frame_off, .timestamp_us = c->frame.timestamp_us,
+                                    .length = c->frame.length, .flags = c->frame.flags};
+        cam_pack_index_entry(entry, &e);
+        if(fwrite(entry, sizeof(entry), 1, c->index) != 1) errno_exit("Index_write");
+    }
+    c->frame_off += c->frame.length;
+    if(c->ring) cam_ring_written(c->ring, CAM_FRAME_HDR_LEN + c->frame.length);
+
+    cam_trace_arrive("frame", c->trace_frame, c->trace_stream, c->frame.sequence);
+    uint64_t now = now_us();
+    cam_hist_add(&c->latency, now > c->frame.timestamp_us ? now - c->frame.timestamp_us : 0);
+    // Time the write too, unless too many frames are waiting for it
+    if(c->stamp_head - c->stamp_tail < STAMP_RING){
+        c->stamps[c->stamp_head % STAMP_RING].end = c->frame_off;
+        c->stamps[c->stamp_head++ % STAMP_RING].recv_us = now;
+        frames_written(c);
+    }
+    if(c->vframe){
+        view_publish(c->vstream, c->vframe);
+        c->vframe = NULL;
+    }
+    if(!c->check) return;
+
+    if(c->frame.length < 4 || memcmp(c->marks, "\xFF\xD8\xFF\xD9", 4)) c->corrupt++;
+}
+
+// Function to consume a received chunk: headers are staged, payload is written to file.
+// Returns -1 on protocol error.
+static int parse_stream(struct conn* c, const uint8_t* data, size_t len){
+    struct iovec iov[MAX_IOV];
+    uint8_t ring_hdrs[MAX_IOV][CAM_FRAME_HDR_LEN];  // Frame headers stored in the ring, by span
+    int iov_cnt = 0;
+    size_t pos = 0;
+
+    while(pos < len){
+        size_t take;
+        switch(c->state){
+        case CONN_SESSION:
+            if(c->skip){
+                take = len - pos < c->skip ? len - pos : c->skip;
+                c->skip -= take;
+                pos += take;
+                if(!c->skip) c->state = CONN_FRAME_HDR;
+                break;
+            }
+            // The length field (first 8 bytes) tells how much of the header is known to this server
+            take = (c->hdr_len < 8 ? 8 : cam_session_staged(c->hdr)) - c->hdr_len;
+            if(take > len - pos) take = len - pos;
+            // The magic tells a framed client from a legacy one
+            if(c->hdr_len < 4){
+                size_t n = 4 - c->hdr_len < take ? 4 - c->hdr_len : take;
+                uint8_t magic[4];
+                cam_put32(magic, CAM_PROTO_MAGIC);
+                if(memcmp(data + pos, magic + c->hdr_len, n)){
+                    if(start_legacy(c, data, len, &pos) == -1) return -1;
+                    break;
+                }
+            }
+            memcpy(c->hdr + c->hdr_len, data + pos, take);
+            c->hdr_len += take;
+            pos += take;
+            if(c->hdr_len >= 8 && cam_session_len(c->hdr) == -1){
+                fprintf(stderr, "[%s] Unsupported protocol version %u\n", c->addr, cam_get16(c->hdr + 4));
+                return -1;
+            }
+            if(c->hdr_len < 8 || c->hdr_len < (size_t)cam_session_staged(c->hdr)) break;
+
+            cam_unpack_session(c->hdr, &c->session);
+            c->start_us = now_us();
+            c->skip = cam_session_len(c->hdr) - cam_session_staged(c->hdr);
+            c->hdr_len = 0;
+            if(!c->skip) c->state = CONN_FRAME_HDR;
+            strcpy(c->filename, c->session.filename);
+            c->trace_stream = cam_trace_stream(c->session.filename);
+            printf("[%s] Session: %ux%u %.4s @ %u/%u fps\n", c->addr, c->session.width, c->session.height,
+                (const char*)&c->session.pixelformat, c->session.fps_num, c->session.fps_den);
+            if(open_recording(c) == -1) return -1;
+            break;
+
+        case CONN_FRAME_HDR:
+            take = CAM_FRAME_HDR_LEN - c->hdr_len;
+            if(take > len - pos) take = len - pos;
+            memcpy(c->hdr + c->hdr_len, data + pos, take);
+            c->hdr_len += take;
+            pos += take;
+            if(c->hdr_len < CAM_FRAME_HDR_LEN) break;
+
+            c->hdr_len = 0;
+            c->trace_frame = cam_trace_begin();
+            if(cam_unpack_frame(c->hdr, &c->frame) == -1){
+                fprintf(stderr, "[%s] Corrupt frame header after frame %d\n", c->addr, c->frame_count);
+                return -1;
+            }
+            // Detect frames lost before reaching the server (e.g. dropped by the driver)
+            // A gated gap may also hide frames the driver dropped: they count as gated
+            if(c->frame_count && c->frame.sequence > c->next_seq){
+                if(c->frame.flags & CAM_FRAME_GATED) c->gated += c->frame.sequence - c->next_seq;
+                else c->dropped += c->frame.sequence - c->next_seq;
+            }
+            c->next_seq = c->frame.sequence + 1;
+            c->payload_left = c->frame.length;
+            c->state = CONN_PAYLOAD;
+            // A ring keeps the frame headers, and no frame straddles two segments
+            if(c->ring){
+                if(!cam_ring_fits(c->ring, CAM_FRAME_HDR_LEN + c->frame.length)){
+                    if(CAM_FRAME_HDR_LEN + c->frame.length > c->ring->seg_size){
+                        fprintf(stderr, "[%s] Frame of %u bytes larger than a ring segment\n", c->addr, c->frame.length);
+                        return -1;
+                    }
+                    // Spans pending belong to the full segment
+                    if(iov_cnt) write_spans(c, iov, iov_cnt);
+                    iov_cnt = 0;
+                    if(cam_ring_advance(c->ring) == -1) errno_exit("Ring_segment");
+                }
+                if(iov_cnt == MAX_IOV){
+                    write_spans(c, iov, iov_cnt);
+                    iov_cnt = 0;
+                }
+                memcpy(ring_hdrs[iov_cnt], c->hdr, CAM_FRAME_HDR_LEN);
+                iov[iov_cnt].iov_base = ring_hdrs[iov_cnt];
+                iov[iov_cnt++].iov_len = CAM_FRAME_HDR_LEN;
+                c->frame_off += CAM_FRAME_HDR_LEN;
+            }
+            // Frames are only kept while someone is watching
+            if(c->vstream && view_stream_watched(c->vstream) && c->frame.length &&
+               !(c->vframe = view_frame_alloc(c->frame.length))) errno_exit("Out of memory");
+            if(c->payload_left) break;
+            // Fall through - empty frame
+        case CONN_PAYLOAD:
+            take = len - pos < c->payload_left ? len - pos : c->payload_left;
+            if(take){
+                if(c->check) track_marks(c, data + pos, take);
+                if(c->vframe) memcpy(c->vframe->data + c->frame.length - c->payload_left, data + pos, take);
+                if(iov_cnt == MAX_IOV){
+                    write_spans(c, iov, iov_cnt);
+                    iov_cnt = 0;
+                }
+                iov[iov_cnt].iov_base = (void*)(data + pos);
+                iov[iov_cnt++].iov_len = take;
+            }
+            c->payload_left -= take;
+            pos += take;
+            if(!c->payload_left) end_frame(c);
+            break;
+
+        case CONN_LEGACY:
+            iov[iov_cnt].iov_base = (void*)(data + pos);
+            iov[iov_cnt++].iov_len = len - pos;
+            // Count frames by detecting MJPEG start marker (0xFF 0xD8), also across chunks
+            c->frame_count += mjpeg_count_soi(&c->scan, data + pos, len - pos);
+            pos = len;
+            break;
+        }
+    }
+
+    if(iov_cnt) write_spans(c, iov, iov_cnt);
+    return 0;
+}
+
+// Function to count the frames of a legacy stream written by splice(), by mapping
+// the new region of the recording. Runs once SCAN_BATCH bytes are pending, or at the end.
+static void count_spliced(struct conn* c, int flush){
+    off_t start = c->scan.offset;
+    if(c->file_len == start || (!flush && c->file_len - start < SCAN_BATCH)) return;
+
+    // mmap() needs a page-aligned offset
+    off_t map_start = start & ~((off_t)sysconf(_SC_PAGESIZE) - 1);
+    size_t map_len = c->file_len - map_start;
+    int map_ds = open(c->filename, O_RDONLY);
+    if(map_ds == -1) errno_exit("Open");
+    uint8_t* map = mmap(NULL, map_len, PROT_READ, MAP_SHARED, map_ds, map_start);
+    if(map == MAP_FAILED) errno_exit("mmap");
+    c->frame_count += mjpeg_count_soi(&c->scan, map + (start - map_start), c->file_len - start);
+    munmap(map, map_len);
+    close(map_ds);
 }
 
-// Function to count frames by detecting MJPEG start marker (0xFF 0xD8)
-static void count_frame(int* frame_count, const char* buffer,int rec_bytes){
-    char prev_byte=0;
-    for (int i = 0; i < rec_bytes; i++) {
-        if (prev_byte == (char)0xFF && buffer[i] == (char)0xD8) {
-            (*frame_count)++;
+// Function to move payload from the socket to the file through the pipe, without copying
+// it to user space: returns the bytes moved, 0 at end of stream, -1 on error
+static ssize_t splice_payload(struct conn* c){
+    size_t want = c->pipe_size;
+    if(c->state == CONN_PAYLOAD && c->payload_left < want) want = c->payload_left;
+
+    ssize_t moved = splice(c->client_ds, NULL, c->pipe_ds[1], NULL, want, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+    if(moved <= 0) return moved;
+
+    // Always empty the pipe, so the next splice() from the socket has room
+    uint64_t t0 = cam_trace_begin();
+    for(ssize_t left = moved; left > 0;){
+        ssize_t out = splice(c->pipe_ds[0], NULL, c->file_ds, NULL, left, SPLICE_F_MOVE);
+        if(out == -1){
+            if(errno == EINTR || errno == EAGAIN) continue;
+            errno_exit("Splice");
         }
-        prev_byte = buffer[i];
+        left -= out;
+    }
+    cam_trace_span("write", t0, c->trace_stream, c->frame.sequence);
+    c->file_len += moved;
+    c->disk_len = c->file_len;
+
+    if(c->state == CONN_LEGACY) count_spliced(c, 0);
+    else if(!(c->payload_left -= moved)){
+        // The payload never reached user space: read its markers back from the page cache
+        if(c->check && c->frame.length >= 4 &&
+           (pread(c->file_ds, c->marks, 2, c->file_len - c->frame.length) != 2 ||
+            pread(c->file_ds, c->marks + 2, 2, c->file_len - 2) != 2)) errno_exit("Pread");
+        end_frame(c);
     }
+    return moved;
+}
+
+// Function to size a recv(): in splice mode, headers are read exactly so that payload
+// stays in the socket for splice()
+static size_t recv_len(const struct server* srv, const struct conn* c){
+    if(!srv->splice) return srv->buf_size;
+    if(c->state == CONN_FRAME_HDR) return CAM_FRAME_HDR_LEN - c->hdr_len;
+    if(c->skip) return c->skip < srv->buf_size ? c->skip : srv->buf_size;
+    return (c->hdr_len < 8 ? CAM_SESSION_MIN_LEN : cam_session_staged(c->hdr)) - c->hdr_len;
+}
+
+// Function to append a metrics row: <scope> is "stream" or "server"
+static void write_metrics(FILE* f, const char* scope, const char* addr, const char* filename, unsigned long long frames,
+                          unsigned long long bytes, unsigned long long missing, unsigned long long corrupt,
+                          double seconds, const struct cam_hist* h){
+    fprintf(f, "%s,%s,%s,%llu,%llu,%llu,%llu,%.3f,%llu,%llu,%llu,%llu\n", scope, addr, filename, frames, bytes, missing, corrupt, seconds,
+        (unsigned long long)cam_hist_percentile(h, 0.5), (unsigned long long)cam_hist_percentile(h, 0.99),
+        (unsigned long long)cam_hist_percentile(h, 0.999), (unsigned long long)h->max);
+    fflush(f);
+}
+
+// Function to add a finished stream to the metrics file
+static void record_metrics(struct server* srv, struct conn* c){
+    if(!srv->metrics || c->state == CONN_LEGACY || !c->start_us) return;
+    uint64_t now = now_us();
+    if(!srv->start_us || c->start_us < srv->start_us) srv->start_us = c->start_us;
+
+    srv->streams++;
+    srv->frames += c->frame_count;
+    srv->bytes += c->file_len;
+    srv->missing += c->dropped;
+    srv->corrupt += c->corrupt;
+    cam_hist_merge(&srv->latency, &c->latency);
+
+    write_metrics(srv->metrics, "stream", c->addr, c->filename, c->frame_count, c->file_len, c->dropped, c->corrupt,
+        (now - c->start_us) / 1e6, &c->latency);
+    write_metrics(srv->metrics, "server", "-", "-", srv->frames, srv->bytes, srv->missing, srv->corrupt,
+        (now - srv->start_us) / 1e6, &srv->latency);
+}
+
+// Function to print the stage latencies of a stream: since the previous summary
+// (<interval> s, periodic) or since it started
+static void print_stages(struct conn* c, double interval){
+    struct cam_hist since[2];
+    const struct cam_hist* h[2] = {&c->latency, &c->write_lat};
+    char lat[2][64];
+    int frames = c->frame_count, dropped = c->dropped;
+    if(interval > 0){
+        cam_hist_since(&since[0], &c->latency, &c->last[0]);
+        cam_hist_since(&since[1], &c->write_lat, &c->last[1]);
+        h[0] = &since[0];
+        h[1] = &since[1];
+        c->last[0] = c->latency;
+        c->last[1] = c->write_lat;
+        frames -= c->last_frames;
+        dropped -= c->last_dropped;
+        c->last_frames = c->frame_count;
+        c->last_dropped = c->dropped;
+    }
+    cam_hist_format(lat[0], sizeof(lat[0]), h[0]);
+    cam_hist_format(lat[1], sizeof(lat[1]), h[1]);
+    if(interval > 0) printf("[%s] %s: %d frames (%.1f fps), %d missing in %.1f s", c->addr, c->filename, frames, frames / interval, dropped, interval);
+    else printf("[%s] %s: %d frames, %d missing", c->addr, c->filename, frames, dropped);
+    printf("; p50/p99/max us: capture>recv %s, recv>written %s\n", lat[0], lat[1]);
+}
+
+// Function to print the periodic summary of every framed stream (-i)
+static void stats_tick(struct server* srv){
+    uint64_t expirations, now = now_us();
+    if(read(srv->stats_ds, &expirations, sizeof(expirations)) == -1 && errno != EAGAIN) errno_exit("Timerfd_read");
+    double interval = (now - srv->stats_us) / 1e6;
+    srv->stats_us = now;
+    for(int i = 0; i < MAX_STREAMS; i++){
+        struct conn* c = srv->conns[i];
+        if(c && c->recording && c->state != CONN_LEGACY) print_stages(c, interval);
+    }
+}
+
+// Function to dump the stage latencies of every framed stream since its start (SIGUSR1)
+static void stats_dump(struct server* srv){
+    struct cam_hist total[2];
+    char lat[2][64];
+    int streams = 0;
+    cam_hist_init(&total[0]);
+    cam_hist_init(&total[1]);
+    printf("Stage latencies since the start of each stream:\n");
+    for(int i = 0; i < MAX_STREAMS; i++){
+        struct conn* c = srv->conns[i];
+        if(!c || !c->recording || c->state == CONN_LEGACY) continue;
+        print_stages(c, 0);
+        cam_hist_merge(&total[0], &c->latency);
+        cam_hist_merge(&total[1], &c->write_lat);
+        streams++;
+    }
+    cam_hist_format(lat[0], sizeof(lat[0]), &total[0]);
+    cam_hist_format(lat[1], sizeof(lat[1]), &total[1]);
+    printf("All %d streams: p50/p99/max us: capture>recv %s, recv>written %s\n", streams, lat[0], lat[1]);
+}
+
+// Function to handle the signals read from the signalfd: SIGUSR1 dumps the stage latencies,
+// SIGINT/SIGTERM (only caught when tracing) end the server, writing the trace at exit
+static void read_signal(struct server* srv){
+    struct signalfd_siginfo si;
+    CLEAR(si);
+    if(read(srv->signal_ds, &si, sizeof(si)) == -1 && errno != EAGAIN) errno_exit("Signalfd_read");
+    if(si.ssi_signo == SIGUSR1) stats_dump(srv);
+    else if(si.ssi_signo){
+        printf("Stopping on signal %u\n", si.ssi_signo);
+        exit(EXIT_SUCCESS);
+    }
+}
+
+// Function to finalize the recording of a closed connection, once all its data is on disk
+static void finish_recording(struct server* srv, struct conn* c){
+    if(c->recording){
+        if(srv->splice && c->state == CONN_LEGACY) count_spliced(c, 1);
+        // Drop the O_DIRECT padding of the last block
+        if(c->uw && c->uw->direct && ftruncate(c->file_ds, c->file_len) == -1) errno_exit("Ftruncate");
+        if(c->ring){
+            if(cam_ring_close(c->ring) == -1) perror("Ring_close");
+            free(c->ring);
+        }
+        else close(c->file_ds);
+        if(c->index && fclose(c->index) == EOF) perror("Index_close");
+        printf("[%s] File %s saved successfully. Frames received: %d\n", c->addr, c->filename, c->frame_count);
+        if(c->dropped) printf("[%s] Frames missing from the sequence: %d\n", c->addr, c->dropped);
+        if(c->gated) printf("[%s] Frames left out by the client's motion gate: %d\n", c->addr, c->gated);
+        if(c->corrupt) printf("[%s] Frames without JPEG start/end markers: %d\n", c->addr, c->corrupt);
+        if(c->state == CONN_PAYLOAD || c->hdr_len) printf("[%s] Stream ended in the middle of a frame\n", c->addr);
+        if(c->state != CONN_LEGACY) print_stages(c, 0);
+        record_metrics(srv, c);
+        // Convert in the background if <-c> flag is set
+        if(srv->convert && !c->ring){
+            char output_filename[MAX_FILE_LEN];
+            change_extension(c->filename, output_filename, srv->transcode ? ".mp4" : ".mkv");
+            conv_submit(&srv->conv, c->filename, output_filename);
+        }
+    }
+    free(c);
+}
+
+// Function to receive io_uring write completions. Writes of a stream may complete in
+// any order: a frame counts as written once every buffer up to its last byte is.
+static void write_done(void* ctx, const struct uw_buf* b, int res){
+    struct conn* c = b->owner;
+    if(res < 0){
+        errno = -res;
+        errno_exit("Write");
+    }
+    // Buffers cover consecutive, aligned stretches of the recording: their number is unique in the stream
+    cam_trace_async("disk write", b->trace_ns, (uint64_t)c->trace_stream << 32 | b->off / c->uw->buf_size, c->trace_stream, -1);
+    // Buffers cover consecutive stretches of the recording: the one ending at b's end is b
+    for(unsigned int k = c->write_tail; k != c->write_head; k++)
+        if(c->writes[k % WRITE_RING].end == (uint64_t)b->off + b->len){
+            c->writes[k % WRITE_RING].done = 1;
+            break;
+        }
+    // The recording is on disk up to the end of the completed prefix
+    while(c->write_tail != c->write_head && c->writes[c->write_tail % WRITE_RING].done)
+        c->disk_len = c->writes[c->write_tail++ % WRITE_RING].end;
+    frames_written(c);
+    if(!--c->inflight && c->closing) finish_recording(ctx, c);
+}
+
+// Function to close a client connection and finalize its recording
+static void close_conn(struct server* srv, struct conn* c){
+    if(c->udp){
+        // Write the complete frames still waiting behind a missing one
+        udp_reasm_flush(c->udp);
+        if(c->udp->lost) printf("[%s] UDP frames lost: %llu (%llu incomplete)\n", c->addr, c->udp->lost, c->udp->incomplete);
+        if(c->udp->late || c->udp->dups) printf("[%s] UDP datagrams too late: %llu, duplicate: %llu\n", c->addr, c->udp->late, c->udp->dups);
+        udp_reasm_free(c->udp);
+        free(c->udp);
+        c->udp = NULL;
+    }
+    if(c->pipe_ds[0] != -1){
+        close(c->pipe_ds[0]);
+        close(c->pipe_ds[1]);
+    }
+    view_frame_put(c->vframe);
+    if(c->vstream) view_stream_close(c->vstream);
+
+    // Closing the socket also removes it from the epoll set
+    if(c->client_ds != -1) close(c->client_ds);
+    for(int i = 0; i < MAX_STREAMS; i++) if(srv->conns[i] == c) srv->conns[i] = NULL;
+    srv->num_conn--;
+
+    // With io_uring, the recording is finalized by the last write completion
+    if(c->wb) submit_buffer(c);
+    if(c->inflight){
+        c->closing = 1;
+        return;
+    }
+    finish_recording(srv, c);
+}
+
+// Function to set up the state of a new stream, with the server's settings
+static struct conn* new_conn(struct server* srv, int client_ds){
+    struct conn* c = calloc(1, sizeof(*c));
+    if(!c) errno_exit("Out of memory");
+    c->client_ds = client_ds;
+    c->file_ds = -1;
+    c->pipe_ds[0] = c->pipe_ds[1] = -1;
+    c->check = srv->metrics != NULL;
+    c->indexed = srv->index;
+    c->ring_segments = srv->ring_segments;
+    c->ring_seg_size = srv->ring_seg_size;
+    c->view = srv->view;
+    c->uw = srv->uring_depth ? &srv->uw : NULL;
+    return c;
+}
+
+// Function to add a stream to the server's table
+static void add_conn(struct server* srv, struct conn* c){
+    for(int i = 0; i < MAX_STREAMS; i++) if(!srv->conns[i]){ srv->conns[i] = c; break; }
+    srv->num_conn++;
+}
+
+// Function to accept every pending connection (the listening socket is edge-triggered)
+static void accept_conns(struct server* srv){
+    while(srv->num_conn < MAX_STREAMS){
+        struct sockaddr_in sClient;
+        CLEAR(sClient);
+        socklen_t sAddrLen = sizeof(sClient);
+
+        int client_ds = accept4(srv->socket_ds, (struct sockaddr *) &sClient, &sAddrLen, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if(client_ds == -1){
+            if(errno == EAGAIN || errno == EWOULDBLOCK){
+                srv->accept_pending = 0;
+                return;
+            }
+            if(errno == EINTR || errno == ECONNABORTED) continue;
+            errno_exit("Accept");
+        }
+
+        struct conn* c = new_conn(srv, client_ds);
+        if(srv->splice){
+            if(pipe2(c->pipe_ds, O_NONBLOCK | O_CLOEXEC) == -1) errno_exit("Pipe");
+            // A larger pipe moves more data per splice() pair; keep the default if refused
+            int size = fcntl(c->pipe_ds[1], F_SETPIPE_SZ, PIPE_SIZE);
+            c->pipe_size = size > 0 ? size : fcntl(c->pipe_ds[1], F_GETPIPE_SZ);
+        }
+        inet_ntop(AF_INET, &sClient.sin_addr, c->addr, sizeof(c->addr));
+
+        struct epoll_event ev;
+        CLEAR(ev);
+        ev.events = EPOLLIN | EPOLLRDHUP | EPOLLET;
+        ev.data.ptr = c;
+        if(epoll_ctl(srv->epoll_ds, EPOLL_CTL_ADD, client_ds, &ev) == -1) errno_exit("Epoll_ctl");
+
+        add_conn(srv, c);
+        printf("Connection received from %s (%d/%d streams)\n", c->addr, srv->num_conn, MAX_STREAMS);
+    }
+    // Leave the rest in the listen() backlog until a stream ends
+    srv->accept_pending = 1;
+}
+
+// Function to receive a frame put together by the UDP reassembly
+static void udp_deliver(void* ctx, const uint8_t* frame, size_t len){
+    struct conn* c = ctx;
+    if(!c->failed && parse_stream(c, frame, len) == -1) c->failed = 1;
+}
+
+// Function to find the UDP stream a datagram belongs to
+static struct conn* find_udp(struct server* srv, uint32_t stream, const struct sockaddr_in* from){
+    for(int i = 0; i < MAX_STREAMS; i++){
+        struct conn* c = srv->conns[i];
+        if(c && c->udp && c->stream == stream && c->peer.sin_addr.s_addr == from->sin_addr.s_addr && c->peer.sin_port == from->sin_port)
+            return c;
+    }
+    return NULL;
+}
+
+// Function to start a UDP stream on its (first) session datagram
+static void start_udp(struct server* srv, const struct cam_udp_hdr* h, const struct sockaddr_in* from, const uint8_t* body, size_t len){
+    if(len < CAM_SESSION_MIN_LEN || cam_session_len(body) == -1 || (size_t)cam_session_len(body) > len) return;
+    if(srv->num_conn == MAX_STREAMS) return;     // The client keeps repeating its session: it gets in once a stream ends
+
+    struct conn* c = new_conn(srv, -1);
+    if(!(c->udp = malloc(sizeof(*c->udp)))) errno_exit("Out of memory");
+    udp_reasm_init(c->udp, srv->udp_deadline_us, udp_deliver, c);
+    c->stream = h->stream;
+    c->peer = *from;
+    c->last_rx_us = now_us();
+    inet_ntop(AF_INET, &from->sin_addr, c->addr, sizeof(c->addr));
+    add_conn(srv, c);
+    printf("UDP stream %08x from %s (%d/%d streams)\n", c->stream, c->addr, srv->num_conn, MAX_STREAMS);
+    if(parse_stream(c, body, len) == -1) c->failed = 1;
+}
+
+// Function to drain the UDP socket, UDP_BATCH datagrams per recvmmsg()
+static void read_udp(struct server* srv){
+    struct mmsghdr msgs[UDP_BATCH];
+    struct iovec iov[UDP_BATCH];
+    struct sockaddr_in from[UDP_BATCH];
+
+    for(int budget = READ_BUDGET; budget > 0; budget--){
+        CLEAR(msgs);
+        for(int i = 0; i < UDP_BATCH; i++){
+            iov[i].iov_base = srv->udp_buf + (size_t)i * CAM_UDP_MAX_DGRAM;
+            iov[i].iov_len = CAM_UDP_MAX_DGRAM;
+            msgs[i].msg_hdr.msg_iov = &iov[i];
+            msgs[i].msg_hdr.msg_iovlen = 1;
+            msgs[i].msg_hdr.msg_name = &from[i];
+            msgs[i].msg_hdr.msg_namelen = sizeof(from[i]);
+        }
+        uint64_t t0 = cam_trace_begin();
+        int n = recvmmsg(srv->udp_ds, msgs, UDP_BATCH, MSG_DONTWAIT, NULL);
+        if(n == -1){
+            if(errno == EAGAIN || errno == EWOULDBLOCK) return;
+            if(errno == EINTR) continue;
+            errno_exit("Recvmmsg");
+        }
+        uint64_t now = now_us();
+        for(int i = 0; i < n; i++){
+            const uint8_t* dgram = iov[i].iov_base;
+            size_t len = msgs[i].msg_len;
+            struct cam_udp_hdr h;
+            if((msgs[i].msg_hdr.msg_flags & MSG_TRUNC) || cam_unpack_udp(dgram, len, &h) == -1) continue;
+
+            struct conn* c = find_udp(srv, h.stream, &from[i]);
+            if(!c){
+                // Fragments of a stream whose session has not arrived yet are lost
+                if(h.type == CAM_UDP_SESSION) start_udp(srv, &h, &from[i], dgram + CAM_UDP_HDR_LEN, len - CAM_UDP_HDR_LEN);
+                continue;
+            }
+            c->last_rx_us = now;
+            if(h.type == CAM_UDP_FRAME && !c->failed) udp_reasm_add(c->udp, &h, dgram + CAM_UDP_HDR_LEN, len - CAM_UDP_HDR_LEN, now);
+            else if(h.type == CAM_UDP_END){
+                close_conn(srv, c);
+                if(srv->accept_pending) accept_conns(srv);
+            }
+        }
+        cam_trace_span("recv", t0, 0, -1);
+        if(n < UDP_BATCH) return;
+    }
+}
+
+// Function to run the UDP deadlines: frames that cannot complete any more, and silent streams
+static void tick_udp(struct server* srv){
+    uint64_t expirations, now = now_us();
+    if(read(srv->tick_ds, &expirations, sizeof(expirations)) == -1 && errno != EAGAIN) errno_exit("Timerfd_read");
+    for(int i = 0; i < MAX_STREAMS; i++){
+        struct conn* c = srv->conns[i];
+        if(!c || !c->udp) continue;
+        udp_reasm_expire(c->udp, now);
+        if(c->failed || now - c->last_rx_us > UDP_IDLE_US){
+            if(!c->failed) printf("[%s] UDP stream %08x timed out\n", c->addr, c->stream);
+            close_conn(srv, c);
+            if(srv->accept_pending) accept_conns(srv);
+        }
+    }
+}
+
+// Function to trace the reception of a chunk of a stream, labelled with the frame it ends in
+static void trace_recv(const struct conn* c, uint64_t start){
+    cam_trace_span("recv", start, c->trace_stream, c->frame_count || c->state == CONN_PAYLOAD ? (int64_t)c->frame.sequence : -1);
+}
+
+// Function to drain a client socket: returns 1 if the connection is done
+static int read_conn(struct server* srv, struct conn* c){
+    char* buffer = srv->buffer;
+    c->ready = 0;
+
+    for(int budget = READ_BUDGET; budget > 0; budget--){
+        // Receive frames from client and write them to file
+        ssize_t rec_bytes;
+        uint64_t t0 = cam_trace_begin();
+        if(srv->splice && c->recording && (c->state == CONN_PAYLOAD || c->state == CONN_LEGACY)){
+            if((rec_bytes = splice_payload(c)) > 0){
+                trace_recv(c, t0);
+                continue;
+            }
+        }
+        else if((rec_bytes = recv(c->client_ds, buffer, recv_len(srv, c), 0)) > 0){
+            if(parse_stream(c, (const uint8_t*)buffer, rec_bytes) == -1) return 1;
+            trace_recv(c, t0);
+            continue;
+        }
+
+        if(rec_bytes == 0) return 1;
+        if(errno == EAGAIN || errno == EWOULDBLOCK) return 0;
+        if(errno == EINTR) continue;
+        fprintf(stderr, "[%s] Recv error %d, %s\n", c->addr, errno, strerror(errno));
+        return 1;
+    }
+    // Out of budget: come back after serving the other streams
+    c->ready = 1;
+    return 0;
 }
 #pragma endregion
 
+static void usage(void){
+    printf("Usage: ./Cserver <port> [-c|-x [-j <workers>] [-n <nice>] [-J <journal>]] [-s] [-b <buffer_size>] [-u <depth> [-D]] [-I] [-r <MB>[:<segments>]] [-H <http_port>] [-U <deadline_ms>] [-i <sec>] [-t <trace.json>] [-m <metrics.csv>]\n"
+           "  -c  convert each recording to Matroska in the background when its stream ends: the JPEG frames\n"
+           "      are remuxed unchanged, timed by their capture timestamps (needs the frame index)\n"
+           "  -x  convert each recording to H.264 MP4 instead (ffmpeg re-encode, much slower)\n"
+           "  -j  concurrent conversions (default: one per core)\n"
+           "  -n  niceness of the conversions (default %d)\n"
+           "  -J  conversion journal, to resume pending conversions after a restart (default %s)\n"
+           "  -s  zero-copy ingest: splice() payload from the socket to the file\n"
+           "  -b  receive buffer size in bytes for the copy path (default %d)\n"
+           "  -u  io_uring storage: asynchronous %d KiB writes, <depth> in flight (copy path)\n"
+           "  -D  with -u, write with O_DIRECT (bypass the page cache)\n"
+           "  -I  do not write the frame index next to recordings (<file>.idx)\n"
+           "  -r  record continuous streams (Cclient <num_frame> -1) in a preallocated ring of <MB> per camera,\n"
+           "      <segments> segments (default %d) reused oldest first: <file>.ring, read back with Cindex ring\n"
+           "  -H  serve the live streams to viewers over HTTP (MJPEG) on <http_port>\n"
+           "  -U  also receive UDP streams (Cclient -U) on <port>; frames not complete <deadline_ms> after their\n"
+           "      first datagram are lost and left out of the recording\n"
+           "  -i  print the frames, missing frames and stage latencies of every stream each <sec> seconds\n"
+           "      (since the start of each stream: kill -USR1 <pid>)\n"
+           "  -t  trace every frame (recv, write...) to a Chrome trace JSON file, written when the server\n"
+           "      is stopped with Ctrl-C or SIGTERM\n"
+           "  -m  append per-stream metrics (frames, MB, missing/corrupt frames, latency percentiles) to a CSV file\n",
+           CONV_NICE, CONV_JOURNAL, BUFFER_SIZE, URING_BUF_SIZE >> 10, RING_SEGMENTS);
+    exit(0);
+}
+
 int main(int argc, char *argv[]){
     int port;
-    char convert=0;
+    struct server srv;
+    CLEAR(srv);
+    srv.buf_size = BUFFER_SIZE;
+    srv.index = 1;
+    srv.udp_ds = srv.tick_ds = -1;
 
-    if(argc < 2){
-        printf("Usage: ./Cserver <port> [-c]\n");
-        exit(0);
-    }
+    if(argc < 2) usage();
     sscanf(argv[1], "%d", &port);
-    if(argc>2 && !strcmp(argv[2],"-c")) convert=1;
+
+    int opt;
+    optind = 2;
+    const char* metrics = NULL;
+    const char* journal = CONV_JOURNAL;
+    int conv_workers = 0, conv_nice = CONV_NICE;
+    int direct = 0, view_port = 0, udp = 0, udp_deadline_ms = 0;
+    double stats_interval = 0;
+    const char* trace = NULL;
+    unsigned long ring_mb = 0;
+    while((opt = getopt(argc, argv, "cxj:n:J:sb:u:DIr:H:U:i:t:m:")) != -1){
+        switch(opt){
+        case 'c': srv.convert = 1; break;
+        case 'x': srv.convert = srv.transcode = 1; break;
+        case 'j': conv_workers = atoi(optarg); break;
+        case 'n': conv_nice = atoi(optarg); break;
+        case 'J': journal = optarg; break;
+        case 's': srv.splice = 1; break;
+        case 'b': srv.buf_size = strtoul(optarg, NULL, 0); break;
+        case 'm': metrics = optarg; break;
+        case 'u': srv.uring_depth = atoi(optarg); break;
+        case 'D': direct = 1; break;
+        case 'I': srv.index = 0; break;
+        case 'r':
+            srv.ring_segments = RING_SEGMENTS;
+            if(sscanf(optarg, "%lu:%u", &ring_mb, &srv.ring_segments) < 1) usage();
+            break;
+        case 'H': view_port = atoi(optarg); break;
+        case 'i': stats_interval = atof(optarg); break;
+        case 't': trace = optarg; break;
+        case 'U': udp_deadline_ms = atoi(optarg); udp = 1; break;
+        default: usage();
+        }
+    }
+    if(srv.buf_size < CAM_SESSION_HDR_LEN) srv.buf_size = CAM_SESSION_HDR_LEN;
+    if(srv.uring_depth && srv.splice){
+        fprintf(stderr, "io_uring storage uses the copy path, ignoring -s\n");
+        srv.splice = 0;
+    }
+    if(view_port && srv.splice){
+        // Viewers need the payload in user space
+        fprintf(stderr, "Live viewing uses the copy path, ignoring -s\n");
+        srv.splice = 0;
+    }
+    if(srv.ring_segments){
+        // Whole blocks per segment; the frame headers are written with the payload
+        srv.ring_seg_size = ((uint64_t)ring_mb << 20) / (srv.ring_segments ? srv.ring_segments : 1) & ~(uint64_t)4095;
+        if(!srv.ring_segments || srv.ring_segments > CAM_RING_MAX_SEGMENTS || srv.ring_seg_size < CAM_RING_MIN_SEGMENT){
+            fprintf(stderr, "Ring of %lu MB in %u segments: segments must be 1-%d, of at least %u MB\n",
+                ring_mb, srv.ring_segments, (int)CAM_RING_MAX_SEGMENTS, CAM_RING_MIN_SEGMENT >> 20);
+            exit(EXIT_FAILURE);
+        }
+        if(srv.splice){
+            fprintf(stderr, "Ring recording uses the copy path, ignoring -s\n");
+            srv.splice = 0;
+        }
+    }
+
+    // Keep the log readable when stdout is redirected
+    setvbuf(stdout, NULL, _IOLBF, 0);
+
+    // SIGUSR1 dumps the stage latencies: blocked before any thread starts, read from a signalfd.
+    // When tracing, SIGINT/SIGTERM go through it too, so that the trace is written on the way out.
+    sigset_t sigs;
+    sigemptyset(&sigs);
+    sigaddset(&sigs, SIGUSR1);
+    if(trace){
+        if(cam_trace_open(trace, "Cserver") == -1) errno_exit(trace);
+        cam_trace_thread("event loop");
+        sigaddset(&sigs, SIGINT);
+        sigaddset(&sigs, SIGTERM);
+    }
+    if(sigprocmask(SIG_BLOCK, &sigs, NULL) == -1) errno_exit("Sigprocmask");
+    if((srv.signal_ds = signalfd(-1, &sigs, SFD_NONBLOCK | SFD_CLOEXEC)) == -1) errno_exit("Signalfd");
+    srv.stats_ds = -1;
+    if(stats_interval > 0){
+        uint64_t ns = stats_interval * 1e9;
+        struct itimerspec its = {.it_interval = {ns / 1000000000, ns % 1000000000}, .it_value = {ns / 1000000000, ns % 1000000000}};
+        if((srv.stats_ds = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC)) == -1) errno_exit("Timerfd_create");
+        if(timerfd_settime(srv.stats_ds, 0, &its, NULL) == -1) errno_exit("Timerfd_settime");
+        srv.stats_us = now_us();
+    }
+
+    if(metrics){
+        if(!(srv.metrics = fopen(metrics, "a"))) errno_exit(metrics);
+        if(!ftell(srv.metrics))
+            fprintf(srv.metrics, "scope,addr,filename,frames,bytes,missing,corrupt,seconds,lat_p50_us,lat_p99_us,lat_p999_us,lat_max_us\n");
+    }
+
+    // Conversions run on a pool of worker threads, remuxing or each waiting for its ffmpeg
+    if(srv.convert){
+        if(conv_start(&srv.conv, conv_workers, conv_nice, journal) == -1) errno_exit("Conversion_queue");
+        printf("%s conversion: %d worker(s), nice %d, journal %s\n", srv.transcode ? "MP4" : "Matroska",
+               srv.conv.workers, conv_nice, journal);
+    }
     
+    if(srv.ring_segments)
+        printf("Continuous streams: ring of %u segments of %.1f MB per camera\n", srv.ring_segments, srv.ring_seg_size / 1e6);
+
+    if(view_port){
+        if(!(srv.view = view_start(view_port))) errno_exit("Viewer_socket");
+        printf("Live streams for viewers at http://<host>:%d/\n", view_port);
+    }
+
+    // io_uring storage, with write() as fallback on kernels without it
+    if(srv.uring_depth){
+        if(uw_init(&srv.uw, srv.uring_depth, URING_BUF_SIZE, srv.uring_depth + MAX_STREAMS, write_done, &srv) == -1){
+            fprintf(stderr, "io_uring unavailable (error %d, %s), using write()\n", errno, strerror(errno));
+            uw_close(&srv.uw);
+            srv.uring_depth = 0;
+        }
+        srv.uw.direct = direct;
+    }
+
     // Create socket
     int socket_ds=-1;
-    if ((socket_ds = socket(AF_INET, SOCK_STREAM, 0)) == -1) errno_exit("Socket");
+    if ((socket_ds = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0)) == -1) errno_exit("Socket");
 
     // Enable address reuse
     int reuse = 1;
     if (setsockopt(socket_ds, SOL_SOCKET, SO_REUSEADDR, (const char*)&reuse, sizeof(reuse)) < 0) errno_exit("Setsockopt(SO_REUSEADDR)");
+    // Allow one Cserver per core on the same port
+    if (setsockopt(socket_ds, SOL_SOCKET, SO_REUSEPORT, (const char*)&reuse, sizeof(reuse)) < 0) errno_exit("Setsockopt(SO_REUSEPORT)");
 
     // Bind socket to localhost:<port> 
     struct  sockaddr_in sin;
@@ -82,59 +1198,127 @@ int main(int argc, char *argv[]){
 
     // Start listening for incoming connections 
     if(listen(socket_ds, QUEUE_LEN) == -1) errno_exit("Listen");
-    printf("Listening to port %d...\n",port);
 
-    while(TRUE){
-        int client_ds=-1;
-        struct  sockaddr_in sClient;
-        CLEAR(sClient);
-        int sAddrLen = sizeof(sClient);
+    // UDP streams on the same port, with a tick for the reassembly deadlines
+    if(udp){
+        if((srv.udp_ds = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0)) == -1) errno_exit("Socket(UDP)");
+        if(setsockopt(srv.udp_ds, SOL_SOCKET, SO_REUSEPORT, (const char*)&reuse, sizeof(reuse)) < 0) errno_exit("Setsockopt(SO_REUSEPORT)");
+        int rcvbuf = UDP_RCVBUF;
+        if(setsockopt(srv.udp_ds, SOL_SOCKET, SO_RCVBUF, (const char*)&rcvbuf, sizeof(rcvbuf)) < 0) errno_exit("Setsockopt(SO_RCVBUF)");
+        if(bind(srv.udp_ds, (struct sockaddr *) &sin, sizeof(sin)) == -1) errno_exit("Bind(UDP)");
+        if(!(srv.udp_buf = malloc((size_t)UDP_BATCH * CAM_UDP_MAX_DGRAM))) errno_exit("Out of memory");
+        srv.udp_deadline_us = (uint64_t)(udp_deadline_ms > 0 ? udp_deadline_ms : 1) * 1000;
 
-        if ((client_ds = accept(socket_ds, (struct sockaddr *) &sClient, &sAddrLen)) == -1) errno_exit("Accept");
-        printf("Connection received from %s\n", inet_ntoa(sClient.sin_addr));
+        struct itimerspec tick = {.it_interval = {0, UDP_TICK_NS}, .it_value = {0, UDP_TICK_NS}};
+        if((srv.tick_ds = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC)) == -1) errno_exit("Timerfd_create");
+        if(timerfd_settime(srv.tick_ds, 0, &tick, NULL) == -1) errno_exit("Timerfd_settime");
+    }
+    printf("Listening to port %d (%s ingest, %s storage)...\n", port, srv.splice ? "splice" : "copy",
+        srv.uring_depth ? (srv.uw.direct ? "io_uring O_DIRECT" : "io_uring") : "write()");
+    if(srv.udp_ds != -1) printf("Receiving UDP streams on port %d, frame deadline %d ms\n", port, udp_deadline_ms);
 
-        // Read the filename from the client
-        char filename[MAX_FILE_LEN];
-        CLEAR(filename);
-        if(read(client_ds, filename, MAX_FILE_LEN)==-1) errno_exit("Read");
-        clean_string(filename);
-        printf("Filename: %s\n", filename);
+    // Initialize the event loop
+    srv.socket_ds = socket_ds;
+    if((srv.epoll_ds = epoll_create1(EPOLL_CLOEXEC)) == -1) errno_exit("Epoll_create");
+    if(!(srv.buffer = calloc(srv.buf_size, sizeof(char)))) errno_exit("Out of memory");
 
-        // Open file for writing received data
-        int file_ds = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
-        char *buffer = calloc(BUFFER_SIZE, sizeof(char));
-        int frame_count=0;
-        int rec_bytes; 
+    struct epoll_event ev;
+    CLEAR(ev);
+    ev.events = EPOLLIN | EPOLLET;
+    ev.data.ptr = NULL; // NULL marks the listening socket
+    if(epoll_ctl(srv.epoll_ds, EPOLL_CTL_ADD, socket_ds, &ev) == -1) errno_exit("Epoll_ctl");
 
-        // Receive frames from client and write them to file
-        while ((rec_bytes = recv(client_ds, buffer, BUFFER_SIZE-1, 0)) > 0) {
-            if(write(file_ds, buffer, rec_bytes)==-1) errno_exit("Write");
-            
-            // Count frames by detecting MJPEG start marker (0xFF 0xD8)
-            count_frame(&frame_count,buffer,rec_bytes);
+    // io_uring completions wake up the event loop too
+    if(srv.uring_depth){
+        ev.events = EPOLLIN;
+        ev.data.ptr = &srv.uw;
+        if(epoll_ctl(srv.epoll_ds, EPOLL_CTL_ADD, srv.uw.event_ds, &ev) == -1) errno_exit("Epoll_ctl");
+    }
+    // Viewer sockets are in their own epoll set
+    if(srv.view){
+        ev.events = EPOLLIN;
+        ev.data.ptr = srv.view;
+        if(epoll_ctl(srv.epoll_ds, EPOLL_CTL_ADD, view_fd(srv.view), &ev) == -1) errno_exit("Epoll_ctl");
+    }
+
+    // UDP: level-triggered, read_udp() leaves the rest of a burst for the next round
+    if(srv.udp_ds != -1){
+        ev.events = EPOLLIN;
+        ev.data.ptr = &srv.udp_ds;
+        if(epoll_ctl(srv.epoll_ds, EPOLL_CTL_ADD, srv.udp_ds, &ev) == -1) errno_exit("Epoll_ctl");
+        ev.data.ptr = &srv.tick_ds;
+        if(epoll_ctl(srv.epoll_ds, EPOLL_CTL_ADD, srv.tick_ds, &ev) == -1) errno_exit("Epoll_ctl");
+    }
+
+    // Stage summaries
+    ev.events = EPOLLIN;
+    ev.data.ptr = &srv.signal_ds;
+    if(epoll_ctl(srv.epoll_ds, EPOLL_CTL_ADD, srv.signal_ds, &ev) == -1) errno_exit("Epoll_ctl");
+    if(srv.stats_ds != -1){
+        ev.data.ptr = &srv.stats_ds;
+        if(epoll_ctl(srv.epoll_ds, EPOLL_CTL_ADD, srv.stats_ds, &ev) == -1) errno_exit("Epoll_ctl");
+    }
+
+    struct epoll_event events[MAX_EVENTS];
+    while(TRUE){
+        // Don't sleep while some stream still has unread data
+        int timeout = -1;
+        for(int i = 0; i < MAX_STREAMS; i++) if(srv.conns[i] && srv.conns[i]->ready) timeout = 0;
+
+        int n_events = epoll_wait(srv.epoll_ds, events, MAX_EVENTS, timeout);
+        if(n_events == -1){
+            if(errno == EINTR) continue;
+            errno_exit("Epoll_wait");
         }
-        free(buffer);
-        printf("File saved successfully. Frames received: %d\n",frame_count);
+        uint64_t wake = cam_trace_begin();
 
-       // Convert MJPEG to MP4 if <-c> flag is set
-        if(convert){
-            char output_filename[MAX_FILE_LEN];
-            CLEAR(output_filename);
-            change_extension(filename, output_filename);
-            
-            char command[4*MAX_FILE_LEN];
-            CLEAR(command);
-            sprintf(command, "ffmpeg -i %s -c:v libx264 -preset fast -crf 23 %s > /dev/null 2>&1", filename, output_filename);
-            if(system(command)==-1) errno_exit("System_command");
-            printf("Conversion to MP4 complete: %s\n", output_filename);
+        for(int i = 0; i < n_events; i++){
+            if(events[i].data.ptr == &srv.uw){
+                if(uw_reap(&srv.uw, 0) == -1) errno_exit("Io_uring_reap");
+                continue;
+            }
+            if(events[i].data.ptr == &srv.udp_ds){
+                read_udp(&srv);
+                continue;
+            }
+            if(events[i].data.ptr == &srv.tick_ds){
+                tick_udp(&srv);
+                continue;
+            }
+            if(events[i].data.ptr == &srv.signal_ds){
+                read_signal(&srv);
+                continue;
+            }
+            if(events[i].data.ptr == &srv.stats_ds){
+                stats_tick(&srv);
+                continue;
+            }
+            if(srv.view && events[i].data.ptr == srv.view){
+                view_poll(srv.view);
+                continue;
+            }
+            struct conn* c = events[i].data.ptr;
+            if(!c){
+                accept_conns(&srv);
+                continue;
+            }
+            c->ready = 1;
         }
-        
-        // Close file
-        close(file_ds);
-        // Close client connection
-        close(client_ds);
-    }
 
+        // Serve every readable stream, one READ_BUDGET at a time
+        for(int i = 0; i < MAX_STREAMS; i++){
+            struct conn* c = srv.conns[i];
+            if(!c || !c->ready) continue;
+            if(read_conn(&srv, c)){
+                close_conn(&srv, c);
+                if(srv.accept_pending) accept_conns(&srv);
+            }
+        }
+        cam_trace_span("wake", wake, 0, -1);
+    }
 
+    free(srv.buffer);
+    close(srv.epoll_ds);
+    close(socket_ds);
     return EXIT_SUCCESS;
 }
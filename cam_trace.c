@@ -0,0 +1,156 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+#include "cam_trace.h"
+
+// Events of one thread: appended by that thread only, read when the trace is written
+struct trace_buf{
+    struct trace_buf* next;         // List of every thread's buffer
+    pid_t tid;
+    char name[64];
+    unsigned int len;               // Published with a release store
+    unsigned long long dropped;     // Events past CAM_TRACE_EVENTS
+    struct cam_trace_event events[];
+};
+
+int cam_trace_on;
+
+static FILE* trace_file;
+static char trace_process[64];
+static int trace_closed;
+static struct trace_buf* trace_bufs;
+static unsigned long long trace_lost;   // Threads whose buffer could not be allocated
+static __thread struct trace_buf* trace_own;
+
+// Function to get the calling thread's buffer, allocated and listed on first use
+static struct trace_buf* own_buf(void){
+    if(trace_own) return trace_own;
+    // calloc() of this size maps fresh pages: memory is only used as events are recorded
+    struct trace_buf* b = calloc(1, sizeof(*b) + CAM_TRACE_EVENTS * sizeof(struct cam_trace_event));
+    if(!b) return NULL;
+    b->tid = syscall(SYS_gettid);
+    snprintf(b->name, sizeof(b->name), "thread %d", (int)b->tid);
+    b->next = __atomic_load_n(&trace_bufs, __ATOMIC_RELAXED);
+    while(!__atomic_compare_exchange_n(&trace_bufs, &b->next, b, 1, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+    return trace_own = b;
+}
+
+void cam_trace_record(enum cam_trace_type type, const char* name, uint64_t start_ns, uint64_t end_ns,
+                      uint64_t id, uint32_t stream, int64_t seq){
+    if(__atomic_load_n(&trace_closed, __ATOMIC_RELAXED)) return;
+    struct trace_buf* b = own_buf();
+    if(!b){
+        __atomic_fetch_add(&trace_lost, 1, __ATOMIC_RELAXED);
+        return;
+    }
+    if(b->len == CAM_TRACE_EVENTS){
+        b->dropped++;
+        return;
+    }
+    b->events[b->len] = (struct cam_trace_event){name, start_ns, end_ns, id, seq, stream, type};
+    __atomic_store_n(&b->len, b->len + 1, __ATOMIC_RELEASE);
+}
+
+void cam_trace_thread(const char* name){
+    struct trace_buf* b;
+    if(!cam_trace_on || !(b = own_buf())) return;
+    snprintf(b->name, sizeof(b->name), "%s", name);
+}
+
+uint32_t cam_trace_stream(const char* filename){
+    // FNV-1a
+    uint32_t h = 2166136261u;
+    for(const unsigned char* p = (const unsigned char*)filename; *p; p++) h = (h ^ *p) * 16777619u;
+    return h ? h : 1;
+}
+
+// Function to write a string as a JSON string
+static void put_string(FILE* f, const char* s){
+    fputc('"', f);
+    for(; *s; s++){
+        if(*s == '"' || *s == '\\') fprintf(f, "\\%c", *s);
+        else if((unsigned char)*s < 0x20) fprintf(f, "\\u%04x", *s);
+        else fputc(*s, f);
+    }
+    fputc('"', f);
+}
+
+// Function to write the arguments of an event: the frame it belongs to
+static void put_args(FILE* f, const struct cam_trace_event* e){
+    if(!e->stream && e->seq < 0) return;
+    fprintf(f, ",\"args\":{");
+    if(e->stream) fprintf(f, "\"stream\":\"%08x\"%s", e->stream, e->seq >= 0 ? "," : "");
+    if(e->seq >= 0) fprintf(f, "\"seq\":%lld", (long long)e->seq);
+    fputc('}', f);
+}
+
+// Function to write one recorded event as Chrome trace events (one per line, comma-terminated)
+static void put_event(FILE* f, int pid, pid_t tid, const struct cam_trace_event* e){
+    double ts = e->start_ns / 1e3, end = e->end_ns / 1e3;
+    // Both ends compute the id of a frame's flow from its stream and sequence number
+    unsigned long long frame_id = (unsigned long long)e->stream << 32 | (uint32_t)e->seq;
+
+    switch(e->type){
+    case CAM_TRACE_SEND:
+        fprintf(f, "{\"name\":\"frame\",\"cat\":\"frame\",\"ph\":\"s\",\"id\":\"0x%llx\",\"ts\":%.3f,\"pid\":%d,\"tid\":%d},\n",
+            frame_id, ts, pid, (int)tid);
+        // Fall through - the send itself
+    case CAM_TRACE_SPAN:
+        fprintf(f, "{\"name\":\"%s\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":%d,\"tid\":%d", e->name, ts, end - ts, pid, (int)tid);
+        put_args(f, e);
+        fprintf(f, "},\n");
+        break;
+    case CAM_TRACE_ARRIVE:
+    case CAM_TRACE_ASYNC:
+        if(e->type == CAM_TRACE_ARRIVE)
+            fprintf(f, "{\"name\":\"frame\",\"cat\":\"frame\",\"ph\":\"f\",\"bp\":\"e\",\"id\":\"0x%llx\",\"ts\":%.3f,\"pid\":%d,\"tid\":%d},\n",
+                frame_id, end, pid, (int)tid);
+        unsigned long long id = e->type == CAM_TRACE_ARRIVE ? frame_id : (unsigned long long)e->id;
+        fprintf(f, "{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"b\",\"id\":\"0x%llx\",\"ts\":%.3f,\"pid\":%d,\"tid\":%d", e->name, e->name, id, ts, pid, (int)tid);
+        put_args(f, e);
+        fprintf(f, "},\n{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"e\",\"id\":\"0x%llx\",\"ts\":%.3f,\"pid\":%d,\"tid\":%d},\n",
+            e->name, e->name, id, end, pid, (int)tid);
+        break;
+    }
+}
+
+void cam_trace_close(void){
+    if(!trace_file || __atomic_exchange_n(&trace_closed, 1, __ATOMIC_RELAXED)) return;
+    FILE* f = trace_file;
+    int pid = getpid();
+    unsigned long long events = 0, dropped = 0;
+
+    // The file is a list of events, one per line, the last without a comma (see bench/trace_merge.sh)
+    fprintf(f, "{\"traceEvents\":[\n");
+    for(struct trace_buf* b = __atomic_load_n(&trace_bufs, __ATOMIC_ACQUIRE); b; b = b->next){
+        // A thread still running may add events meanwhile: only the published ones are written
+        unsigned int len = __atomic_load_n(&b->len, __ATOMIC_ACQUIRE);
+        for(unsigned int i = 0; i < len; i++) put_event(f, pid, b->tid, &b->events[i]);
+        fprintf(f, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,\"args\":{\"name\":", pid, (int)b->tid);
+        put_string(f, b->name);
+        fprintf(f, "}},\n");
+        events += len;
+        dropped += b->dropped;
+    }
+    fprintf(f, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,\"args\":{\"name\":", pid);
+    put_string(f, trace_process);
+    fprintf(f, "}}\n],\"displayTimeUnit\":\"ms\"}\n");
+    if(fclose(f) == EOF) perror("Trace_write");
+    trace_file = NULL;
+
+    printf("Trace: %llu events written", events);
+    if(dropped || trace_lost) printf(", %llu dropped (buffers full)", dropped + trace_lost);
+    printf("\n");
+}
+
+int cam_trace_open(const char* path, const char* process){
+    if(!(trace_file = fopen(path, "w"))) return -1;
+    snprintf(trace_process, sizeof(trace_process), "%s", process);
+    cam_trace_on = 1;
+    atexit(cam_trace_close);
+    return 0;
+}
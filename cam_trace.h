@@ -0,0 +1,107 @@
+#ifndef CAM_TRACE_H
+#define CAM_TRACE_H
+
+#include <stdint.h>
+#include <time.h>
+
+/*
+ * Per-frame event tracing, written as a Chrome Trace Event JSON file
+ * (chrome://tracing, https://ui.perfetto.dev).
+ *
+ * Every thread appends to its own event buffer, allocated on its first event:
+ * no lock and no shared cache line on the hot path. The buffers are written
+ * out once, at exit (or cam_trace_close()); a full buffer drops its later
+ * events and counts them. When tracing is off, an event costs one load and
+ * a predicted branch.
+ *
+ * Events carry the stream key (a hash of the recording filename, the same on
+ * both ends of a connection) and the V4L2 sequence number of their frame. The
+ * client's send of a frame and the server's reception of it are joined by a
+ * flow arrow, so the traces of both programs, merged with
+ * bench/trace_merge.sh, form one timeline. Timestamps are CLOCK_MONOTONIC:
+ * traces from different hosts do not line up.
+ */
+
+#define CAM_TRACE_EVENTS (1 << 20)  // Events kept per thread
+
+enum cam_trace_type{
+    CAM_TRACE_SPAN,         // Slice on the thread's track
+    CAM_TRACE_SEND,         // Slice, where the frame's flow arrow starts
+    CAM_TRACE_ARRIVE,       // Async slice (own track), where the frame's flow arrow ends
+    CAM_TRACE_ASYNC,        // Async slice, e.g. a write completing later on
+};
+
+// An event, as recorded (timestamps in ns)
+struct cam_trace_event{
+    const char* name;       // Static string
+    uint64_t start_ns;
+    uint64_t end_ns;
+    uint64_t id;            // Async slices: pairs begin and end
+    int64_t seq;            // Frame sequence number, -1 if none
+    uint32_t stream;        // Stream key, 0 if none
+    uint32_t type;
+};
+
+// Tracing enabled: set once by cam_trace_open(), before any thread starts
+extern int cam_trace_on;
+
+static inline uint64_t cam_trace_now(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/*
+ * start tracing: the trace is written to <path> at exit (also on exit() from an error)
+ * args:
+ *   process - name of the process in the trace
+ *
+ * returns: 0 ok, -1 if the file cannot be created (errno set)
+ */
+int cam_trace_open(const char* path, const char* process);
+
+/*
+ * write the trace now; later events are dropped
+ */
+void cam_trace_close(void);
+
+/*
+ * name the calling thread in the trace
+ */
+void cam_trace_thread(const char* name);
+
+/*
+ * key of a stream in the trace: both ends hash the session filename
+ */
+uint32_t cam_trace_stream(const char* filename);
+
+// Function to append an event to the calling thread's buffer (tracing on)
+void cam_trace_record(enum cam_trace_type type, const char* name, uint64_t start_ns, uint64_t end_ns,
+                      uint64_t id, uint32_t stream, int64_t seq);
+
+// Function to get the start time of an event, 0 when tracing is off
+static inline uint64_t cam_trace_begin(void){
+    return __builtin_expect(cam_trace_on, 0) ? cam_trace_now() : 0;
+}
+
+// Function to record a slice of the calling thread, from <start_ns> to now
+static inline void cam_trace_span(const char* name, uint64_t start_ns, uint32_t stream, int64_t seq){
+    if(__builtin_expect(cam_trace_on, 0)) cam_trace_record(CAM_TRACE_SPAN, name, start_ns, cam_trace_now(), 0, stream, seq);
+}
+
+// Function to record the slice sending a frame: its flow arrow starts there
+static inline void cam_trace_send(const char* name, uint64_t start_ns, uint32_t stream, int64_t seq){
+    if(__builtin_expect(cam_trace_on, 0)) cam_trace_record(CAM_TRACE_SEND, name, start_ns, cam_trace_now(), 0, stream, seq);
+}
+
+// Function to record the reception of a frame, from <start_ns> to now: its flow arrow ends there
+static inline void cam_trace_arrive(const char* name, uint64_t start_ns, uint32_t stream, int64_t seq){
+    if(__builtin_expect(cam_trace_on, 0)) cam_trace_record(CAM_TRACE_ARRIVE, name, start_ns, cam_trace_now(), 0, stream, seq);
+}
+
+// Function to record an operation that ends on another path than it started, from <start_ns> to now
+static inline void cam_trace_async(const char* name, uint64_t start_ns, uint64_t id, uint32_t stream, int64_t seq){
+    if(__builtin_expect(cam_trace_on, 0)) cam_trace_record(CAM_TRACE_ASYNC, name, start_ns, cam_trace_now(), id, stream, seq);
+}
+
+#endif
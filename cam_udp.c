@@ -0,0 +1,271 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#include "cam_udp.h"
+
+static uint64_t now_ns(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+#pragma region SENDER
+
+int udp_sender_init(struct udp_sender* us, int socket_ds, int mtu, double pacing){
+    if(mtu < UDP_IP_OVERHEAD + CAM_UDP_HDR_LEN + 64 || mtu > CAM_UDP_MAX_DGRAM + UDP_IP_OVERHEAD) return -1;
+    memset(us, 0, sizeof(*us));
+    us->socket_ds = socket_ds;
+    us->frag_len = mtu - UDP_IP_OVERHEAD - CAM_UDP_HDR_LEN;
+    us->pacing = pacing;
+
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    srand(ts.tv_nsec ^ ts.tv_sec);
+    us->stream = (uint32_t)rand() << 16 ^ rand();
+    return 0;
+}
+
+// Function to wait for the pacing slot of a burst of len bytes
+static void pace(struct udp_sender* us, size_t len){
+    uint64_t now = now_ns();
+    if(us->next_ns < now) us->next_ns = now;        // Idle time does not buy a later burst
+    else{
+        struct timespec ts = { us->next_ns / 1000000000ull, us->next_ns % 1000000000ull };
+        while(clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR);
+    }
+    us->next_ns += len * 1e9 / us->pacing;
+}
+
+// Function to send n prepared datagrams: returns 0, -1 on a fatal error
+static int send_batch(struct udp_sender* us, struct mmsghdr* msgs, unsigned int n){
+    unsigned int done = 0;
+    while(done < n){
+        int r = sendmmsg(us->socket_ds, msgs + done, n - done, 0);
+        if(r < 0){
+            if(errno == EINTR) continue;
+            // No server yet (ICMP unreachable) or a full queue: this datagram is lost, keep going
+            if(errno == ECONNREFUSED || errno == ENOBUFS || errno == EAGAIN){
+                us->errors++;
+                done++;
+                continue;
+            }
+            return -1;
+        }
+        done += r;
+        us->datagrams += r;
+    }
+    return 0;
+}
+
+// Function to send one datagram made of a header and a body
+static int send_single(struct udp_sender* us, const struct cam_udp_hdr* h, const void* body, size_t len){
+    uint8_t hdr[CAM_UDP_HDR_LEN];
+    struct iovec iov[2] = { { hdr, CAM_UDP_HDR_LEN }, { (void*)body, len } };
+    struct mmsghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_hdr.msg_iov = iov;
+    msg.msg_hdr.msg_iovlen = len ? 2 : 1;
+    cam_pack_udp(hdr, h);
+    return send_batch(us, &msg, 1);
+}
+
+int udp_send_session(struct udp_sender* us, const uint8_t* hdr){
+    struct cam_udp_hdr h = { .type = CAM_UDP_SESSION, .frags = 1, .stream = us->stream, .total = CAM_SESSION_HDR_LEN };
+    memcpy(us->session, hdr, CAM_SESSION_HDR_LEN);
+    us->session_us = now_ns() / 1000;
+    return send_single(us, &h, us->session, CAM_SESSION_HDR_LEN);
+}
+
+int udp_send_frame(struct udp_sender* us, const uint8_t* hdr, const void* data, size_t len){
+    uint8_t hdrs[UDP_BATCH][CAM_UDP_HDR_LEN];
+    struct iovec iov[UDP_BATCH][3];
+    struct mmsghdr msgs[UDP_BATCH];
+    size_t total = CAM_FRAME_HDR_LEN + len;
+    size_t frags = (total + us->frag_len - 1) / us->frag_len;
+    unsigned int batch = us->pacing > 0 ? UDP_PACE_BURST : UDP_BATCH;
+
+    if(frags > UINT16_MAX){
+        us->too_big++;
+        return 0;
+    }
+    // The server cannot place frames without a session: repeat it now and then
+    if(now_ns() / 1000 - us->session_us >= UDP_SESSION_US && udp_send_session(us, us->session)) return -1;
+
+    struct cam_udp_hdr h = { .type = CAM_UDP_FRAME, .frags = frags, .stream = us->stream, .frame = us->next_frame++, .total = total };
+    memset(msgs, 0, sizeof(msgs));
+    for(size_t f = 0; f < frags; f += batch){
+        unsigned int n = frags - f < batch ? frags - f : batch;
+        size_t bytes = 0;
+        for(unsigned int i = 0; i < n; i++){
+            size_t off = (f + i) * us->frag_len;
+            size_t end = off + us->frag_len < total ? off + us->frag_len : total;
+            int k = 0;
+            h.frag = f + i;
+            h.offset = off;
+            cam_pack_udp(hdrs[i], &h);
+            iov[i][k++] = (struct iovec){ hdrs[i], CAM_UDP_HDR_LEN };
+            // Slice of the frame header, then slice of the payload
+            if(off < CAM_FRAME_HDR_LEN){
+                size_t e = end < CAM_FRAME_HDR_LEN ? end : CAM_FRAME_HDR_LEN;
+                iov[i][k++] = (struct iovec){ (void*)(hdr + off), e - off };
+                off = e;
+            }
+            if(end > off) iov[i][k++] = (struct iovec){ (uint8_t*)data + off - CAM_FRAME_HDR_LEN, end - off };
+            msgs[i].msg_hdr.msg_iov = iov[i];
+            msgs[i].msg_hdr.msg_iovlen = k;
+            bytes += CAM_UDP_HDR_LEN + UDP_IP_OVERHEAD + end - (size_t)h.offset;
+        }
+        if(us->pacing > 0) pace(us, bytes);
+        if(send_batch(us, msgs, n)) return -1;
+    }
+    return 0;
+}
+
+void udp_send_end(struct udp_sender* us){
+    struct cam_udp_hdr h = { .type = CAM_UDP_END, .stream = us->stream, .frame = us->next_frame };
+    for(int i = 0; i < 3; i++) send_single(us, &h, NULL, 0);
+}
+
+#pragma endregion
+
+#pragma region REASSEMBLY
+
+void udp_reasm_init(struct udp_reasm* r, uint64_t deadline_us, udp_deliver_fn deliver, void* ctx){
+    memset(r, 0, sizeof(*r));
+    r->deadline_us = deadline_us;
+    r->deliver = deliver;
+    r->ctx = ctx;
+}
+
+static struct udp_slot* slot_of(struct udp_reasm* r, uint32_t frame){
+    struct udp_slot* s = &r->slots[frame % UDP_SLOTS];
+    return s->used && s->frame == frame ? s : NULL;
+}
+
+static void release(struct udp_reasm* r, struct udp_slot* s){
+    s->used = 0;
+    r->pending--;
+}
+
+// Function to deliver the complete frames at the head of the window
+static void drain(struct udp_reasm* r){
+    struct udp_slot* s;
+    while((s = slot_of(r, r->next)) && s->received == s->frags){
+        r->deliver(r->ctx, s->buf, s->total);
+        r->frames++;
+        release(r, s);
+        r->next++;
+    }
+}
+
+// Function to move past the next n frames: complete ones are delivered, the others given up
+static void skip(struct udp_reasm* r, uint32_t n){
+    for(uint32_t i = 0; i < n; i++){
+        if(i == UDP_SLOTS){
+            // Beyond the window nothing can have arrived
+            r->lost += n - i;
+            r->next += n - i;
+            break;
+        }
+        struct udp_slot* s = slot_of(r, r->next);
+        if(s && s->received == s->frags){
+            r->deliver(r->ctx, s->buf, s->total);
+            r->frames++;
+        }
+        else{
+            r->lost++;
+            if(s) r->incomplete++;
+        }
+        if(s) release(r, s);
+        r->next++;
+    }
+    drain(r);
+}
+
+void udp_reasm_add(struct udp_reasm* r, const struct cam_udp_hdr* h, const uint8_t* data, size_t len, uint64_t now_us){
+    if(!r->started){
+        r->next = h->frame;
+        r->started = 1;
+    }
+    int32_t d = (int32_t)(h->frame - r->next);
+    if(d < 0){
+        r->late++;
+        return;
+    }
+    // A frame past the window pushes the oldest frames out, whatever their deadline
+    if(d >= UDP_SLOTS) skip(r, d - UDP_SLOTS + 1);
+
+    struct udp_slot* s = &r->slots[h->frame % UDP_SLOTS];
+    if(!s->used){
+        size_t words = (h->frags + 63) / 64;
+        if(s->cap < h->total){
+            uint8_t* buf = realloc(s->buf, h->total);
+            if(!buf) return;
+            s->buf = buf;
+            s->cap = h->total;
+        }
+        if(s->got_words < words){
+            uint64_t* got = realloc(s->got, words * sizeof(*got));
+            if(!got) return;
+            s->got = got;
+            s->got_words = words;
+        }
+        memset(s->got, 0, words * sizeof(*s->got));
+        s->used = 1;
+        s->frame = h->frame;
+        s->total = h->total;
+        s->frags = h->frags;
+        s->received = 0;
+        s->first_us = now_us;
+        r->pending++;
+    }
+    else if(s->total != h->total || s->frags != h->frags){
+        r->bad++;
+        return;
+    }
+    uint64_t bit = 1ull << (h->frag % 64);
+    if(s->got[h->frag / 64] & bit){
+        r->dups++;
+        return;
+    }
+    s->got[h->frag / 64] |= bit;
+    s->received++;
+    memcpy(s->buf + h->offset, data, len);
+    if(s->received == s->frags && s->frame == r->next) drain(r);
+}
+
+void udp_reasm_expire(struct udp_reasm* r, uint64_t now_us){
+    while(r->pending){
+        // The head frame (missing or incomplete) waits as long as the oldest frame seen behind it
+        uint64_t oldest = UINT64_MAX;
+        struct udp_slot* head = slot_of(r, r->next);
+        if(head) oldest = head->first_us;
+        else{
+            for(int i = 0; i < UDP_SLOTS; i++)
+                if(r->slots[i].used && r->slots[i].first_us < oldest) oldest = r->slots[i].first_us;
+        }
+        if(now_us - oldest < r->deadline_us) break;
+        skip(r, 1);
+    }
+}
+
+void udp_reasm_flush(struct udp_reasm* r){
+    while(r->pending) skip(r, 1);
+}
+
+void udp_reasm_free(struct udp_reasm* r){
+    for(int i = 0; i < UDP_SLOTS; i++){
+        free(r->slots[i].buf);
+        free(r->slots[i].got);
+    }
+    memset(r->slots, 0, sizeof(r->slots));
+    r->pending = 0;
+}
+
+#pragma endregion
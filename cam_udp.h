@@ -0,0 +1,149 @@
+#ifndef CAM_UDP_H
+#define CAM_UDP_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "cam_proto.h"
+
+/*
+ * UDP transport: frame fragmentation on the client, reassembly on the server.
+ *
+ * Over TCP one lost segment holds back every later frame until it is
+ * retransmitted. Over UDP a lost datagram only costs its own frame: the
+ * server puts frames together from their fragments and hands them on in
+ * order, and a frame still incomplete after a deadline is given up.
+ *
+ * The sender batches the datagrams of a frame into sendmmsg() calls and can
+ * pace them at a given rate, so that a large frame does not leave as one
+ * burst that overflows a switch or the receiver's socket buffer.
+ */
+
+#define UDP_MTU 1500            // Default path MTU
+#define UDP_IP_OVERHEAD 28      // IPv4 + UDP headers
+#define UDP_BATCH 64            // Datagrams per sendmmsg()/recvmmsg()
+#define UDP_PACE_BURST 8        // Datagrams sent back to back when pacing
+#define UDP_SESSION_US 1000000  // The session header is repeated this often
+#define UDP_SLOTS 16            // Frames being put together at once, per stream
+
+#pragma region SENDER
+
+struct udp_sender{
+    int socket_ds;              // Connected UDP socket
+    uint32_t stream;            // Random id of this session
+    uint32_t next_frame;
+    size_t frag_len;            // Frame bytes per datagram
+    double pacing;              // Bytes/s, 0 for unpaced
+    uint64_t next_ns;           // Pacing: earliest start of the next burst
+    uint8_t session[CAM_SESSION_HDR_LEN];
+    uint64_t session_us;        // Last time the session header went out
+
+    // Statistics
+    unsigned long long datagrams;
+    unsigned long long errors;  // Datagrams the kernel refused (e.g. ICMP unreachable, ENOBUFS)
+    unsigned long long too_big; // Frames with more fragments than the header can number
+};
+
+/*
+ * set up a sender on a connected UDP socket
+ * args:
+ *   mtu - path MTU, datagrams (IP header included) stay within it
+ *   pacing - rate in bytes/s, 0 to send as fast as possible
+ *
+ * returns: 0 ok, -1 if the MTU is too small
+ */
+int udp_sender_init(struct udp_sender* us, int socket_ds, int mtu, double pacing);
+
+/*
+ * send the session header (kept, and repeated every UDP_SESSION_US by udp_send_frame)
+ *
+ * returns: 0 ok, -1 on error
+ */
+int udp_send_session(struct udp_sender* us, const uint8_t* hdr);
+
+/*
+ * send a frame as fragments
+ * args:
+ *   hdr - packed frame header (CAM_FRAME_HDR_LEN bytes)
+ *   data, len - payload
+ *
+ * returns: 0 ok (datagrams may still be lost), -1 on a fatal socket error
+ */
+int udp_send_frame(struct udp_sender* us, const uint8_t* hdr, const void* data, size_t len);
+
+/*
+ * tell the server the stream is over (sent a few times, it may be lost)
+ */
+void udp_send_end(struct udp_sender* us);
+
+#pragma endregion
+
+#pragma region REASSEMBLY
+
+// Frame being put together
+struct udp_slot{
+    int used;
+    uint32_t frame;
+    uint32_t total;
+    uint16_t frags;
+    uint16_t received;
+    uint64_t first_us;          // Arrival of its first fragment
+    uint8_t* buf;               // Frame bytes, kept across frames
+    size_t cap;
+    uint64_t* got;              // Bitmap of the fragments received
+    size_t got_words;
+};
+
+// Callback receiving each complete frame, in order: frame header + payload
+typedef void (*udp_deliver_fn)(void* ctx, const uint8_t* frame, size_t len);
+
+struct udp_reasm{
+    struct udp_slot slots[UDP_SLOTS];
+    uint32_t next;              // Oldest frame not yet delivered or given up
+    int started;                // next is set
+    int pending;                // Slots in use
+    uint64_t deadline_us;       // Time a frame may take to complete
+    udp_deliver_fn deliver;
+    void* ctx;
+
+    // Statistics
+    unsigned long long frames;      // Delivered
+    unsigned long long lost;        // Given up: incomplete or never seen
+    unsigned long long incomplete;  // Of which some fragments arrived
+    unsigned long long late;        // Fragments of frames already delivered or given up
+    unsigned long long dups;        // Fragments received twice
+    unsigned long long bad;         // Fragments that do not match their frame
+};
+
+/*
+ * set up the reassembly of one stream
+ * args:
+ *   deadline_us - a frame not complete this long after its first fragment is given up
+ *   deliver, ctx - callback for complete frames
+ */
+void udp_reasm_init(struct udp_reasm* r, uint64_t deadline_us, udp_deliver_fn deliver, void* ctx);
+
+/*
+ * add a fragment (may deliver frames)
+ * args:
+ *   h - its datagram header
+ *   data, len - fragment bytes
+ *   now_us - arrival time
+ */
+void udp_reasm_add(struct udp_reasm* r, const struct cam_udp_hdr* h, const uint8_t* data, size_t len, uint64_t now_us);
+
+/*
+ * give up the frames past their deadline, delivering the complete frames behind them
+ */
+void udp_reasm_expire(struct udp_reasm* r, uint64_t now_us);
+
+/*
+ * end of stream: deliver what is complete, give up the rest
+ */
+void udp_reasm_flush(struct udp_reasm* r);
+
+void udp_reasm_free(struct udp_reasm* r);
+
+#pragma endregion
+
+#endif
@@ -0,0 +1,414 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/ioctl.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <linux/sockios.h>
+
+#include "cam_view.h"
+#include "cam_hist.h"
+
+#pragma region DEF_CONST
+
+#define VIEW_BOUNDARY "camframe"
+#define VIEW_REQ_LEN 2048       // Request headers beyond this are ignored
+#define VIEW_HEAD_LEN 256       // Response or part headers
+#define VIEW_EVENTS 64
+
+enum viewer_state{
+    VIEWER_REQUEST,     // Reading the request
+    VIEWER_STREAM,      // Sending a stream, frame after frame
+    VIEWER_REPLY,       // Sending a one-shot reply, then closing
+};
+
+struct view_stream{
+    struct view_server* vs;
+    char name[CAM_FILENAME_LEN];
+    struct cam_session session;
+    int viewers;
+    unsigned long long frames;
+};
+
+struct viewer{
+    int ds;
+    char addr[INET_ADDRSTRLEN];
+    enum viewer_state state;
+    char req[VIEW_REQ_LEN];
+    size_t req_len;
+    struct view_stream* stream;
+
+    // Part being sent: head, then frame (if any), then CRLF for a stream part
+    char head[VIEW_HEAD_LEN];
+    size_t head_len;
+    struct view_frame* cur;
+    size_t off;                     // Bytes of the part already sent
+    struct view_frame* pending;     // Latest frame, waiting for cur to be sent
+
+    // Statistics
+    uint64_t start_us;
+    unsigned long long sent, skipped, bytes;
+    unsigned long long sendq_sum;   // Sum of the samples of the socket send queue
+    int sendq, sendq_max;           // Unsent bytes in the socket, sampled after each frame
+    struct cam_hist delivery;       // Publication to fully written, in us
+};
+
+struct view_server{
+    int listen_ds;
+    int epoll_ds;
+    struct view_stream* streams[VIEW_MAX_STREAMS];
+    struct viewer* viewers[VIEW_MAX_VIEWERS];
+    int n_viewers;
+};
+
+static uint64_t now_us(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000ull + ts.tv_nsec / 1000;
+}
+
+#pragma endregion
+
+#pragma region FRAMES
+
+struct view_frame* view_frame_alloc(size_t len){
+    struct view_frame* f = malloc(sizeof(*f) + len);
+    if(!f) return NULL;
+    f->refs = 1;
+    f->published_us = 0;
+    f->len = len;
+    return f;
+}
+
+void view_frame_put(struct view_frame* f){
+    if(f && !--f->refs) free(f);
+}
+
+#pragma endregion
+
+#pragma region VIEWERS
+
+// Function to disconnect a viewer, printing its statistics if it was watching a stream
+static void close_viewer(struct view_server* vs, struct viewer* v){
+    if(v->state == VIEWER_STREAM){
+        double seconds = (now_us() - v->start_us) / 1e6;
+        printf("[viewer %s] %s: %llu frames sent, %llu skipped, %.1f MB in %.1f s, send queue avg %llu KB max %d KB, "
+               "delivery p50 %.1f ms p99 %.1f ms\n", v->addr, v->stream ? v->stream->name : "-", v->sent, v->skipped,
+               v->bytes / 1e6, seconds, v->sent ? v->sendq_sum / v->sent >> 10 : 0, v->sendq_max >> 10,
+               cam_hist_percentile(&v->delivery, 0.5) / 1e3, cam_hist_percentile(&v->delivery, 0.99) / 1e3);
+        if(v->stream) v->stream->viewers--;
+    }
+    // Closing the socket also removes it from the epoll set
+    close(v->ds);
+    view_frame_put(v->cur);
+    view_frame_put(v->pending);
+    for(int i = 0; i < VIEW_MAX_VIEWERS; i++) if(vs->viewers[i] == v) vs->viewers[i] = NULL;
+    vs->n_viewers--;
+    free(v);
+}
+
+// Function to account for a frame fully handed to the socket
+static void frame_sent(struct viewer* v){
+    int unsent;
+    v->sent++;
+    v->bytes += v->cur->len;
+    cam_hist_add(&v->delivery, now_us() - v->cur->published_us);
+    if(ioctl(v->ds, SIOCOUTQ, &unsent) == 0){
+        v->sendq = unsent;
+        v->sendq_sum += unsent;
+        if(unsent > v->sendq_max) v->sendq_max = unsent;
+    }
+}
+
+// Function to send as much as the socket takes: returns -1 when the viewer must be closed
+static int flush_viewer(struct viewer* v){
+    static const char crlf[] = "\r\n";
+    while(1){
+        size_t tail = v->cur && v->state == VIEWER_STREAM ? 2 : 0;
+        size_t part_len = v->head_len + (v->cur ? v->cur->len : 0) + tail;
+        if(v->off == part_len){
+            if(v->cur && v->state == VIEWER_STREAM) frame_sent(v);
+            view_frame_put(v->cur);
+            v->cur = NULL;
+            v->head_len = v->off = 0;
+            if(v->state == VIEWER_REPLY) return -1;
+            if(!v->pending) return 0;
+
+            // Next part: the latest frame
+            v->cur = v->pending;
+            v->pending = NULL;
+            v->head_len = snprintf(v->head, sizeof(v->head), "--" VIEW_BOUNDARY "\r\nContent-Type: image/jpeg\r\nContent-Length: %zu\r\n\r\n", v->cur->len);
+            continue;
+        }
+
+        // Skip what was already sent of head, frame and tail
+        struct iovec iov[3];
+        int iov_cnt = 0;
+        size_t skip = v->off;
+        const uint8_t* spans[3] = {(const uint8_t*)v->head, v->cur ? v->cur->data : NULL, (const uint8_t*)crlf};
+        size_t lens[3] = {v->head_len, v->cur ? v->cur->len : 0, tail};
+        for(int i = 0; i < 3; i++){
+            if(skip >= lens[i]){
+                skip -= lens[i];
+                continue;
+            }
+            iov[iov_cnt].iov_base = (void*)(spans[i] + skip);
+            iov[iov_cnt++].iov_len = lens[i] - skip;
+            skip = 0;
+        }
+        struct msghdr msg = {.msg_iov = iov, .msg_iovlen = iov_cnt};
+        ssize_t n = sendmsg(v->ds, &msg, MSG_NOSIGNAL | MSG_DONTWAIT);
+        if(n == -1){
+            if(errno == EINTR) continue;
+            // Socket full: EPOLLOUT resumes the part
+            return errno == EAGAIN || errno == EWOULDBLOCK ? 0 : -1;
+        }
+        v->off += n;
+    }
+}
+
+// Function to queue a one-shot reply (headers and body), sent before closing
+static void reply(struct viewer* v, const char* status, const char* type, const char* body, size_t len){
+    v->state = VIEWER_REPLY;
+    if(len && (v->cur = view_frame_alloc(len))) memcpy(v->cur->data, body, len);
+    v->head_len = snprintf(v->head, sizeof(v->head), "HTTP/1.0 %s\r\nContent-Type: %s\r\nContent-Length: %zu\r\nConnection: close\r\n\r\n",
+        status, type, v->cur ? len : 0);
+    v->off = 0;
+}
+
+// Function to append formatted text to a growing reply body
+static void body_printf(char** body, size_t* len, size_t* cap, const char* fmt, ...) __attribute__((format(printf, 4, 5)));
+static void body_printf(char** body, size_t* len, size_t* cap, const char* fmt, ...){
+    va_list ap;
+    while(1){
+        va_start(ap, fmt);
+        int n = vsnprintf(*body ? *body + *len : NULL, *body ? *cap - *len : 0, fmt, ap);
+        va_end(ap);
+        if(n < 0) return;
+        if(*body && *len + n < *cap){
+            *len += n;
+            return;
+        }
+        size_t new_cap = 2 * (*cap + n + 1);
+        char* p = realloc(*body, new_cap);
+        if(!p) return;
+        *body = p;
+        *cap = new_cap;
+    }
+}
+
+// Function to answer a request once its headers are in
+static void route(struct view_server* vs, struct viewer* v){
+    char method[8], path[CAM_FILENAME_LEN + 8];
+    char* body = NULL;
+    size_t len = 0, cap = 0;
+
+    if(sscanf(v->req, "%7s %263s", method, path) != 2 || path[0] != '/'){
+        reply(v, "400 Bad Request", "text/plain", "Bad request\n", 12);
+        return;
+    }
+    if(strcmp(method, "GET")){
+        reply(v, "405 Method Not Allowed", "text/plain", "GET only\n", 9);
+        return;
+    }
+    path[strcspn(path, "?")] = '\0';
+
+    if(!strcmp(path, "/")){
+        body_printf(&body, &len, &cap, "<html><head><title>Cserver</title></head><body><h1>Live streams</h1><ul>\n");
+        for(int i = 0; i < VIEW_MAX_STREAMS; i++){
+            struct view_stream* st = vs->streams[i];
+            if(st) body_printf(&body, &len, &cap, "<li><a href=\"/%s\">%s</a> %ux%u, %d viewer(s)</li>\n",
+                st->name, st->name, st->session.width, st->session.height, st->viewers);
+        }
+        body_printf(&body, &len, &cap, "</ul><a href=\"/stats\">Viewer statistics</a></body></html>\n");
+        reply(v, "200 OK", "text/html", body, len);
+    }
+    else if(!strcmp(path, "/stats")){
+        body_printf(&body, &len, &cap, "viewer,stream,seconds,sent,skipped,bytes,sendq_bytes,sendq_avg_bytes,sendq_max_bytes,delivery_p50_us,delivery_p99_us,delivery_max_us\n");
+        uint64_t now = now_us();
+        for(int i = 0; i < VIEW_MAX_VIEWERS; i++){
+            struct viewer* w = vs->viewers[i];
+            if(!w || w->state != VIEWER_STREAM) continue;
+            body_printf(&body, &len, &cap, "%s,%s,%.1f,%llu,%llu,%llu,%d,%llu,%d,%llu,%llu,%llu\n", w->addr, w->stream ? w->stream->name : "-",
+                (now - w->start_us) / 1e6, w->sent, w->skipped, w->bytes, w->sendq, w->sent ? w->sendq_sum / w->sent : 0, w->sendq_max,
+                (unsigned long long)cam_hist_percentile(&w->delivery, 0.5), (unsigned long long)cam_hist_percentile(&w->delivery, 0.99),
+                (unsigned long long)w->delivery.max);
+        }
+        reply(v, "200 OK", "text/plain", body, len);
+    }
+    else{
+        struct view_stream* st = NULL;
+        for(int i = 0; i < VIEW_MAX_STREAMS && !st; i++)
+            if(vs->streams[i] && !strcmp(vs->streams[i]->name, path + 1)) st = vs->streams[i];
+        if(!st){
+            reply(v, "404 Not Found", "text/plain", "No such stream\n", 15);
+            return;
+        }
+        // The multipart response has no length: frames follow until the stream ends
+        v->state = VIEWER_STREAM;
+        v->stream = st;
+        v->start_us = now_us();
+        st->viewers++;
+        v->head_len = snprintf(v->head, sizeof(v->head), "HTTP/1.0 200 OK\r\nContent-Type: multipart/x-mixed-replace; boundary=" VIEW_BOUNDARY
+            "\r\nCache-Control: no-cache\r\nConnection: close\r\n\r\n");
+        v->off = 0;
+        printf("[viewer %s] Watching %s (%d viewer(s))\n", v->addr, st->name, st->viewers);
+    }
+    free(body);
+}
+
+// Function to read a viewer's request: returns -1 when the viewer must be closed
+static int read_request(struct view_server* vs, struct viewer* v){
+    while(v->state == VIEWER_REQUEST){
+        ssize_t n = recv(v->ds, v->req + v->req_len, sizeof(v->req) - 1 - v->req_len, 0);
+        if(n == -1) return errno == EAGAIN || errno == EWOULDBLOCK ? 0 : -1;
+        if(n == 0) return -1;
+        v->req_len += n;
+        v->req[v->req_len] = '\0';
+        if(strstr(v->req, "\r\n\r\n") || strstr(v->req, "\n\n") || v->req_len == sizeof(v->req) - 1) route(vs, v);
+    }
+    // Viewers send nothing more: detect the hang-up
+    char drain[256];
+    ssize_t n;
+    while((n = recv(v->ds, drain, sizeof(drain), 0)) > 0);
+    if(n == -1 && errno != EAGAIN && errno != EWOULDBLOCK) return -1;
+    // A client may shut down its side once the request is sent: only a watcher has left
+    if(n == 0 && v->state == VIEWER_STREAM) return -1;
+    return flush_viewer(v);
+}
+
+// Function to accept pending viewers
+static void accept_viewers(struct view_server* vs){
+    while(1){
+        struct sockaddr_in sin;
+        socklen_t sin_len = sizeof(sin);
+        int ds = accept4(vs->listen_ds, (struct sockaddr*)&sin, &sin_len, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if(ds == -1){
+            if(errno == EINTR || errno == ECONNABORTED) continue;
+            if(errno != EAGAIN && errno != EWOULDBLOCK) perror("Viewer_accept");
+            return;
+        }
+        struct viewer* v = NULL;
+        int slot = 0;
+        while(slot < VIEW_MAX_VIEWERS && vs->viewers[slot]) slot++;
+        if(slot == VIEW_MAX_VIEWERS || !(v = calloc(1, sizeof(*v)))){
+            static const char busy[] = "HTTP/1.0 503 Service Unavailable\r\nConnection: close\r\n\r\n";
+            if(send(ds, busy, sizeof(busy) - 1, MSG_NOSIGNAL | MSG_DONTWAIT) == -1){}
+            close(ds);
+            continue;
+        }
+        v->ds = ds;
+        inet_ntop(AF_INET, &sin.sin_addr, v->addr, sizeof(v->addr));
+        cam_hist_init(&v->delivery);
+        vs->viewers[slot] = v;
+        vs->n_viewers++;
+
+        struct epoll_event ev = {.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET, .data.ptr = v};
+        if(epoll_ctl(vs->epoll_ds, EPOLL_CTL_ADD, ds, &ev) == -1){
+            perror("Viewer_epoll_ctl");
+            close_viewer(vs, v);
+        }
+    }
+}
+
+#pragma endregion
+
+#pragma region API
+
+struct view_server* view_start(int port){
+    struct view_server* vs = calloc(1, sizeof(*vs));
+    if(!vs) return NULL;
+    int reuse = 1;
+    struct sockaddr_in sin = {.sin_family = AF_INET, .sin_port = htons(port), .sin_addr.s_addr = INADDR_ANY};
+    struct epoll_event ev = {.events = EPOLLIN};
+
+    // No SO_REUSEPORT: viewers of every stream must reach the same server
+    if((vs->listen_ds = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0)) == -1 ||
+       setsockopt(vs->listen_ds, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse)) == -1 ||
+       bind(vs->listen_ds, (struct sockaddr*)&sin, sizeof(sin)) == -1 ||
+       listen(vs->listen_ds, VIEW_MAX_VIEWERS) == -1 ||
+       (vs->epoll_ds = epoll_create1(EPOLL_CLOEXEC)) == -1 ||
+       epoll_ctl(vs->epoll_ds, EPOLL_CTL_ADD, vs->listen_ds, &ev) == -1){
+        int err = errno;
+        if(vs->listen_ds != -1) close(vs->listen_ds);
+        free(vs);
+        errno = err;
+        return NULL;
+    }
+    return vs;
+}
+
+int view_fd(const struct view_server* vs){
+    return vs->epoll_ds;
+}
+
+void view_poll(struct view_server* vs){
+    struct epoll_event events[VIEW_EVENTS];
+    int n = epoll_wait(vs->epoll_ds, events, VIEW_EVENTS, 0);
+    for(int i = 0; i < n; i++){
+        struct viewer* v = events[i].data.ptr;
+        if(!v){
+            accept_viewers(vs);
+            continue;
+        }
+        if(events[i].events & (EPOLLERR | EPOLLHUP) || read_request(vs, v) == -1) close_viewer(vs, v);
+    }
+}
+
+struct view_stream* view_stream_open(struct view_server* vs, const char* name, const struct cam_session* session){
+    int slot = 0;
+    while(slot < VIEW_MAX_STREAMS && vs->streams[slot]) slot++;
+    if(slot == VIEW_MAX_STREAMS) return NULL;
+    struct view_stream* st = calloc(1, sizeof(*st));
+    if(!st) return NULL;
+    st->vs = vs;
+    snprintf(st->name, sizeof(st->name), "%s", name);
+    st->session = *session;
+    vs->streams[slot] = st;
+    return st;
+}
+
+void view_stream_close(struct view_stream* st){
+    struct view_server* vs = st->vs;
+    for(int i = 0; i < VIEW_MAX_VIEWERS && st->viewers; i++){
+        struct viewer* v = vs->viewers[i];
+        if(!v || v->stream != st) continue;
+        // Finishing the frame being sent would mean waiting for the socket: just hang up
+        close_viewer(vs, v);
+    }
+    for(int i = 0; i < VIEW_MAX_STREAMS; i++) if(vs->streams[i] == st) vs->streams[i] = NULL;
+    free(st);
+}
+
+int view_stream_watched(const struct view_stream* st){
+    return st->viewers > 0;
+}
+
+void view_publish(struct view_stream* st, struct view_frame* f){
+    struct view_server* vs = st->vs;
+    f->published_us = now_us();
+    st->frames++;
+    for(int i = 0; i < VIEW_MAX_VIEWERS; i++){
+        struct viewer* v = vs->viewers[i];
+        if(!v || v->stream != st) continue;
+        // Only the latest frame waits: an older one is skipped
+        if(v->pending){
+            view_frame_put(v->pending);
+            v->skipped++;
+        }
+        f->refs++;
+        v->pending = f;
+        // Idle viewer: start sending now, otherwise EPOLLOUT picks it up
+        if(!v->cur && !v->head_len && flush_viewer(v) == -1) close_viewer(vs, v);
+    }
+    view_frame_put(f);
+}
+
+#pragma endregion
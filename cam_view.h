@@ -0,0 +1,89 @@
+#ifndef CAM_VIEW_H
+#define CAM_VIEW_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "cam_proto.h"
+
+/*
+ * Live fan-out of the ingested streams to HTTP viewers, as MJPEG
+ * (multipart/x-mixed-replace: browsers, VLC, ffplay).
+ *
+ * Every received frame is stored once, in a refcounted buffer shared by all the
+ * viewers of its stream. A viewer holds at most the frame it is sending and the
+ * latest frame waiting: a newer frame replaces the waiting one, which is counted
+ * as skipped. A slow viewer thus falls behind in frames, never in time, and never
+ * stalls ingest or the other viewers.
+ *
+ * Runs on the server's event loop thread, with its own epoll set for the viewer
+ * sockets: the server watches view_fd() and calls view_poll() when it is readable.
+ *
+ * Endpoints: "/" lists the streams, "/<recording filename>" serves a stream live,
+ * "/stats" reports per-viewer send-queue statistics.
+ */
+
+#define VIEW_MAX_STREAMS 64
+#define VIEW_MAX_VIEWERS 256
+
+// Frame shared by the viewers of a stream
+struct view_frame{
+    int refs;
+    uint64_t published_us;      // Handed to the viewers (CLOCK_MONOTONIC)
+    size_t len;
+    uint8_t data[];
+};
+
+struct view_server;
+struct view_stream;
+
+/*
+ * listen for viewers on <port>
+ *
+ * returns: the server, NULL on error (errno set)
+ */
+struct view_server* view_start(int port);
+
+/*
+ * returns: epoll descriptor to watch for EPOLLIN in the caller's event loop
+ */
+int view_fd(const struct view_server* vs);
+
+/*
+ * accept viewers, read their requests and send what their sockets can take
+ */
+void view_poll(struct view_server* vs);
+
+/*
+ * make a stream available to viewers under <name>
+ *
+ * returns: the stream, NULL if VIEW_MAX_STREAMS are already open
+ */
+struct view_stream* view_stream_open(struct view_server* vs, const char* name, const struct cam_session* session);
+
+/*
+ * end of stream: disconnect its viewers (their statistics are printed)
+ */
+void view_stream_close(struct view_stream* st);
+
+/*
+ * returns: 1 if the stream has viewers, i.e. its frames are worth keeping
+ */
+int view_stream_watched(const struct view_stream* st);
+
+/*
+ * allocate a frame of <len> bytes, with one reference
+ */
+struct view_frame* view_frame_alloc(size_t len);
+
+/*
+ * release a reference, freeing the frame with the last one
+ */
+void view_frame_put(struct view_frame* f);
+
+/*
+ * hand a complete frame to the viewers of the stream; takes the caller's reference
+ */
+void view_publish(struct view_stream* st, struct view_frame* f);
+
+#endif
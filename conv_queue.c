@@ -0,0 +1,264 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+
+#include "conv_queue.h"
+#include "cam_mkv.h"
+#include "conv_split.h"
+
+/*
+ * Journal: one line per state change, "<state>\t<unix time>\t<wait ms>\t<run ms>\t<exit status>\t<input>\t<output>".
+ * States: queued, deferred (queue full: converted after the next restart), started, done, failed.
+ * Filenames never contain tabs or newlines
+ * (the server strips non-printable characters).
+ */
+
+static double elapsed_ms(const struct timespec* from, const struct timespec* to){
+    return (to->tv_sec - from->tv_sec) * 1e3 + (to->tv_nsec - from->tv_nsec) / 1e6;
+}
+
+// Function to append a journal line (one write() on an O_APPEND file: safe from every thread)
+static void journal(struct conv_queue* q, const char* state, const struct conv_job* job, double wait_ms, double run_ms, int status){
+    if(q->journal_ds == -1) return;
+    char line[2 * CONV_FILE_LEN + 128];
+    int len = snprintf(line, sizeof(line), "%s\t%ld\t%.0f\t%.0f\t%d\t%s\t%s\n", state, (long)time(NULL), wait_ms, run_ms, status, job->input, job->output);
+    if(len > 0 && write(q->journal_ds, line, len) == -1) perror("Journal_write");
+}
+
+// Function to run ffmpeg on one job, re-encoding to H.264 or copying the frames (<copy>):
+// returns its exit status, -1 if it did not exit normally
+static int run_ffmpeg(struct conv_queue* q, const struct conv_job* job, int copy){
+    char threads[16], ffmpeg[CONV_FILE_LEN];
+    snprintf(threads, sizeof(threads), "%d", q->threads);
+    // Looked up before fork(): the child of a multithreaded process only execs
+    if(split_ffmpeg_path(ffmpeg, sizeof(ffmpeg)) == -1) return -1;
+
+    pid_t pid = fork();
+    if(pid == -1) return -1;
+    if(pid == 0){
+        // Only async-signal-safe calls between fork() and exec()
+        setpriority(PRIO_PROCESS, 0, q->nice);
+        int null_ds = open("/dev/null", O_WRONLY);
+        if(null_ds != -1){
+            dup2(null_ds, STDIN_FILENO);
+            dup2(null_ds, STDOUT_FILENO);
+            dup2(null_ds, STDERR_FILENO);
+        }
+        if(copy) execl(ffmpeg, "ffmpeg", "-y", "-f", "mjpeg", "-i", job->input, "-c:v", "copy", job->output, (char*)NULL);
+        else execl(ffmpeg, "ffmpeg", "-y", "-i", job->input, "-c:v", "libx264", "-preset", "fast", "-crf", "23",
+                  "-threads", threads, job->output, (char*)NULL);
+        _exit(127);
+    }
+
+    int status;
+    while(waitpid(pid, &status, 0) == -1) if(errno != EINTR) return -1;
+    return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+
+// Function to tell a remux job (Matroska output) from a transcode job
+static int is_remux(const struct conv_job* job){
+    const char* ext = strrchr(job->output, '.');
+    return ext && !strcmp(ext, ".mkv");
+}
+
+// Function to transcode one recording to H.264, in segments on all cores: returns 0 ok,
+// else a failure status (ffmpeg's exit status, -1)
+static int transcode(struct conv_queue* q, const struct conv_job* job){
+    struct split_stats st;
+    const char* step;
+    int status = split_transcode(job->input, job->output, q->segments, &q->cores, q->nice, &st, &step);
+    if(status == 0){
+        printf("Transcode of %s: %u segment(s), %.1f s of encoding, joined in %.1f s\n", job->input, st.segments,
+               st.encode_ms / 1e3, st.concat_ms / 1e3);
+        return 0;
+    }
+    if(status > 0){
+        fprintf(stderr, "Transcode of %s failed: %s (ffmpeg exit status %d)\n", job->input, step, status);
+        return status;
+    }
+    if(strcmp(step, "Index")){
+        fprintf(stderr, "Transcode of %s failed: %s error %d, %s\n", job->input, step, errno, strerror(errno));
+        return -1;
+    }
+    // No index (legacy stream, server run with -I): the frame boundaries are unknown, one ffmpeg does it all
+    fprintf(stderr, "Transcode of %s: no frame index, not segmented\n", job->input);
+    return run_ffmpeg(q, job, 0);
+}
+
+// Function to run one job: returns 0 ok, else a failure status (ffmpeg's exit status, -1)
+static int convert(struct conv_queue* q, const struct conv_job* job){
+    if(!is_remux(job)) return transcode(q, job);
+
+    struct mkv_stats st;
+    const char* step;
+    if(mkv_remux(job->input, job->output, &st, &step) == 0){
+        if(!st.timed) printf("Remux of %s: no capture timestamps in its index, timed at the nominal frame rate\n", job->input);
+        return 0;
+    }
+    if(strcmp(step, "Index")){
+        fprintf(stderr, "Remux of %s failed: %s error %d, %s\n", job->input, step, errno, strerror(errno));
+        return -1;
+    }
+    // No index (legacy stream, server run with -I): let ffmpeg find the frames, at its assumed frame rate
+    fprintf(stderr, "Remux of %s: no frame index, copying with ffmpeg instead\n", job->input);
+    return run_ffmpeg(q, job, 1);
+}
+
+// Worker thread: converts queued recordings one at a time
+static void* conv_worker(void* arg){
+    struct conv_queue* q = arg;
+    // Remuxing runs on this thread: it gets the conversions' priority too (Linux: per thread)
+    setpriority(PRIO_PROCESS, syscall(SYS_gettid), q->nice);
+
+    while(1){
+        pthread_mutex_lock(&q->lock);
+        while(!q->count) pthread_cond_wait(&q->cond, &q->lock);
+        struct conv_job job = q->jobs[q->head];
+        q->head = (q->head + 1) % CONV_QUEUE_LEN;
+        q->count--;
+        q->running++;
+        pthread_mutex_unlock(&q->lock);
+
+        struct timespec start, end;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        double wait_ms = elapsed_ms(&job.queued, &start);
+        journal(q, "started", &job, wait_ms, 0, 0);
+
+        int status = convert(q, &job);
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        double run_ms = elapsed_ms(&start, &end);
+        journal(q, status ? "failed" : "done", &job, wait_ms, run_ms, status);
+
+        pthread_mutex_lock(&q->lock);
+        q->running--;
+        if(status) q->failed++;
+        else q->done++;
+        unsigned int depth = q->count;
+        int running = q->running;
+        pthread_mutex_unlock(&q->lock);
+
+        if(status) fprintf(stderr, "Conversion failed: %s (exit status %d)\n", job.output, status);
+        else printf("Conversion complete: %s (waited %.1f s, converted in %.1f s; queue %u, running %d)\n",
+                    job.output, wait_ms / 1e3, run_ms / 1e3, depth, running);
+    }
+    return NULL;
+}
+
+int conv_submit(struct conv_queue* q, const char* input, const char* output){
+    pthread_mutex_lock(&q->lock);
+    if(q->count == CONV_QUEUE_LEN){
+        // Kept in the journal: the next start queues it again
+        struct conv_job deferred;
+        snprintf(deferred.input, sizeof(deferred.input), "%s", input);
+        snprintf(deferred.output, sizeof(deferred.output), "%s", output);
+        journal(q, "deferred", &deferred, 0, 0, 0);
+        q->rejected++;
+        pthread_mutex_unlock(&q->lock);
+        fprintf(stderr, "Conversion queue full (%d jobs), %s %s\n", CONV_QUEUE_LEN,
+                q->journal_ds != -1 ? "deferred to the next start:" : "not converting", input);
+        return -1;
+    }
+    struct conv_job* job = &q->jobs[(q->head + q->count++) % CONV_QUEUE_LEN];
+    snprintf(job->input, sizeof(job->input), "%s", input);
+    snprintf(job->output, sizeof(job->output), "%s", output);
+    clock_gettime(CLOCK_MONOTONIC, &job->queued);
+    journal(q, "queued", job, 0, 0, 0);
+    // Logged before a worker can take it: "queued" always precedes "complete"
+    printf("Conversion queued: %s (queue %u/%d, running %d/%d)\n", input, q->count, CONV_QUEUE_LEN, q->running, q->workers);
+    pthread_cond_signal(&q->cond);
+    pthread_mutex_unlock(&q->lock);
+    return 0;
+}
+
+// Function to queue again the jobs of the journal that never finished, and to compact it.
+// Beyond the queue's length, jobs are deferred again: none is lost.
+static int replay_journal(struct conv_queue* q, const char* path){
+    struct conv_job* pending = NULL;
+    int n_pending = 0, max_pending = 0;
+
+    FILE* f = fopen(path, "r");
+    if(f){
+        char line[2 * CONV_FILE_LEN + 128];
+        while(fgets(line, sizeof(line), f)){
+            line[strcspn(line, "\n")] = '\0';
+            char* field[7];
+            int n = 0;
+            for(char* p = line; n < 7 && p; n++){
+                field[n] = p;
+                if((p = strchr(p, '\t'))) *p++ = '\0';
+            }
+            if(n != 7) continue;
+
+            // Latest state wins
+            int i;
+            for(i = 0; i < n_pending && strcmp(pending[i].input, field[5]); i++);
+            if(!strcmp(field[0], "queued") || !strcmp(field[0], "deferred") || !strcmp(field[0], "started")){
+                if(i == n_pending){
+                    if(n_pending == max_pending){
+                        max_pending = max_pending ? 2 * max_pending : CONV_QUEUE_LEN;
+                        struct conv_job* grown = realloc(pending, max_pending * sizeof(*pending));
+                        if(!grown){
+                            free(pending);
+                            fclose(f);
+                            return -1;
+                        }
+                        pending = grown;
+                    }
+                    snprintf(pending[n_pending].input, CONV_FILE_LEN, "%s", field[5]);
+                    snprintf(pending[n_pending++].output, CONV_FILE_LEN, "%s", field[6]);
+                }
+            }
+            else if(i < n_pending) memmove(&pending[i], &pending[i+1], (--n_pending - i) * sizeof(pending[0]));
+        }
+        fclose(f);
+    }
+
+    // Start a fresh journal holding only the pending jobs
+    char tmp[CONV_FILE_LEN + 8];
+    snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+    if((q->journal_ds = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC, 0644)) == -1){
+        free(pending);
+        return -1;
+    }
+    for(int i = 0; i < n_pending; i++){
+        if(access(pending[i].input, R_OK) == -1){
+            fprintf(stderr, "Pending conversion of %s dropped: %s\n", pending[i].input, strerror(errno));
+            continue;
+        }
+        conv_submit(q, pending[i].input, pending[i].output);
+    }
+    free(pending);
+    if(rename(tmp, path) == -1) return -1;
+    if(n_pending) printf("Resumed %u pending conversion(s) from %s\n", q->count, path);
+    return 0;
+}
+
+int conv_start(struct conv_queue* q, int workers, int nice, const char* journal_path){
+    memset(q, 0, sizeof(*q));
+    pthread_mutex_init(&q->lock, NULL);
+    pthread_cond_init(&q->cond, NULL);
+    q->journal_ds = -1;
+    q->nice = nice;
+
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    if(cores < 1) cores = 1;
+    q->workers = workers > 0 ? workers : cores;
+    if(q->workers > CONV_MAX_WORKERS) q->workers = CONV_MAX_WORKERS;
+    // Split the cores between the concurrent ffmpeg processes
+    q->threads = cores / q->workers > 1 ? cores / q->workers : 1;
+    // Segmented transcodes take every free core: a lone recording uses them all, a burst shares them
+    q->segments = cores;
+    if(sem_init(&q->cores, 0, cores) == -1) return -1;
+
+    if(journal_path && replay_journal(q, journal_path) == -1) return -1;
+
+    for(int i = 0; i < q->workers; i++)
+        if((errno = pthread_create(&q->tids[i], NULL, conv_worker, q))) return -1;
+    return 0;
+}
@@ -0,0 +1,66 @@
+#ifndef CONV_QUEUE_H
+#define CONV_QUEUE_H
+
+#include <pthread.h>
+#include <semaphore.h>
+#include <time.h>
+
+/*
+ * Background conversion queue for finished recordings.
+ *
+ * Finished recordings are queued and converted by a pool of worker threads,
+ * one conversion at a time each (at a lower CPU priority), so the server keeps
+ * ingesting. The output's extension picks the conversion:
+ *   - .mkv: the JPEG frames are remuxed unchanged, timed by their capture
+ *     timestamps (cam_mkv.h), on the worker thread
+ *   - anything else: re-encoded to H.264, in segments spread over every core
+ *     (conv_split.h); recordings without an index by a single ffmpeg
+ * The queue is bounded. Every state change is appended to a journal file: on
+ * restart, conversions that were queued or running are queued again.
+ */
+
+#define CONV_QUEUE_LEN 256      // Max jobs waiting
+#define CONV_MAX_WORKERS 64
+#define CONV_FILE_LEN 512
+
+struct conv_job{
+    char input[CONV_FILE_LEN];
+    char output[CONV_FILE_LEN];
+    struct timespec queued;     // CLOCK_MONOTONIC
+};
+
+struct conv_queue{
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    struct conv_job jobs[CONV_QUEUE_LEN];
+    unsigned int head, count;
+    int running;                // Jobs being converted
+    int workers;
+    int nice;                   // Priority of the conversions
+    int threads;                // ffmpeg threads per job (whole-recording transcodes)
+    int segments;               // Segments per transcode: one per core
+    sem_t cores;                // Free cores for segment encoders, shared by the workers
+    int journal_ds;             // Append-only journal, -1 if none
+    unsigned long long done, failed, rejected;
+    pthread_t tids[CONV_MAX_WORKERS];
+};
+
+/*
+ * start the worker pool, after queueing the conversions left pending in the journal
+ * args:
+ *   workers - number of concurrent conversions (0: one per core)
+ *   nice - niceness of the conversions
+ *   journal - journal file, NULL for none
+ *
+ * returns: 0 ok, -1 on error (errno set)
+ */
+int conv_start(struct conv_queue* q, int workers, int nice, const char* journal);
+
+/*
+ * queue a conversion of <input> to <output>
+ *
+ * returns: 0 queued, -1 queue full (the job is dropped)
+ */
+int conv_submit(struct conv_queue* q, const char* input, const char* output);
+
+#endif
@@ -0,0 +1,282 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <signal.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+
+#include "conv_split.h"
+#include "cam_index.h"
+#include "cam_mkv.h"
+
+#pragma region DEF_CONST
+
+#define SPLIT_PATH_LEN 1024
+
+#pragma endregion
+
+#pragma region SEGMENT
+
+// One piece of the recording and its encoding
+struct segment{
+    const uint8_t* map;             // Recording
+    const struct cam_index_entry* e;    // Index entries of its frames
+    uint64_t frames;
+    uint32_t width, height;
+    int timed;                      // Capture timestamps, else frames at <fps>
+    double fps;                     // Frame rate of the whole recording
+    double seconds;                 // Up to the next segment's first frame
+    int nice;
+    const char* ffmpeg;             // Resolved program path
+    sem_t* cores;
+    char path[SPLIT_PATH_LEN];      // Encoded segment
+    pthread_t tid;
+    int status;                     // ffmpeg's exit status, -1 if it could not run (errno in err)
+    int err;
+    double ms;                      // Encoding time, without the wait for a core
+};
+
+static double elapsed_ms(const struct timespec* from, const struct timespec* to){
+    return (to->tv_sec - from->tv_sec) * 1e3 + (to->tv_nsec - from->tv_nsec) / 1e6;
+}
+
+int split_ffmpeg_path(char* path, size_t len){
+    const char* dirs = getenv("PATH");
+    if(!dirs) dirs = "/usr/local/bin:/usr/bin:/bin";
+    for(const char* d = dirs;; d++){
+        const char* end = strchrnul(d, ':');
+        struct stat st;
+        // An empty entry is the current directory
+        int n = snprintf(path, len, "%.*s%s" SPLIT_FFMPEG, (int)(end - d), d, end > d ? "/" : "");
+        if(n > 0 && (size_t)n < len && stat(path, &st) == 0 && S_ISREG(st.st_mode) && access(path, X_OK) == 0) return 0;
+        if(!*(d = end)) break;
+    }
+    errno = ENOENT;
+    return -1;
+}
+
+// Function to start the program at <path> with <argv>, reading from <in_ds>, with the
+// signal mask <mask> (NULL: the caller's): returns its pid, -1 on error
+static pid_t spawn(const char* path, char* const argv[], int in_ds, int nice, const sigset_t* mask){
+    pid_t pid = fork();
+    if(pid != 0) return pid;
+    // Only async-signal-safe calls between fork() and exec(): no PATH search (execvp())
+    if(mask) sigprocmask(SIG_SETMASK, mask, NULL);
+    setpriority(PRIO_PROCESS, 0, nice);
+    dup2(in_ds, STDIN_FILENO);
+    int null_ds = open("/dev/null", O_WRONLY);
+    if(null_ds != -1){
+        dup2(null_ds, STDOUT_FILENO);
+        dup2(null_ds, STDERR_FILENO);
+    }
+    execv(path, argv);
+    _exit(127);
+}
+
+// Function to wait for a child: returns its exit status, -1 if it did not exit normally
+static int reap(pid_t pid){
+    int status;
+    while(waitpid(pid, &status, 0) == -1) if(errno != EINTR) return -1;
+    return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+
+// Thread: encodes one segment once a core is free
+static void* encode_segment(void* arg){
+    struct segment* s = arg;
+    // An ffmpeg that dies early must fail the segment, not kill the process with SIGPIPE
+    // ffmpeg itself gets the thread's original mask back
+    sigset_t pipe_sig, orig_sig;
+    sigemptyset(&pipe_sig);
+    sigaddset(&pipe_sig, SIGPIPE);
+    pthread_sigmask(SIG_BLOCK, &pipe_sig, &orig_sig);
+
+    while(sem_wait(s->cores) == -1 && errno == EINTR);
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    char gop[16];
+    snprintf(gop, sizeof(gop), "%d", (int)(s->fps * SPLIT_GOP_SEC + 0.5) > 0 ? (int)(s->fps * SPLIT_GOP_SEC + 0.5) : 1);
+    // The frames go in as Matroska, with their timestamps. Every segment announces the same frame
+    // rate and gets the same settings, so x264 picks the same level and writes the same SPS/PPS:
+    // the joined MP4 only keeps the first segment's. Closed GOPs (x264 starts every process on an
+    // IDR frame anyway): a segment decodes on its own. Passthrough and a 90 kHz encoder time base:
+    // frames keep their timestamps (the default time base, one frame period, rounds them off).
+    char* argv[] = {"ffmpeg", "-y", "-f", "matroska", "-i", "pipe:0",
+                    "-c:v", "libx264", "-preset", "fast", "-crf", "23", "-profile:v", "high", "-threads", "1",
+                    "-g", gop, "-flags", "+cgop", "-fps_mode", "passthrough", "-enc_time_base:v", "1/90000",
+                    "-video_track_timescale", "90000", s->path, NULL};
+
+    // Close-on-exec: the other segments' ffmpeg must not hold this pipe open, or it never ends
+    int fds[2];
+    pid_t pid = -1;
+    s->status = -1;
+    if(pipe2(fds, O_CLOEXEC) == -1) s->err = errno;
+    else{
+        if((pid = spawn(s->ffmpeg, argv, fds[0], s->nice, &orig_sig)) == -1) s->err = errno;
+        close(fds[0]);
+        if(pid != -1 && mkv_write_frames(fds[1], s->map, s->e, s->frames, s->width, s->height, s->timed, s->fps) == -1)
+            s->err = errno;
+        close(fds[1]);
+        if(pid != -1){
+            int status = reap(pid);
+            // A feeding error is ffmpeg's failure when it stopped reading
+            s->status = s->err && !status ? -1 : status;
+        }
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    s->ms = elapsed_ms(&start, &end);
+    sem_post(s->cores);
+    return NULL;
+}
+
+#pragma endregion
+
+#pragma region CONCAT
+
+// Function to write the concat demuxer's list of the segments, named relative to it. Each one lasts
+// up to the next one's first frame, which places every frame at its capture time. Returns -1 on error.
+static int write_list(const char* path, const struct segment* segs, unsigned int n){
+    FILE* f = fopen(path, "w");
+    if(!f) return -1;
+    for(unsigned int i = 0; i < n; i++){
+        const char* name = strrchr(segs[i].path, '/');
+        fputs("file '", f);
+        for(name = name ? name + 1 : segs[i].path; *name; name++){
+            if(*name == '\'') fputs("'\\''", f);
+            else fputc(*name, f);
+        }
+        fprintf(f, "'\nduration %.6f\n", segs[i].seconds);
+    }
+    return fclose(f);
+}
+
+// Function to join the encoded segments into <output>: returns ffmpeg's exit status, -1 on error
+static int concat(const char* ffmpeg, const char* list, const char* output, int nice){
+    char* argv[] = {"ffmpeg", "-y", "-f", "concat", "-safe", "0", "-i", (char*)list, "-c", "copy",
+                    "-movflags", "+faststart", (char*)output, NULL};
+    int null_ds = open("/dev/null", O_RDONLY | O_CLOEXEC);
+    if(null_ds == -1) return -1;
+    pid_t pid = spawn(ffmpeg, argv, null_ds, nice, NULL);
+    close(null_ds);
+    return pid == -1 ? -1 : reap(pid);
+}
+
+#pragma endregion
+
+int split_transcode(const char* recording, const char* output, int segments, sem_t* cores, int nice,
+                    struct split_stats* stats, const char** step){
+    struct cam_index_info info;
+    struct cam_index_entry* e;
+    struct segment* segs = NULL;
+    struct stat st;
+    uint64_t n;
+    unsigned int s_count = 0, started = 0;
+    int in_ds = -1, ret = -1, saved;
+    uint8_t* map = MAP_FAILED;
+    char list[SPLIT_PATH_LEN], ffmpeg[SPLIT_PATH_LEN];
+
+    *step = "Index";
+    if(!(e = cam_index_load(recording, &info, &n))) return -1;
+    *step = SPLIT_FFMPEG;
+    if(split_ffmpeg_path(ffmpeg, sizeof(ffmpeg)) == -1) goto out;
+    *step = "Recording";
+    if((in_ds = open(recording, O_RDONLY | O_CLOEXEC)) == -1 || fstat(in_ds, &st) == -1) goto out;
+    // Frames past the end of the recording (e.g. cut short by a crash) are left out
+    while(n && e[n-1].offset + e[n-1].length > (uint64_t)st.st_size) n--;
+    errno = EINVAL;
+    if(!n) goto out;
+    if((map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, in_ds, 0)) == MAP_FAILED) goto out;
+
+    // Equal frame counts, none shorter than SPLIT_MIN_FRAMES
+    s_count = segments < 1 ? 1 : segments > SPLIT_MAX_SEGMENTS ? SPLIT_MAX_SEGMENTS : segments;
+    if(n / SPLIT_MIN_FRAMES < s_count) s_count = n / SPLIT_MIN_FRAMES ? n / SPLIT_MIN_FRAMES : 1;
+    *step = "Out of memory";
+    errno = ENOMEM;
+    if(!(segs = calloc(s_count, sizeof(*segs)))) goto out;
+
+    int timed = !(info.flags & CAM_INDEX_REBUILT) && n > 1 && e[n-1].timestamp_us > e[0].timestamp_us;
+    for(uint64_t k = 0; k < n && timed; k++) if(!e[k].timestamp_us) timed = 0;
+    // One rate for every segment: the recording's mean, else its nominal rate
+    double nominal = info.fps_num && info.fps_den ? (double)info.fps_num / info.fps_den : SPLIT_FALLBACK_FPS;
+    double fps = timed ? (n - 1) * 1e6 / (e[n-1].timestamp_us - e[0].timestamp_us) : nominal;
+    *step = "Segment";
+    errno = ENAMETOOLONG;
+    for(unsigned int i = 0; i < s_count; i++){
+        struct segment* s = &segs[i];
+        uint64_t first = i * n / s_count, last = (i + 1) * n / s_count - 1;
+        s->map = map;
+        s->e = e + first;
+        s->frames = last - first + 1;
+        s->width = info.width;
+        s->height = info.height;
+        s->timed = timed;
+        s->fps = fps;
+        s->nice = nice;
+        s->ffmpeg = ffmpeg;
+        s->cores = cores;
+        // Up to the next segment's first frame (the last one: one mean interval past its last frame)
+        if(!timed) s->seconds = s->frames / fps;
+        else s->seconds = ((last + 1 < n ? e[last+1].timestamp_us : e[last].timestamp_us + 1e6 / fps) - e[first].timestamp_us) / 1e6;
+        int len = snprintf(s->path, sizeof(s->path), "%s.part%03u.mp4", output, i);
+        if(len < 0 || (size_t)len >= sizeof(s->path)) goto out;
+    }
+
+    // Every segment waits for a core on its own thread
+    *step = "Thread";
+    for(; started < s_count; started++)
+        if((errno = pthread_create(&segs[started].tid, NULL, encode_segment, &segs[started]))) goto out;
+    for(unsigned int i = 0; i < started; i++) pthread_join(segs[i].tid, NULL);
+    started = 0;
+
+    double encode_ms = 0;
+    *step = "Segment";
+    for(unsigned int i = 0; i < s_count; i++){
+        encode_ms += segs[i].ms;
+        if(segs[i].status){
+            errno = segs[i].err;
+            ret = segs[i].status;
+            goto out;
+        }
+    }
+
+    // Lossless join: the segments' packets are copied, in order
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    *step = "Concat";
+    snprintf(list, sizeof(list), "%s.parts", output);
+    if(write_list(list, segs, s_count) == -1) goto out;
+    ret = concat(ffmpeg, list, output, nice);
+    if(ret) goto out;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    if(stats){
+        stats->segments = s_count;
+        stats->frames = n;
+        stats->encode_ms = encode_ms;
+        stats->concat_ms = elapsed_ms(&start, &end);
+    }
+
+out:
+    saved = errno;
+    for(unsigned int i = 0; i < started; i++) pthread_join(segs[i].tid, NULL);
+    if(segs){
+        for(unsigned int i = 0; i < s_count; i++) if(segs[i].path[0]) unlink(segs[i].path);
+        if(!strcmp(*step, "Concat")) unlink(list);
+    }
+    if(ret && !strcmp(*step, "Concat")) unlink(output);
+    if(map != MAP_FAILED) munmap(map, st.st_size);
+    if(in_ds != -1) close(in_ds);
+    free(segs);
+    free(e);
+    errno = saved;
+    return ret;
+}
@@ -0,0 +1,66 @@
+#ifndef CONV_SPLIT_H
+#define CONV_SPLIT_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <semaphore.h>
+
+/*
+ * Segmented MJPEG -> H.264/MP4 transcoding, on every core.
+ *
+ * The recording is cut into segments of equal frame counts, at the frame
+ * boundaries of its index (<recording>.idx, written while ingesting: nothing
+ * is rescanned). Each segment is piped to its own single-threaded ffmpeg as
+ * Matroska (mkv_write_frames()), with closed GOPs, so the segments start on a
+ * keyframe and depend on nothing before them; the encoded segments are then
+ * joined by ffmpeg's concat demuxer without re-encoding.
+ *
+ * The concat demuxer keeps the first segment's SPS/PPS only, so every segment
+ * is encoded with the same parameters: profile, and the recording's mean frame
+ * rate as the announced rate (which selects the level). Frames keep their
+ * capture timestamps (or the nominal rate for rebuilt indexes): passed through
+ * on a 90 kHz time base, and each segment lasts up to the next one's first
+ * frame in the concat list.
+ */
+
+#define SPLIT_MAX_SEGMENTS 256
+#define SPLIT_MIN_FRAMES 60         // Shortest segment worth an ffmpeg start (and a keyframe)
+#define SPLIT_GOP_SEC 2             // Keyframe interval within a segment
+#define SPLIT_FALLBACK_FPS 30       // Frame rate when neither timestamps nor a nominal rate are known
+#define SPLIT_FFMPEG "ffmpeg"       // Program, looked up in PATH
+
+struct split_stats{
+    unsigned int segments;
+    uint64_t frames;
+    double encode_ms;               // Encoding time of all segments (on one core: the sequential time)
+    double concat_ms;               // Joining the segments
+};
+
+/*
+ * find ffmpeg in PATH. The threads that run it resolve it before fork(): a child
+ * of a multithreaded process may only call async-signal-safe functions, which
+ * rules out execvp()'s PATH search.
+ * args:
+ *   path, len - resolved path
+ *
+ * returns: 0 ok, -1 if not found (errno ENOENT)
+ */
+int split_ffmpeg_path(char* path, size_t len);
+
+/*
+ * transcode <recording> to an H.264 MP4
+ * args:
+ *   output - MP4 file to create
+ *   segments - pieces to cut the recording in (fewer if it is short)
+ *   cores - one unit per ffmpeg allowed to run, shared by concurrent transcodes
+ *   nice - niceness of the ffmpeg processes
+ *   stats - filled on success, may be NULL
+ *   step - on error, the step that failed
+ *
+ * returns: 0 ok, -1 on error (errno set; ENOENT/EINVAL for a missing or invalid index),
+ *          else the failing ffmpeg's exit status
+ */
+int split_transcode(const char* recording, const char* output, int segments, sem_t* cores, int nice,
+                    struct split_stats* stats, const char** step);
+
+#endif
@@ -33,6 +33,8 @@
 //#include "gviewrender.h"
 //#include "render.h"
 #include "render_sdl2.h"
+#include "../mjpeg_decode.h"
+#include "../pix_convert.h"
 //#include "../config.h"
 
 
@@ -47,6 +49,11 @@ static SDL_Window*  sdl_window = NULL;
 static SDL_Texture* rendering_texture = NULL;
 static SDL_Renderer*  main_renderer = NULL;
 
+/* persistent MJPEG decoder (NULL: SDL_image fallback) */
+static struct mjpeg_decoder* mjpeg_dec = NULL;
+static int texture_width = 0;
+static int texture_height = 0;
+
 /*
  * initialize sdl video
  * args:
@@ -235,6 +242,14 @@ static int video_init(int width, int height, int flags)
 		return -4;
 	}
 
+	texture_width = width;
+	texture_height = height;
+
+	/* decoder context reused by every frame */
+	mjpeg_dec = mjpeg_decoder_open();
+	if(verbosity > 0)
+		printf("RENDER: MJPEG decoder: %s\n", mjpeg_dec ? "libjpeg-turbo (persistent)" : "SDL_image");
+
     return 0;
 }
 
@@ -404,6 +419,9 @@ void render_sdl2_dispatch_events()
  */
 void render_sdl2_clean()
 {
+	mjpeg_decoder_close(mjpeg_dec);
+	mjpeg_dec = NULL;
+
 	if(rendering_texture)
 		SDL_DestroyTexture(rendering_texture);
 
@@ -453,31 +471,70 @@ int decode_sdl2_mjpeg_frame(uint8_t *src, uint8_t *dst, size_t size) {
 }
 
 
+/*
+ * decode a MJPEG frame straight into the streaming texture and render it
+ * args:
+ *   src - jpeg data
+ *   size - jpeg data size
+ *
+ * asserts:
+ *   rendering_texture is not null
+ *
+ * returns: error code (0 ok, -1 frame not decoded)
+ */
+int render_sdl2_mjpeg_frame(const uint8_t *src, size_t size)
+{
+	assert(rendering_texture != NULL);
+
+	void *pixels;
+	int pitch;
+	if(SDL_LockTexture(rendering_texture, NULL, &pixels, &pitch) < 0)
+	{
+		fprintf(stderr, "RENDER: (SDL2) Couldn't lock texture: %s\n", SDL_GetError());
+		return -1;
+	}
+
+	int ret = 0;
+	if(mjpeg_dec)
+		ret = mjpeg_decode(mjpeg_dec, src, size, pixels, pitch, texture_width, texture_height);
+	else
+	{
+		/* SDL_image allocates a surface per frame: copy its rows to the texture */
+		SDL_RWops *buffer_stream = SDL_RWFromMem((void *)src, size);
+		SDL_Surface *frame = IMG_LoadJPG_RW(buffer_stream);
+		if(frame && frame->format->format == SDL_PIXELFORMAT_RGB24 && frame->w == texture_width && frame->h == texture_height)
+		{
+			for(int y = 0; y < frame->h; y++)
+				memcpy((uint8_t *)pixels + y * pitch, (uint8_t *)frame->pixels + y * frame->pitch, frame->w * 3);
+		}
+		else
+			ret = -1;
+		if(frame)
+			SDL_FreeSurface(frame);
+		SDL_FreeRW(buffer_stream);
+	}
+	SDL_UnlockTexture(rendering_texture);
+
+	/* keep showing the previous frame if this one is damaged */
+	if(ret < 0 && verbosity > 1)
+		fprintf(stderr, "RENDER: couldn't decode frame\n");
+
+	SDL_SetRenderDrawColor(main_renderer, 0, 0, 0, 255); /*black*/
+	SDL_RenderClear(main_renderer);
+	SDL_RenderCopy(main_renderer, rendering_texture, NULL, NULL);
+	SDL_RenderPresent(main_renderer);
+
+	return ret;
+}
+
 int RGB24_to_GREY(uint8_t *src, uint8_t *dst, int imgsize) {
-    int8_t src_pixw = sizeof(char)*3;
-    int8_t dst_pixw = sizeof(char);
-    int32_t si, di;
-    for(si=0, di=0; si < imgsize*src_pixw;) {        
-        register int R = src[si];
-        register int G = src[si+1];
-        register int B = src[si+2];
-        dst[di] = (R+R+R+B+G+G+G+G)>>3;
-        si += src_pixw;
-        di += dst_pixw;
-    }
-    return di;
+	pix_rgb24_to_grey(src, dst, imgsize);
+	return imgsize;
 }
 
 int GREY_to_RGB24(uint8_t *src, uint8_t *dst, int imgsize) {
-    int8_t src_pixw = sizeof(char);
-    int8_t dst_pixw = sizeof(char)*3;
-    int32_t si, di;
-    for(si=0, di=0; si < imgsize*src_pixw;) {
-        dst[di] = dst[di+1] = dst[di+2] = src[si];
-        si += src_pixw;
-        di += dst_pixw;
-    }
-    return di;
+	pix_grey_to_rgb24(src, dst, imgsize);
+	return imgsize * 3;
 }
 
 
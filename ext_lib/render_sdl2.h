@@ -26,6 +26,7 @@
 #ifndef RENDER_SDL2_H
 #define RENDER_SDL2_H
 #include <stdint.h>
+#include <stddef.h>
 
 /*
  * init sdl2 render
@@ -58,6 +59,20 @@ int init_render_sdl2(int width, int height, int flags);
  */
 int render_sdl2_frame(uint8_t *frame, int pitch);
 
+/*
+ * decode a MJPEG frame straight into the streaming texture and render it
+ * (persistent libjpeg-turbo decoder, SDL_image if built without it)
+ * args:
+ *   src - jpeg data
+ *   size - jpeg data size
+ *
+ * asserts:
+ *   rendering texture is not null
+ *
+ * returns: error code (0 ok, -1 frame not decoded)
+ */
+int render_sdl2_mjpeg_frame(const uint8_t *src, size_t size);
+
 /*
  * set sdl1 render caption
  * args:
@@ -0,0 +1,653 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/timerfd.h>
+#include <sys/eventfd.h>
+#include <linux/videodev2.h>
+
+#include "frame_source.h"
+#include "mjpeg_scan.h"
+
+// Macro to clear struct memory
+#define CLEAR(x) memset(&(x), 0, sizeof(x))
+
+// Function to record the failing step: returns -1 so that callers can "return fail(...)"
+static int fail(struct frame_source* src, const char* step){
+    src->error = step;
+    return -1;
+}
+
+// Function to undo a failed open with the backend's own close(), which releases whatever was
+// acquired so far: returns -1, errno is kept for the caller
+static int open_fail(struct frame_source* src, const char* step){
+    int err = errno;
+    src->ops->close(src);
+    src->priv = NULL;
+    src->fd = -1;
+    errno = err;
+    return fail(src, step);
+}
+
+static uint64_t now_us(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+#pragma region V4L2
+
+struct v4l2_priv{
+    void* start[SOURCE_MAX_BUFFERS];
+    size_t length[SOURCE_MAX_BUFFERS];
+};
+
+static int v4l2_dequeue(struct frame_source* src, struct frame_desc* frame){
+    struct v4l2_priv* p = src->priv;
+    struct v4l2_buffer buf;
+    CLEAR(buf);
+    buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    buf.memory = V4L2_MEMORY_MMAP;
+
+    // Dequeue a frame from the buffer
+    if (ioctl(src->fd, VIDIOC_DQBUF, &buf) == -1){
+        if(errno == EAGAIN) return 0;
+        return fail(src, "VIDIOC_DQBUF");
+    }
+    frame->index = buf.index;
+    frame->data = p->start[buf.index];
+    frame->bytesused = buf.bytesused;
+    frame->sequence = buf.sequence;
+    frame->timestamp_us = (uint64_t)buf.timestamp.tv_sec * 1000000 + buf.timestamp.tv_usec;
+    return 1;
+}
+
+static int v4l2_requeue(struct frame_source* src, uint32_t index){
+    struct v4l2_buffer buf;
+    CLEAR(buf);
+    buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    buf.memory = V4L2_MEMORY_MMAP;
+    buf.index = index;
+    if (ioctl(src->fd, VIDIOC_QBUF, &buf) == -1) return fail(src, "VIDIOC_QBUF");
+    return 0;
+}
+
+static int v4l2_set_fps(struct frame_source* src, uint32_t fps_num, uint32_t fps_den){
+    struct v4l2_streamparm parm;
+    CLEAR(parm);
+    parm.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    parm.parm.capture.timeperframe.numerator = fps_den;
+    parm.parm.capture.timeperframe.denominator = fps_num;
+    if (ioctl(src->fd, VIDIOC_S_PARM, &parm) == -1) return fail(src, "VIDIOC_S_PARM");
+    // The driver picks the closest interval it supports
+    src->fps_num = parm.parm.capture.timeperframe.denominator;
+    src->fps_den = parm.parm.capture.timeperframe.numerator;
+    return 0;
+}
+
+// Also undoes a partial open: the device may not be open, the buffers not mapped yet
+static void v4l2_close(struct frame_source* src){
+    struct v4l2_priv* p = src->priv;
+    if (src->fd == -1) return;
+
+    // Stop capturing the frames (a no-op if not streaming yet)
+    enum v4l2_buf_type type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    if (p && -1 == ioctl(src->fd, VIDIOC_STREAMOFF, &type)) perror("VIDIOC_STREAMOFF");
+
+    // Clean-up the webcam device
+    if (p){
+        for (unsigned int i = 0; i < src->n_buffers; ++i)
+            if (-1 == munmap(p->start[i], p->length[i])) perror("munmap");
+        free(p);
+    }
+
+    // Close the webcam device
+    close(src->fd);
+}
+
+static const struct frame_source_ops v4l2_ops = {
+    .dequeue = v4l2_dequeue,
+    .requeue = v4l2_requeue,
+    .set_fps = v4l2_set_fps,
+    .close = v4l2_close,
+};
+
+int source_open_v4l2(struct frame_source* src, const char* dev_name, uint32_t width, uint32_t height, unsigned int n_buffers){
+    memset(src, 0, sizeof(*src));
+    src->ops = &v4l2_ops;
+    src->name = "v4l2";
+
+    // Open the webcam device
+    // REMINDER: Active webcam device on VirtualBox
+    if((src->fd = open(dev_name,O_RDWR | O_NONBLOCK, 0)) == -1) return open_fail(src, dev_name);
+
+    // Initialize the webcam device
+    // 1. Query webcam device capabilities
+    // NOTE: V4L2_CAP_READWRITE not work
+    struct v4l2_capability cap;
+    CLEAR(cap);
+
+    if(ioctl(src->fd,VIDIOC_QUERYCAP,&cap)==-1) return open_fail(src, "VIDIOC_QUERYCAP");
+
+    errno = ENODEV;
+    if (!(cap.capabilities & V4L2_CAP_VIDEO_CAPTURE)) return open_fail(src, "Not a video capture device");
+    if (!(cap.capabilities & V4L2_CAP_STREAMING)) return open_fail(src, "Streaming I/O not supported");
+
+    //2. Set video format (MJPEG for VirtualBox compatibility)
+    struct v4l2_format my_fmt;
+    CLEAR(my_fmt);
+
+    my_fmt.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    my_fmt.fmt.pix.width = width;
+    my_fmt.fmt.pix.height = height;
+    my_fmt.fmt.pix.pixelformat = V4L2_PIX_FMT_MJPEG;
+
+    if (ioctl(src->fd, VIDIOC_S_FMT, &my_fmt) == -1) return open_fail(src, "VIDIOC_S_FMT");
+    src->width = my_fmt.fmt.pix.width;
+    src->height = my_fmt.fmt.pix.height;
+    src->pixelformat = my_fmt.fmt.pix.pixelformat;
+
+    // 3. Read back the frame interval
+    struct v4l2_streamparm parm;
+    CLEAR(parm);
+    parm.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    if (ioctl(src->fd, VIDIOC_G_PARM, &parm) == -1) return open_fail(src, "VIDIOC_G_PARM");
+    src->fps_num = parm.parm.capture.timeperframe.denominator;
+    src->fps_den = parm.parm.capture.timeperframe.numerator;
+
+    // Initilzie mmap
+    struct v4l2_requestbuffers req;
+    CLEAR(req);
+
+    req.count = n_buffers < SOURCE_MAX_BUFFERS ? n_buffers : SOURCE_MAX_BUFFERS;
+    req.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    req.memory = V4L2_MEMORY_MMAP;
+
+    if (ioctl(src->fd, VIDIOC_REQBUFS, &req) == -1) return open_fail(src, "VIDIOC_REQBUFS");
+    errno = ENOMEM;
+    if (req.count < 2) return open_fail(src, "Insufficient buffer memory");
+    if (req.count > SOURCE_MAX_BUFFERS) req.count = SOURCE_MAX_BUFFERS;
+
+    struct v4l2_priv* p = calloc(1, sizeof(*p));
+    if (!p) return open_fail(src, "Out of memory");
+    src->priv = p;
+
+    // Map the webcam device registers to main memory addresses
+    for (src->n_buffers = 0; src->n_buffers < req.count; ++src->n_buffers){
+        struct v4l2_buffer buf;
+        CLEAR(buf);
+
+        buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+        buf.memory = V4L2_MEMORY_MMAP;
+        buf.index = src->n_buffers;
+
+        if (ioctl(src->fd, VIDIOC_QUERYBUF, &buf)== -1) return open_fail(src, "VIDIOC_QUERYBUF");
+
+        p->length[src->n_buffers] = buf.length;
+        p->start[src->n_buffers] =
+            mmap(NULL /* start anywhere */,
+                 buf.length,
+                 PROT_READ | PROT_WRITE /* required */,
+                 MAP_SHARED /* recommended */,
+                 src->fd, buf.m.offset);
+
+        if (MAP_FAILED == p->start[src->n_buffers]) return open_fail(src, "mmap");     // Not counted in n_buffers
+    }
+
+    // Start capturing the frames
+    for (unsigned int i = 0; i < src->n_buffers; ++i)
+        if (v4l2_requeue(src, i) == -1) return open_fail(src, src->error);
+
+    enum v4l2_buf_type type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    if (ioctl(src->fd, VIDIOC_STREAMON, &type) == -1) return open_fail(src, "VIDIOC_STREAMON");
+    return 0;
+}
+
+#pragma endregion
+
+#pragma region SYNTHETIC
+
+/*
+ * Shared by the file and pattern sources. Paced sources tick on a timerfd: a
+ * tick with no free buffer is a dropped frame, like a driver would do. Unpaced
+ * sources use an eventfd counting the free buffers, so select() only wakes up
+ * when a frame can actually be produced.
+ */
+
+struct frame_span{
+    uint64_t offset;
+    uint32_t length;
+};
+
+struct synth_priv{
+    int paced;
+    uint32_t free_mask;         // Buffers available to produce into
+    uint32_t sequence;          // Next frame sequence number
+    void* (*produce)(struct frame_source* src, uint32_t index, uint32_t* bytesused);
+
+    // File replay
+    uint8_t* map;
+    size_t map_len;
+    struct frame_span* frames;
+    size_t n_frames;
+    size_t next_frame;
+    int loop;
+
+    // Test pattern
+    uint8_t* buf[SOURCE_MAX_BUFFERS];
+    size_t buf_len;
+    uint8_t* entropy;           // Scratch space for the entropy-coded segment
+    size_t frame_size;          // Padding target
+};
+
+static int synth_dequeue(struct frame_source* src, struct frame_desc* frame){
+    struct synth_priv* p = src->priv;
+    uint64_t ticks;
+
+    if(read(src->fd, &ticks, sizeof(ticks)) == -1){
+        if(errno == EAGAIN) return 0;
+        return fail(src, "Source_read");
+    }
+    if(p->paced){
+        // Missed ticks, and a tick without free buffer, are dropped frames
+        p->sequence += ticks - 1;
+        if(!p->free_mask){
+            p->sequence++;
+            return 0;
+        }
+    }
+
+    uint32_t index = __builtin_ctz(p->free_mask);
+    uint32_t bytesused;
+    void* data = p->produce(src, index, &bytesused);
+    if(!data){
+        errno = ENODATA;
+        return fail(src, "End of stream");
+    }
+    p->free_mask &= ~(1u << index);
+
+    frame->index = index;
+    frame->data = data;
+    frame->bytesused = bytesused;
+    frame->sequence = p->sequence++;
+    frame->timestamp_us = now_us();
+    return 1;
+}
+
+static int synth_requeue(struct frame_source* src, uint32_t index){
+    struct synth_priv* p = src->priv;
+    p->free_mask |= 1u << index;
+    if(!p->paced){
+        uint64_t one = 1;
+        if(write(src->fd, &one, sizeof(one)) == -1) return fail(src, "Source_write");
+    }
+    return 0;
+}
+
+// Function to (re)arm the frame timer
+static int synth_set_fps(struct frame_source* src, uint32_t fps_num, uint32_t fps_den){
+    struct synth_priv* p = src->priv;
+    if(!p->paced || !fps_num || !fps_den){
+        errno = ENOTSUP;
+        return fail(src, "Source_set_fps");
+    }
+    uint64_t period_ns = (uint64_t)fps_den * 1000000000 / fps_num;
+    struct itimerspec its;
+    CLEAR(its);
+    its.it_interval.tv_sec = period_ns / 1000000000;
+    its.it_interval.tv_nsec = period_ns % 1000000000;
+    its.it_value = its.it_interval;
+    if(timerfd_settime(src->fd, 0, &its, NULL) == -1) return fail(src, "Timerfd_settime");
+    src->fps_num = fps_num;
+    src->fps_den = fps_den;
+    return 0;
+}
+
+static void synth_close(struct frame_source* src){
+    struct synth_priv* p = src->priv;
+    if(p->map) munmap(p->map, p->map_len);
+    free(p->frames);
+    for(unsigned int i = 0; i < src->n_buffers; i++) if(p->buf[i]) munmap(p->buf[i], p->buf_len);
+    free(p->entropy);
+    free(p);
+    if(src->fd != -1) close(src->fd);
+}
+
+static const struct frame_source_ops synth_ops = {
+    .dequeue = synth_dequeue,
+    .requeue = synth_requeue,
+    .set_fps = synth_set_fps,
+    .close = synth_close,
+};
+
+// Function to start a synthetic source: synth_close() releases it from here on, even half open
+static struct synth_priv* synth_alloc(struct frame_source* src, const char* name){
+    memset(src, 0, sizeof(*src));
+    src->name = name;
+    src->fd = -1;
+    src->ops = &synth_ops;
+    struct synth_priv* p = calloc(1, sizeof(*p));
+    if(!p) fail(src, "Out of memory");
+    src->priv = p;
+    return p;
+}
+
+// Function to set up the buffers and the pacing of a synthetic source
+static int synth_init(struct frame_source* src, struct synth_priv* p, double fps, unsigned int n_buffers){
+    src->n_buffers = n_buffers < 2 ? 2 : n_buffers > SOURCE_MAX_BUFFERS ? SOURCE_MAX_BUFFERS : n_buffers;
+    p->free_mask = src->n_buffers == 32 ? ~0u : (1u << src->n_buffers) - 1;
+    src->pixelformat = V4L2_PIX_FMT_MJPEG;
+    src->fps_den = 1;
+
+    if(fps <= 0){
+        if((src->fd = eventfd(src->n_buffers, EFD_NONBLOCK | EFD_SEMAPHORE | EFD_CLOEXEC)) == -1) return fail(src, "Eventfd");
+        return 0;
+    }
+    p->paced = 1;
+    if((src->fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC)) == -1) return fail(src, "Timerfd_create");
+    // Keep fractional rates such as 29.97 exact enough
+    if(fps == (uint32_t)fps) return synth_set_fps(src, fps, 1);
+    return synth_set_fps(src, (uint32_t)(fps * 1000 + 0.5), 1000);
+}
+
+#pragma endregion
+
+#pragma region FILE_REPLAY
+
+// Function to hand out the next recorded frame, straight from the file mapping
+static void* file_produce(struct frame_source* src, uint32_t index, uint32_t* bytesused){
+    struct synth_priv* p = src->priv;
+    (void)index;
+    if(p->next_frame == p->n_frames){
+        if(!p->loop) return NULL;
+        p->next_frame = 0;
+    }
+    struct frame_span* f = &p->frames[p->next_frame++];
+    *bytesused = f->length;
+    return p->map + f->offset;
+}
+
+// Function to find the frames of a recording: each runs from an SOI to the next EOI
+static int index_frames(struct synth_priv* p){
+    struct mjpeg_scanner scan;
+    struct mjpeg_mark marks[4096];
+    size_t cap = 1024, pos = 0;
+    int64_t start = -1;
+    mjpeg_scan_init(&scan);
+    if(!(p->frames = malloc(cap * sizeof(*p->frames)))) return -1;
+
+    while(pos < p->map_len){
+        size_t consumed;
+        size_t n = mjpeg_scan(&scan, p->map + pos, p->map_len - pos, marks, sizeof(marks)/sizeof(marks[0]), &consumed);
+        pos += consumed;
+        for(size_t i = 0; i < n; i++){
+            if(marks[i].type == MJPEG_SOI){
+                start = marks[i].offset;
+                continue;
+            }
+            if(start < 0) continue;
+            if(p->n_frames == cap){
+                struct frame_span* f = realloc(p->frames, 2 * cap * sizeof(*f));
+                if(!f) return -1;
+                p->frames = f;
+                cap *= 2;
+            }
+            p->frames[p->n_frames].offset = start;
+            p->frames[p->n_frames++].length = marks[i].offset + 2 - start;
+            start = -1;
+        }
+    }
+    return 0;
+}
+
+int source_open_file(struct frame_source* src, const char* path, double fps, int loop, unsigned int n_buffers){
+    struct synth_priv* p = synth_alloc(src, "file");
+    if(!p) return -1;
+    p->produce = file_produce;
+    p->loop = loop;
+
+    int fd = open(path, O_RDONLY);
+    if(fd == -1) return open_fail(src, path);
+    struct stat st;
+    if(fstat(fd, &st) == -1){
+        int err = errno;
+        close(fd);
+        errno = err;
+        return open_fail(src, path);
+    }
+    p->map_len = st.st_size;
+    p->map = p->map_len ? mmap(NULL, p->map_len, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0) : NULL;
+    close(fd);
+    if(p->map == MAP_FAILED){
+        p->map = NULL;
+        return open_fail(src, "mmap");
+    }
+    if(index_frames(p) == -1) return open_fail(src, "Out of memory");
+    errno = ENODATA;
+    if(!p->n_frames) return open_fail(src, "No JPEG frame in file");
+
+    // Take the resolution from the first frame's SOF header
+    const uint8_t* f = p->map + p->frames[0].offset;
+    for(uint32_t i = 2; i + 9 < p->frames[0].length && f[i] == 0xFF; i += 2 + (f[i+2] << 8 | f[i+3])){
+        if(f[i+1] >= 0xC0 && f[i+1] <= 0xC2){
+            src->height = f[i+5] << 8 | f[i+6];
+            src->width = f[i+7] << 8 | f[i+8];
+            break;
+        }
+    }
+    if(synth_init(src, p, fps, n_buffers) == -1) return open_fail(src, src->error);
+    return 0;
+}
+
+#pragma endregion
+
+#pragma region TEST_PATTERN
+
+/*
+ * Minimal baseline JPEG encoder: YCbCr 4:2:0, flat 8x8 blocks (DC only).
+ * Each block only needs a DC difference and an end-of-block code, so frames are
+ * cheap to produce yet decode with any JPEG decoder. The DC codes use the
+ * standard tables of JPEG Annex K; the AC tables only hold the EOB symbol.
+ */
+
+#define PATTERN_Q 16    // Quantizer of every coefficient
+
+static const uint8_t dc_luma_bits[16] = {0, 1, 5, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0, 0, 0};
+static const uint8_t dc_chroma_bits[16] = {0, 3, 1, 1, 1, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0};
+static const uint8_t dc_vals[12] = {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11};
+static const uint8_t ac_eob_bits[16] = {1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0};
+static const uint8_t ac_eob_vals[1] = {0x00};
+
+// 75% color bars in Y'CbCr: white, yellow, cyan, green, magenta, red, blue, black
+static const uint8_t bars[8][3] = {
+    {180, 128, 128}, {162, 44, 142}, {131, 156, 44}, {112, 72, 58},
+    {84, 184, 198}, {65, 100, 212}, {35, 212, 114}, {16, 128, 128},
+};
+
+struct bit_writer{
+    uint8_t* out;
+    size_t pos;
+    uint32_t acc;
+    int n_bits;
+};
+
+static void put_bits(struct bit_writer* w, uint32_t bits, int n){
+    w->acc = w->acc << n | (bits & ((1u << n) - 1));
+    w->n_bits += n;
+    while(w->n_bits >= 8){
+        uint8_t byte = w->acc >> (w->n_bits - 8);
+        w->out[w->pos++] = byte;
+        // Byte stuffing: 0xFF in entropy data is followed by 0x00
+        if(byte == 0xFF) w->out[w->pos++] = 0x00;
+        w->n_bits -= 8;
+    }
+}
+
+// Function to derive canonical Huffman codes, for the DC categories
+static void huff_codes(const uint8_t bits[16], uint16_t code[12], uint8_t size[12]){
+    uint16_t c = 0;
+    int k = 0;
+    for(int len = 1; len <= 16; len++){
+        for(int i = 0; i < bits[len-1]; i++){
+            code[dc_vals[k]] = c++;
+            size[dc_vals[k++]] = len;
+        }
+        c <<= 1;
+    }
+}
+
+// Function to code one flat block: DC difference, then EOB
+static void put_block(struct bit_writer* w, int dc, int* pred, const uint16_t* code, const uint8_t* size){
+    int diff = dc - *pred;
+    *pred = dc;
+    int mag = diff < 0 ? -diff : diff;
+    int cat = 0;
+    while(mag >> cat) cat++;
+    put_bits(w, code[cat], size[cat]);
+    if(cat) put_bits(w, diff < 0 ? diff - 1 : diff, cat);
+    put_bits(w, 0, 1);  // EOB: the only AC symbol, code "0"
+}
+
+static int level_to_dc(int v){
+    return (v - 128) * 8 / PATTERN_Q;
+}
+
+// Function to encode the entropy-coded segment of frame <n>: moving bars with a bouncing box
+static size_t pattern_entropy(const struct frame_source* src, uint8_t* out, uint32_t n){
+    static uint16_t luma_code[12], chroma_code[12];
+    static uint8_t luma_size[12], chroma_size[12];
+    if(!luma_size[0]){
+        huff_codes(dc_luma_bits, luma_code, luma_size);
+        huff_codes(dc_chroma_bits, chroma_code, chroma_size);
+    }
+
+    struct bit_writer w = {.out = out};
+    int pred[3] = {0, 0, 0};
+    uint32_t mcu_w = (src->width + 15) / 16, mcu_h = (src->height + 15) / 16;
+    uint32_t box_w = mcu_w > 8 ? mcu_w / 8 : 1;
+    uint32_t box_x = mcu_w > box_w ? n % (2 * (mcu_w - box_w)) : 0;
+    if(box_x >= mcu_w - box_w) box_x = 2 * (mcu_w - box_w) - box_x;
+    uint32_t box_y = mcu_h / 2 > box_w ? mcu_h / 2 - box_w / 2 : 0;
+
+    for(uint32_t my = 0; my < mcu_h; my++){
+        for(uint32_t mx = 0; mx < mcu_w; mx++){
+            const uint8_t* c = bars[((mx + n) * 8 / mcu_w) % 8];
+            int in_box = mx >= box_x && mx < box_x + box_w && my >= box_y && my < box_y + box_w;
+            int y = in_box ? 235 : c[0];
+            // 4 luma blocks with a slight gradient, then Cb, Cr
+            for(int b = 0; b < 4; b++) put_block(&w, level_to_dc(y - 4 * (b >> 1)), &pred[0], luma_code, luma_size);
+            put_block(&w, level_to_dc(in_box ? 128 : c[1]), &pred[1], chroma_code, chroma_size);
+            put_block(&w, level_to_dc(in_box ? 128 : c[2]), &pred[2], chroma_code, chroma_size);
+        }
+    }
+    // Pad the last byte with 1s
+    if(w.n_bits) put_bits(&w, 0x7F, 8 - w.n_bits);
+    return w.pos;
+}
+
+static uint8_t* put_segment(uint8_t* p, uint8_t marker, uint16_t len){
+    *p++ = 0xFF;
+    *p++ = marker;
+    *p++ = len >> 8;
+    *p++ = len;
+    return p;
+}
+
+static uint8_t* put_dht(uint8_t* p, uint8_t class_id, const uint8_t bits[16], const uint8_t* vals, int n_vals){
+    *p++ = class_id;
+    memcpy(p, bits, 16);
+    memcpy(p + 16, vals, n_vals);
+    return p + 16 + n_vals;
+}
+
+// Function to build test-pattern frame number <sequence> into buffer <index>
+static void* pattern_produce(struct frame_source* src, uint32_t index, uint32_t* bytesused){
+    struct synth_priv* p = src->priv;
+    uint8_t* out = p->buf[index];
+    uint8_t* o = out;
+    size_t entropy_len = pattern_entropy(src, p->entropy, p->sequence);
+
+    *o++ = 0xFF; *o++ = 0xD8;                               // SOI
+    o = put_segment(o, 0xE0, 16);                           // APP0 (JFIF)
+    memcpy(o, "JFIF\0\1\1\0\0\1\0\1\0\0", 14);
+    o += 14;
+    o = put_segment(o, 0xDB, 67);                           // DQT
+    *o++ = 0;
+    memset(o, PATTERN_Q, 64);
+    o += 64;
+    o = put_segment(o, 0xC0, 17);                           // SOF0
+    *o++ = 8;
+    *o++ = src->height >> 8; *o++ = src->height;
+    *o++ = src->width >> 8; *o++ = src->width;
+    *o++ = 3;
+    *o++ = 1; *o++ = 0x22; *o++ = 0;                        // Y: 2x2 sampling
+    *o++ = 2; *o++ = 0x11; *o++ = 0;                        // Cb
+    *o++ = 3; *o++ = 0x11; *o++ = 0;                        // Cr
+    o = put_segment(o, 0xC4, 2 + 2 * (17 + 12) + 2 * (17 + 1));  // DHT
+    o = put_dht(o, 0x00, dc_luma_bits, dc_vals, 12);
+    o = put_dht(o, 0x10, ac_eob_bits, ac_eob_vals, 1);
+    o = put_dht(o, 0x01, dc_chroma_bits, dc_vals, 12);
+    o = put_dht(o, 0x11, ac_eob_bits, ac_eob_vals, 1);
+
+    // Pad to the requested size with comment segments (bytes < 0x80, so no fake markers)
+    const size_t tail = 14 + entropy_len + 2;   // SOS + data + EOI
+    size_t used = o - out;
+    while(p->frame_size >= used + tail + 4 + 1){
+        size_t seg = p->frame_size - used - tail - 4;
+        if(seg > 65533) seg = 65533;
+        if(p->frame_size - used - tail - 4 - seg > 0 && p->frame_size - used - tail - 4 - seg < 5) seg -= 5;
+        o = put_segment(o, 0xFE, seg + 2);
+        int head = snprintf((char*)o, seg, "frame %u ", p->sequence);
+        for(size_t i = head > 0 ? head : 0; i < seg; i++) o[i] = (uint8_t)(i * 7 + p->sequence) & 0x7F;
+        o += seg;
+        used = o - out;
+    }
+
+    o = put_segment(o, 0xDA, 12);                           // SOS
+    *o++ = 3;
+    *o++ = 1; *o++ = 0x00;
+    *o++ = 2; *o++ = 0x11;
+    *o++ = 3; *o++ = 0x11;
+    *o++ = 0; *o++ = 63; *o++ = 0;
+    memcpy(o, p->entropy, entropy_len);
+    o += entropy_len;
+    *o++ = 0xFF; *o++ = 0xD9;                               // EOI
+
+    *bytesused = o - out;
+    return out;
+}
+
+int source_open_pattern(struct frame_source* src, uint32_t width, uint32_t height, double fps, size_t frame_size, unsigned int n_buffers){
+    struct synth_priv* p = synth_alloc(src, "pattern");
+    if(!p) return -1;
+    src->width = width;
+    src->height = height;
+    p->produce = pattern_produce;
+    p->frame_size = frame_size;
+    if(synth_init(src, p, fps, n_buffers) == -1) return open_fail(src, src->error);
+
+    // Worst case per MCU: 6 blocks of <= 20 bits, doubled by byte stuffing
+    size_t mcus = (size_t)((width + 15) / 16) * ((height + 15) / 16);
+    size_t entropy_max = mcus * 30 + 16;
+    if(!(p->entropy = malloc(entropy_max))) return open_fail(src, "Out of memory");
+
+    // Page-aligned buffers, as V4L2 would hand out (and MSG_ZEROCOPY prefers)
+    p->buf_len = 1024 + entropy_max + frame_size;
+    for(unsigned int i = 0; i < src->n_buffers; i++){
+        p->buf[i] = mmap(NULL, p->buf_len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if(p->buf[i] == MAP_FAILED){
+            p->buf[i] = NULL;
+            return open_fail(src, "mmap");
+        }
+    }
+    return 0;
+}
+
+#pragma endregion
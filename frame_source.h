@@ -0,0 +1,102 @@
+#ifndef FRAME_SOURCE_H
+#define FRAME_SOURCE_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+ * Frame sources for the client.
+ *
+ * Every source hands out frames in a fixed set of buffers, like the V4L2 mmap
+ * interface: dequeue a frame, use it, requeue its buffer. A source also
+ * exposes a file descriptor that becomes readable when a frame may be ready,
+ * so that the capture loop can select() on it.
+ *
+ * Backends:
+ *   - v4l2:    a capture device (mmap streaming I/O)
+ *   - file:    replay of an existing .mjpeg recording
+ *   - pattern: generated test-pattern JPEGs (moving bars), padded to a chosen size
+ * The synthetic backends run at a given fps, or as fast as possible with fps 0.
+ */
+
+#define SOURCE_MAX_BUFFERS 32
+
+// A dequeued frame
+struct frame_desc{
+    uint32_t index;         // Buffer index, to requeue
+    void* data;             // Frame bytes
+    uint32_t bytesused;
+    uint32_t sequence;      // Frame counter: gaps mean frames dropped by the source
+    uint64_t timestamp_us;  // Capture time (CLOCK_MONOTONIC)
+};
+
+struct frame_source;
+
+struct frame_source_ops{
+    // returns: 1 frame dequeued, 0 none ready, -1 error (errno ENODATA: end of stream)
+    int (*dequeue)(struct frame_source* src, struct frame_desc* frame);
+    // returns: 0 ok, -1 error
+    int (*requeue)(struct frame_source* src, uint32_t index);
+    // returns: 0 ok, -1 error (unsupported: ENOTSUP)
+    int (*set_fps)(struct frame_source* src, uint32_t fps_num, uint32_t fps_den);
+    void (*close)(struct frame_source* src);
+};
+
+struct frame_source{
+    const struct frame_source_ops* ops;
+    const char* name;       // Backend name
+    const char* error;      // Step that failed, when a call returns -1
+    int fd;                 // Readable when a frame may be ready
+    unsigned int n_buffers;
+
+    // Negotiated format
+    uint32_t width;
+    uint32_t height;
+    uint32_t pixelformat;   // V4L2 fourcc
+    uint32_t fps_num;       // 0/1: unpaced
+    uint32_t fps_den;
+
+    void* priv;             // Backend state
+};
+
+/*
+ * open a V4L2 capture device and start streaming MJPEG
+ * args:
+ *   dev_name - device node, e.g. /dev/video0
+ *   width, height - requested resolution
+ *   n_buffers - requested number of capture buffers
+ *
+ * returns: 0 ok, -1 on error (errno set, src->error names the step)
+ */
+int source_open_v4l2(struct frame_source* src, const char* dev_name, uint32_t width, uint32_t height, unsigned int n_buffers);
+
+/*
+ * replay an .mjpeg recording
+ * args:
+ *   path - recording to replay
+ *   fps - frame rate, 0 for as fast as possible
+ *   loop - restart at the end instead of reporting end of stream
+ *   n_buffers - number of buffers
+ *
+ * returns: 0 ok, -1 on error
+ */
+int source_open_file(struct frame_source* src, const char* path, double fps, int loop, unsigned int n_buffers);
+
+/*
+ * generate test-pattern JPEGs
+ * args:
+ *   width, height - resolution
+ *   fps - frame rate, 0 for as fast as possible
+ *   frame_size - pad every frame to this many bytes (0: no padding)
+ *   n_buffers - number of buffers
+ *
+ * returns: 0 ok, -1 on error
+ */
+int source_open_pattern(struct frame_source* src, uint32_t width, uint32_t height, double fps, size_t frame_size, unsigned int n_buffers);
+
+static inline int source_dequeue(struct frame_source* src, struct frame_desc* frame){ return src->ops->dequeue(src, frame); }
+static inline int source_requeue(struct frame_source* src, uint32_t index){ return src->ops->requeue(src, index); }
+static inline int source_set_fps(struct frame_source* src, uint32_t num, uint32_t den){ return src->ops->set_fps(src, num, den); }
+static inline void source_close(struct frame_source* src){ src->ops->close(src); }
+
+#endif
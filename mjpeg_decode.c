@@ -0,0 +1,153 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "mjpeg_decode.h"
+
+#ifdef HAVE_LIBJPEG
+
+#include <setjmp.h>
+#include <jpeglib.h>
+
+struct mjpeg_decoder{
+    struct jpeg_decompress_struct cinfo;
+    struct jpeg_error_mgr err;
+    jmp_buf fail;                   // Where libjpeg errors land
+    JSAMPROW* rows;                 // Row table, grown to the tallest frame
+    int max_rows;
+};
+
+// libjpeg error handler: back to mjpeg_decode() instead of exit()
+static void on_error(j_common_ptr cinfo){
+    struct mjpeg_decoder* d = (struct mjpeg_decoder*)cinfo;
+    longjmp(d->fail, 1);
+}
+
+// Warnings (e.g. truncated entropy data) would be printed for every damaged frame
+static void on_message(j_common_ptr cinfo){
+    (void)cinfo;
+}
+
+int mjpeg_decoder_available(void){
+    return 1;
+}
+
+// Function to create the libjpeg decompressor: returns -1 on error. Kept apart from the
+// allocation so that no local of mjpeg_decoder_open() lives across the setjmp()
+static int create_decompress(struct mjpeg_decoder* d){
+    if(setjmp(d->fail)) return -1;
+    jpeg_create_decompress(&d->cinfo);
+    return 0;
+}
+
+struct mjpeg_decoder* mjpeg_decoder_open(void){
+    struct mjpeg_decoder* d = calloc(1, sizeof(*d));
+    if(!d) return NULL;
+    d->cinfo.err = jpeg_std_error(&d->err);
+    d->err.error_exit = on_error;
+    d->err.output_message = on_message;
+    if(create_decompress(d)){
+        free(d);
+        return NULL;
+    }
+    return d;
+}
+
+// Function to make room for height rows in the row table: returns -1 if out of memory
+static int grow_rows(struct mjpeg_decoder* d, int height){
+    if(height <= d->max_rows) return 0;
+    JSAMPROW* rows = realloc(d->rows, height * sizeof(*rows));
+    if(!rows) return -1;
+    d->rows = rows;
+    d->max_rows = height;
+    return 0;
+}
+
+int mjpeg_decode(struct mjpeg_decoder* d, const uint8_t* src, size_t len, uint8_t* dst, int pitch, int width, int height){
+    struct jpeg_decompress_struct* cinfo = &d->cinfo;
+    if(setjmp(d->fail)){
+        jpeg_abort_decompress(cinfo);
+        return -1;
+    }
+    jpeg_mem_src(cinfo, src, len);
+    jpeg_read_header(cinfo, TRUE);
+    if((int)cinfo->image_width != width || (int)cinfo->image_height != height || pitch < width * 3){
+        jpeg_abort_decompress(cinfo);
+        return -1;
+    }
+    cinfo->out_color_space = JCS_RGB;
+    jpeg_start_decompress(cinfo);
+
+    if(grow_rows(d, height)){
+        jpeg_abort_decompress(cinfo);
+        return -1;
+    }
+    for(int y = 0; y < height; y++) d->rows[y] = dst + (size_t)y * pitch;
+    while(cinfo->output_scanline < cinfo->output_height)
+        jpeg_read_scanlines(cinfo, d->rows + cinfo->output_scanline, cinfo->output_height - cinfo->output_scanline);
+    jpeg_finish_decompress(cinfo);
+    return 0;
+}
+
+int mjpeg_decode_luma_dc(struct mjpeg_decoder* d, const uint8_t* src, size_t len, uint8_t* dst, size_t max_len, int* width, int* height){
+    struct jpeg_decompress_struct* cinfo = &d->cinfo;
+    if(setjmp(d->fail)){
+        jpeg_abort_decompress(cinfo);
+        return -1;
+    }
+    jpeg_mem_src(cinfo, src, len);
+    jpeg_read_header(cinfo, TRUE);
+    // 1/8 scaling takes the DC-only IDCT path; greyscale output skips chroma
+    cinfo->out_color_space = JCS_GRAYSCALE;
+    cinfo->scale_num = 1;
+    cinfo->scale_denom = 8;
+    cinfo->dct_method = JDCT_IFAST;
+    cinfo->do_fancy_upsampling = FALSE;
+    jpeg_calc_output_dimensions(cinfo);
+    int w = cinfo->output_width, h = cinfo->output_height;
+    if((size_t)w * h > max_len || grow_rows(d, h)){
+        jpeg_abort_decompress(cinfo);
+        return -1;
+    }
+    jpeg_start_decompress(cinfo);
+    for(int y = 0; y < h; y++) d->rows[y] = dst + (size_t)y * w;
+    while(cinfo->output_scanline < cinfo->output_height)
+        jpeg_read_scanlines(cinfo, d->rows + cinfo->output_scanline, cinfo->output_height - cinfo->output_scanline);
+    jpeg_finish_decompress(cinfo);
+    *width = w;
+    *height = h;
+    return 0;
+}
+
+void mjpeg_decoder_close(struct mjpeg_decoder* d){
+    if(!d) return;
+    jpeg_destroy_decompress(&d->cinfo);
+    free(d->rows);
+    free(d);
+}
+
+#else
+
+int mjpeg_decoder_available(void){
+    return 0;
+}
+
+struct mjpeg_decoder* mjpeg_decoder_open(void){
+    return NULL;
+}
+
+int mjpeg_decode(struct mjpeg_decoder* d, const uint8_t* src, size_t len, uint8_t* dst, int pitch, int width, int height){
+    (void)d; (void)src; (void)len; (void)dst; (void)pitch; (void)width; (void)height;
+    return -1;
+}
+
+int mjpeg_decode_luma_dc(struct mjpeg_decoder* d, const uint8_t* src, size_t len, uint8_t* dst, size_t max_len, int* width, int* height){
+    (void)d; (void)src; (void)len; (void)dst; (void)max_len; (void)width; (void)height;
+    return -1;
+}
+
+void mjpeg_decoder_close(struct mjpeg_decoder* d){
+    (void)d;
+}
+
+#endif
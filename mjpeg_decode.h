@@ -0,0 +1,54 @@
+#ifndef MJPEG_DECODE_H
+#define MJPEG_DECODE_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+ * Persistent MJPEG -> RGB24 decoder (libjpeg-turbo, build with LIBJPEG=1, the default).
+ *
+ * The decompressor and the row table are set up once and reused for every
+ * frame, and rows are decoded straight into the caller's memory (e.g. a locked
+ * streaming texture), whatever its pitch. Frames of a new size only grow the
+ * row table; otherwise the decoder itself allocates nothing per frame (libjpeg
+ * keeps its own per-image work pool).
+ */
+
+struct mjpeg_decoder;
+
+/*
+ * returns: 1 if built with libjpeg, 0 otherwise
+ */
+int mjpeg_decoder_available(void);
+
+/*
+ * returns: the decoder, NULL on error (also when built without libjpeg)
+ */
+struct mjpeg_decoder* mjpeg_decoder_open(void);
+
+/*
+ * decode a JPEG frame to RGB24
+ * args:
+ *   src, len - JPEG data
+ *   dst, pitch - output rows (pitch: bytes between two rows, at least width * 3)
+ *   width, height - expected size: a frame of another size is not decoded
+ *
+ * returns: 0 ok, -1 on corrupt data or size mismatch
+ */
+int mjpeg_decode(struct mjpeg_decoder* d, const uint8_t* src, size_t len, uint8_t* dst, int pitch, int width, int height);
+
+/*
+ * decode the 1/8-scale luma of a JPEG frame: one byte per 8x8 block, from the
+ * DC coefficients only (no chroma, no inverse DCT)
+ * args:
+ *   src, len - JPEG data
+ *   dst, max_len - output, (width + 7) / 8 * (height + 7) / 8 bytes for a full frame
+ *   width, height - set to the size of the output
+ *
+ * returns: 0 ok, -1 on corrupt data or if dst is too small
+ */
+int mjpeg_decode_luma_dc(struct mjpeg_decoder* d, const uint8_t* src, size_t len, uint8_t* dst, size_t max_len, int* width, int* height);
+
+void mjpeg_decoder_close(struct mjpeg_decoder* d);
+
+#endif
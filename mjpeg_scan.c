@@ -0,0 +1,257 @@
+#include "mjpeg_scan.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define MJPEG_SCAN_X86 1
+#endif
+
+/*
+ * Every kernel looks at the byte pairs (buf[i], buf[i+1]) for i in [0, len-1)
+ * and reports each i where buf[i] == 0xFF and buf[i+1] is 0xD8 or 0xD9.
+ * D8 and D9 only differ in the lowest bit, so (b | 1) == 0xD9 matches both.
+ * The pair straddling two buffers is handled by the caller.
+ */
+
+typedef size_t (*scan_fn)(const uint8_t* buf, size_t len, uint64_t base,
+                          struct mjpeg_mark* marks, size_t max_marks, size_t* stop);
+typedef size_t (*count_fn)(const uint8_t* buf, size_t len);
+
+#pragma region SCALAR
+
+static size_t scan_scalar(const uint8_t* buf, size_t len, uint64_t base,
+                          struct mjpeg_mark* marks, size_t max_marks, size_t* stop){
+    size_t n = 0;
+    for(size_t i = 0; i + 1 < len; i++){
+        if(buf[i] != 0xFF || (buf[i+1] | 1) != MJPEG_EOI) continue;
+        if(n == max_marks){
+            *stop = i;
+            return n;
+        }
+        marks[n].offset = base + i;
+        marks[n++].type = buf[i+1];
+    }
+    *stop = len;
+    return n;
+}
+
+static size_t count_scalar(const uint8_t* buf, size_t len){
+    size_t n = 0;
+    for(size_t i = 0; i + 1 < len; i++)
+        n += (buf[i] == 0xFF) & (buf[i+1] == MJPEG_SOI);
+    return n;
+}
+
+#pragma endregion
+
+#ifdef MJPEG_SCAN_X86
+#pragma region SIMD
+
+// Function to turn a bitmask of marker positions into marks: returns 0 if marks filled up
+static inline int emit_marks(uint64_t mask, const uint8_t* buf, size_t i, uint64_t base,
+                             struct mjpeg_mark* marks, size_t max_marks, size_t* n, size_t* stop){
+    while(mask){
+        size_t at = i + __builtin_ctzll(mask);
+        if(*n == max_marks){
+            *stop = at;
+            return 0;
+        }
+        marks[*n].offset = base + at;
+        marks[(*n)++].type = buf[at+1];
+        mask &= mask - 1;
+    }
+    return 1;
+}
+
+__attribute__((target("sse2")))
+static size_t scan_sse2(const uint8_t* buf, size_t len, uint64_t base,
+                        struct mjpeg_mark* marks, size_t max_marks, size_t* stop){
+    const __m128i ff = _mm_set1_epi8((char)0xFF);
+    const __m128i eoi = _mm_set1_epi8((char)MJPEG_EOI);
+    const __m128i one = _mm_set1_epi8(1);
+    size_t n = 0, i = 0;
+
+    // Pairs i..i+15 need bytes up to i+16
+    for(; i + 17 <= len; i += 16){
+        __m128i a = _mm_loadu_si128((const __m128i*)(buf + i));
+        __m128i b = _mm_loadu_si128((const __m128i*)(buf + i + 1));
+        __m128i m = _mm_and_si128(_mm_cmpeq_epi8(a, ff), _mm_cmpeq_epi8(_mm_or_si128(b, one), eoi));
+        uint32_t mask = _mm_movemask_epi8(m);
+        if(mask && !emit_marks(mask, buf, i, base, marks, max_marks, &n, stop)) return n;
+    }
+
+    size_t tail_stop;
+    n += scan_scalar(buf + i, len - i, base + i, marks + n, max_marks - n, &tail_stop);
+    *stop = i + tail_stop;
+    return n;
+}
+
+// No popcnt target: SSE2 does not imply POPCNT, __builtin_popcount stays portable here
+__attribute__((target("sse2")))
+static size_t count_sse2(const uint8_t* buf, size_t len){
+    const __m128i ff = _mm_set1_epi8((char)0xFF);
+    const __m128i soi = _mm_set1_epi8((char)MJPEG_SOI);
+    size_t n = 0, i = 0;
+
+    for(; i + 17 <= len; i += 16){
+        __m128i a = _mm_loadu_si128((const __m128i*)(buf + i));
+        __m128i b = _mm_loadu_si128((const __m128i*)(buf + i + 1));
+        __m128i m = _mm_and_si128(_mm_cmpeq_epi8(a, ff), _mm_cmpeq_epi8(b, soi));
+        n += __builtin_popcount(_mm_movemask_epi8(m));
+    }
+    return n + count_scalar(buf + i, len - i);
+}
+
+__attribute__((target("avx2")))
+static size_t scan_avx2(const uint8_t* buf, size_t len, uint64_t base,
+                        struct mjpeg_mark* marks, size_t max_marks, size_t* stop){
+    const __m256i ff = _mm256_set1_epi8((char)0xFF);
+    const __m256i eoi = _mm256_set1_epi8((char)MJPEG_EOI);
+    const __m256i one = _mm256_set1_epi8(1);
+    size_t n = 0, i = 0;
+
+    // 64 pairs per iteration, with a single test for the common no-marker case
+    for(; i + 65 <= len; i += 64){
+        __m256i a0 = _mm256_loadu_si256((const __m256i*)(buf + i));
+        __m256i b0 = _mm256_loadu_si256((const __m256i*)(buf + i + 1));
+        __m256i a1 = _mm256_loadu_si256((const __m256i*)(buf + i + 32));
+        __m256i b1 = _mm256_loadu_si256((const __m256i*)(buf + i + 33));
+        __m256i m0 = _mm256_and_si256(_mm256_cmpeq_epi8(a0, ff), _mm256_cmpeq_epi8(_mm256_or_si256(b0, one), eoi));
+        __m256i m1 = _mm256_and_si256(_mm256_cmpeq_epi8(a1, ff), _mm256_cmpeq_epi8(_mm256_or_si256(b1, one), eoi));
+        if(_mm256_testz_si256(_mm256_or_si256(m0, m1), _mm256_or_si256(m0, m1))) continue;
+
+        uint64_t mask = (uint32_t)_mm256_movemask_epi8(m0) | (uint64_t)(uint32_t)_mm256_movemask_epi8(m1) << 32;
+        if(!emit_marks(mask, buf, i, base, marks, max_marks, &n, stop)) return n;
+    }
+
+    // Remaining blocks of 32 pairs
+    for(; i + 33 <= len; i += 32){
+        __m256i a0 = _mm256_loadu_si256((const __m256i*)(buf + i));
+        __m256i b0 = _mm256_loadu_si256((const __m256i*)(buf + i + 1));
+        __m256i m0 = _mm256_and_si256(_mm256_cmpeq_epi8(a0, ff), _mm256_cmpeq_epi8(_mm256_or_si256(b0, one), eoi));
+        uint32_t mask = _mm256_movemask_epi8(m0);
+        if(mask && !emit_marks(mask, buf, i, base, marks, max_marks, &n, stop)) return n;
+    }
+
+    size_t tail_stop;
+    n += scan_scalar(buf + i, len - i, base + i, marks + n, max_marks - n, &tail_stop);
+    *stop = i + tail_stop;
+    return n;
+}
+
+__attribute__((target("avx2,popcnt")))
+static size_t count_avx2(const uint8_t* buf, size_t len){
+    const __m256i ff = _mm256_set1_epi8((char)0xFF);
+    const __m256i soi = _mm256_set1_epi8((char)MJPEG_SOI);
+    size_t n = 0, i = 0;
+
+    for(; i + 65 <= len; i += 64){
+        __m256i a0 = _mm256_loadu_si256((const __m256i*)(buf + i));
+        __m256i b0 = _mm256_loadu_si256((const __m256i*)(buf + i + 1));
+        __m256i a1 = _mm256_loadu_si256((const __m256i*)(buf + i + 32));
+        __m256i b1 = _mm256_loadu_si256((const __m256i*)(buf + i + 33));
+        __m256i m0 = _mm256_and_si256(_mm256_cmpeq_epi8(a0, ff), _mm256_cmpeq_epi8(b0, soi));
+        __m256i m1 = _mm256_and_si256(_mm256_cmpeq_epi8(a1, ff), _mm256_cmpeq_epi8(b1, soi));
+        if(_mm256_testz_si256(_mm256_or_si256(m0, m1), _mm256_or_si256(m0, m1))) continue;
+        n += __builtin_popcount(_mm256_movemask_epi8(m0)) + __builtin_popcount(_mm256_movemask_epi8(m1));
+    }
+    return n + count_sse2(buf + i, len - i);
+}
+
+#pragma endregion
+#endif
+
+#pragma region DISPATCH
+
+static enum mjpeg_scan_impl impl = MJPEG_SCAN_AUTO;
+static scan_fn scan_kernel = scan_scalar;
+static count_fn count_kernel = count_scalar;
+
+enum mjpeg_scan_impl mjpeg_scan_set_impl(enum mjpeg_scan_impl req){
+#ifdef MJPEG_SCAN_X86
+    __builtin_cpu_init();
+    // The AVX2 count kernel uses POPCNT: both must be there
+    int avx2 = __builtin_cpu_supports("avx2") && __builtin_cpu_supports("popcnt");
+    if(req == MJPEG_SCAN_AUTO) req = avx2 ? MJPEG_SCAN_AVX2 : MJPEG_SCAN_SSE2;
+    if(req == MJPEG_SCAN_AVX2 && !avx2) req = MJPEG_SCAN_SCALAR;
+    if(req == MJPEG_SCAN_SSE2 && !__builtin_cpu_supports("sse2")) req = MJPEG_SCAN_SCALAR;
+#else
+    req = MJPEG_SCAN_SCALAR;
+#endif
+
+    switch(req){
+#ifdef MJPEG_SCAN_X86
+    case MJPEG_SCAN_AVX2:
+        scan_kernel = scan_avx2;
+        count_kernel = count_avx2;
+        break;
+    case MJPEG_SCAN_SSE2:
+        scan_kernel = scan_sse2;
+        count_kernel = count_sse2;
+        break;
+#endif
+    default:
+        req = MJPEG_SCAN_SCALAR;
+        scan_kernel = scan_scalar;
+        count_kernel = count_scalar;
+        break;
+    }
+    impl = req;
+    return impl;
+}
+
+const char* mjpeg_scan_impl_name(void){
+    if(impl == MJPEG_SCAN_AUTO) mjpeg_scan_set_impl(MJPEG_SCAN_AUTO);
+    switch(impl){
+    case MJPEG_SCAN_AVX2: return "avx2";
+    case MJPEG_SCAN_SSE2: return "sse2";
+    default: return "scalar";
+    }
+}
+
+#pragma endregion
+
+void mjpeg_scan_init(struct mjpeg_scanner* s){
+    s->offset = 0;
+    s->prev_ff = 0;
+}
+
+size_t mjpeg_scan(struct mjpeg_scanner* s, const uint8_t* buf, size_t len,
+                  struct mjpeg_mark* marks, size_t max_marks, size_t* consumed){
+    if(impl == MJPEG_SCAN_AUTO) mjpeg_scan_set_impl(MJPEG_SCAN_AUTO);
+    size_t n = 0;
+    *consumed = 0;
+    if(!len) return 0;
+
+    // Marker split across the previous buffer and this one
+    if(s->prev_ff && (buf[0] | 1) == MJPEG_EOI){
+        if(!max_marks) return 0;
+        marks[n].offset = s->offset - 1;
+        marks[n++].type = buf[0];
+    }
+
+    size_t stop;
+    n += scan_kernel(buf, len, s->offset, marks + n, max_marks - n, &stop);
+    if(stop < len){
+        // Out of room: resume at the 0xFF of the marker that did not fit
+        s->prev_ff = 0;
+        s->offset += stop;
+        *consumed = stop;
+        return n;
+    }
+
+    s->prev_ff = buf[len-1] == 0xFF;
+    s->offset += len;
+    *consumed = len;
+    return n;
+}
+
+size_t mjpeg_count_soi(struct mjpeg_scanner* s, const uint8_t* buf, size_t len){
+    if(impl == MJPEG_SCAN_AUTO) mjpeg_scan_set_impl(MJPEG_SCAN_AUTO);
+    if(!len) return 0;
+
+    size_t n = s->prev_ff && buf[0] == MJPEG_SOI;
+    n += count_kernel(buf, len);
+    s->prev_ff = buf[len-1] == 0xFF;
+    s->offset += len;
+    return n;
+}
@@ -0,0 +1,79 @@
+#ifndef MJPEG_SCAN_H
+#define MJPEG_SCAN_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+ * JPEG marker scanner for MJPEG byte streams.
+ *
+ * Finds every start-of-image (0xFF 0xD8) and end-of-image (0xFF 0xD9) marker
+ * and reports its exact offset in the stream. The scanner state carries over
+ * between calls, so a marker split across two buffers is still found.
+ * SSE2 and AVX2 kernels are picked at runtime, with a scalar fallback.
+ */
+
+#define MJPEG_SOI 0xD8
+#define MJPEG_EOI 0xD9
+
+enum mjpeg_scan_impl{
+    MJPEG_SCAN_AUTO = 0,    // Best kernel supported by the CPU
+    MJPEG_SCAN_SCALAR,
+    MJPEG_SCAN_SSE2,
+    MJPEG_SCAN_AVX2,
+};
+
+// Marker found in the stream
+struct mjpeg_mark{
+    uint64_t offset;    // Stream offset of the 0xFF byte
+    uint8_t type;       // MJPEG_SOI or MJPEG_EOI
+};
+
+// Scanner state, carried across buffers
+struct mjpeg_scanner{
+    uint64_t offset;    // Stream offset of the next byte to scan
+    int prev_ff;        // The last scanned byte was 0xFF
+};
+
+/*
+ * reset the scanner to the start of a stream
+ */
+void mjpeg_scan_init(struct mjpeg_scanner* s);
+
+/*
+ * scan a buffer for SOI/EOI markers
+ * args:
+ *   s - scanner state
+ *   buf, len - next chunk of the stream
+ *   marks - output array
+ *   max_marks - capacity of marks
+ *   consumed - bytes scanned: less than len only if marks filled up,
+ *              in which case the caller scans the rest in another call
+ *
+ * returns: number of marks written
+ */
+size_t mjpeg_scan(struct mjpeg_scanner* s, const uint8_t* buf, size_t len,
+                  struct mjpeg_mark* marks, size_t max_marks, size_t* consumed);
+
+/*
+ * count SOI markers (i.e. frames) in a buffer
+ *
+ * returns: number of frame starts in buf
+ */
+size_t mjpeg_count_soi(struct mjpeg_scanner* s, const uint8_t* buf, size_t len);
+
+/*
+ * force a kernel (for benchmarks); falls back to scalar if unsupported.
+ * MJPEG_SCAN_AUTO picks the best one, as the first scan otherwise does: call
+ * it before scanning from several threads
+ *
+ * returns: the kernel in use
+ */
+enum mjpeg_scan_impl mjpeg_scan_set_impl(enum mjpeg_scan_impl impl);
+
+/*
+ * returns: name of the kernel in use
+ */
+const char* mjpeg_scan_impl_name(void);
+
+#endif
@@ -0,0 +1,117 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+#include "motion.h"
+#include "mjpeg_decode.h"
+
+static uint64_t now_ns(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+int motion_add_region(struct motion_gate* g, const char* spec){
+    struct motion_region r;
+    if(g->n_regions == MOTION_MAX_REGIONS) return -1;
+    if(sscanf(spec, "%f,%f,%f,%f", &r.x, &r.y, &r.w, &r.h) != 4) return -1;
+    if(r.x < 0 || r.y < 0 || r.w <= 0 || r.h <= 0 || r.x + r.w > 100 || r.y + r.h > 100) return -1;
+    r.x /= 100; r.y /= 100; r.w /= 100; r.h /= 100;
+    g->regions[g->n_regions++] = r;
+    return 0;
+}
+
+// Function to mark the blocks inside the regions (every block without regions)
+static void build_mask(struct motion_gate* g){
+    memset(g->mask, !g->n_regions, (size_t)g->width * g->height);
+    for(int i = 0; i < g->n_regions; i++){
+        const struct motion_region* r = &g->regions[i];
+        int x0 = r->x * g->width, y0 = r->y * g->height;
+        int x1 = (r->x + r->w) * g->width + 0.999f, y1 = (r->y + r->h) * g->height + 0.999f;
+        if(x1 > g->width) x1 = g->width;
+        if(y1 > g->height) y1 = g->height;
+        for(int y = y0; y < y1; y++) memset(g->mask + (size_t)y * g->width + x0, 1, x1 - x0);
+    }
+    g->masked = 0;
+    for(size_t i = 0; i < (size_t)g->width * g->height; i++) g->masked += g->mask[i];
+}
+
+int motion_init(struct motion_gate* g, uint32_t width, uint32_t height){
+    if(!mjpeg_decoder_available()){
+        errno = ENOTSUP;
+        return -1;
+    }
+    g->width = (width + 7) / 8;
+    g->height = (height + 7) / 8;
+    size_t blocks = (size_t)g->width * g->height;
+    g->dec = mjpeg_decoder_open();
+    g->cur = malloc(blocks);
+    g->ref = malloc(blocks);
+    g->mask = malloc(blocks);
+    if(!g->dec || !g->cur || !g->ref || !g->mask){
+        motion_close(g);
+        errno = ENOMEM;
+        return -1;
+    }
+    build_mask(g);
+    g->have_ref = 0;
+    return 0;
+}
+
+// Function to tell whether enough masked blocks changed between cur and ref
+static int has_motion(const struct motion_gate* g){
+    size_t blocks = (size_t)g->width * g->height;
+    unsigned int changed = 0, needed = g->min_area * g->masked;
+    if(!needed) needed = 1;
+    for(size_t i = 0; i < blocks; i++){
+        int diff = g->cur[i] - g->ref[i];
+        changed += g->mask[i] & ((diff > g->threshold) | (-diff > g->threshold));
+    }
+    return changed >= needed;
+}
+
+enum motion_verdict motion_check(struct motion_gate* g, const uint8_t* jpeg, size_t len, uint64_t timestamp_us){
+    uint64_t t0 = now_ns();
+    enum motion_verdict v = MOTION_SEND;
+    int w, h;
+    g->frames++;
+
+    if(mjpeg_decode_luma_dc(g->dec, jpeg, len, g->cur, (size_t)g->width * g->height, &w, &h) || w != g->width || h != g->height){
+        // Let the server see (and count) the damaged frame; keep the reference
+        g->errors++;
+        goto out;
+    }
+    if(g->have_ref && !has_motion(g)){
+        if(!g->keepalive_us || timestamp_us - g->last_sent_us < g->keepalive_us){
+            g->suppressed++;
+            v = MOTION_SKIP;
+            goto out;
+        }
+        g->keepalives++;
+        v = MOTION_KEEPALIVE;
+    }
+
+    // The frame goes out: it is the new reference
+    uint8_t* tmp = g->ref;
+    g->ref = g->cur;
+    g->cur = tmp;
+    g->have_ref = 1;
+    g->last_sent_us = timestamp_us;
+
+out:;
+    uint64_t dt = now_ns() - t0;
+    g->time_ns += dt;
+    if(dt > g->max_time_ns) g->max_time_ns = dt;
+    return v;
+}
+
+void motion_close(struct motion_gate* g){
+    mjpeg_decoder_close(g->dec);
+    free(g->cur);
+    free(g->ref);
+    free(g->mask);
+    g->dec = NULL;
+    g->cur = g->ref = g->mask = NULL;
+}
@@ -0,0 +1,88 @@
+#ifndef MOTION_H
+#define MOTION_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+ * Motion gate for the client: decides which captured frames are worth sending.
+ *
+ * Every frame is reduced to its 1/8-scale luma (the JPEG DC coefficients, one
+ * byte per 8x8 block) and compared with the luma of the last frame sent. A
+ * block changed if its luma moved by more than the threshold; a frame has
+ * motion if enough of the blocks inside the region mask changed. Frames
+ * without motion are suppressed, except for a keep-alive frame after a quiet
+ * interval. Comparing with the last frame sent, rather than the previous one,
+ * also catches slow changes (e.g. lighting) once they add up.
+ */
+
+#define MOTION_MAX_REGIONS 8
+
+// Rectangle of the frame, as fractions of its width and height (0-1)
+struct motion_region{
+    float x, y, w, h;
+};
+
+struct motion_gate{
+    // Settings
+    int threshold;              // Luma change of a block that counts as changed (0-255)
+    double min_area;            // Fraction of the masked blocks that must change (0-1)
+    uint64_t keepalive_us;      // Send a frame at least this often (0: never)
+    struct motion_region regions[MOTION_MAX_REGIONS];
+    int n_regions;              // 0: whole frame
+
+    // State
+    struct mjpeg_decoder* dec;
+    int width, height;          // Luma size (blocks)
+    uint8_t* cur;
+    uint8_t* ref;               // Luma of the last frame sent
+    uint8_t* mask;              // Blocks inside the regions
+    unsigned int masked;        // Blocks in the mask
+    int have_ref;
+    uint64_t last_sent_us;
+
+    // Statistics
+    unsigned long long frames;
+    unsigned long long suppressed;
+    unsigned long long keepalives;
+    unsigned long long errors;      // Undecodable frames (sent as they are)
+    uint64_t time_ns;               // Time spent in motion_check()
+    uint64_t max_time_ns;
+};
+
+enum motion_verdict{
+    MOTION_SKIP = 0,    // No motion: do not send
+    MOTION_SEND,        // Motion (or no reference yet, or undecodable frame)
+    MOTION_KEEPALIVE,   // No motion, but the keep-alive interval is up
+};
+
+/*
+ * set up the gate for frames of one size; threshold, min_area, keepalive_us
+ * and regions must be set beforehand
+ * args:
+ *   width, height - frame size (pixels)
+ *
+ * returns: 0 ok, -1 on error (no libjpeg, out of memory)
+ */
+int motion_init(struct motion_gate* g, uint32_t width, uint32_t height);
+
+/*
+ * look at a frame and decide whether to send it; a frame that is sent becomes the reference
+ * args:
+ *   jpeg, len - frame data
+ *   timestamp_us - capture time
+ *
+ * returns: the verdict
+ */
+enum motion_verdict motion_check(struct motion_gate* g, const uint8_t* jpeg, size_t len, uint64_t timestamp_us);
+
+/*
+ * parse a region "x,y,w,h" in percent of the frame, and add it to the mask
+ *
+ * returns: 0 ok, -1 if invalid or too many regions
+ */
+int motion_add_region(struct motion_gate* g, const char* spec);
+
+void motion_close(struct motion_gate* g);
+
+#endif
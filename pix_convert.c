@@ -0,0 +1,540 @@
+#include "pix_convert.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define PIX_CONVERT_X86 1
+#endif
+
+/*
+ * Every kernel converts a run of n pixels of one row or of a whole packed
+ * frame; the public functions split NV12 frames into rows. The SIMD kernels
+ * run the same integer arithmetic as the scalar ones on 16-bit lanes and
+ * leave the tail (n not a multiple of the vector width) to the scalar kernel.
+ * Packed YUV kernels take even n.
+ */
+
+struct kernels{
+    void (*rgb_grey)(const uint8_t* src, uint8_t* dst, size_t n);
+    void (*grey_rgb)(const uint8_t* src, uint8_t* dst, size_t n);
+    void (*packed_rgb)(const uint8_t* src, uint8_t* dst, size_t n, int uyvy);
+    void (*packed_grey)(const uint8_t* src, uint8_t* dst, size_t n, int uyvy);
+    void (*nv12_rgb)(const uint8_t* y, const uint8_t* uv, uint8_t* dst, size_t n);
+    void (*luma_grey)(const uint8_t* y, uint8_t* dst, size_t n);
+};
+
+#pragma region SCALAR
+
+static inline uint8_t clip8(int v){
+    return v < 0 ? 0 : v > 255 ? 255 : v;
+}
+
+static inline void yuv_to_rgb(int y, int u, int v, uint8_t* rgb){
+    int c = 74 * (y - 16) + 32, d = u - 128, e = v - 128;
+    rgb[0] = clip8((c + 102 * e) >> 6);
+    rgb[1] = clip8((c - 25 * d - 52 * e) >> 6);
+    rgb[2] = clip8((c + 129 * d) >> 6);
+}
+
+static inline uint8_t luma(int y){
+    return clip8((74 * (y - 16) + 32) >> 6);
+}
+
+static void rgb_grey_scalar(const uint8_t* src, uint8_t* dst, size_t n){
+    for(size_t i = 0; i < n; i++, src += 3){
+        int r = src[0], g = src[1], b = src[2];
+        dst[i] = (3 * r + 4 * g + b) >> 3;
+    }
+}
+
+static void grey_rgb_scalar(const uint8_t* src, uint8_t* dst, size_t n){
+    for(size_t i = 0; i < n; i++, dst += 3)
+        dst[0] = dst[1] = dst[2] = src[i];
+}
+
+static void packed_rgb_scalar(const uint8_t* src, uint8_t* dst, size_t n, int uyvy){
+    int yo = uyvy, co = !uyvy;      // Offsets of Y0 and U in each 4-byte pair
+    for(size_t i = 0; i + 1 < n; i += 2, src += 4, dst += 6){
+        int u = src[co], v = src[co+2];
+        yuv_to_rgb(src[yo], u, v, dst);
+        yuv_to_rgb(src[yo+2], u, v, dst + 3);
+    }
+}
+
+static void packed_grey_scalar(const uint8_t* src, uint8_t* dst, size_t n, int uyvy){
+    src += uyvy;
+    for(size_t i = 0; i < n; i++) dst[i] = luma(src[2*i]);
+}
+
+static void nv12_rgb_scalar(const uint8_t* y, const uint8_t* uv, uint8_t* dst, size_t n){
+    for(size_t i = 0; i + 1 < n; i += 2, dst += 6){
+        yuv_to_rgb(y[i], uv[i], uv[i+1], dst);
+        yuv_to_rgb(y[i+1], uv[i], uv[i+1], dst + 3);
+    }
+}
+
+static void luma_grey_scalar(const uint8_t* y, uint8_t* dst, size_t n){
+    for(size_t i = 0; i < n; i++) dst[i] = luma(y[i]);
+}
+
+static const struct kernels kernels_scalar = {
+    rgb_grey_scalar, grey_rgb_scalar, packed_rgb_scalar, packed_grey_scalar, nv12_rgb_scalar, luma_grey_scalar,
+};
+
+#pragma endregion
+
+#ifdef PIX_CONVERT_X86
+#pragma region SIMD
+
+#define Z -1    // pshufb: zero this byte
+
+// Bytes of channel k of 16 RGB24 pixels, from each of the three 16-byte loads
+static const int8_t deint_mask[3][3][16] = {
+    {{0, 3, 6, 9, 12, 15, Z, Z, Z, Z, Z, Z, Z, Z, Z, Z},
+     {Z, Z, Z, Z, Z, Z, 2, 5, 8, 11, 14, Z, Z, Z, Z, Z},
+     {Z, Z, Z, Z, Z, Z, Z, Z, Z, Z, Z, 1, 4, 7, 10, 13}},
+    {{1, 4, 7, 10, 13, Z, Z, Z, Z, Z, Z, Z, Z, Z, Z, Z},
+     {Z, Z, Z, Z, Z, 0, 3, 6, 9, 12, 15, Z, Z, Z, Z, Z},
+     {Z, Z, Z, Z, Z, Z, Z, Z, Z, Z, Z, 2, 5, 8, 11, 14}},
+    {{2, 5, 8, 11, 14, Z, Z, Z, Z, Z, Z, Z, Z, Z, Z, Z},
+     {Z, Z, Z, Z, Z, 1, 4, 7, 10, 13, Z, Z, Z, Z, Z, Z},
+     {Z, Z, Z, Z, Z, Z, Z, Z, Z, Z, 0, 3, 6, 9, 12, 15}},
+};
+
+// Bytes of output store o of 16 RGB24 pixels, from each of the R, G, B vectors
+static const int8_t inter_mask[3][3][16] = {
+    {{0, Z, Z, 1, Z, Z, 2, Z, Z, 3, Z, Z, 4, Z, Z, 5},
+     {Z, 0, Z, Z, 1, Z, Z, 2, Z, Z, 3, Z, Z, 4, Z, Z},
+     {Z, Z, 0, Z, Z, 1, Z, Z, 2, Z, Z, 3, Z, Z, 4, Z}},
+    {{Z, Z, 6, Z, Z, 7, Z, Z, 8, Z, Z, 9, Z, Z, 10, Z},
+     {5, Z, Z, 6, Z, Z, 7, Z, Z, 8, Z, Z, 9, Z, Z, 10},
+     {Z, 5, Z, Z, 6, Z, Z, 7, Z, Z, 8, Z, Z, 9, Z, Z}},
+    {{Z, 11, Z, Z, 12, Z, Z, 13, Z, Z, 14, Z, Z, 15, Z, Z},
+     {Z, Z, 11, Z, Z, 12, Z, Z, 13, Z, Z, 14, Z, Z, 15, Z},
+     {10, Z, Z, 11, Z, Z, 12, Z, Z, 13, Z, Z, 14, Z, Z, 15}},
+};
+
+// Output store o of 16 GREY pixels expanded to RGB24
+static const int8_t grey_mask[3][16] = {
+    {0, 0, 0, 1, 1, 1, 2, 2, 2, 3, 3, 3, 4, 4, 4, 5},
+    {5, 5, 6, 6, 6, 7, 7, 7, 8, 8, 8, 9, 9, 9, 10, 10},
+    {10, 11, 11, 11, 12, 12, 12, 13, 13, 13, 14, 14, 14, 15, 15, 15},
+};
+
+// 16-bit lanes U0 V0 U1 V1 U2 V2 U3 V3 -> U (V) of each of 8 pixels
+static const int8_t dup_mask[2][16] = {
+    {0, 1, 0, 1, 4, 5, 4, 5, 8, 9, 8, 9, 12, 13, 12, 13},
+    {2, 3, 2, 3, 6, 7, 6, 7, 10, 11, 10, 11, 14, 15, 14, 15},
+};
+
+#undef Z
+
+#define MASK128(m) _mm_loadu_si128((const __m128i*)(m))
+#define MASK256(m) _mm256_broadcastsi128_si256(MASK128(m))
+
+#pragma region SSE4
+
+// Function to gather channel k of the 16 RGB24 pixels in a, b, c
+__attribute__((target("sse4.1")))
+static inline __m128i rgb_channel_sse4(__m128i a, __m128i b, __m128i c, int k){
+    __m128i x = _mm_shuffle_epi8(a, MASK128(deint_mask[k][0]));
+    x = _mm_or_si128(x, _mm_shuffle_epi8(b, MASK128(deint_mask[k][1])));
+    return _mm_or_si128(x, _mm_shuffle_epi8(c, MASK128(deint_mask[k][2])));
+}
+
+// Function to interleave 16 pixels of R, G, B bytes into 48 bytes of RGB24
+__attribute__((target("sse4.1")))
+static inline void store_rgb_sse4(uint8_t* dst, __m128i r, __m128i g, __m128i b){
+    for(int o = 0; o < 3; o++){
+        __m128i x = _mm_shuffle_epi8(r, MASK128(inter_mask[o][0]));
+        x = _mm_or_si128(x, _mm_shuffle_epi8(g, MASK128(inter_mask[o][1])));
+        x = _mm_or_si128(x, _mm_shuffle_epi8(b, MASK128(inter_mask[o][2])));
+        _mm_storeu_si128((__m128i*)(dst + 16 * o), x);
+    }
+}
+
+// Function to (3R + 4G + B) >> 3 on 16-bit lanes
+__attribute__((target("sse4.1")))
+static inline __m128i grey16_sse4(__m128i r, __m128i g, __m128i b){
+    __m128i s = _mm_add_epi16(_mm_add_epi16(r, _mm_slli_epi16(r, 1)), _mm_add_epi16(_mm_slli_epi16(g, 2), b));
+    return _mm_srli_epi16(s, 3);
+}
+
+// Function to expand 16-bit Y lanes to 74 * (Y - 16) + 32
+__attribute__((target("sse4.1")))
+static inline __m128i luma16_sse4(__m128i y){
+    __m128i c = _mm_mullo_epi16(_mm_sub_epi16(y, _mm_set1_epi16(16)), _mm_set1_epi16(74));
+    return _mm_add_epi16(c, _mm_set1_epi16(32));
+}
+
+/*
+ * Function to convert 8 pixels held as 16-bit lanes: y, and uv as U V pairs.
+ * Only B can overflow 16 bits (Y 255, U 255), and the saturated sum still
+ * clips to 255 like the scalar int does.
+ */
+__attribute__((target("sse4.1")))
+static inline void yuv16_sse4(__m128i y, __m128i uv, __m128i* r, __m128i* g, __m128i* b){
+    const __m128i bias = _mm_set1_epi16(128);
+    __m128i c = luma16_sse4(y);
+    __m128i d = _mm_sub_epi16(_mm_shuffle_epi8(uv, MASK128(dup_mask[0])), bias);
+    __m128i e = _mm_sub_epi16(_mm_shuffle_epi8(uv, MASK128(dup_mask[1])), bias);
+    *r = _mm_srai_epi16(_mm_adds_epi16(c, _mm_mullo_epi16(e, _mm_set1_epi16(102))), 6);
+    *g = _mm_srai_epi16(_mm_subs_epi16(_mm_subs_epi16(c, _mm_mullo_epi16(d, _mm_set1_epi16(25))),
+                                       _mm_mullo_epi16(e, _mm_set1_epi16(52))), 6);
+    *b = _mm_srai_epi16(_mm_adds_epi16(c, _mm_mullo_epi16(d, _mm_set1_epi16(129))), 6);
+}
+
+// Function to convert 16 pixels: two halves of 8 as 16-bit lanes
+__attribute__((target("sse4.1")))
+static inline void yuv_store_sse4(uint8_t* dst, __m128i y0, __m128i uv0, __m128i y1, __m128i uv1){
+    __m128i r0, g0, b0, r1, g1, b1;
+    yuv16_sse4(y0, uv0, &r0, &g0, &b0);
+    yuv16_sse4(y1, uv1, &r1, &g1, &b1);
+    store_rgb_sse4(dst, _mm_packus_epi16(r0, r1), _mm_packus_epi16(g0, g1), _mm_packus_epi16(b0, b1));
+}
+
+__attribute__((target("sse4.1")))
+static void rgb_grey_sse4(const uint8_t* src, uint8_t* dst, size_t n){
+    const __m128i zero = _mm_setzero_si128();
+    size_t i = 0;
+    for(; i + 16 <= n; i += 16){
+        const uint8_t* p = src + i * 3;
+        __m128i a = _mm_loadu_si128((const __m128i*)p);
+        __m128i b = _mm_loadu_si128((const __m128i*)(p + 16));
+        __m128i c = _mm_loadu_si128((const __m128i*)(p + 32));
+        __m128i R = rgb_channel_sse4(a, b, c, 0), G = rgb_channel_sse4(a, b, c, 1), B = rgb_channel_sse4(a, b, c, 2);
+        __m128i lo = grey16_sse4(_mm_unpacklo_epi8(R, zero), _mm_unpacklo_epi8(G, zero), _mm_unpacklo_epi8(B, zero));
+        __m128i hi = grey16_sse4(_mm_unpackhi_epi8(R, zero), _mm_unpackhi_epi8(G, zero), _mm_unpackhi_epi8(B, zero));
+        _mm_storeu_si128((__m128i*)(dst + i), _mm_packus_epi16(lo, hi));
+    }
+    rgb_grey_scalar(src + i * 3, dst + i, n - i);
+}
+
+__attribute__((target("sse4.1")))
+static void grey_rgb_sse4(const uint8_t* src, uint8_t* dst, size_t n){
+    size_t i = 0;
+    for(; i + 16 <= n; i += 16){
+        __m128i g = _mm_loadu_si128((const __m128i*)(src + i));
+        for(int o = 0; o < 3; o++)
+            _mm_storeu_si128((__m128i*)(dst + i * 3 + 16 * o), _mm_shuffle_epi8(g, MASK128(grey_mask[o])));
+    }
+    grey_rgb_scalar(src + i, dst + i * 3, n - i);
+}
+
+__attribute__((target("sse4.1")))
+static void packed_rgb_sse4(const uint8_t* src, uint8_t* dst, size_t n, int uyvy){
+    const __m128i low = _mm_set1_epi16(0xFF);
+    size_t i = 0;
+    for(; i + 16 <= n; i += 16){
+        __m128i v0 = _mm_loadu_si128((const __m128i*)(src + i * 2));
+        __m128i v1 = _mm_loadu_si128((const __m128i*)(src + i * 2 + 16));
+        __m128i e0 = _mm_and_si128(v0, low), o0 = _mm_srli_epi16(v0, 8);
+        __m128i e1 = _mm_and_si128(v1, low), o1 = _mm_srli_epi16(v1, 8);
+        if(uyvy) yuv_store_sse4(dst + i * 3, o0, e0, o1, e1);
+        else yuv_store_sse4(dst + i * 3, e0, o0, e1, o1);
+    }
+    packed_rgb_scalar(src + i * 2, dst + i * 3, n - i, uyvy);
+}
+
+__attribute__((target("sse4.1")))
+static void packed_grey_sse4(const uint8_t* src, uint8_t* dst, size_t n, int uyvy){
+    const __m128i low = _mm_set1_epi16(0xFF);
+    size_t i = 0;
+    for(; i + 16 <= n; i += 16){
+        __m128i v0 = _mm_loadu_si128((const __m128i*)(src + i * 2));
+        __m128i v1 = _mm_loadu_si128((const __m128i*)(src + i * 2 + 16));
+        __m128i y0 = uyvy ? _mm_srli_epi16(v0, 8) : _mm_and_si128(v0, low);
+        __m128i y1 = uyvy ? _mm_srli_epi16(v1, 8) : _mm_and_si128(v1, low);
+        __m128i lo = _mm_srai_epi16(luma16_sse4(y0), 6), hi = _mm_srai_epi16(luma16_sse4(y1), 6);
+        _mm_storeu_si128((__m128i*)(dst + i), _mm_packus_epi16(lo, hi));
+    }
+    packed_grey_scalar(src + i * 2, dst + i, n - i, uyvy);
+}
+
+__attribute__((target("sse4.1")))
+static void nv12_rgb_sse4(const uint8_t* y, const uint8_t* uv, uint8_t* dst, size_t n){
+    const __m128i zero = _mm_setzero_si128();
+    size_t i = 0;
+    for(; i + 16 <= n; i += 16){
+        __m128i yy = _mm_loadu_si128((const __m128i*)(y + i));
+        __m128i cc = _mm_loadu_si128((const __m128i*)(uv + i));
+        yuv_store_sse4(dst + i * 3, _mm_unpacklo_epi8(yy, zero), _mm_unpacklo_epi8(cc, zero),
+                       _mm_unpackhi_epi8(yy, zero), _mm_unpackhi_epi8(cc, zero));
+    }
+    nv12_rgb_scalar(y + i, uv + i, dst + i * 3, n - i);
+}
+
+__attribute__((target("sse4.1")))
+static void luma_grey_sse4(const uint8_t* y, uint8_t* dst, size_t n){
+    const __m128i zero = _mm_setzero_si128();
+    size_t i = 0;
+    for(; i + 16 <= n; i += 16){
+        __m128i yy = _mm_loadu_si128((const __m128i*)(y + i));
+        __m128i lo = _mm_srai_epi16(luma16_sse4(_mm_unpacklo_epi8(yy, zero)), 6);
+        __m128i hi = _mm_srai_epi16(luma16_sse4(_mm_unpackhi_epi8(yy, zero)), 6);
+        _mm_storeu_si128((__m128i*)(dst + i), _mm_packus_epi16(lo, hi));
+    }
+    luma_grey_scalar(y + i, dst + i, n - i);
+}
+
+static const struct kernels kernels_sse4 = {
+    rgb_grey_sse4, grey_rgb_sse4, packed_rgb_sse4, packed_grey_sse4, nv12_rgb_sse4, luma_grey_sse4,
+};
+
+#pragma endregion
+
+#pragma region AVX2
+
+/*
+ * pshufb and the pack instructions work within 128-bit lanes, so the AVX2
+ * kernels run the SSE4 byte shuffles on two groups of 16 pixels at once:
+ * lane 0 holds pixels 0-15 and lane 1 pixels 16-31.
+ */
+
+// Function to load 16 bytes at p into lane 0 and at p + off into lane 1
+__attribute__((target("avx2")))
+static inline __m256i load_lanes(const uint8_t* p, size_t off){
+    __m256i x = _mm256_castsi128_si256(_mm_loadu_si128((const __m128i*)p));
+    return _mm256_inserti128_si256(x, _mm_loadu_si128((const __m128i*)(p + off)), 1);
+}
+
+// Function to store 48 bytes of each lane of o0, o1, o2 as 96 contiguous bytes
+__attribute__((target("avx2")))
+static inline void store_lanes3(uint8_t* dst, __m256i o0, __m256i o1, __m256i o2){
+    _mm256_storeu_si256((__m256i*)dst, _mm256_permute2x128_si256(o0, o1, 0x20));
+    _mm256_storeu_si256((__m256i*)(dst + 32), _mm256_permute2x128_si256(o2, o0, 0x30));
+    _mm256_storeu_si256((__m256i*)(dst + 64), _mm256_permute2x128_si256(o1, o2, 0x31));
+}
+
+__attribute__((target("avx2")))
+static inline __m256i rgb_channel_avx2(__m256i a, __m256i b, __m256i c, int k){
+    __m256i x = _mm256_shuffle_epi8(a, MASK256(deint_mask[k][0]));
+    x = _mm256_or_si256(x, _mm256_shuffle_epi8(b, MASK256(deint_mask[k][1])));
+    return _mm256_or_si256(x, _mm256_shuffle_epi8(c, MASK256(deint_mask[k][2])));
+}
+
+__attribute__((target("avx2")))
+static inline void store_rgb_avx2(uint8_t* dst, __m256i r, __m256i g, __m256i b){
+    __m256i o[3];
+    for(int k = 0; k < 3; k++){
+        __m256i x = _mm256_shuffle_epi8(r, MASK256(inter_mask[k][0]));
+        x = _mm256_or_si256(x, _mm256_shuffle_epi8(g, MASK256(inter_mask[k][1])));
+        o[k] = _mm256_or_si256(x, _mm256_shuffle_epi8(b, MASK256(inter_mask[k][2])));
+    }
+    store_lanes3(dst, o[0], o[1], o[2]);
+}
+
+__attribute__((target("avx2")))
+static inline __m256i grey16_avx2(__m256i r, __m256i g, __m256i b){
+    __m256i s = _mm256_add_epi16(_mm256_add_epi16(r, _mm256_slli_epi16(r, 1)), _mm256_add_epi16(_mm256_slli_epi16(g, 2), b));
+    return _mm256_srli_epi16(s, 3);
+}
+
+__attribute__((target("avx2")))
+static inline __m256i luma16_avx2(__m256i y){
+    __m256i c = _mm256_mullo_epi16(_mm256_sub_epi16(y, _mm256_set1_epi16(16)), _mm256_set1_epi16(74));
+    return _mm256_add_epi16(c, _mm256_set1_epi16(32));
+}
+
+__attribute__((target("avx2")))
+static inline void yuv16_avx2(__m256i y, __m256i uv, __m256i* r, __m256i* g, __m256i* b){
+    const __m256i bias = _mm256_set1_epi16(128);
+    __m256i c = luma16_avx2(y);
+    __m256i d = _mm256_sub_epi16(_mm256_shuffle_epi8(uv, MASK256(dup_mask[0])), bias);
+    __m256i e = _mm256_sub_epi16(_mm256_shuffle_epi8(uv, MASK256(dup_mask[1])), bias);
+    *r = _mm256_srai_epi16(_mm256_adds_epi16(c, _mm256_mullo_epi16(e, _mm256_set1_epi16(102))), 6);
+    *g = _mm256_srai_epi16(_mm256_subs_epi16(_mm256_subs_epi16(c, _mm256_mullo_epi16(d, _mm256_set1_epi16(25))),
+                                             _mm256_mullo_epi16(e, _mm256_set1_epi16(52))), 6);
+    *b = _mm256_srai_epi16(_mm256_adds_epi16(c, _mm256_mullo_epi16(d, _mm256_set1_epi16(129))), 6);
+}
+
+// Function to pack pixels 0-15 (a) and 16-31 (b) of 16-bit lanes to 32 bytes in order
+__attribute__((target("avx2")))
+static inline __m256i pack_ordered(__m256i a, __m256i b){
+    return _mm256_permute4x64_epi64(_mm256_packus_epi16(a, b), 0xD8);
+}
+
+// Function to convert 32 pixels: y0/uv0 pixels 0-15 and y1/uv1 pixels 16-31 as 16-bit lanes
+__attribute__((target("avx2")))
+static inline void yuv_store_avx2(uint8_t* dst, __m256i y0, __m256i uv0, __m256i y1, __m256i uv1){
+    __m256i r0, g0, b0, r1, g1, b1;
+    yuv16_avx2(y0, uv0, &r0, &g0, &b0);
+    yuv16_avx2(y1, uv1, &r1, &g1, &b1);
+    store_rgb_avx2(dst, pack_ordered(r0, r1), pack_ordered(g0, g1), pack_ordered(b0, b1));
+}
+
+__attribute__((target("avx2")))
+static void rgb_grey_avx2(const uint8_t* src, uint8_t* dst, size_t n){
+    const __m256i zero = _mm256_setzero_si256();
+    size_t i = 0;
+    for(; i + 32 <= n; i += 32){
+        const uint8_t* p = src + i * 3;
+        __m256i a = load_lanes(p, 48), b = load_lanes(p + 16, 48), c = load_lanes(p + 32, 48);
+        __m256i R = rgb_channel_avx2(a, b, c, 0), G = rgb_channel_avx2(a, b, c, 1), B = rgb_channel_avx2(a, b, c, 2);
+        __m256i lo = grey16_avx2(_mm256_unpacklo_epi8(R, zero), _mm256_unpacklo_epi8(G, zero), _mm256_unpacklo_epi8(B, zero));
+        __m256i hi = grey16_avx2(_mm256_unpackhi_epi8(R, zero), _mm256_unpackhi_epi8(G, zero), _mm256_unpackhi_epi8(B, zero));
+        _mm256_storeu_si256((__m256i*)(dst + i), _mm256_packus_epi16(lo, hi));
+    }
+    rgb_grey_sse4(src + i * 3, dst + i, n - i);
+}
+
+__attribute__((target("avx2")))
+static void grey_rgb_avx2(const uint8_t* src, uint8_t* dst, size_t n){
+    size_t i = 0;
+    for(; i + 32 <= n; i += 32){
+        __m256i g = _mm256_loadu_si256((const __m256i*)(src + i));
+        store_lanes3(dst + i * 3, _mm256_shuffle_epi8(g, MASK256(grey_mask[0])),
+                     _mm256_shuffle_epi8(g, MASK256(grey_mask[1])), _mm256_shuffle_epi8(g, MASK256(grey_mask[2])));
+    }
+    grey_rgb_sse4(src + i, dst + i * 3, n - i);
+}
+
+__attribute__((target("avx2")))
+static void packed_rgb_avx2(const uint8_t* src, uint8_t* dst, size_t n, int uyvy){
+    const __m256i low = _mm256_set1_epi16(0xFF);
+    size_t i = 0;
+    for(; i + 32 <= n; i += 32){
+        __m256i v0 = _mm256_loadu_si256((const __m256i*)(src + i * 2));
+        __m256i v1 = _mm256_loadu_si256((const __m256i*)(src + i * 2 + 32));
+        __m256i e0 = _mm256_and_si256(v0, low), o0 = _mm256_srli_epi16(v0, 8);
+        __m256i e1 = _mm256_and_si256(v1, low), o1 = _mm256_srli_epi16(v1, 8);
+        if(uyvy) yuv_store_avx2(dst + i * 3, o0, e0, o1, e1);
+        else yuv_store_avx2(dst + i * 3, e0, o0, e1, o1);
+    }
+    packed_rgb_sse4(src + i * 2, dst + i * 3, n - i, uyvy);
+}
+
+__attribute__((target("avx2")))
+static void packed_grey_avx2(const uint8_t* src, uint8_t* dst, size_t n, int uyvy){
+    const __m256i low = _mm256_set1_epi16(0xFF);
+    size_t i = 0;
+    for(; i + 32 <= n; i += 32){
+        __m256i v0 = _mm256_loadu_si256((const __m256i*)(src + i * 2));
+        __m256i v1 = _mm256_loadu_si256((const __m256i*)(src + i * 2 + 32));
+        __m256i y0 = uyvy ? _mm256_srli_epi16(v0, 8) : _mm256_and_si256(v0, low);
+        __m256i y1 = uyvy ? _mm256_srli_epi16(v1, 8) : _mm256_and_si256(v1, low);
+        __m256i lo = _mm256_srai_epi16(luma16_avx2(y0), 6), hi = _mm256_srai_epi16(luma16_avx2(y1), 6);
+        _mm256_storeu_si256((__m256i*)(dst + i), pack_ordered(lo, hi));
+    }
+    packed_grey_sse4(src + i * 2, dst + i, n - i, uyvy);
+}
+
+__attribute__((target("avx2")))
+static void nv12_rgb_avx2(const uint8_t* y, const uint8_t* uv, uint8_t* dst, size_t n){
+    size_t i = 0;
+    for(; i + 32 <= n; i += 32){
+        __m256i y0 = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*)(y + i)));
+        __m256i y1 = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*)(y + i + 16)));
+        __m256i c0 = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*)(uv + i)));
+        __m256i c1 = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*)(uv + i + 16)));
+        yuv_store_avx2(dst + i * 3, y0, c0, y1, c1);
+    }
+    nv12_rgb_sse4(y + i, uv + i, dst + i * 3, n - i);
+}
+
+__attribute__((target("avx2")))
+static void luma_grey_avx2(const uint8_t* y, uint8_t* dst, size_t n){
+    size_t i = 0;
+    for(; i + 32 <= n; i += 32){
+        __m256i y0 = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*)(y + i)));
+        __m256i y1 = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*)(y + i + 16)));
+        __m256i lo = _mm256_srai_epi16(luma16_avx2(y0), 6), hi = _mm256_srai_epi16(luma16_avx2(y1), 6);
+        _mm256_storeu_si256((__m256i*)(dst + i), pack_ordered(lo, hi));
+    }
+    luma_grey_sse4(y + i, dst + i, n - i);
+}
+
+static const struct kernels kernels_avx2 = {
+    rgb_grey_avx2, grey_rgb_avx2, packed_rgb_avx2, packed_grey_avx2, nv12_rgb_avx2, luma_grey_avx2,
+};
+
+#pragma endregion
+
+#pragma endregion
+#endif
+
+#pragma region DISPATCH
+
+static enum pix_convert_impl impl = PIX_CONVERT_AUTO;
+static const struct kernels* kernel = &kernels_scalar;
+
+enum pix_convert_impl pix_convert_set_impl(enum pix_convert_impl req){
+#ifdef PIX_CONVERT_X86
+    __builtin_cpu_init();
+    if(req == PIX_CONVERT_AUTO) req = __builtin_cpu_supports("avx2") ? PIX_CONVERT_AVX2 : PIX_CONVERT_SSE4;
+    if(req == PIX_CONVERT_AVX2 && !__builtin_cpu_supports("avx2")) req = PIX_CONVERT_SCALAR;
+    if(req == PIX_CONVERT_SSE4 && !__builtin_cpu_supports("sse4.1")) req = PIX_CONVERT_SCALAR;
+#else
+    req = PIX_CONVERT_SCALAR;
+#endif
+
+    switch(req){
+#ifdef PIX_CONVERT_X86
+    case PIX_CONVERT_AVX2:
+        kernel = &kernels_avx2;
+        break;
+    case PIX_CONVERT_SSE4:
+        kernel = &kernels_sse4;
+        break;
+#endif
+    default:
+        req = PIX_CONVERT_SCALAR;
+        kernel = &kernels_scalar;
+        break;
+    }
+    impl = req;
+    return impl;
+}
+
+const char* pix_convert_impl_name(void){
+    if(impl == PIX_CONVERT_AUTO) pix_convert_set_impl(PIX_CONVERT_AUTO);
+    switch(impl){
+    case PIX_CONVERT_AVX2: return "avx2";
+    case PIX_CONVERT_SSE4: return "sse4.1";
+    default: return "scalar";
+    }
+}
+
+#pragma endregion
+
+void pix_rgb24_to_grey(const uint8_t* src, uint8_t* dst, size_t pixels){
+    if(impl == PIX_CONVERT_AUTO) pix_convert_set_impl(PIX_CONVERT_AUTO);
+    kernel->rgb_grey(src, dst, pixels);
+}
+
+void pix_grey_to_rgb24(const uint8_t* src, uint8_t* dst, size_t pixels){
+    if(impl == PIX_CONVERT_AUTO) pix_convert_set_impl(PIX_CONVERT_AUTO);
+    kernel->grey_rgb(src, dst, pixels);
+}
+
+void pix_yuyv_to_rgb24(const uint8_t* src, uint8_t* dst, int width, int height){
+    if(impl == PIX_CONVERT_AUTO) pix_convert_set_impl(PIX_CONVERT_AUTO);
+    kernel->packed_rgb(src, dst, (size_t)width * height, 0);
+}
+
+void pix_uyvy_to_rgb24(const uint8_t* src, uint8_t* dst, int width, int height){
+    if(impl == PIX_CONVERT_AUTO) pix_convert_set_impl(PIX_CONVERT_AUTO);
+    kernel->packed_rgb(src, dst, (size_t)width * height, 1);
+}
+
+void pix_yuyv_to_grey(const uint8_t* src, uint8_t* dst, int width, int height){
+    if(impl == PIX_CONVERT_AUTO) pix_convert_set_impl(PIX_CONVERT_AUTO);
+    kernel->packed_grey(src, dst, (size_t)width * height, 0);
+}
+
+void pix_uyvy_to_grey(const uint8_t* src, uint8_t* dst, int width, int height){
+    if(impl == PIX_CONVERT_AUTO) pix_convert_set_impl(PIX_CONVERT_AUTO);
+    kernel->packed_grey(src, dst, (size_t)width * height, 1);
+}
+
+void pix_nv12_to_rgb24(const uint8_t* src, uint8_t* dst, int width, int height){
+    if(impl == PIX_CONVERT_AUTO) pix_convert_set_impl(PIX_CONVERT_AUTO);
+    const uint8_t* uv = src + (size_t)width * height;
+    // Each UV row is shared by two Y rows
+    for(int y = 0; y < height; y++)
+        kernel->nv12_rgb(src + (size_t)y * width, uv + (size_t)(y / 2) * width, dst + (size_t)y * width * 3, width);
+}
+
+void pix_nv12_to_grey(const uint8_t* src, uint8_t* dst, int width, int height){
+    if(impl == PIX_CONVERT_AUTO) pix_convert_set_impl(PIX_CONVERT_AUTO);
+    kernel->luma_grey(src, dst, (size_t)width * height);
+}
@@ -0,0 +1,78 @@
+#ifndef PIX_CONVERT_H
+#define PIX_CONVERT_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+ * Pixel-format conversion kernels: RGB24 <-> GREY and YUYV/UYVY/NV12 -> RGB24/GREY.
+ *
+ * YUV input is BT.601 limited range (Y 16..235), converted with 6-bit
+ * fixed-point coefficients that fit 16-bit SIMD lanes:
+ *   c = 74 * (Y - 16), d = U - 128, e = V - 128
+ *   R = clip((c + 102 * e + 32) >> 6)
+ *   G = clip((c - 25 * d - 52 * e + 32) >> 6)
+ *   B = clip((c + 129 * d + 32) >> 6)
+ * and GREY from YUV is the same expanded luma, clip((c + 32) >> 6).
+ * GREY from RGB24 is (3R + 4G + B) >> 3.
+ * SSE4.1 and AVX2 kernels are picked at runtime and give exactly the scalar
+ * results. Buffers are packed (no row padding); widths of YUV frames are even,
+ * and so are NV12 heights.
+ */
+
+enum pix_convert_impl{
+    PIX_CONVERT_AUTO = 0,   // Best kernel supported by the CPU
+    PIX_CONVERT_SCALAR,
+    PIX_CONVERT_SSE4,
+    PIX_CONVERT_AVX2,
+};
+
+/*
+ * RGB24 -> GREY
+ * args:
+ *   src - pixels * 3 bytes
+ *   dst - pixels bytes
+ */
+void pix_rgb24_to_grey(const uint8_t* src, uint8_t* dst, size_t pixels);
+
+/*
+ * GREY -> RGB24 (R = G = B)
+ * args:
+ *   src - pixels bytes
+ *   dst - pixels * 3 bytes
+ */
+void pix_grey_to_rgb24(const uint8_t* src, uint8_t* dst, size_t pixels);
+
+/*
+ * packed 4:2:2 -> RGB24 / GREY
+ * args:
+ *   src - width * height * 2 bytes, Y0 U Y1 V (YUYV) or U Y0 V Y1 (UYVY)
+ *   dst - width * height * 3 (RGB24) or width * height (GREY) bytes
+ */
+void pix_yuyv_to_rgb24(const uint8_t* src, uint8_t* dst, int width, int height);
+void pix_uyvy_to_rgb24(const uint8_t* src, uint8_t* dst, int width, int height);
+void pix_yuyv_to_grey(const uint8_t* src, uint8_t* dst, int width, int height);
+void pix_uyvy_to_grey(const uint8_t* src, uint8_t* dst, int width, int height);
+
+/*
+ * NV12 (4:2:0, Y plane then interleaved UV plane) -> RGB24 / GREY
+ * args:
+ *   src - width * height * 3 / 2 bytes
+ *   dst - width * height * 3 (RGB24) or width * height (GREY) bytes
+ */
+void pix_nv12_to_rgb24(const uint8_t* src, uint8_t* dst, int width, int height);
+void pix_nv12_to_grey(const uint8_t* src, uint8_t* dst, int width, int height);
+
+/*
+ * force a kernel (for benchmarks); falls back to scalar if unsupported
+ *
+ * returns: the kernel in use
+ */
+enum pix_convert_impl pix_convert_set_impl(enum pix_convert_impl impl);
+
+/*
+ * returns: name of the kernel in use
+ */
+const char* pix_convert_impl_name(void);
+
+#endif
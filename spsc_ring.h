@@ -0,0 +1,59 @@
+#ifndef SPSC_RING_H
+#define SPSC_RING_H
+
+#include <stdint.h>
+#include <stdatomic.h>
+
+/*
+ * Lock-free single-producer/single-consumer ring of 32-bit values
+ * (here: V4L2 buffer indices).
+ *
+ * Besides push, the producer may evict the oldest entry (drop-oldest policy):
+ * both sides advance <head> with a compare-and-swap, so an entry is taken by
+ * exactly one of them. Only the producer writes <tail> and the slots.
+ */
+
+#define SPSC_RING_MAX 64    // Max capacity, power of 2
+
+struct spsc_ring{
+    _Atomic uint32_t head;              // Next entry to take (consumer, or producer evicting)
+    char pad0[64 - sizeof(uint32_t)];   // Keep head and tail on separate cache lines
+    _Atomic uint32_t tail;              // Next free slot (producer)
+    char pad1[64 - sizeof(uint32_t)];
+    uint32_t capacity;
+    uint32_t slots[SPSC_RING_MAX];
+};
+
+// Function to initialize a ring holding up to <capacity> (<= SPSC_RING_MAX) entries
+static inline void spsc_init(struct spsc_ring* r, uint32_t capacity){
+    atomic_init(&r->head, 0);
+    atomic_init(&r->tail, 0);
+    r->capacity = capacity < SPSC_RING_MAX ? capacity : SPSC_RING_MAX;
+}
+
+// Function to get the number of entries (exact from either side, approximate otherwise)
+static inline uint32_t spsc_count(struct spsc_ring* r){
+    return atomic_load_explicit(&r->tail, memory_order_acquire) - atomic_load_explicit(&r->head, memory_order_acquire);
+}
+
+// Producer: append a value, returns 0 if the ring is full
+static inline int spsc_push(struct spsc_ring* r, uint32_t v){
+    uint32_t tail = atomic_load_explicit(&r->tail, memory_order_relaxed);
+    if(tail - atomic_load_explicit(&r->head, memory_order_acquire) >= r->capacity) return 0;
+    r->slots[tail % SPSC_RING_MAX] = v;
+    atomic_store_explicit(&r->tail, tail + 1, memory_order_release);
+    return 1;
+}
+
+// Consumer (or producer, to evict the oldest entry): take the oldest value, returns 0 if empty
+static inline int spsc_pop(struct spsc_ring* r, uint32_t* v){
+    uint32_t head = atomic_load_explicit(&r->head, memory_order_relaxed);
+    while(1){
+        if(head == atomic_load_explicit(&r->tail, memory_order_acquire)) return 0;
+        // The slot cannot be reused before head moves past it, i.e. before our CAS
+        *v = r->slots[head % SPSC_RING_MAX];
+        if(atomic_compare_exchange_weak_explicit(&r->head, &head, head + 1, memory_order_acq_rel, memory_order_relaxed)) return 1;
+    }
+}
+
+#endif
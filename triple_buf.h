@@ -0,0 +1,50 @@
+#ifndef TRIPLE_BUF_H
+#define TRIPLE_BUF_H
+
+#include <stdint.h>
+#include <stdatomic.h>
+
+/*
+ * Lock-free latest-value-wins triple buffer between one producer and one
+ * consumer (here: the capture thread and the preview thread).
+ *
+ * Three slots, identified by index: the producer writes its <back> slot, the
+ * consumer reads its <front> slot, and the third one (<middle>) holds the last
+ * value published. Publishing swaps back and middle, taking swaps middle and
+ * front, so neither side ever waits for the other: a value the consumer was
+ * too slow to take is simply replaced by the next one. The slots themselves
+ * live with the caller; a slot is only touched by the side that owns it.
+ */
+
+#define TB_INDEX 0x3u           // Slot index in <middle>
+#define TB_NEW 0x4u             // <middle> was published and not taken yet
+
+struct triple_buf{
+    _Atomic uint32_t middle;    // Shared slot, with TB_NEW
+    uint32_t back;              // Producer's slot
+    uint32_t front;             // Consumer's slot
+};
+
+// Function to initialize the triple buffer: nothing published yet
+static inline void tb_init(struct triple_buf* t){
+    t->back = 0;
+    atomic_init(&t->middle, 1);
+    t->front = 2;
+}
+
+// Producer: publish the back slot once written, and switch to a free one.
+// Returns 1 if the previous value was never taken (replaced: skipped by the consumer).
+static inline int tb_publish(struct triple_buf* t){
+    uint32_t old = atomic_exchange_explicit(&t->middle, t->back | TB_NEW, memory_order_acq_rel);
+    t->back = old & TB_INDEX;
+    return (old & TB_NEW) != 0;
+}
+
+// Consumer: move the newest published value to the front slot, returns 0 if there is none
+static inline int tb_take(struct triple_buf* t){
+    if(!(atomic_load_explicit(&t->middle, memory_order_acquire) & TB_NEW)) return 0;
+    t->front = atomic_exchange_explicit(&t->middle, t->front, memory_order_acq_rel) & TB_INDEX;
+    return 1;
+}
+
+#endif
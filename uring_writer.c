@@ -0,0 +1,178 @@
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/eventfd.h>
+#include <linux/io_uring.h>
+
+#include "uring_writer.h"
+
+#pragma region SYSCALLS
+
+static int uring_setup(unsigned int entries, struct io_uring_params* p){
+    return syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int uring_enter(int ring_ds, unsigned int to_submit, unsigned int min_complete, unsigned int flags){
+    return syscall(__NR_io_uring_enter, ring_ds, to_submit, min_complete, flags, NULL, 0);
+}
+
+static int uring_register(int ring_ds, unsigned int opcode, void* arg, unsigned int nr_args){
+    return syscall(__NR_io_uring_register, ring_ds, opcode, arg, nr_args);
+}
+
+#pragma endregion
+
+int uw_init(struct uring_writer* w, unsigned int depth, size_t buf_size, unsigned int n_bufs,
+            void (*complete)(void* ctx, const struct uw_buf* b, int res), void* ctx){
+    memset(w, 0, sizeof(*w));
+    w->ring_ds = w->event_ds = -1;
+    w->depth = depth ? depth : 1;
+    w->buf_size = (buf_size + UW_ALIGN - 1) & ~(size_t)(UW_ALIGN - 1);
+    w->complete = complete;
+    w->ctx = ctx;
+
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    if((w->ring_ds = uring_setup(w->depth, &p)) == -1) return -1;
+
+    // Map the submission and completion rings (a single mapping on recent kernels)
+    w->sq_map_len = p.sq_off.array + p.sq_entries * sizeof(unsigned int);
+    w->cq_map_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if(p.features & IORING_FEAT_SINGLE_MMAP){
+        if(w->cq_map_len > w->sq_map_len) w->sq_map_len = w->cq_map_len;
+        w->cq_map_len = 0;
+    }
+    w->sq_map = mmap(NULL, w->sq_map_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, w->ring_ds, IORING_OFF_SQ_RING);
+    if(w->sq_map == MAP_FAILED) return -1;
+    w->cq_map = w->sq_map;
+    if(w->cq_map_len){
+        w->cq_map = mmap(NULL, w->cq_map_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, w->ring_ds, IORING_OFF_CQ_RING);
+        if(w->cq_map == MAP_FAILED) return -1;
+    }
+    w->sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+    w->sqes = mmap(NULL, w->sqes_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, w->ring_ds, IORING_OFF_SQES);
+    if(w->sqes == MAP_FAILED) return -1;
+
+    uint8_t* sq = w->sq_map;
+    uint8_t* cq = w->cq_map;
+    w->sq_head = (unsigned int*)(sq + p.sq_off.head);
+    w->sq_tail = (unsigned int*)(sq + p.sq_off.tail);
+    w->sq_mask = (unsigned int*)(sq + p.sq_off.ring_mask);
+    w->sq_array = (unsigned int*)(sq + p.sq_off.array);
+    w->cq_head = (unsigned int*)(cq + p.cq_off.head);
+    w->cq_tail = (unsigned int*)(cq + p.cq_off.tail);
+    w->cq_mask = (unsigned int*)(cq + p.cq_off.ring_mask);
+    w->cqes = (struct io_uring_cqe*)(cq + p.cq_off.cqes);
+
+    // Completions are signalled on an eventfd, for the caller's epoll loop
+    if((w->event_ds = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) == -1) return -1;
+    if(uring_register(w->ring_ds, IORING_REGISTER_EVENTFD, &w->event_ds, 1) == -1) return -1;
+
+    // Buffer pool: pages are only touched when first filled
+    w->n_bufs = n_bufs > w->depth ? n_bufs : w->depth + 1;
+    if(!(w->bufs = calloc(w->n_bufs, sizeof(*w->bufs)))) return -1;
+    for(unsigned int i = 0; i < w->n_bufs; i++){
+        if(posix_memalign((void**)&w->bufs[i].data, UW_ALIGN, w->buf_size)){
+            errno = ENOMEM;
+            return -1;
+        }
+        uw_put(w, &w->bufs[i]);
+    }
+    return 0;
+}
+
+// Function to push one write to the submission ring and hand it to the kernel
+static int queue_write(struct uring_writer* w, struct uw_buf* b){
+    unsigned int tail = *w->sq_tail;
+    unsigned int index = tail & *w->sq_mask;
+    struct io_uring_sqe* sqe = &w->sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = IORING_OP_WRITE;
+    sqe->fd = b->fd;
+    sqe->addr = (uint64_t)(uintptr_t)(b->data + b->done);
+    sqe->len = b->len - b->done;
+    sqe->off = b->off + b->done;
+    sqe->user_data = (uint64_t)(uintptr_t)b;
+    w->sq_array[index] = index;
+    // The kernel must see the entry before the new tail
+    __atomic_store_n(w->sq_tail, tail + 1, __ATOMIC_RELEASE);
+
+    while(uring_enter(w->ring_ds, 1, 0, 0) == -1)
+        if(errno != EINTR && errno != EAGAIN && errno != EBUSY) return -1;
+    return 0;
+}
+
+int uw_reap(struct uring_writer* w, int wait){
+    int completed = 0;
+    uint64_t n;
+    if(read(w->event_ds, &n, sizeof(n)) == -1 && errno != EAGAIN) return -1;
+
+    while(1){
+        unsigned int head = *w->cq_head;
+        if(head == __atomic_load_n(w->cq_tail, __ATOMIC_ACQUIRE)){
+            if(!wait || completed || !w->inflight) return completed;
+            if(uring_enter(w->ring_ds, 0, 1, IORING_ENTER_GETEVENTS) == -1 && errno != EINTR) return -1;
+            continue;
+        }
+        struct io_uring_cqe* cqe = &w->cqes[head & *w->cq_mask];
+        struct uw_buf* b = (struct uw_buf*)(uintptr_t)cqe->user_data;
+        int res = cqe->res;
+        __atomic_store_n(w->cq_head, head + 1, __ATOMIC_RELEASE);
+
+        // Short write: write the rest
+        if(res > 0 && b->done + res < b->len){
+            b->done += res;
+            if(queue_write(w, b) == -1) return -1;
+            continue;
+        }
+        w->inflight--;
+        completed++;
+        int status = res < 0 ? res : res == 0 && b->done < b->len ? -EIO : 0;
+        w->complete(w->ctx, b, status);
+        uw_put(w, b);
+    }
+}
+
+struct uw_buf* uw_get(struct uring_writer* w){
+    while(!w->free_list){
+        // Every buffer is being filled: the pool is too small
+        if(!w->inflight){
+            errno = ENOBUFS;
+            return NULL;
+        }
+        if(uw_reap(w, 1) == -1) return NULL;
+    }
+    struct uw_buf* b = w->free_list;
+    w->free_list = b->next;
+    b->len = b->done = 0;
+    return b;
+}
+
+void uw_put(struct uring_writer* w, struct uw_buf* b){
+    b->next = w->free_list;
+    w->free_list = b;
+}
+
+int uw_submit(struct uring_writer* w, struct uw_buf* b){
+    // Backpressure: keep at most <depth> writes in flight
+    while(w->inflight >= w->depth)
+        if(uw_reap(w, 1) == -1) return -1;
+    w->inflight++;
+    return queue_write(w, b);
+}
+
+void uw_close(struct uring_writer* w){
+    while(w->inflight && uw_reap(w, 1) != -1);
+    if(w->sqes && w->sqes != MAP_FAILED) munmap(w->sqes, w->sqes_len);
+    if(w->cq_map && w->cq_map != MAP_FAILED && w->cq_map != w->sq_map) munmap(w->cq_map, w->cq_map_len);
+    if(w->sq_map && w->sq_map != MAP_FAILED) munmap(w->sq_map, w->sq_map_len);
+    for(unsigned int i = 0; w->bufs && i < w->n_bufs; i++) free(w->bufs[i].data);
+    free(w->bufs);
+    if(w->event_ds != -1) close(w->event_ds);
+    if(w->ring_ds != -1) close(w->ring_ds);
+    memset(w, 0, sizeof(*w));
+    w->ring_ds = w->event_ds = -1;
+}
@@ -0,0 +1,102 @@
+#ifndef URING_WRITER_H
+#define URING_WRITER_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+/*
+ * Asynchronous file writer on io_uring (raw syscalls, no liburing).
+ *
+ * Writes go out from a pool of large, page-aligned buffers (suitable for
+ * O_DIRECT) with up to <depth> writes in flight, so receiving from the network
+ * overlaps with persisting to disk. Completions are signalled on an eventfd,
+ * to be watched by the caller's event loop. Submitting while <depth> writes are
+ * in flight waits for one to complete (backpressure when the disk stalls).
+ */
+
+#define UW_ALIGN 4096           // Buffer, offset and length alignment for O_DIRECT
+
+// A pooled write buffer
+struct uw_buf{
+    uint8_t* data;
+    size_t len;                 // Bytes filled
+    size_t done;                // Bytes already written (after a short write)
+    off_t off;                  // File offset
+    int fd;
+    void* owner;                // Passed back on completion
+    uint64_t trace_ns;          // Caller's use: submission time when tracing
+    struct uw_buf* next;        // Free list
+};
+
+struct uring_writer{
+    int ring_ds;
+    int event_ds;               // eventfd: readable when completions are pending
+    int direct;                 // Files are opened with O_DIRECT
+    size_t buf_size;
+    unsigned int depth;         // Max writes in flight
+    unsigned int inflight;
+
+    // Completion callback: res is 0, or -errno; the buffer goes back to the pool right after
+    void (*complete)(void* ctx, const struct uw_buf* b, int res);
+    void* ctx;
+
+    // Rings shared with the kernel
+    unsigned int *sq_head, *sq_tail, *sq_mask, *sq_array;
+    unsigned int *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_sqe* sqes;
+    struct io_uring_cqe* cqes;
+    void* sq_map;
+    void* cq_map;
+    size_t sq_map_len, cq_map_len, sqes_len;
+
+    struct uw_buf* bufs;
+    unsigned int n_bufs;
+    struct uw_buf* free_list;
+};
+
+/*
+ * set up the ring, the buffer pool and the completion eventfd
+ * args:
+ *   depth - max writes in flight
+ *   buf_size - size of each buffer (multiple of UW_ALIGN)
+ *   n_bufs - pool size: depth plus the buffers being filled at any time
+ *   complete, ctx - completion callback, called from uw_reap()
+ *
+ * returns: 0 ok, -1 on error (errno set; ENOSYS/EPERM: io_uring unavailable)
+ */
+int uw_init(struct uring_writer* w, unsigned int depth, size_t buf_size, unsigned int n_bufs,
+            void (*complete)(void* ctx, const struct uw_buf* b, int res), void* ctx);
+
+/*
+ * take a free buffer from the pool, waiting for a completion if needed
+ *
+ * returns: the buffer, NULL on error
+ */
+struct uw_buf* uw_get(struct uring_writer* w);
+
+/*
+ * queue the write of buf->len bytes of <b> at b->off in b->fd; the buffer goes
+ * back to the pool once written
+ *
+ * returns: 0 ok, -1 on error
+ */
+int uw_submit(struct uring_writer* w, struct uw_buf* b);
+
+/*
+ * give back a buffer that will not be written
+ */
+void uw_put(struct uring_writer* w, struct uw_buf* b);
+
+/*
+ * process completed writes
+ * args:
+ *   wait - block until at least one write completes
+ *
+ * returns: number of writes completed, -1 on error
+ */
+int uw_reap(struct uring_writer* w, int wait);
+
+void uw_close(struct uring_writer* w);
+
+#endif